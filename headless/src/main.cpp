@@ -0,0 +1,468 @@
+// Headless batch renderer: renders a volume from a scripted camera orbit with every render mode and interpolation mode
+// and reports the frame times as JSON. This is meant for catching performance regressions, so it does not require a
+// window or an OpenGL context. Usage:
+//   volvis_headless <volume.fld> [--resolution N]... [--frames N] [--warmup N] [--shading] [--gradients ENCODING] [--output DIR] [--json FILE]
+//                   [--threads N]... [--tile-size N] [--grain-size N] [--partitioner NAME] [--first-touch]
+//   volvis_headless <volume.fld> --convert-bricks <volume.bvol>
+//   volvis_headless <volume.fld> --compress <volume.cvol> [--quantize BITS]
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "render/ray_trace_camera.h"
+#include "render/render_config.h"
+#include "render/renderer.h"
+#include "render/tile_scheduler.h"
+#include "volume/brick_cache.h"
+#include "volume/compressed_volume.h"
+#include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
+#include "volume/volume.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <glm/trigonometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <sstream>
+#include <stb_image_write.h>
+#include <string>
+#include <string_view>
+#include <tbb/task_arena.h>
+#include <vector>
+
+// Camera that circles around the center of the volume. Unlike ui::Trackball it does not need a window.
+class OrbitCamera : public render::RayTraceCamera {
+public:
+    OrbitCamera(const glm::vec3& target, float distance, float angle, float fovy)
+        : m_position(target + distance * glm::normalize(glm::vec3(std::sin(angle), 0.3f, std::cos(angle))))
+        , m_forward(glm::normalize(target - m_position))
+        , m_right(glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), m_forward)))
+        , m_up(glm::cross(m_forward, m_right))
+        , m_halfScreenPlaneSize(std::tan(fovy / 2.0f))
+    {
+    }
+
+    glm::vec3 position() const override { return m_position; }
+    glm::vec3 forward() const override { return m_forward; }
+
+    render::Ray generateRay(const glm::vec2& pixel) const override
+    {
+        render::Ray ray;
+        ray.origin = m_position;
+        ray.direction = glm::normalize(m_forward + pixel.x * m_halfScreenPlaneSize * m_right + pixel.y * m_halfScreenPlaneSize * m_up);
+        ray.tmin = std::numeric_limits<float>::lowest();
+        ray.tmax = std::numeric_limits<float>::max();
+        return ray;
+    }
+
+private:
+    glm::vec3 m_position, m_forward, m_right, m_up;
+    float m_halfScreenPlaneSize;
+};
+
+struct Options {
+    std::filesystem::path volumeFile;
+    std::vector<int> resolutions;
+    int frames { 36 };
+    int warmupFrames { 1 };
+    bool volumeShading { false };
+    volume::GradientEncoding gradientEncoding { volume::GradientEncoding::Float };
+    std::optional<std::filesystem::path> optOutputDirectory;
+    std::optional<std::filesystem::path> optJsonFile;
+    std::optional<std::filesystem::path> optBrickFile;
+    std::optional<std::filesystem::path> optCompressedFile;
+    // Lossy compression with this many bits per voxel (lossless if not set).
+    std::optional<int> optQuantizationBits;
+    // Every configuration is measured with each number of threads (all hardware threads if empty).
+    std::vector<int> threadCounts;
+    render::TileSchedulerSettings tileScheduling;
+    bool firstTouch { false };
+};
+
+struct FrameStatistics {
+    double mean, p50, p99;
+    // Ray marching samples per second, assuming one sample per voxel (the sample step) along each ray.
+    double megaSamplesPerSecond;
+};
+
+static constexpr std::array renderModes {
+    render::RenderMode::RenderSlicer,
+    render::RenderMode::RenderMIP,
+    render::RenderMode::RenderIso,
+    render::RenderMode::RenderComposite,
+    render::RenderMode::RenderTF2D,
+    render::RenderMode::RenderMIDA,
+    render::RenderMode::RenderCombined,
+};
+static constexpr std::array interpolationModes {
+    volume::InterpolationMode::NearestNeighbour,
+    volume::InterpolationMode::Linear,
+    volume::InterpolationMode::Cubic,
+};
+
+static std::optional<Options> parseOptions(int argc, char** argv);
+static void printUsage();
+static std::string_view renderModeName(render::RenderMode renderMode);
+static std::string_view interpolationModeName(volume::InterpolationMode interpolationMode);
+static render::RenderConfig defaultRenderConfig(const volume::Volume& volume);
+static double samplesPerFrame(const render::RayTraceCamera& camera, const glm::ivec3& dims, const glm::ivec2& resolution);
+static FrameStatistics computeStatistics(std::vector<double> frameTimes, double samples);
+static void writeImage(const std::filesystem::path& file, gsl::span<const glm::vec4> frameBuffer, const glm::ivec2& resolution);
+
+int main(int argc, char** argv)
+{
+    const auto optOptions = parseOptions(argc, argv);
+    if (!optOptions) {
+        printUsage();
+        return 1;
+    }
+    const Options& options = *optOptions;
+    if (!std::filesystem::exists(options.volumeFile)) {
+        std::cerr << "Volume file " << options.volumeFile << " does not exist" << std::endl;
+        return 1;
+    }
+    if (options.optOutputDirectory)
+        std::filesystem::create_directories(*options.optOutputDirectory);
+
+    volume::Volume volume { options.volumeFile, volume::VoxelLayout::Bricked };
+    volume::GradientVolume gradientVolume { volume, options.gradientEncoding };
+    if (options.optBrickFile) {
+        volume::writeBrickFile(volume, gradientVolume, *options.optBrickFile);
+        return 0;
+    }
+    if (options.optCompressedFile) {
+        const auto compression = options.optQuantizationBits ? volume::VolumeCompression::Quantized : volume::VolumeCompression::Lossless;
+        volume::writeCompressedVolume(volume, *options.optCompressedFile, compression, options.optQuantizationBits.value_or(8));
+        std::cerr << "Compressed to " << std::filesystem::file_size(*options.optCompressedFile) << " bytes" << std::endl;
+        return 0;
+    }
+    const volume::MacroCellGrid macroCellGrid { volume };
+    if (options.firstTouch)
+        volume.spreadOverNumaNodes();
+
+    // The same framing as the interactive viewer: the camera looks at the center from one volume size away.
+    const glm::vec3 volumeCenter = glm::vec3(volume.dims()) / 2.0f;
+    const float maxDimension = float(glm::compMax(volume.dims()));
+    std::vector<OrbitCamera> cameras;
+    for (int frame = 0; frame < options.frames; frame++) {
+        const float angle = 2.0f * glm::pi<float>() * float(frame) / float(options.frames);
+        cameras.emplace_back(volumeCenter, maxDimension, angle, glm::radians(60.0f));
+    }
+
+    render::RenderConfig config = defaultRenderConfig(volume);
+    config.volumeShading = options.volumeShading;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &cameras[0], config };
+    renderer.setTileScheduling(options.tileScheduling);
+
+    std::ostringstream json;
+    json << "{\n  \"volume\": \"" << volume.fileName() << "\",\n  \"frames\": " << options.frames << ",\n  \"results\": [";
+    bool firstResult = true;
+    for (const int threads : options.threadCounts) {
+        // The renderer uses the threads of the arena in which it is called.
+        tbb::task_arena arena { threads };
+        arena.execute([&] {
+            for (const int resolution : options.resolutions) {
+                config.renderResolution = glm::ivec2(resolution);
+
+                double samples = 0.0;
+                for (const auto& camera : cameras)
+                    samples += samplesPerFrame(camera, volume.dims(), config.renderResolution);
+                samples /= double(cameras.size());
+
+                for (const auto renderMode : renderModes) {
+                    for (const auto interpolationMode : interpolationModes) {
+                        config.renderMode = renderMode;
+                        volume.interpolationMode = interpolationMode;
+                        gradientVolume.interpolationMode = interpolationMode;
+                        renderer.setConfig(config);
+
+                        renderer.setCamera(&cameras[0]);
+                        for (int i = 0; i < options.warmupFrames; i++)
+                            renderer.render();
+                        // Streaming volumes: measure with the bricks of the first frame resident.
+                        if (volume::BrickCache* pBrickCache = volume.brickCache())
+                            pBrickCache->waitUntilIdle();
+
+                        std::vector<double> frameTimes;
+                        for (size_t frame = 0; frame < cameras.size(); frame++) {
+                            renderer.setCamera(&cameras[frame]);
+                            const auto start = std::chrono::high_resolution_clock::now();
+                            renderer.render();
+                            const std::chrono::duration<double, std::milli> renderTime = std::chrono::high_resolution_clock::now() - start;
+                            frameTimes.push_back(renderTime.count());
+
+                            if (frame == 0 && options.optOutputDirectory) {
+                                std::ostringstream fileName;
+                                fileName << renderModeName(renderMode) << "_" << interpolationModeName(interpolationMode) << "_" << resolution << ".png";
+                                writeImage(*options.optOutputDirectory / fileName.str(), renderer.frameBuffer(), config.renderResolution);
+                            }
+                        }
+
+                        const FrameStatistics statistics = computeStatistics(std::move(frameTimes), samples);
+                        std::cerr << renderModeName(renderMode) << " " << interpolationModeName(interpolationMode) << " " << resolution << "x" << resolution
+                                  << " " << threads << " threads: mean " << statistics.mean << "ms, p50 " << statistics.p50 << "ms, p99 " << statistics.p99 << "ms, "
+                                  << statistics.megaSamplesPerSecond << " Msamples/s" << std::endl;
+
+                        json << (firstResult ? "\n" : ",\n");
+                        json << "    { \"render_mode\": \"" << renderModeName(renderMode) << "\", \"interpolation_mode\": \"" << interpolationModeName(interpolationMode)
+                             << "\", \"resolution\": " << resolution << ", \"threads\": " << threads << ", \"mean_ms\": " << statistics.mean << ", \"p50_ms\": " << statistics.p50
+                             << ", \"p99_ms\": " << statistics.p99 << ", \"msamples_per_second\": " << statistics.megaSamplesPerSecond << " }";
+                        firstResult = false;
+                    }
+                }
+            }
+        });
+    }
+    json << "\n  ]\n}\n";
+
+    if (options.optJsonFile) {
+        std::ofstream file { *options.optJsonFile };
+        file << json.str();
+    } else {
+        std::cout << json.str();
+    }
+    return 0;
+}
+
+static std::optional<Options> parseOptions(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        const std::string_view argument { argv[i] };
+        // All options except --shading and --first-touch take a value.
+        if (argument == "--shading") {
+            options.volumeShading = true;
+            continue;
+        }
+        if (argument == "--first-touch") {
+            options.firstTouch = true;
+            continue;
+        }
+        if (argument.substr(0, 2) == "--" && i + 1 >= argc) {
+            std::cerr << "Missing value for " << argument << std::endl;
+            return {};
+        }
+
+        if (argument == "--resolution") {
+            options.resolutions.push_back(std::stoi(argv[++i]));
+        } else if (argument == "--frames") {
+            options.frames = std::stoi(argv[++i]);
+        } else if (argument == "--warmup") {
+            options.warmupFrames = std::stoi(argv[++i]);
+        } else if (argument == "--gradients") {
+            const std::string_view encoding { argv[++i] };
+            if (encoding == "float") {
+                options.gradientEncoding = volume::GradientEncoding::Float;
+            } else if (encoding == "quantized") {
+                options.gradientEncoding = volume::GradientEncoding::Quantized;
+            } else if (encoding == "on-the-fly") {
+                options.gradientEncoding = volume::GradientEncoding::OnTheFly;
+            } else {
+                std::cerr << "Unknown gradient encoding " << encoding << std::endl;
+                return {};
+            }
+        } else if (argument == "--output") {
+            options.optOutputDirectory = argv[++i];
+        } else if (argument == "--json") {
+            options.optJsonFile = argv[++i];
+        } else if (argument == "--convert-bricks") {
+            options.optBrickFile = argv[++i];
+        } else if (argument == "--compress") {
+            options.optCompressedFile = argv[++i];
+        } else if (argument == "--quantize") {
+            options.optQuantizationBits = std::stoi(argv[++i]);
+        } else if (argument == "--threads") {
+            options.threadCounts.push_back(std::stoi(argv[++i]));
+        } else if (argument == "--tile-size") {
+            options.tileScheduling.tileSize = glm::ivec2(std::stoi(argv[++i]));
+        } else if (argument == "--grain-size") {
+            options.tileScheduling.grainSize = size_t(std::max(std::stoi(argv[++i]), 1));
+        } else if (argument == "--partitioner") {
+            const std::string_view partitioner { argv[++i] };
+            if (partitioner == "auto") {
+                options.tileScheduling.partitioner = render::TilePartitioner::Auto;
+            } else if (partitioner == "simple") {
+                options.tileScheduling.partitioner = render::TilePartitioner::Simple;
+            } else if (partitioner == "affinity") {
+                options.tileScheduling.partitioner = render::TilePartitioner::Affinity;
+            } else if (partitioner == "static") {
+                options.tileScheduling.partitioner = render::TilePartitioner::Static;
+            } else {
+                std::cerr << "Unknown partitioner " << partitioner << std::endl;
+                return {};
+            }
+        } else if (argument.substr(0, 2) == "--" || !options.volumeFile.empty()) {
+            std::cerr << "Unexpected argument " << argument << std::endl;
+            return {};
+        } else {
+            options.volumeFile = argument;
+        }
+    }
+
+    if (options.volumeFile.empty() || options.frames <= 0)
+        return {};
+    if (options.resolutions.empty())
+        options.resolutions = { 256, 512 };
+    if (std::any_of(std::begin(options.resolutions), std::end(options.resolutions), [](int resolution) { return resolution <= 0; }))
+        return {};
+    if (options.threadCounts.empty())
+        options.threadCounts = { tbb::this_task_arena::max_concurrency() };
+    if (std::any_of(std::begin(options.threadCounts), std::end(options.threadCounts), [](int threads) { return threads <= 0; }) || options.tileScheduling.tileSize.x <= 0)
+        return {};
+    return options;
+}
+
+static void printUsage()
+{
+    std::cerr << "Usage: volvis_headless <volume.fld> [options]\n"
+              << "  --resolution N  render at N x N pixels (may be repeated, default 256 and 512)\n"
+              << "  --frames N      number of camera positions on the orbit (default 36)\n"
+              << "  --warmup N      untimed frames before each measurement (default 1)\n"
+              << "  --shading       enable volume shading\n"
+              << "  --gradients ENCODING\n"
+              << "                  gradient storage: float (default, 16 bytes per voxel), quantized (4 bytes per\n"
+              << "                  voxel) or on-the-fly (not stored)\n"
+              << "  --output DIR    write the first frame of every configuration as PNG\n"
+              << "  --json FILE     write the statistics to FILE instead of stdout\n"
+              << "  --convert-bricks FILE\n"
+              << "                  convert the volume to a brick file (.bvol) that is streamed from disk when\n"
+              << "                  loaded, instead of rendering it\n"
+              << "  --compress FILE compress the volume to FILE (.cvol) instead of rendering it\n"
+              << "  --quantize BITS with --compress: lossy compression with BITS (1 to 16) bits per voxel\n"
+              << "  --threads N     render with N threads (may be repeated to measure the scaling, default all)\n"
+              << "  --tile-size N   render in tiles of N x N pixels (default 16)\n"
+              << "  --grain-size N  minimum number of tiles that a thread renders in one go (default 1)\n"
+              << "  --partitioner NAME\n"
+              << "                  how tiles are split over the threads: auto (default), simple, affinity or static\n"
+              << "  --first-touch   spread the voxels over all NUMA nodes before rendering" << std::endl;
+}
+
+static std::string_view renderModeName(render::RenderMode renderMode)
+{
+    switch (renderMode) {
+    case render::RenderMode::RenderSlicer:
+        return "slicer";
+    case render::RenderMode::RenderMIP:
+        return "mip";
+    case render::RenderMode::RenderIso:
+        return "iso";
+    case render::RenderMode::RenderComposite:
+        return "composite";
+    case render::RenderMode::RenderTF2D:
+        return "tf2d";
+    case render::RenderMode::RenderMIDA:
+        return "mida";
+    case render::RenderMode::RenderCombined:
+        return "combined";
+    default:
+        throw std::exception();
+    }
+}
+
+static std::string_view interpolationModeName(volume::InterpolationMode interpolationMode)
+{
+    switch (interpolationMode) {
+    case volume::InterpolationMode::NearestNeighbour:
+        return "nearest";
+    case volume::InterpolationMode::Linear:
+        return "linear";
+    case volume::InterpolationMode::Cubic:
+        return "cubic";
+    default:
+        throw std::exception();
+    }
+}
+
+// The settings of the interactive viewer when a volume has just been loaded (see ui::TransferFunctionWidget and
+// ui::TransferFunction2DWidget), such that the images can be compared with the viewer.
+static render::RenderConfig defaultRenderConfig(const volume::Volume& volume)
+{
+    render::RenderConfig config {};
+
+    // Piecewise linear transfer function through the default transfer function points.
+    struct Point {
+        float value;
+        glm::vec4 color;
+    };
+    const std::array<Point, 3> points { { { 0.0f, glm::vec4(0.0f) }, { 0.7f, glm::vec4(glm::vec3(0.7f), 0.03f) }, { 1.0f, glm::vec4(1.0f) } } };
+    size_t left = 0;
+    for (size_t x = 0; x < config.tfColorMap.size(); x++) {
+        const float value = float(x) / float(config.tfColorMap.size());
+        if (value > points[left + 1].value)
+            left++;
+        config.tfColorMap[x] = glm::mix(points[left].color, points[left + 1].color, (value - points[left].value) / (points[left + 1].value - points[left].value));
+    }
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = volume.maximum();
+
+    config.TF2DIntensity = 92.34f;
+    config.TF2DRadius = 125.26f;
+    config.TF2DColor = glm::vec4(0.0f, 0.8f, 0.6f, 0.3f);
+    return config;
+}
+
+// Number of samples that ray marching takes at one sample per voxel (without empty space skipping or early ray
+// termination). Dividing by the frame time gives a throughput that can be compared between volumes and cameras.
+static double samplesPerFrame(const render::RayTraceCamera& camera, const glm::ivec3& dims, const glm::ivec2& resolution)
+{
+    const glm::vec3 lower { 0.0f };
+    const glm::vec3 upper = glm::vec3(dims - glm::ivec3(1));
+    double samples = 0.0;
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            const glm::vec2 pixel = (glm::vec2(x, y) + 0.5f) / glm::vec2(resolution) * 2.0f - 1.0f;
+            const render::Ray ray = camera.generateRay(pixel);
+            const glm::vec3 t0 = (lower - ray.origin) / ray.direction;
+            const glm::vec3 t1 = (upper - ray.origin) / ray.direction;
+            const float tEntry = glm::compMax(glm::min(t0, t1));
+            const float tExit = glm::compMin(glm::max(t0, t1));
+            if (tExit > std::max(tEntry, 0.0f))
+                samples += double(tExit - std::max(tEntry, 0.0f));
+        }
+    }
+    return samples;
+}
+
+static FrameStatistics computeStatistics(std::vector<double> frameTimes, double samples)
+{
+    std::sort(std::begin(frameTimes), std::end(frameTimes));
+    // Nearest rank percentile.
+    const auto percentile = [&](double p) {
+        const size_t rank = size_t(std::ceil(p * double(frameTimes.size())));
+        return frameTimes[std::clamp(rank, size_t(1), frameTimes.size()) - 1];
+    };
+
+    FrameStatistics statistics;
+    statistics.mean = std::accumulate(std::begin(frameTimes), std::end(frameTimes), 0.0) / double(frameTimes.size());
+    statistics.p50 = percentile(0.5);
+    statistics.p99 = percentile(0.99);
+    statistics.megaSamplesPerSecond = samples / (statistics.mean * 1000.0);
+    return statistics;
+}
+
+static void writeImage(const std::filesystem::path& file, gsl::span<const glm::vec4> frameBuffer, const glm::ivec2& resolution)
+{
+    // The frame buffer starts at the bottom row (OpenGL convention), PNG at the top row.
+    std::vector<uint8_t> pixels(size_t(resolution.x * resolution.y * 3));
+    for (int y = 0; y < resolution.y; y++) {
+        for (int x = 0; x < resolution.x; x++) {
+            const glm::vec4& color = frameBuffer[size_t((resolution.y - 1 - y) * resolution.x + x)];
+            for (int channel = 0; channel < 3; channel++)
+                pixels[size_t((y * resolution.x + x) * 3 + channel)] = uint8_t(std::clamp(color[channel], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    if (!stbi_write_png(file.string().c_str(), resolution.x, resolution.y, 3, pixels.data(), resolution.x * 3))
+        std::cerr << "Could not write " << file << std::endl;
+}
@@ -0,0 +1,97 @@
+// Tests that rendering does not allocate once it reached a steady state. They replace the global allocation functions
+// (see counting_allocator.cpp), so they are built into their own executable from the root of the repository with, for
+// example:
+//   c++ -std=c++17 -O3 -DNDEBUG -Isrc -Iintegrity_tests/src integrity_tests/allocations/*.cpp src/render/*.cpp
+//       src/volume/*.cpp -ltbb -lfmt -lpthread -o allocation_tests
+// (glm, GSL, Catch2 2.x, TBB and fmt on the include path, as for the integrity tests).
+#include "counting_allocator.h"
+#include "test_classes.h"
+#include "render/render_config.h"
+#include "render/renderer.h"
+#include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
+#include "volume/volume.h"
+#include <catch2/catch.hpp>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Stores a pointer where the compiler cannot see it, such that it does not elide the allocation.
+static void* volatile pAllocationSink;
+template <typename T>
+static T* escape(T* p)
+{
+    pAllocationSink = p;
+    return p;
+}
+
+TEST_CASE("Counting Allocator Tests")
+{
+    // Every form of operator new is counted, and so are the allocations of C code where malloc can be replaced.
+    struct alignas(64) CacheLine {
+        float values[16];
+    };
+    startCountingAllocations();
+    delete escape(new int { 1 });
+    delete[] escape(new int[4]);
+    delete escape(new CacheLine {});
+    delete[] escape(new CacheLine[2]);
+    delete escape(new (std::nothrow) int { 2 });
+    REQUIRE(stopCountingAllocations() == 5);
+
+#ifdef __GLIBC__
+    startCountingAllocations();
+    void* p = escape(std::malloc(16));
+    p = escape(std::realloc(p, 32));
+    std::free(p);
+    std::free(escape(std::calloc(4, 4)));
+    std::free(escape(std::aligned_alloc(64, 64)));
+    REQUIRE(stopCountingAllocations() == 4);
+#endif
+}
+
+TEST_CASE("Steady State Allocation Tests")
+{
+    // Once both resolutions of dynamic resolution scaling have been rendered, switching between them and rendering
+    // does not allocate (see render::FrameBufferPool).
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint8_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint8_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume::GradientVolume gradientVolume { volume };
+    volume.interpolationMode = gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.volumeShading = true;
+    config.isoValue = 100.0f;
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, 0.1f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    const glm::ivec2 fullResolution { 40, 30 };
+    const glm::ivec2 reducedResolution { 20, 15 };
+    for (const auto renderMode : { render::RenderMode::RenderComposite, render::RenderMode::RenderIso, render::RenderMode::RenderMIP }) {
+        config.renderMode = renderMode;
+        config.renderResolution = fullResolution;
+        render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+        const auto renderBothResolutions = [&]() {
+            for (const glm::ivec2& renderResolution : { reducedResolution, fullResolution }) {
+                config.renderResolution = renderResolution;
+                renderer.setConfig(config);
+                renderer.render();
+            }
+        };
+        for (int i = 0; i < 3; i++)
+            renderBothResolutions();
+
+        startCountingAllocations();
+        for (int i = 0; i < 3; i++)
+            renderBothResolutions();
+        REQUIRE(stopCountingAllocations() == 0);
+    }
+}
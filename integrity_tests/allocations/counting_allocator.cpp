@@ -0,0 +1,152 @@
+// Replacements of the global allocation functions that count allocations (see counting_allocator.h). They live in a
+// translation unit of their own so that the compiler never inlines them into code that allocates, and in a test
+// executable of their own so that the integrity tests keep the default allocator.
+#include "counting_allocator.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+static std::atomic<bool> countAllocations { false };
+static std::atomic<size_t> numAllocations { 0 };
+
+static void countAllocation()
+{
+    if (countAllocations.load(std::memory_order_relaxed))
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+void startCountingAllocations()
+{
+    numAllocations = 0;
+    countAllocations = true;
+}
+
+size_t stopCountingAllocations()
+{
+    countAllocations = false;
+    return numAllocations.load();
+}
+
+#ifdef __GLIBC__
+// The implementation of glibc, which the counting versions of malloc and co. below forward to.
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* p, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* p);
+
+void* malloc(size_t size)
+{
+    countAllocation();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    countAllocation();
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* p, size_t size)
+{
+    countAllocation();
+    return __libc_realloc(p, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    countAllocation();
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** pp, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+        return EINVAL;
+    countAllocation();
+    void* p = __libc_memalign(alignment, size);
+    if (!p)
+        return ENOMEM;
+    *pp = p;
+    return 0;
+}
+}
+#endif
+
+// Allocate without counting (operator new counts itself).
+static void* allocate(size_t size, size_t alignment)
+{
+    size = size > 0 ? size : 1;
+#if defined(__GLIBC__)
+    return alignment > alignof(std::max_align_t) ? __libc_memalign(alignment, size) : __libc_malloc(size);
+#elif defined(_WIN32)
+    return alignment > alignof(std::max_align_t) ? _aligned_malloc(size, alignment) : std::malloc(size);
+#else
+    return alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : std::malloc(size);
+#endif
+}
+
+static void deallocate(void* p, size_t alignment)
+{
+#if defined(__GLIBC__)
+    static_cast<void>(alignment);
+    __libc_free(p);
+#elif defined(_WIN32)
+    if (alignment > alignof(std::max_align_t))
+        _aligned_free(p);
+    else
+        std::free(p);
+#else
+    static_cast<void>(alignment);
+    std::free(p);
+#endif
+}
+
+static void* countedNew(size_t size, size_t alignment)
+{
+    countAllocation();
+    if (void* p = allocate(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+static void* countedNewNoThrow(size_t size, size_t alignment) noexcept
+{
+    countAllocation();
+    return allocate(size, alignment);
+}
+
+static constexpr size_t defaultAlignment = alignof(std::max_align_t);
+
+void* operator new(size_t size) { return countedNew(size, defaultAlignment); }
+void* operator new[](size_t size) { return countedNew(size, defaultAlignment); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedNew(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedNew(size, size_t(alignment)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedNewNoThrow(size, defaultAlignment); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedNewNoThrow(size, defaultAlignment); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedNewNoThrow(size, size_t(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return countedNewNoThrow(size, size_t(alignment)); }
+
+void operator delete(void* p) noexcept { deallocate(p, defaultAlignment); }
+void operator delete[](void* p) noexcept { deallocate(p, defaultAlignment); }
+void operator delete(void* p, size_t) noexcept { deallocate(p, defaultAlignment); }
+void operator delete[](void* p, size_t) noexcept { deallocate(p, defaultAlignment); }
+void operator delete(void* p, std::align_val_t alignment) noexcept { deallocate(p, size_t(alignment)); }
+void operator delete[](void* p, std::align_val_t alignment) noexcept { deallocate(p, size_t(alignment)); }
+void operator delete(void* p, size_t, std::align_val_t alignment) noexcept { deallocate(p, size_t(alignment)); }
+void operator delete[](void* p, size_t, std::align_val_t alignment) noexcept { deallocate(p, size_t(alignment)); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { deallocate(p, defaultAlignment); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { deallocate(p, defaultAlignment); }
+void operator delete(void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { deallocate(p, size_t(alignment)); }
+void operator delete[](void* p, std::align_val_t alignment, const std::nothrow_t&) noexcept { deallocate(p, size_t(alignment)); }
@@ -0,0 +1,9 @@
+#pragma once
+#include <cstddef>
+
+// Counts the heap allocations of all threads while counting is enabled. The counting allocator (see
+// counting_allocator.cpp) replaces every form of the global operator new and, with glibc, also malloc and its
+// relatives, so that allocations of C code and of TBB are counted as well.
+void startCountingAllocations();
+// Returns the number of allocations since startCountingAllocations.
+size_t stopCountingAllocations();
@@ -0,0 +1,418 @@
+// Performance benchmarks of the renderer. They are built into their own executable (so the integrity tests are not
+// compiled with benchmarking enabled) from the root of the repository with, for example:
+//   c++ -std=c++17 -O3 -DNDEBUG -Isrc -Iintegrity_tests/src integrity_tests/benchmarks/*.cpp src/render/*.cpp
+//       src/volume/*.cpp -ltbb -lfmt -lpthread -o integrity_benchmarks
+// (glm, GSL, Catch2 2.x, TBB and fmt on the include path, as for the integrity tests), and run from the root of the
+// repository with:
+//   ./integrity_benchmarks "[!benchmark]"
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "test_classes.h"
+#include "render/distributed_renderer.h"
+#include "render/ray_trace_camera.h"
+#include "render/render_config.h"
+#include "render/renderer.h"
+#include "render/tile_scheduler.h"
+#include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
+#include "volume/volume.h"
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <cmath>
+#include <filesystem>
+#include <glm/geometric.hpp>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <tbb/task_arena.h>
+#include <utility>
+#include <vector>
+
+// Camera at a fixed position that looks at the center of the volume.
+class BenchmarkCamera : public render::RayTraceCamera {
+public:
+    BenchmarkCamera(const glm::vec3& position, const glm::vec3& target)
+        : m_position(position)
+        , m_forward(glm::normalize(target - position))
+        , m_right(glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), m_forward)))
+        , m_up(glm::cross(m_forward, m_right))
+    {
+    }
+
+    glm::vec3 position() const override { return m_position; }
+    glm::vec3 forward() const override { return m_forward; }
+
+    render::Ray generateRay(const glm::vec2& pixel) const override
+    {
+        const float halfScreenPlaneSize = std::tan(0.4f);
+        render::Ray ray;
+        ray.origin = m_position;
+        ray.direction = glm::normalize(m_forward + pixel.x * halfScreenPlaneSize * m_right + pixel.y * halfScreenPlaneSize * m_up);
+        ray.tmin = std::numeric_limits<float>::lowest();
+        ray.tmax = std::numeric_limits<float>::max();
+        return ray;
+    }
+
+private:
+    glm::vec3 m_position, m_forward, m_right, m_up;
+};
+
+// Synthetic scan: a noisy shell around a denser core, surrounded by air (like most CT scans).
+static volume::Volume createBenchmarkVolume(const glm::ivec3& dim, volume::VoxelLayout layout = volume::VoxelLayout::Linear)
+{
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    const glm::vec3 center = glm::vec3(dim) / 2.0f;
+    const float radius = static_cast<float>(std::min(dim.x, std::min(dim.y, dim.z))) * 0.4f;
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                const float distance = glm::length(glm::vec3(x, y, z) - center) / radius;
+                const float noise = static_cast<float>((x * 73 + y * 151 + z * 283) % 17);
+                float value = 0.0f;
+                if (distance < 0.5f)
+                    value = 200.0f + noise;
+                else if (distance < 1.0f)
+                    value = 60.0f + 40.0f * std::sin(distance * 12.0f) + noise;
+                data[static_cast<size_t>(x + dim.x * (y + dim.y * z))] = static_cast<uint16_t>(std::max(value, 0.0f));
+            }
+        }
+    }
+    return volume::Volume { std::move(data), dim, layout };
+}
+
+// Render settings similar to the defaults of the viewer: a transfer function where low values are transparent.
+static render::RenderConfig createBenchmarkConfig(const volume::Volume& volume, const glm::ivec2& resolution)
+{
+    render::RenderConfig config {};
+    config.renderResolution = resolution;
+    for (size_t i = 0; i < config.tfColorMap.size(); i++) {
+        const float value = static_cast<float>(i) / static_cast<float>(config.tfColorMap.size());
+        config.tfColorMap[i] = glm::vec4(value, 0.5f, 1.0f - value, value < 0.2f ? 0.0f : value * 0.05f);
+    }
+    config.tfColorMapIndexStart = volume.minimum();
+    config.tfColorMapIndexRange = volume.maximum() - volume.minimum();
+    config.TF2DIntensity = 150.0f;
+    config.TF2DRadius = 40.0f;
+    config.TF2DColor = glm::vec4(0.0f, 0.8f, 0.6f, 0.3f);
+    return config;
+}
+
+static std::string renderModeName(render::RenderMode renderMode)
+{
+    switch (renderMode) {
+    case render::RenderMode::RenderSlicer:
+        return "Slicer";
+    case render::RenderMode::RenderMIP:
+        return "MIP";
+    case render::RenderMode::RenderIso:
+        return "ISO";
+    case render::RenderMode::RenderComposite:
+        return "Composite";
+    case render::RenderMode::RenderTF2D:
+        return "TF2D";
+    case render::RenderMode::RenderMIDA:
+        return "MIDA";
+    case render::RenderMode::RenderCombined:
+        return "Combined";
+    default:
+        throw std::exception();
+    }
+}
+
+static std::string interpolationModeName(volume::InterpolationMode interpolationMode)
+{
+    switch (interpolationMode) {
+    case volume::InterpolationMode::NearestNeighbour:
+        return "NN";
+    case volume::InterpolationMode::Linear:
+        return "Linear";
+    case volume::InterpolationMode::Cubic:
+        return "Cubic";
+    default:
+        throw std::exception();
+    }
+}
+
+// Pseudo-random positions in [0, extent) (the same sequence on every run).
+static std::vector<glm::vec3> randomPositions(size_t count, const glm::vec3& extent)
+{
+    std::vector<glm::vec3> out(count);
+    uint32_t state = 12345;
+    for (glm::vec3& position : out) {
+        for (int axis = 0; axis < 3; axis++) {
+            state = state * 1664525u + 1013904223u;
+            position[axis] = static_cast<float>(state >> 8) / static_cast<float>(1 << 24) * extent[axis];
+        }
+    }
+    return out;
+}
+
+// Time to render a full frame for every render mode / interpolation mode / shading combination.
+TEST_CASE("Render Mode Benchmarks", "[!benchmark]")
+{
+    volume::Volume volume = createBenchmarkVolume(glm::ivec3(128));
+    volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+    const BenchmarkCamera camera { center + glm::vec3(150.0f, 60.0f, -100.0f), center };
+    render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(256));
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    const render::RenderMode renderModes[] = {
+        render::RenderMode::RenderMIP, render::RenderMode::RenderIso, render::RenderMode::RenderComposite,
+        render::RenderMode::RenderTF2D, render::RenderMode::RenderMIDA, render::RenderMode::RenderCombined
+    };
+    for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear }) {
+        volume.interpolationMode = interpolationMode;
+        gradientVolume.interpolationMode = interpolationMode;
+        for (const bool volumeShading : { false, true }) {
+            for (const auto renderMode : renderModes) {
+                config.renderMode = renderMode;
+                config.volumeShading = volumeShading;
+                config.smoothstep = volumeShading;
+                renderer.setConfig(config);
+
+                BENCHMARK(renderModeName(renderMode) + " " + interpolationModeName(interpolationMode) + (volumeShading ? " shaded" : ""))
+                {
+                    renderer.render();
+                    return renderer.frameBuffer()[0];
+                };
+            }
+        }
+    }
+}
+
+// Speedup of early ray termination on the scans that ship with the viewer (loaded relative to the working directory,
+// so run the benchmarks from the root of the repository).
+TEST_CASE("Early Ray Termination Benchmarks", "[!benchmark]")
+{
+    for (const char* fileName : { "resources/carp8.fld", "resources/pig8.fld" }) {
+        if (!std::filesystem::exists(fileName)) {
+            WARN("Skipping " << fileName << " (not found)");
+            continue;
+        }
+
+        volume::Volume volume { fileName, volume::VoxelLayout::Bricked };
+        volume.interpolationMode = volume::InterpolationMode::Linear;
+        volume::GradientVolume gradientVolume { volume };
+        gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+        const volume::MacroCellGrid macroCellGrid { volume };
+        const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+        const float distance = 1.5f * static_cast<float>(std::max(volume.dims().x, std::max(volume.dims().y, volume.dims().z)));
+        const BenchmarkCamera camera { center + distance * glm::normalize(glm::vec3(0.6f, 0.3f, -1.0f)), center };
+        render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(256));
+        // Make the tissue fairly opaque so that most rays that hit it saturate.
+        for (glm::vec4& color : config.tfColorMap)
+            color.a = std::min(color.a * 8.0f, 1.0f);
+        render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+        for (const auto renderMode : { render::RenderMode::RenderComposite, render::RenderMode::RenderMIDA, render::RenderMode::RenderCombined }) {
+            for (const float earlyTerminationOpacity : { 1.0f, 0.98f }) {
+                config.renderMode = renderMode;
+                config.earlyTerminationOpacity = earlyTerminationOpacity;
+                renderer.setConfig(config);
+
+                std::ostringstream name;
+                name << std::filesystem::path(fileName).filename().string() << " " << renderModeName(renderMode) << " threshold " << earlyTerminationOpacity;
+                BENCHMARK(name.str())
+                {
+                    renderer.render();
+                    return renderer.frameBuffer()[0];
+                };
+            }
+        }
+    }
+}
+
+// Cost of cubic interpolation relative to linear: single samples at pseudo-random positions (the same sequence for
+// every mode) and full frames of the render modes that are bound by sampling.
+TEST_CASE("Interpolation Benchmarks", "[!benchmark]")
+{
+    for (const auto layout : { volume::VoxelLayout::Linear, volume::VoxelLayout::Bricked }) {
+        volume::Volume volume = createBenchmarkVolume(glm::ivec3(128), layout);
+        const std::string layoutName = layout == volume::VoxelLayout::Linear ? "linear" : "bricked";
+
+        const std::vector<glm::vec3> positions = randomPositions(1 << 16, glm::vec3(126.0f));
+        for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear, volume::InterpolationMode::Cubic }) {
+            volume.interpolationMode = interpolationMode;
+            BENCHMARK(std::to_string(positions.size()) + " samples " + interpolationModeName(interpolationMode) + " " + layoutName)
+            {
+                float sum = 0.0f;
+                for (const glm::vec3& position : positions)
+                    sum += volume.getSampleInterpolate(position);
+                return sum;
+            };
+        }
+
+        volume::GradientVolume gradientVolume { volume };
+        const volume::MacroCellGrid macroCellGrid { volume };
+        const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+        const BenchmarkCamera camera { center + glm::vec3(150.0f, 60.0f, -100.0f), center };
+        render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(256));
+        render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+        for (const auto renderMode : { render::RenderMode::RenderMIP, render::RenderMode::RenderComposite }) {
+            for (const auto interpolationMode : { volume::InterpolationMode::Linear, volume::InterpolationMode::Cubic }) {
+                volume.interpolationMode = interpolationMode;
+                config.renderMode = renderMode;
+                renderer.setConfig(config);
+                BENCHMARK(renderModeName(renderMode) + " " + interpolationModeName(interpolationMode) + " " + layoutName)
+                {
+                    renderer.render();
+                    return renderer.frameBuffer()[0];
+                };
+            }
+        }
+    }
+}
+
+// Scaling of a full frame with the number of threads, for several tile sizes and partitioners (the Composite frame has
+// a large spread in cost per pixel: most rays that hit the air around the scan are skipped).
+TEST_CASE("Tile Scheduler Benchmarks", "[!benchmark]")
+{
+    volume::Volume volume = createBenchmarkVolume(glm::ivec3(128), volume::VoxelLayout::Bricked);
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+    const BenchmarkCamera camera { center + glm::vec3(150.0f, 60.0f, -100.0f), center };
+    render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(512));
+    config.renderMode = render::RenderMode::RenderComposite;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    const std::pair<render::TilePartitioner, std::string> partitioners[] = {
+        { render::TilePartitioner::Auto, "auto" }, { render::TilePartitioner::Simple, "simple" },
+        { render::TilePartitioner::Affinity, "affinity" }, { render::TilePartitioner::Static, "static" }
+    };
+    const int maxThreads = tbb::this_task_arena::max_concurrency();
+    for (int threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        tbb::task_arena arena { threads };
+        for (const int tileSize : { 8, 16, 32 }) {
+            for (const auto& [partitioner, partitionerName] : partitioners) {
+                renderer.setTileScheduling({ glm::ivec2(tileSize), 1, partitioner });
+                BENCHMARK(std::to_string(threads) + " threads " + std::to_string(tileSize) + "x" + std::to_string(tileSize) + " " + partitionerName)
+                {
+                    arena.execute([&] { renderer.render(); });
+                    return renderer.frameBuffer()[0];
+                };
+            }
+        }
+        if (threads == maxThreads)
+            break;
+    }
+}
+
+// Scaling of sort-last rendering with the number of workers: the frame time of the distributed renderer, and the time
+// it spends rendering the partial images and compositing them (which grows with the number of workers).
+TEST_CASE("Distributed Rendering Benchmarks", "[!benchmark]")
+{
+    const volume::Volume volume = createBenchmarkVolume(glm::ivec3(256));
+    const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+    const BenchmarkCamera camera { center + glm::vec3(300.0f, 120.0f, -200.0f), center };
+    render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(512));
+
+    for (const int numWorkers : { 1, 2, 4, 8, 16 }) {
+        render::DistributedRenderer distributedRenderer { volume, numWorkers, config };
+        distributedRenderer.setCamera(&camera);
+        distributedRenderer.setInterpolationMode(volume::InterpolationMode::Linear);
+        for (const auto renderMode : { render::RenderMode::RenderComposite, render::RenderMode::RenderMIP }) {
+            config.renderMode = renderMode;
+            distributedRenderer.setConfig(config);
+            BENCHMARK(renderModeName(renderMode) + " " + std::to_string(numWorkers) + " workers")
+            {
+                distributedRenderer.render();
+                return distributedRenderer.frameBuffer()[0];
+            };
+            WARN(renderModeName(renderMode) << " " << numWorkers << " workers: partial images " << distributedRenderer.partialRenderTime().count() * 1000.0
+                                            << " ms, compositing " << distributedRenderer.compositeTime().count() * 1000.0 << " ms");
+        }
+    }
+}
+
+// The building blocks of a frame on their own: gradient lookups for every encoding and interpolation mode (sample
+// lookups are covered by the interpolation benchmarks), and each ray marching kernel for the same set of rays through
+// the volume (called through the TestRenderer accessors, so without the packet and tiling machinery of render()).
+TEST_CASE("Kernel Benchmarks", "[!benchmark]")
+{
+    volume::Volume volume = createBenchmarkVolume(glm::ivec3(128));
+    const std::vector<glm::vec3> positions = randomPositions(1 << 16, glm::vec3(126.0f));
+    const std::pair<volume::GradientEncoding, std::string> encodings[] = {
+        { volume::GradientEncoding::Float, "float" }, { volume::GradientEncoding::Quantized, "quantized" },
+        { volume::GradientEncoding::OnTheFly, "on the fly" }
+    };
+    for (const auto& [encoding, encodingName] : encodings) {
+        volume::GradientVolume gradientVolume { volume, encoding };
+        for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear, volume::InterpolationMode::Cubic }) {
+            volume.interpolationMode = interpolationMode;
+            gradientVolume.interpolationMode = interpolationMode;
+            BENCHMARK(std::to_string(positions.size()) + " gradients " + interpolationModeName(interpolationMode) + " " + encodingName)
+            {
+                float sum = 0.0f;
+                for (const glm::vec3& position : positions)
+                    sum += gradientVolume.getGradientInterpolate(position).magnitude;
+                return sum;
+            };
+        }
+    }
+
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    volume::GradientVolume gradientVolume { volume };
+    gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const glm::vec3 center = glm::vec3(volume.dims()) / 2.0f;
+    const BenchmarkCamera camera { center + glm::vec3(150.0f, 60.0f, -100.0f), center };
+    render::RenderConfig config = createBenchmarkConfig(volume, glm::ivec2(256));
+    config.volumeShading = true;
+    TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    // The rays of a 64x64 image that hit the volume, clipped to its bounds.
+    const render::Bounds bounds { glm::vec3(0.0f), glm::vec3(volume.dims() - 1) };
+    std::vector<render::Ray> rays;
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            render::Ray ray = camera.generateRay(glm::vec2(x, y) / 32.0f - 1.0f);
+            if (renderer.test_instersectRayVolumeBounds(ray, bounds))
+                rays.push_back(ray);
+        }
+    }
+    const glm::vec3 planeNormal = -glm::normalize(camera.forward());
+
+    const render::RenderMode renderModes[] = {
+        render::RenderMode::RenderSlicer, render::RenderMode::RenderMIP, render::RenderMode::RenderIso, render::RenderMode::RenderComposite,
+        render::RenderMode::RenderTF2D, render::RenderMode::RenderMIDA, render::RenderMode::RenderCombined
+    };
+    for (const auto renderMode : renderModes) {
+        config.renderMode = renderMode;
+        renderer.setConfig(config);
+        // Sets up the per frame state that the kernels read.
+        renderer.render();
+        BENCHMARK("traceRay " + renderModeName(renderMode) + " " + std::to_string(rays.size()) + " rays")
+        {
+            glm::vec4 sum { 0.0f };
+            for (const render::Ray& ray : rays) {
+                switch (renderMode) {
+                case render::RenderMode::RenderSlicer:
+                    sum += renderer.test_traceRaySlice(ray, center, planeNormal);
+                    break;
+                case render::RenderMode::RenderMIP:
+                    sum += renderer.test_traceRayMIP(ray, config.sampleStep);
+                    break;
+                case render::RenderMode::RenderIso:
+                    sum += renderer.test_traceRayISO(ray, config.sampleStep);
+                    break;
+                case render::RenderMode::RenderComposite:
+                    sum += renderer.test_traceRayComposite(ray, config.sampleStep);
+                    break;
+                case render::RenderMode::RenderTF2D:
+                    sum += renderer.test_traceRayTF2D(ray, config.sampleStep);
+                    break;
+                case render::RenderMode::RenderMIDA:
+                    sum += renderer.test_traceRayMIDA(ray, config.sampleStep);
+                    break;
+                case render::RenderMode::RenderCombined:
+                    sum += renderer.test_traceRayCombined(ray, config.sampleStep);
+                    break;
+                }
+            }
+            return sum;
+        };
+    }
+}
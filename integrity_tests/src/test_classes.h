@@ -1,7 +1,10 @@
 #include <render/ray.h>
+#include <render/ray_trace_camera.h>
 #include <render/renderer.h>
 #include <volume/gradient_volume.h>
 #include <volume/volume.h>
+#include <glm/geometric.hpp>
+#include <limits>
 #include <utility>
 
 #define provide_member_function_access(func_name)      \
@@ -55,7 +58,38 @@ public:
     provide_member_function_access(traceRayISO)
     provide_member_function_access(traceRayComposite)
     provide_member_function_access(traceRayTF2D)
+    provide_member_function_access(traceRayMIDA)
+    provide_member_function_access(traceRayCombined)
+    provide_const_member_function_access(packetTraceContext)
+    provide_const_member_function_access(instersectRayVolumeBounds)
+    provide_static_member_function_access(intersectRaysVolumeBounds)
 
     provide_member_function_access(bisectionAccuracy)
     provide_member_function_access(computePhongShading)
-};
\ No newline at end of file
+    provide_static_member_function_access(computePhongShadingHeadlight)
+};
+
+// Camera that looks along the positive z-axis.
+class TestCamera : public render::RayTraceCamera {
+public:
+    TestCamera(const glm::vec3& position)
+        : m_position(position)
+    {
+    }
+
+    glm::vec3 position() const override { return m_position; }
+    glm::vec3 forward() const override { return glm::vec3(0.0f, 0.0f, 1.0f); }
+
+    render::Ray generateRay(const glm::vec2& pixel) const override
+    {
+        render::Ray ray;
+        ray.origin = m_position;
+        ray.direction = glm::normalize(glm::vec3(pixel * 0.5f, 1.0f));
+        ray.tmin = std::numeric_limits<float>::lowest();
+        ray.tmax = std::numeric_limits<float>::max();
+        return ray;
+    }
+
+private:
+    glm::vec3 m_position;
+};
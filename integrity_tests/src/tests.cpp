@@ -1,9 +1,38 @@
 // Can access the header files from the viewer...
 #include "test_classes.h"
+#include "render/distributed_renderer.h"
+#include "render/frame_buffer_pool.h"
+#include "render/instrumentation.h"
+#include "render/packet_tracer.h"
+#include "render/preintegration_table.h"
+#include "render/render_service.h"
+#include "render/tile_scheduler.h"
+#include "render/transfer_function_2d_table.h"
 #include "ui/window.h"
+#include "volume/brick_cache.h"
+#include "volume/compressed_volume.h"
+#include "volume/derived_data_cache.h"
+#include "volume/macro_cell_grid.h"
+#include "volume/statistics_cache.h"
+#include "volume/volume_pyramid.h"
+#include "volume/volume_sequence.h"
 #include <algorithm>
+#include <atomic>
 #include <catch2/catch.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <glm/gtc/epsilon.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <thread>
 
 /*
 GradientVolume:
@@ -37,6 +66,100 @@ TEST_CASE("Volume Tests")
     REQUIRE_NOTHROW(volume.test_getSampleTriCubicInterpolation(glm::vec3(2.5f)));
 }
 
+TEST_CASE("Cubic Interpolation Tests")
+{
+    REQUIRE(TestVolume::test_weight(0.0f) == Approx(2.0f / 3.0f));
+    REQUIRE(TestVolume::test_weight(-1.0f) == Approx(1.0f / 6.0f));
+    REQUIRE(TestVolume::test_weight(2.0f) == 0.0f);
+    for (const float factor : { 0.0f, 0.3f, 0.5f, 0.9f, 1.0f }) {
+        // The weights sum to one and reproduce linear functions.
+        REQUIRE(TestVolume::test_cubicInterpolate(1.0f, 1.0f, 1.0f, 1.0f, factor) == Approx(1.0f));
+        REQUIRE(TestVolume::test_cubicInterpolate(-1.0f, 0.0f, 1.0f, 2.0f, factor) == Approx(factor).margin(1e-6f));
+        float weightSum = 0.0f;
+        for (int i = -1; i < 3; i++)
+            weightSum += TestVolume::test_weight(factor - float(i));
+        REQUIRE(weightSum == Approx(1.0f));
+    }
+
+    const glm::ivec3 dim { 11, 9, 10 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i * 7919) % 1000);
+    for (const auto layout : { volume::VoxelLayout::Linear, volume::VoxelLayout::Bricked }) {
+        const TestVolume volume { data, dim, layout };
+        // Reference: the 64-tap kernel (with the neighbours clamped to the volume) and the bicubic slices.
+        const auto reference = [&](const glm::vec3& coord) {
+            const glm::ivec3 base { coord };
+            float sum = 0.0f;
+            for (int z = -1; z < 3; z++) {
+                for (int y = -1; y < 3; y++) {
+                    for (int x = -1; x < 3; x++) {
+                        const glm::ivec3 voxel = glm::clamp(base + glm::ivec3(x, y, z), glm::ivec3(0), dim - 1);
+                        const glm::vec3 distance = coord - glm::vec3(base + glm::ivec3(x, y, z));
+                        sum += TestVolume::test_weight(distance.x) * TestVolume::test_weight(distance.y) * TestVolume::test_weight(distance.z) * volume.getVoxel(voxel.x, voxel.y, voxel.z);
+                    }
+                }
+            }
+            return sum;
+        };
+        for (const glm::vec3& coord : { glm::vec3(0.0f), glm::vec3(0.5f, 0.25f, 0.75f), glm::vec3(4.3f, 5.7f, 2.1f), glm::vec3(9.9f, 7.5f, 8.2f), glm::vec3(5.0f, 4.0f, 3.0f) }) {
+            const float sample = volume.test_getSampleTriCubicInterpolation(coord);
+            REQUIRE(sample == Approx(reference(coord)).epsilon(1e-4f));
+            const int z = int(coord.z);
+            const float slices = TestVolume::test_cubicInterpolate(
+                volume.test_biCubicInterpolate(glm::vec2(coord), std::max(z - 1, 0)), volume.test_biCubicInterpolate(glm::vec2(coord), z),
+                volume.test_biCubicInterpolate(glm::vec2(coord), std::min(z + 1, dim.z - 1)), volume.test_biCubicInterpolate(glm::vec2(coord), std::min(z + 2, dim.z - 1)),
+                coord.z - float(z));
+            REQUIRE(sample == Approx(slices).epsilon(1e-4f));
+            // The B-spline never leaves the value range of the data.
+            REQUIRE(sample >= volume.minimum());
+            REQUIRE(sample <= volume.maximum());
+        }
+        // Same domain as trilinear interpolation.
+        REQUIRE(volume.test_getSampleTriCubicInterpolation(glm::vec3(-0.1f, 1.0f, 1.0f)) == 0.0f);
+        REQUIRE(volume.test_getSampleTriCubicInterpolation(glm::vec3(1.0f, 8.5f, 1.0f)) == 0.0f);
+    }
+}
+
+TEST_CASE("Trilinear Interpolation Tests")
+{
+    const glm::ivec3 dim { 11, 9, 10 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint16_t((i * 7919) % 1000);
+    for (const auto layout : { volume::VoxelLayout::Linear, volume::VoxelLayout::Bricked }) {
+        const TestVolume volume { data, dim, layout };
+        // Reference: interpolation along x, then y, then z with the (unchecked) linearInterpolate.
+        const auto reference = [&](const glm::vec3& coord) {
+            const glm::ivec3 base { coord };
+            const glm::vec3 factor = coord - glm::vec3(base);
+            float planes[2];
+            for (int z = 0; z < 2; z++) {
+                float rows[2];
+                for (int y = 0; y < 2; y++)
+                    rows[y] = TestVolume::test_linearInterpolate(volume.getVoxel(base.x, base.y + y, base.z + z), volume.getVoxel(base.x + 1, base.y + y, base.z + z), factor.x);
+                planes[z] = TestVolume::test_linearInterpolate(rows[0], rows[1], factor.y);
+            }
+            return TestVolume::test_linearInterpolate(planes[0], planes[1], factor.z);
+        };
+        for (const glm::vec3& coord : { glm::vec3(0.0f), glm::vec3(0.5f, 0.25f, 0.75f), glm::vec3(4.3f, 5.7f, 2.1f), glm::vec3(9.9f, 7.5f, 8.2f), glm::vec3(5.0f, 4.0f, 3.0f) })
+            REQUIRE(volume.test_getSampleTriLinearInterpolation(coord) == Approx(reference(coord)).epsilon(1e-5f));
+        REQUIRE(volume.test_getSampleTriLinearInterpolation(glm::vec3(-0.1f, 1.0f, 1.0f)) == 0.0f);
+        REQUIRE(volume.test_getSampleTriLinearInterpolation(glm::vec3(1.0f, 8.5f, 1.0f)) == 0.0f);
+
+        // The batch samples along a ray that leaves the volume match the individual samples.
+        const glm::vec3 start { 0.3f, 0.6f, 0.2f };
+        const glm::vec3 increment { 0.7f, 0.45f, 0.6f };
+        std::vector<float> samples(20);
+        volume.getSamplesInterpolate<volume::InterpolationMode::Linear, uint16_t>(start, increment, samples);
+        for (size_t i = 0; i < samples.size(); i++)
+            REQUIRE(samples[i] == volume.test_getSampleTriLinearInterpolation(start + float(i) * increment));
+        volume.getSamplesInterpolate<volume::InterpolationMode::Cubic, uint16_t>(start, increment, samples);
+        for (size_t i = 0; i < samples.size(); i++)
+            REQUIRE(samples[i] == volume.test_getSampleTriCubicInterpolation(start + float(i) * increment));
+    }
+}
+
 TEST_CASE("Gradient Volume Tests")
 {
     volume::GradientVoxel gv = { glm::vec3(1.f, 0.f, 0.f), 1.f };
@@ -46,3 +169,1943 @@ TEST_CASE("Gradient Volume Tests")
     const TestGradientVolume gradient { volume };
     REQUIRE_NOTHROW(gradient.test_getGradientLinearInterpolate(glm::vec3(100.f)));
 }
+
+TEST_CASE("Macro Cell Grid Tests")
+{
+    // A single bright voxel in the last cell along x.
+    std::vector<uint16_t> data(16 * 8 * 8, 0);
+    data[12 + 16 * (4 + 8 * 4)] = 100;
+    const volume::Volume volume { std::move(data), glm::ivec3(16, 8, 8) };
+    const volume::MacroCellGrid grid { volume };
+
+    REQUIRE(grid.dims() == glm::ivec3(2, 1, 1));
+    REQUIRE(grid.getCell(0, 0, 0).maximum == 0.0f);
+    REQUIRE(grid.getCell(1, 0, 0).minimum == 0.0f);
+    REQUIRE(grid.getCell(1, 0, 0).maximum == 100.0f);
+    REQUIRE(grid.cellOf(glm::vec3(-1.0f)) == glm::ivec3(0));
+    REQUIRE(grid.cellOf(glm::vec3(100.0f)) == glm::ivec3(1, 0, 0));
+}
+
+TEST_CASE("Voxel Layout Tests")
+{
+    // Use dimensions that are not a multiple of the brick size to test the padding.
+    const glm::ivec3 dim { 11, 9, 17 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 1000);
+
+    const volume::Volume linear { data, dim, volume::VoxelLayout::Linear };
+    const volume::Volume bricked { data, dim, volume::VoxelLayout::Bricked };
+    REQUIRE(bricked.minimum() == linear.minimum());
+    REQUIRE(bricked.maximum() == linear.maximum());
+    REQUIRE(bricked.histogram() == linear.histogram());
+
+    const volume::GradientVolume linearGradient { linear };
+    const volume::GradientVolume brickedGradient { bricked };
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                REQUIRE(bricked.getVoxel(x, y, z) == linear.getVoxel(x, y, z));
+                for (const volume::Volume* pVolume : { &linear, &bricked }) {
+                    const volume::VoxelIndexer& indexer = pVolume->indexer();
+                    REQUIRE(indexer.xOffset(x) + indexer.yOffset(y) + indexer.zOffset(z) == indexer.index(x, y, z));
+                }
+                REQUIRE(brickedGradient.getGradient(x, y, z).magnitude == linearGradient.getGradient(x, y, z).magnitude);
+            }
+        }
+    }
+}
+
+TEST_CASE("Voxel Type Tests")
+{
+    // The same values stored with each voxel type should produce the same samples and images.
+    const glm::ivec3 dim { 20, 18, 17 };
+    std::vector<uint8_t> data8(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data8.size(); i++)
+        data8[i] = uint8_t((i * 37) % 251);
+    const std::vector<uint16_t> data16(std::begin(data8), std::end(data8));
+    const std::vector<float> dataFloat(std::begin(data8), std::end(data8));
+
+    const volume::Volume volume16 { data16, dim, volume::VoxelLayout::Bricked };
+    const volume::Volume volume8 { data8, dim, volume::VoxelLayout::Bricked };
+    const volume::Volume volumeFloat { dataFloat, dim, volume::VoxelLayout::Bricked };
+    REQUIRE(volume8.voxelType() == volume::VoxelType::UInt8);
+    REQUIRE(volume16.voxelType() == volume::VoxelType::UInt16);
+    REQUIRE(volumeFloat.voxelType() == volume::VoxelType::Float);
+    REQUIRE(volume8.data<uint8_t>().size() == volume16.data<uint16_t>().size());
+    REQUIRE(volume8.histogram() == volume16.histogram());
+    REQUIRE(volumeFloat.histogram() == volume16.histogram());
+
+    const TestCamera camera { glm::vec3(10.0f, 9.0f, -15.0f) };
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(16, 16);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(glm::vec3(float(i) / 255.0f), i < 100 ? 0.0f : 0.05f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 250.0f;
+
+    for (auto* pVolume : { &volume8, &volumeFloat }) {
+        for (int z = 0; z < dim.z; z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++)
+                    REQUIRE(pVolume->getVoxel(x, y, z) == volume16.getVoxel(x, y, z));
+            }
+        }
+
+        for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear }) {
+            for (const auto renderMode : { render::RenderMode::RenderMIP, render::RenderMode::RenderComposite, render::RenderMode::RenderMIDA }) {
+                config.renderMode = renderMode;
+                std::vector<glm::vec4> images[2];
+                int image = 0;
+                for (const volume::Volume* pRenderVolume : { &volume16, pVolume }) {
+                    volume::Volume renderVolume = *pRenderVolume;
+                    renderVolume.interpolationMode = interpolationMode;
+                    const volume::GradientVolume gradientVolume { renderVolume };
+                    const volume::MacroCellGrid macroCellGrid { renderVolume };
+                    render::Renderer renderer { &renderVolume, &gradientVolume, &macroCellGrid, &camera, config };
+                    renderer.render();
+                    images[image++].assign(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+                }
+                REQUIRE(images[0] == images[1]);
+            }
+        }
+    }
+}
+
+TEST_CASE("Quantized Gradient Tests")
+{
+    // A smooth radial ramp with some noise, so the gradients point in all directions.
+    const glm::ivec3 dim { 24, 20, 22 };
+    std::vector<uint16_t> data(size_t(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                const size_t i = size_t(x + dim.x * (y + dim.y * z));
+                const float distance = glm::length(glm::vec3(x, y, z) - glm::vec3(dim) / 2.0f);
+                data[i] = uint16_t(40.0f * distance + float((i * 7919) % 13));
+            }
+        }
+    }
+    volume::Volume volume { std::move(data), dim, volume::VoxelLayout::Bricked };
+    volume::GradientVolume floatGradient { volume };
+    volume::GradientVolume quantizedGradient { volume, volume::GradientEncoding::Quantized };
+    REQUIRE(floatGradient.encoding() == volume::GradientEncoding::Float);
+    REQUIRE(quantizedGradient.encoding() == volume::GradientEncoding::Quantized);
+    REQUIRE(quantizedGradient.minMagnitude() == floatGradient.minMagnitude());
+    REQUIRE(quantizedGradient.maxMagnitude() == floatGradient.maxMagnitude());
+
+    const float magnitudeTolerance = floatGradient.maxMagnitude() / 65535.0f;
+    const float minCosAngle = std::cos(glm::radians(1.0f));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                const volume::GradientVoxel expected = floatGradient.getGradient(x, y, z);
+                const volume::GradientVoxel actual = quantizedGradient.getGradient(x, y, z);
+                REQUIRE(actual.magnitude == Approx(expected.magnitude).margin(magnitudeTolerance));
+                REQUIRE(glm::length(actual.dir) == Approx(actual.magnitude).margin(1e-3f * floatGradient.maxMagnitude()));
+                if (expected.magnitude == 0.0f)
+                    REQUIRE(actual.magnitude == 0.0f);
+                else
+                    REQUIRE(glm::dot(glm::normalize(actual.dir), glm::normalize(expected.dir)) >= minCosAngle);
+            }
+        }
+    }
+
+    // Axis aligned directions (very common in scanned data) are represented exactly.
+    for (const glm::vec3& direction : { glm::vec3(1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) }) {
+        const auto quantized = volume::GradientVolume::quantize({ direction * 2.0f, 2.0f }, 4.0f);
+        REQUIRE(glm::normalize(volume::GradientVolume::dequantize(quantized, 4.0f).dir) == direction);
+    }
+
+    // Shaded images are nearly indistinguishable.
+    const TestCamera camera { glm::vec3(12.0f, 10.0f, -25.0f) };
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(16, 16);
+    config.volumeShading = true;
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(0.8f, 0.6f, 0.4f, i < 64 ? 0.02f : 0.0f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = volume.maximum();
+    const volume::MacroCellGrid macroCellGrid { volume };
+    for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear }) {
+        for (const auto renderMode : { render::RenderMode::RenderComposite, render::RenderMode::RenderMIDA }) {
+            config.renderMode = renderMode;
+            volume.interpolationMode = interpolationMode;
+            std::vector<glm::vec4> images[2];
+            int image = 0;
+            for (auto* pGradientVolume : { &floatGradient, &quantizedGradient }) {
+                pGradientVolume->interpolationMode = interpolationMode;
+                render::Renderer renderer { &volume, pGradientVolume, &macroCellGrid, &camera, config };
+                renderer.render();
+                images[image++].assign(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+            }
+            for (size_t i = 0; i < images[0].size(); i++) {
+                for (int channel = 0; channel < 4; channel++)
+                    REQUIRE(images[1][i][channel] == Approx(images[0][i][channel]).margin(0.01f));
+            }
+        }
+    }
+}
+
+TEST_CASE("On The Fly Gradient Tests")
+{
+    const glm::ivec3 dim { 13, 11, 10 };
+    std::vector<uint8_t> data(size_t(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = uint8_t((i * 7919) % 251);
+
+    for (const auto layout : { volume::VoxelLayout::Linear, volume::VoxelLayout::Bricked }) {
+        volume::Volume volume { data, dim, layout };
+        volume::GradientVolume storedGradient { volume };
+        volume::GradientVolume onTheFlyGradient { volume, volume::GradientEncoding::OnTheFly };
+        REQUIRE(onTheFlyGradient.minMagnitude() == storedGradient.minMagnitude());
+        REQUIRE(onTheFlyGradient.maxMagnitude() == storedGradient.maxMagnitude());
+
+        for (int z = 0; z < dim.z; z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++) {
+                    REQUIRE(onTheFlyGradient.getGradient(x, y, z).dir == storedGradient.getGradient(x, y, z).dir);
+                    REQUIRE(onTheFlyGradient.getGradient(x, y, z).magnitude == storedGradient.getGradient(x, y, z).magnitude);
+                }
+            }
+        }
+
+        // Includes positions outside of the volume and on voxel centers.
+        for (const glm::vec3& coord : { glm::vec3(-0.5f, 2.0f, 3.0f), glm::vec3(0.25f, 0.5f, 0.75f), glm::vec3(5.0f, 6.0f, 4.0f), glm::vec3(3.3f, 7.9f, 8.2f), glm::vec3(11.5f, 9.5f, 8.5f), glm::vec3(12.0f, 1.0f, 1.0f) }) {
+            for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear }) {
+                storedGradient.interpolationMode = onTheFlyGradient.interpolationMode = interpolationMode;
+                const volume::GradientVoxel expected = storedGradient.getGradientInterpolate(coord);
+                const volume::GradientVoxel actual = onTheFlyGradient.getGradientInterpolate(coord);
+                REQUIRE(actual.dir == expected.dir);
+                REQUIRE(actual.magnitude == expected.magnitude);
+            }
+        }
+
+        // So the images are equal too.
+        const TestCamera camera { glm::vec3(6.0f, 5.0f, -15.0f) };
+        render::RenderConfig config {};
+        config.renderResolution = glm::ivec2(12, 12);
+        config.volumeShading = true;
+        config.isoValue = 120.0f;
+        for (size_t i = 0; i < config.tfColorMap.size(); i++)
+            config.tfColorMap[i] = glm::vec4(glm::vec3(float(i) / 255.0f), i < 128 ? 0.0f : 0.05f);
+        config.tfColorMapIndexStart = 0.0f;
+        config.tfColorMapIndexRange = 250.0f;
+        const volume::MacroCellGrid macroCellGrid { volume };
+        for (const auto renderMode : { render::RenderMode::RenderIso, render::RenderMode::RenderComposite, render::RenderMode::RenderTF2D, render::RenderMode::RenderMIDA }) {
+            config.renderMode = renderMode;
+            volume.interpolationMode = volume::InterpolationMode::Linear;
+            std::vector<glm::vec4> images[2];
+            int image = 0;
+            for (auto* pGradientVolume : { &storedGradient, &onTheFlyGradient }) {
+                pGradientVolume->interpolationMode = volume::InterpolationMode::Linear;
+                render::Renderer renderer { &volume, pGradientVolume, &macroCellGrid, &camera, config };
+                renderer.render();
+                images[image++].assign(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+            }
+            REQUIRE(images[0] == images[1]);
+        }
+    }
+}
+
+TEST_CASE("Volume Loading Tests")
+{
+    const glm::ivec3 dim { 11, 7, 5 };
+    const size_t voxelCount = size_t(dim.x * dim.y * dim.z);
+    const auto expectedVoxel = [&](int x, int y, int z, size_t elementSize) {
+        const size_t i = size_t(x + dim.x * (y + dim.y * z));
+        return float(elementSize == 1 ? (i * 37) % 256 : (i * 997) % 65536);
+    };
+
+    // The length of the header decides whether 16-bit voxels are aligned in the memory mapped file.
+    for (const auto& [elementSize, header] : { std::pair { size_t(1), "data=byte" }, std::pair { size_t(2), "data=short" }, std::pair { size_t(2), "data=short " } }) {
+        const auto file = std::filesystem::temp_directory_path() / "volvis_loading_test.fld";
+        {
+            std::ofstream ofs { file, std::ios::binary };
+            ofs << "# AVS field file\nndim=3\ndim1=" << dim.x << "\ndim2=" << dim.y << "\ndim3=" << dim.z << "\nnspace=3\nveclen=1\n"
+                << header << "\nfield=uniform\n\f\f";
+            for (size_t i = 0; i < voxelCount; i++) {
+                const auto value = uint16_t(expectedVoxel(int(i) % dim.x, (int(i) / dim.x) % dim.y, int(i) / (dim.x * dim.y), elementSize));
+                ofs.put(char(value & 0xFF));
+                if (elementSize == 2)
+                    ofs.put(char(value >> 8));
+            }
+        }
+
+        for (const auto layout : { volume::VoxelLayout::Linear, volume::VoxelLayout::Bricked }) {
+            const volume::Volume volume { file, layout };
+            REQUIRE(volume.dims() == dim);
+            REQUIRE(volume.minimum() == 0.0f);
+            for (int z = 0; z < dim.z; z++) {
+                for (int y = 0; y < dim.y; y++) {
+                    for (int x = 0; x < dim.x; x++)
+                        REQUIRE(volume.getVoxel(x, y, z) == expectedVoxel(x, y, z, elementSize));
+                }
+            }
+        }
+        std::filesystem::remove(file);
+    }
+}
+
+TEST_CASE("Statistics Cache Tests")
+{
+    const glm::ivec3 dim { 20, 17, 9 };
+    const size_t voxelCount = size_t(dim.x * dim.y * dim.z);
+    const auto file = std::filesystem::temp_directory_path() / "volvis_statistics_test.fld";
+    const auto writeVolume = [&](size_t trailingBytes) {
+        std::ofstream ofs { file, std::ios::binary };
+        ofs << "# AVS field file\nndim=3\ndim1=" << dim.x << "\ndim2=" << dim.y << "\ndim3=" << dim.z << "\nnspace=3\nveclen=1\ndata=byte\nfield=uniform\n\f\f";
+        for (size_t i = 0; i < voxelCount; i++)
+            ofs.put(char((i * 37) % 200));
+        for (size_t i = 0; i < trailingBytes; i++)
+            ofs.put(0);
+    };
+    writeVolume(0);
+    std::filesystem::remove(volume::statisticsCachePath(file));
+
+    // Without a cache the statistics are computed; the cache is only written on request. The 2D histogram counts
+    // every voxel once.
+    const volume::Volume volume { file };
+    REQUIRE(volume.statisticsCache() == nullptr);
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::Histogram2D& histogram2D = gradientVolume.histogram2D();
+    REQUIRE(histogram2D.dims.x == 256);
+    REQUIRE(histogram2D.dims.y >= 1);
+    REQUIRE(histogram2D.bins.size() == size_t(histogram2D.dims.x * histogram2D.dims.y));
+    REQUIRE(std::accumulate(std::begin(histogram2D.bins), std::end(histogram2D.bins), size_t(0)) == voxelCount);
+    REQUIRE(float(histogram2D.dims.y) * histogram2D.magnitudeBinSize > gradientVolume.maxMagnitude());
+    const glm::ivec3 voxel { 4, 5, 6 };
+    const int column = std::min(int(volume.getVoxel(voxel.x, voxel.y, voxel.z) / histogram2D.intensityBinSize), histogram2D.dims.x - 1);
+    const int row = int(gradientVolume.getGradient(voxel.x, voxel.y, voxel.z).magnitude / histogram2D.magnitudeBinSize);
+    REQUIRE(histogram2D.bins[size_t(row * histogram2D.dims.x + column)] > 0);
+    REQUIRE(!std::filesystem::exists(volume::statisticsCachePath(file)));
+    volume::updateStatisticsCache(volume, gradientVolume);
+    REQUIRE(std::filesystem::exists(volume::statisticsCachePath(file)));
+
+    // Reloading uses the cache, which gives the same statistics; gradients computed on the fly skip the gradient pass.
+    {
+        const volume::Volume cachedVolume { file };
+        REQUIRE(cachedVolume.statisticsCache() != nullptr);
+        REQUIRE(cachedVolume.minimum() == volume.minimum());
+        REQUIRE(cachedVolume.maximum() == volume.maximum());
+        REQUIRE(cachedVolume.histogram() == volume.histogram());
+        const volume::GradientVolume cachedGradient { cachedVolume, volume::GradientEncoding::OnTheFly };
+        REQUIRE(cachedGradient.minMagnitude() == gradientVolume.minMagnitude());
+        REQUIRE(cachedGradient.maxMagnitude() == gradientVolume.maxMagnitude());
+        REQUIRE(cachedGradient.histogram2D().dims == histogram2D.dims);
+        REQUIRE(cachedGradient.histogram2D().bins == histogram2D.bins);
+    }
+
+    // A modified volume file invalidates the cache.
+    writeVolume(16);
+    {
+        const volume::Volume modifiedVolume { file };
+        REQUIRE(modifiedVolume.statisticsCache() == nullptr);
+    }
+    std::filesystem::remove(file);
+    std::filesystem::remove(volume::statisticsCachePath(file));
+}
+
+TEST_CASE("Derived Data Cache Tests")
+{
+    const glm::ivec3 dim { 70, 40, 20 };
+    const size_t voxelCount = size_t(dim.x * dim.y * dim.z);
+    const auto file = std::filesystem::temp_directory_path() / "volvis_derived_data_test.fld";
+    const auto writeVolume = [&](size_t trailingBytes) {
+        std::ofstream ofs { file, std::ios::binary };
+        ofs << "# AVS field file\nndim=3\ndim1=" << dim.x << "\ndim2=" << dim.y << "\ndim3=" << dim.z << "\nnspace=3\nveclen=1\ndata=byte\nfield=uniform\n\f\f";
+        for (size_t i = 0; i < voxelCount; i++)
+            ofs.put(char((i * 37 + (i / 70) * 11) % 200));
+        for (size_t i = 0; i < trailingBytes; i++)
+            ofs.put(0);
+    };
+    writeVolume(0);
+    std::filesystem::remove(volume::statisticsCachePath(file));
+
+    for (const auto encoding : { volume::GradientEncoding::Float, volume::GradientEncoding::Quantized }) {
+        std::filesystem::remove(volume::derivedDataCachePath(file));
+        const volume::Volume volume { file, volume::VoxelLayout::Bricked };
+        REQUIRE(volume::readDerivedDataCache(volume, encoding).empty());
+        const volume::GradientVolume gradientVolume { volume, encoding };
+        const volume::MacroCellGrid macroCellGrid { volume };
+        const volume::VolumePyramid pyramid { volume, gradientVolume, macroCellGrid };
+        REQUIRE(pyramid.numLevels() == 3);
+        volume::writeDerivedDataCache(pyramid);
+
+        // The cache is only used with the layout and gradient encoding that it was written for.
+        REQUIRE(volume::readDerivedDataCache(volume, volume::GradientEncoding::OnTheFly).empty());
+        REQUIRE(volume::readDerivedDataCache(volume::Volume { file, volume::VoxelLayout::Linear }, encoding).empty());
+
+        // The mapped levels are identical to the computed ones.
+        const auto derivedLevels = volume::readDerivedDataCache(volume, encoding);
+        REQUIRE(derivedLevels.size() == 3);
+        const volume::GradientVolume cachedGradientVolume { volume, derivedLevels[0] };
+        const volume::MacroCellGrid cachedMacroCellGrid { derivedLevels[0] };
+        const volume::VolumePyramid cachedPyramid { volume, cachedGradientVolume, cachedMacroCellGrid, derivedLevels };
+        REQUIRE(cachedPyramid.numLevels() == pyramid.numLevels());
+        for (int levelIndex = 0; levelIndex < pyramid.numLevels(); levelIndex++) {
+            const volume::PyramidLevel level = pyramid.level(levelIndex);
+            const volume::PyramidLevel cachedLevel = cachedPyramid.level(levelIndex);
+            const glm::ivec3 levelDim = level.pVolume->dims();
+            REQUIRE(cachedLevel.pVolume->dims() == levelDim);
+            REQUIRE(cachedLevel.pVolume->minimum() == level.pVolume->minimum());
+            REQUIRE(cachedLevel.pVolume->maximum() == level.pVolume->maximum());
+            REQUIRE(cachedLevel.pVolume->histogram() == level.pVolume->histogram());
+            REQUIRE(cachedLevel.pGradientVolume->encoding() == encoding);
+            REQUIRE(cachedLevel.pGradientVolume->maxMagnitude() == level.pGradientVolume->maxMagnitude());
+            REQUIRE(cachedLevel.pGradientVolume->histogram2D().bins == level.pGradientVolume->histogram2D().bins);
+            for (int z = 0; z < levelDim.z; z++) {
+                for (int y = 0; y < levelDim.y; y++) {
+                    for (int x = 0; x < levelDim.x; x++) {
+                        REQUIRE(cachedLevel.pVolume->getVoxel(x, y, z) == level.pVolume->getVoxel(x, y, z));
+                        const volume::GradientVoxel gradient = level.pGradientVolume->getGradient(x, y, z);
+                        const volume::GradientVoxel cachedGradient = cachedLevel.pGradientVolume->getGradient(x, y, z);
+                        REQUIRE(cachedGradient.dir == gradient.dir);
+                        REQUIRE(cachedGradient.magnitude == gradient.magnitude);
+                    }
+                }
+            }
+            const auto cells = level.pMacroCellGrid->cells();
+            const auto cachedCells = cachedLevel.pMacroCellGrid->cells();
+            REQUIRE(std::equal(std::begin(cells), std::end(cells), std::begin(cachedCells), std::end(cachedCells),
+                [](const volume::MacroCell& lhs, const volume::MacroCell& rhs) { return lhs.minimum == rhs.minimum && lhs.maximum == rhs.maximum; }));
+        }
+    }
+
+    // A modified volume file invalidates the cache.
+    writeVolume(16);
+    {
+        const volume::Volume modifiedVolume { file, volume::VoxelLayout::Bricked };
+        REQUIRE(volume::readDerivedDataCache(modifiedVolume, volume::GradientEncoding::Quantized).empty());
+    }
+    std::filesystem::remove(file);
+    std::filesystem::remove(volume::statisticsCachePath(file));
+    std::filesystem::remove(volume::derivedDataCachePath(file));
+}
+
+TEST_CASE("Packet Tracer Tests")
+{
+    if (!render::packetTracingSupported())
+        return;
+
+    const glm::ivec3 dim { 21, 18, 19 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    // Leave an empty block to test empty space skipping.
+    for (int z = 0; z < 8; z++) {
+        for (int y = 0; y < 8; y++) {
+            for (int x = 0; x < 8; x++)
+                data[static_cast<size_t>(x + dim.x * (y + dim.y * z))] = 0;
+        }
+    }
+
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(1);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++) {
+        const float value = static_cast<float>(i) / static_cast<float>(config.tfColorMap.size());
+        config.tfColorMap[i] = glm::vec4(value, 1.0f - value, 0.5f, i < 40 ? 0.0f : value * 0.1f);
+    }
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+
+    const render::RenderMode modes[] = { render::RenderMode::RenderMIP, render::RenderMode::RenderComposite, render::RenderMode::RenderMIDA };
+    for (const auto layout : { volume::VoxelLayout::Linear, volume::VoxelLayout::Bricked }) {
+        volume::Volume volume { data, dim, layout };
+        const volume::GradientVolume gradientVolume { volume };
+        const volume::MacroCellGrid macroCellGrid { volume };
+        TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, nullptr, config };
+
+        for (const auto& [interpolationMode, earlyTerminationOpacity] : { std::pair { volume::InterpolationMode::NearestNeighbour, 1.0f }, std::pair { volume::InterpolationMode::Linear, 1.0f }, std::pair { volume::InterpolationMode::Linear, 0.5f } }) {
+            volume.interpolationMode = interpolationMode;
+            for (const auto mode : modes) {
+                config.renderMode = mode;
+                config.earlyTerminationOpacity = earlyTerminationOpacity;
+                renderer.setConfig(config);
+                const auto optContext = renderer.test_packetTraceContext(1.0f);
+                REQUIRE(optContext);
+
+                // Diverging rays that start at different distances and enter/leave the volume at different points.
+                render::RayPacket packet;
+                for (int i = 0; i < render::packetSize; i++) {
+                    const float offset = static_cast<float>(i);
+                    packet.rays[i].origin = glm::vec3(-2.0f + offset, 0.5f * offset, 1.0f);
+                    packet.rays[i].direction = glm::normalize(glm::vec3(1.0f, 0.3f + 0.05f * offset, 0.7f - 0.1f * offset));
+                    packet.rays[i].tmin = 0.25f * offset;
+                    packet.rays[i].tmax = 40.0f - offset;
+                    packet.hit[i] = i != 3;
+                }
+
+                std::array<glm::vec4, render::packetSize> colors;
+                render::tracePacket(*optContext, packet, glm::value_ptr(colors[0]));
+                for (int i = 0; i < render::packetSize; i++) {
+                    if (!packet.hit[i])
+                        continue;
+
+                    glm::vec4 expected;
+                    if (mode == render::RenderMode::RenderMIP)
+                        expected = renderer.test_traceRayMIP(packet.rays[i], 1.0f);
+                    else if (mode == render::RenderMode::RenderComposite)
+                        expected = renderer.test_traceRayComposite(packet.rays[i], 1.0f);
+                    else
+                        expected = renderer.test_traceRayMIDA(packet.rays[i], 1.0f);
+                    for (int channel = 0; channel < 4; channel++)
+                        REQUIRE(colors[size_t(i)][channel] == Approx(expected[channel]).margin(1e-5f));
+                }
+            }
+        }
+    }
+
+    // Settings that are not supported by the packet kernels use the scalar code path.
+    const volume::Volume volume { data, dim };
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.earlyTerminationOpacity = 1.0f;
+    config.volumeShading = true;
+    const TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, nullptr, config };
+    REQUIRE(!renderer.test_packetTraceContext(1.0f));
+}
+
+TEST_CASE("Early Ray Termination Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(24, 24);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, 0.2f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    for (const auto renderMode : { render::RenderMode::RenderComposite, render::RenderMode::RenderMIDA }) {
+        config.renderMode = renderMode;
+        config.earlyTerminationOpacity = 1.0f;
+        renderer.setConfig(config);
+        renderer.render();
+        const auto frameBuffer = renderer.frameBuffer();
+        const std::vector<glm::vec4> reference { std::begin(frameBuffer), std::end(frameBuffer) };
+
+        // Terminating at an opacity threshold changes each channel by at most 2 * (1 - threshold), also for MIDA where a
+        // new maximum further along the ray re-weights the accumulated color.
+        config.earlyTerminationOpacity = 0.9f;
+        renderer.setConfig(config);
+        renderer.render();
+        for (size_t i = 0; i < reference.size(); i++) {
+            for (int channel = 0; channel < 4; channel++)
+                REQUIRE(renderer.frameBuffer()[i][channel] == Approx(reference[i][channel]).margin(0.2f));
+        }
+    }
+}
+
+TEST_CASE("Adaptive Sampling Tests")
+{
+    const glm::ivec3 dim { 32, 32, 32 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>(100 + (i * 7919) % 50);
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(16.0f, 16.0f, -20.0f) };
+
+    // A constant transfer function: every cell is homogeneous so the largest steps are taken. With opacity correction
+    // the result should still match the fixed step reference.
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(16, 16);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(0.8f, 0.4f, 0.2f, 0.03f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    config.renderMode = render::RenderMode::RenderComposite;
+    renderer.setConfig(config);
+    renderer.render();
+    const auto frameBuffer = renderer.frameBuffer();
+    const std::vector<glm::vec4> reference { std::begin(frameBuffer), std::end(frameBuffer) };
+
+    config.adaptiveSampling = true;
+    config.adaptiveSamplingQuality = 0.0f;
+    renderer.setConfig(config);
+    renderer.render();
+    for (size_t i = 0; i < reference.size(); i++) {
+        for (int channel = 0; channel < 4; channel++)
+            REQUIRE(renderer.frameBuffer()[i][channel] == Approx(reference[i][channel]).margin(0.02f));
+    }
+
+    // Turning adaptive sampling off again restores the fixed step image exactly.
+    config.adaptiveSampling = false;
+    renderer.setConfig(config);
+    renderer.render();
+    for (size_t i = 0; i < reference.size(); i++)
+        REQUIRE(renderer.frameBuffer()[i] == reference[i]);
+}
+
+TEST_CASE("Temporal Reprojection Tests")
+{
+    // A sphere in an empty volume, such that part of the screen shows the background.
+    const glm::ivec3 dim { 32, 32, 32 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                const float distance = glm::length(glm::vec3(x, y, z) - glm::vec3(16.0f));
+                data[size_t(x + dim.x * (y + dim.y * z))] = static_cast<uint16_t>(distance < 10.0f ? 150 + (x * 7 + y * 3 + z) % 40 : 0);
+            }
+        }
+    }
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(32, 32);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = i < 128 ? glm::vec4(0.0f) : glm::vec4(float(i) / 255.0f, 0.5f, 0.25f, 0.1f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    config.temporalReprojection = true;
+
+    const TestCamera camera { glm::vec3(16.0f, 16.0f, -30.0f) };
+    const TestCamera movedCamera { glm::vec3(18.0f, 15.0f, -28.0f) };
+    const auto renderReference = [&](const TestCamera& referenceCamera) {
+        render::RenderConfig referenceConfig = config;
+        referenceConfig.temporalReprojection = false;
+        render::Renderer reference { &volume, &gradientVolume, &macroCellGrid, &referenceCamera, referenceConfig };
+        reference.render();
+        const auto frameBuffer = reference.frameBuffer();
+        return std::vector<glm::vec4>(std::begin(frameBuffer), std::end(frameBuffer));
+    };
+    const std::vector<glm::vec4> reference = renderReference(camera);
+    const std::vector<glm::vec4> movedReference = renderReference(movedCamera);
+    // Rows of pixels that are all traced may use the packet kernels, which match the scalar kernels up to rounding.
+    const auto requireMatches = [](gsl::span<const glm::vec4> frameBuffer, const std::vector<glm::vec4>& expected) {
+        REQUIRE(frameBuffer.size() == expected.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            for (int channel = 0; channel < 4; channel++)
+                REQUIRE(frameBuffer[i][channel] == Approx(expected[i][channel]).margin(1e-5f));
+        }
+    };
+
+    // The first frame is rendered completely. Reprojecting it to the same camera puts every pixel back in place.
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+    renderer.render();
+    requireMatches(renderer.frameBuffer(), reference);
+    config.interactive = true;
+    renderer.setConfig(config);
+    renderer.render();
+    requireMatches(renderer.frameBuffer(), reference);
+
+    // After the camera moves, the reprojected pixels are traced again over the following frames, after which the image
+    // matches the image rendered from scratch.
+    renderer.setCamera(&movedCamera);
+    for (int frame = 0; frame < 8; frame++)
+        renderer.render();
+    requireMatches(renderer.frameBuffer(), movedReference);
+
+    // Changing the settings discards the previous frame, also while interacting.
+    for (size_t i = 128; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i].a = 0.3f;
+    renderer.setConfig(config);
+    renderer.render();
+    requireMatches(renderer.frameBuffer(), renderReference(movedCamera));
+}
+
+TEST_CASE("Preintegrated Transfer Function Tests")
+{
+    // Segments of which the front and back are the same entry have the color of that entry, and segments through a
+    // constant transfer function the color of any of its entries.
+    std::array<glm::vec4, render::PreintegrationTable::size> tfColorMap;
+    for (size_t i = 0; i < tfColorMap.size(); i++)
+        tfColorMap[i] = glm::vec4(float(i) / 255.0f, 0.5f, 0.25f, i < 128 ? 0.2f : 0.0f);
+    render::PreintegrationTable table;
+    table.build(tfColorMap);
+    REQUIRE(table.lookup(7, 7) == tfColorMap[7]);
+    REQUIRE(table.lookup(200, 200) == tfColorMap[200]);
+    REQUIRE(table.lookup(10, 100).a == Approx(0.2f));
+    REQUIRE(table.lookup(100, 10).a == Approx(0.2f));
+    REQUIRE(table.lookup(150, 250) == glm::vec4(0.0f));
+
+    // A ramp along x (10 per voxel) and a transfer function with a single opaque entry that covers a quarter of a voxel
+    // (x in [32.5, 32.75)), between the samples of a ray along x.
+    const glm::ivec3 dim { 64, 4, 4 };
+    std::vector<float> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = 10.0f * float(i % size_t(dim.x));
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(1);
+    config.tfColorMap.fill(glm::vec4(0.0f));
+    config.tfColorMap[130] = glm::vec4(1.0f, 0.0f, 0.0f, 0.5f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 640.0f;
+    TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, nullptr, config };
+    const render::Ray ray { glm::vec3(-5.0f, 1.5f, 1.5f), glm::vec3(1.0f, 0.0f, 0.0f), 5.0f, 68.0f };
+
+    // Point samples miss the feature completely.
+    REQUIRE(renderer.test_traceRayComposite(ray, 1.0f) == glm::vec4(0.0f));
+
+    // Preintegrated segments capture it with the opacity of a quarter of a voxel, independent of the step size.
+    config.preintegrated = true;
+    renderer.setConfig(config);
+    const float expectedOpacity = 1.0f - std::pow(0.5f, 0.25f);
+    for (const float sampleStep : { 1.0f, 2.0f, 4.0f }) {
+        const glm::vec4 color = renderer.test_traceRayComposite(ray, sampleStep);
+        REQUIRE(color.a == Approx(expectedOpacity));
+        REQUIRE(color.r == Approx(expectedOpacity));
+        REQUIRE(color.g == Approx(0.0f));
+    }
+
+    // The table follows changes of the transfer function.
+    config.tfColorMap[130] = glm::vec4(0.0f, 1.0f, 0.0f, 0.5f);
+    renderer.setConfig(config);
+    REQUIRE(renderer.test_traceRayComposite(ray, 2.0f).g == Approx(expectedOpacity));
+}
+
+TEST_CASE("2D Transfer Function Table Tests")
+{
+    // A tent along the intensity axis that widens with the gradient magnitude.
+    const auto opacity = [](float intensity, float gradientMagnitude) {
+        return std::max(1.0f - std::abs(intensity - 100.0f) / (gradientMagnitude * 0.5f), 0.0f);
+    };
+    render::TransferFunction2DTable table;
+    table.build(glm::vec2(50.0f, 150.0f), glm::vec2(0.0f, 100.0f), opacity);
+
+    // Each bin holds the value at its center (100 / 256 wide along both axes).
+    const float binSize = 100.0f / float(render::TransferFunction2DTable::size);
+    for (const glm::vec2 bin : { glm::vec2(0, 0), glm::vec2(127, 200), glm::vec2(128, 255), glm::vec2(255, 255), glm::vec2(90, 31) }) {
+        const glm::vec2 center = (bin + 0.5f) * binSize + glm::vec2(50.0f, 0.0f);
+        REQUIRE(table.lookup(center.x, center.y) == opacity(center.x, center.y));
+        REQUIRE(table.lookup(center.x + 0.4f * binSize, center.y - 0.4f * binSize) == opacity(center.x, center.y));
+    }
+    // Zero outside of the ranges.
+    REQUIRE(table.lookup(49.9f, 80.0f) == 0.0f);
+    REQUIRE(table.lookup(150.0f, 80.0f) == 0.0f);
+    REQUIRE(table.lookup(100.0f, -1.0f) == 0.0f);
+    REQUIRE(table.lookup(100.0f, 100.0f) == 0.0f);
+
+    // An empty range is zero everywhere.
+    table.build(glm::vec2(100.0f, 100.0f), glm::vec2(0.0f, 100.0f), opacity);
+    REQUIRE(table.lookup(100.0f, 50.0f) == 0.0f);
+}
+
+TEST_CASE("Render Config Change Tests")
+{
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(4);
+    config.tfColorMap.fill(glm::vec4(0.0f));
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 256.0f;
+    config.TF2DIntensity = 100.0f;
+    config.TF2DRadius = 10.0f;
+    config.TF2DColor = glm::vec4(1.0f);
+    REQUIRE(!render::renderConfigChanges(config, config).image);
+
+    // Settings that the render mode does not use do not change the image.
+    const auto changesImage = [&](render::RenderMode renderMode, auto&& modify) {
+        render::RenderConfig previous = config;
+        previous.renderMode = renderMode;
+        render::RenderConfig next = previous;
+        modify(next);
+        return render::renderConfigChanges(previous, next).image;
+    };
+    REQUIRE(!changesImage(render::RenderMode::RenderComposite, [](auto& c) { c.isoValue += 1.0f; }));
+    REQUIRE(changesImage(render::RenderMode::RenderIso, [](auto& c) { c.isoValue += 1.0f; }));
+    REQUIRE(!changesImage(render::RenderMode::RenderMIP, [](auto& c) { c.tfColorMap[3].a = 1.0f; }));
+    REQUIRE(changesImage(render::RenderMode::RenderMIDA, [](auto& c) { c.tfColorMap[3].a = 1.0f; }));
+    REQUIRE(!changesImage(render::RenderMode::RenderComposite, [](auto& c) { c.TF2DRadius += 1.0f; }));
+    REQUIRE(changesImage(render::RenderMode::RenderTF2D, [](auto& c) { c.TF2DRadius += 1.0f; }));
+    REQUIRE(!changesImage(render::RenderMode::RenderComposite, [](auto& c) { c.ka += 0.1f; }));
+    REQUIRE(changesImage(render::RenderMode::RenderComposite, [](auto& c) { c.volumeShading = true; }));
+    REQUIRE(!changesImage(render::RenderMode::RenderSlicer, [](auto& c) { c.sampleStep = 2.0f; }));
+    REQUIRE(!changesImage(render::RenderMode::RenderComposite, [](auto& c) { c.levelOfDetail = true; c.interactive = true; }));
+    REQUIRE(changesImage(render::RenderMode::RenderMIP, [](auto& c) { c.renderMode = render::RenderMode::RenderIso; }));
+    REQUIRE(changesImage(render::RenderMode::RenderSlicer, [](auto& c) { c.renderResolution = glm::ivec2(8); }));
+    const render::RenderConfigChanges changes = render::renderConfigChanges(config, [&] { auto c = config; c.tfColorMapIndexRange = 128.0f; return c; }());
+    REQUIRE(changes.transferFunction1D);
+    REQUIRE(!changes.transferFunction2D);
+
+    // The renderer rebuilds its macro cell classification and tables once a render mode uses them, also if the
+    // transfer function was edited while another mode was active.
+    const glm::ivec3 dim { 16, 4, 4 };
+    std::vector<float> data(static_cast<size_t>(dim.x * dim.y * dim.z), 100.0f);
+    volume::Volume volume { std::move(data), dim };
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, nullptr, config };
+    const render::Ray ray { glm::vec3(-5.0f, 1.5f, 1.5f), glm::vec3(1.0f, 0.0f, 0.0f), 5.0f, 20.0f };
+    REQUIRE(renderer.test_traceRayComposite(ray, 1.0f) == glm::vec4(0.0f));
+
+    config.renderMode = render::RenderMode::RenderMIP;
+    renderer.setConfig(config);
+    config.tfColorMap[100] = glm::vec4(1.0f, 0.0f, 0.0f, 0.5f);
+    config.preintegrated = true;
+    renderer.setConfig(config);
+    config.renderMode = render::RenderMode::RenderComposite;
+    renderer.setConfig(config);
+    const glm::vec4 color = renderer.test_traceRayComposite(ray, 1.0f);
+    REQUIRE(color.a > 0.9f);
+    REQUIRE(color.r == Approx(color.a));
+}
+
+TEST_CASE("Analytic Iso Surface Tests")
+{
+    // A ball of radius 8 whose values fall off linearly from its center.
+    const glm::ivec3 dim { 24, 24, 24 };
+    const glm::vec3 center { 12.0f };
+    std::vector<float> data;
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                data.push_back(std::max(200.0f - 20.0f * glm::distance(glm::vec3(x, y, z), center), 0.0f));
+        }
+    }
+    volume::Volume volume { std::move(data), dim };
+    volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+
+    // All rays hit the ball, so the images only differ by where the rays hit the surface.
+    const TestCamera camera { glm::vec3(12.0f, 12.0f, 0.0f) };
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderIso;
+    config.renderResolution = glm::ivec2(8, 8);
+    config.isoValue = 40.0f;
+    config.volumeShading = true;
+    config.sampleStep = 0.02f;
+    const auto renderImage = [&](bool analytic, volume::InterpolationMode interpolationMode) {
+        volume.interpolationMode = gradientVolume.interpolationMode = interpolationMode;
+        render::RenderConfig renderConfig = config;
+        renderConfig.analyticIsoSurface = analytic;
+        render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, renderConfig };
+        renderer.render();
+        return std::vector<glm::vec4>(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+    };
+
+    // The surface found by marching with small steps matches the exact intersection.
+    const std::vector<glm::vec4> sampled = renderImage(false, volume::InterpolationMode::Linear);
+    const std::vector<glm::vec4> analytic = renderImage(true, volume::InterpolationMode::Linear);
+    for (size_t i = 0; i < sampled.size(); i++) {
+        REQUIRE(analytic[i] != glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+        REQUIRE(glm::all(glm::epsilonEqual(analytic[i], sampled[i], 0.02f)));
+    }
+
+    // Nearest neighbour interpolation has no trilinear interpolant, so it keeps marching.
+    REQUIRE(renderImage(true, volume::InterpolationMode::NearestNeighbour) == renderImage(false, volume::InterpolationMode::NearestNeighbour));
+
+    // A ray that starts inside the surface hits it immediately.
+    volume.interpolationMode = gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    config.volumeShading = false;
+    config.analyticIsoSurface = true;
+    TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+    const render::Ray ray { center, glm::vec3(1.0f, 0.0f, 0.0f), 0.0f, 11.0f };
+    REQUIRE(renderer.test_traceRayISO(ray, 1.0f) == glm::vec4(0.8f, 0.8f, 0.0f, 1.0f));
+    // A ray that passes the ball does not hit it.
+    const render::Ray missingRay { glm::vec3(0.0f, 1.0f, 1.0f), glm::vec3(1.0f, 0.0f, 0.0f), 0.0f, 23.0f };
+    REQUIRE(renderer.test_traceRayISO(missingRay, 1.0f) == glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+TEST_CASE("Iso Surface Buffer Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint8_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint8_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume::GradientVolume gradientVolume { volume };
+    volume.interpolationMode = gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderIso;
+    config.renderResolution = glm::ivec2(19, 13);
+    config.isoValue = 100.0f;
+    config.volumeShading = true;
+
+    // Only changes of the Phong constants keep the surface.
+    const auto shadingOnly = [&](auto&& modify) {
+        render::RenderConfig next = config;
+        modify(next);
+        return render::renderConfigChanges(config, next).shadingOnly;
+    };
+    REQUIRE(shadingOnly([](auto& c) { c.ka += 0.1f; c.alpha = 20.0f; }));
+    REQUIRE(!shadingOnly([](auto& c) { c.ka += 0.1f; c.isoValue += 1.0f; }));
+    REQUIRE(!shadingOnly([](auto& c) { c.ka += 0.1f; c.volumeShading = false; }));
+
+    const auto counter = [](const render::instrumentation::FrameRecord& record, render::instrumentation::Counter c) { return record.counters[size_t(c)]; };
+    for (const bool analytic : { false, true }) {
+        config.analyticIsoSurface = analytic;
+        render::RenderConfig cachedConfig = config;
+        cachedConfig.cacheIsoSurface = true;
+        render::Renderer reference { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+        render::Renderer cached { &volume, &gradientVolume, &macroCellGrid, &camera, cachedConfig };
+        const auto sameImages = [&]() {
+            reference.render();
+            cached.render();
+            return std::equal(std::begin(reference.frameBuffer()), std::end(reference.frameBuffer()), std::begin(cached.frameBuffer()));
+        };
+        REQUIRE(sameImages());
+
+        // Shading the cached surface with other Phong constants does not trace any rays.
+        config.ka = 0.3f;
+        config.alpha = 20.0f;
+        cachedConfig.ka = config.ka;
+        cachedConfig.alpha = config.alpha;
+        reference.setConfig(config);
+        cached.setConfig(cachedConfig);
+        reference.render();
+        render::instrumentation::collectFrame();
+        cached.render();
+        const render::instrumentation::FrameRecord shadingRecord = render::instrumentation::collectFrame();
+        REQUIRE(std::equal(std::begin(reference.frameBuffer()), std::end(reference.frameBuffer()), std::begin(cached.frameBuffer())));
+        if (render::instrumentation::enabled())
+            REQUIRE(counter(shadingRecord, render::instrumentation::Counter::RaysTraced) + counter(shadingRecord, render::instrumentation::Counter::RaysCulled) == 0);
+
+        // A different iso value moves the surface, so it is traced again.
+        config.isoValue = cachedConfig.isoValue = 120.0f;
+        reference.setConfig(config);
+        cached.setConfig(cachedConfig);
+        reference.render();
+        render::instrumentation::collectFrame();
+        cached.render();
+        const render::instrumentation::FrameRecord isoValueRecord = render::instrumentation::collectFrame();
+        REQUIRE(std::equal(std::begin(reference.frameBuffer()), std::end(reference.frameBuffer()), std::begin(cached.frameBuffer())));
+        if (render::instrumentation::enabled())
+            REQUIRE(counter(isoValueRecord, render::instrumentation::Counter::RaysTraced) > 0);
+
+        config.isoValue = 100.0f;
+        config.ka = render::RenderConfig {}.ka;
+        config.alpha = render::RenderConfig {}.alpha;
+    }
+}
+
+TEST_CASE("Fast Phong Shading Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint8_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint8_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume::GradientVolume gradientVolume { volume };
+    volume.interpolationMode = gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(19, 13);
+    config.volumeShading = true;
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, 0.1f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    // The headlight shortcut matches computePhongShading with V = -L, for any gradient magnitude (including zero).
+    const glm::vec3 color { 0.9f, 0.6f, 0.3f };
+    const glm::vec3 lightDirections[] = { glm::normalize(glm::vec3(0.2f, -0.3f, 1.0f)), glm::vec3(1.0f, 0.0f, 0.0f), glm::normalize(glm::vec3(-1.0f, 2.0f, 0.5f)) };
+    const glm::vec3 gradientDirections[] = { glm::normalize(glm::vec3(0.0f, 0.0f, -1.0f)), glm::normalize(glm::vec3(0.3f, 0.1f, -1.0f)), glm::normalize(glm::vec3(1.0f, 1.0f, 1.0f)), glm::vec3(0.0f, 1.0f, 0.0f) };
+    for (const float alpha : { 1.0f, 10.0f, 100.0f }) {
+        render::SpecularTable specularTable;
+        specularTable.build(alpha);
+        REQUIRE(specularTable.alpha() == alpha);
+        for (const float cosine : { 0.0f, 0.25f, 0.5f, 0.9f, 0.99f, 0.999f, 1.0f })
+            REQUIRE(std::abs(specularTable.lookup(cosine) - std::pow(cosine, alpha)) < 2e-3f);
+
+        for (const glm::vec3& L : lightDirections) {
+            for (const glm::vec3& direction : gradientDirections) {
+                for (const float magnitude : { 0.0f, 0.5f, 1.0f, 3.0f, 40.0f }) {
+                    const glm::vec3 g = magnitude * direction;
+                    const glm::vec3 expected = renderer.test_computePhongShading(color, volume::GradientVoxel { g, magnitude }, L, -L, 0.1f, 0.7f, 0.2f, alpha);
+                    const glm::vec3 actual = TestRenderer::test_computePhongShadingHeadlight(color, g, L, 0.1f, 0.7f, 0.2f, specularTable);
+                    REQUIRE(glm::all(glm::epsilonEqual(actual, expected, 2e-3f)));
+                }
+            }
+        }
+    }
+
+    // Rendering with fast shading gives (nearly) the same image.
+    renderer.render();
+    const std::vector<glm::vec4> reference(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+    render::RenderConfig fastConfig = config;
+    fastConfig.fastShading = true;
+    REQUIRE(render::renderConfigChanges(config, fastConfig).shadingOnly);
+    renderer.setConfig(fastConfig);
+    renderer.render();
+    const auto frameBuffer = renderer.frameBuffer();
+    for (size_t i = 0; i < reference.size(); i++)
+        REQUIRE(glm::all(glm::epsilonEqual(frameBuffer[i], reference[i], 1e-2f)));
+}
+
+TEST_CASE("Frame Buffer Pool Tests")
+{
+    // Switching back to a resolution that is in the pool returns its buffer, with its last image.
+    render::FrameBufferPool pool;
+    std::vector<glm::vec4> buffer;
+    pool.exchange(buffer, glm::ivec2(0), glm::ivec2(8, 4));
+    REQUIRE(buffer.size() == 32);
+    REQUIRE(std::all_of(std::begin(buffer), std::end(buffer), [](const glm::vec4& pixel) { return pixel == glm::vec4(0.0f); }));
+    buffer[0] = glm::vec4(1.0f);
+    const glm::vec4* pPixels = buffer.data();
+    pool.exchange(buffer, glm::ivec2(8, 4), glm::ivec2(4, 2));
+    REQUIRE(buffer.size() == 8);
+    REQUIRE(pool.size() == 1);
+    pool.exchange(buffer, glm::ivec2(4, 2), glm::ivec2(8, 4));
+    REQUIRE(buffer.data() == pPixels);
+    REQUIRE(buffer[0] == glm::vec4(1.0f));
+    REQUIRE(pool.numMisses() == 2);
+
+    // The least recently used buffer (4 x 2) is evicted when the pool is full.
+    glm::ivec2 resolution { 8, 4 };
+    for (int i = 1; i <= int(render::FrameBufferPool::capacity) + 1; i++) {
+        const glm::ivec2 next { 8 + i, 4 };
+        pool.exchange(buffer, resolution, next);
+        resolution = next;
+    }
+    REQUIRE(pool.size() == render::FrameBufferPool::capacity);
+    const size_t numMisses = pool.numMisses();
+    pool.exchange(buffer, resolution, glm::ivec2(4, 2));
+    REQUIRE(pool.numMisses() == numMisses + 1);
+}
+
+// Difference between two images: the peak signal to noise ratio (for a peak value of 1), the largest absolute
+// difference over all channels of all pixels, and the fraction of pixels that differ by more than maxPixelError in
+// any channel.
+struct ImageDifference {
+    double psnr;
+    float maxError;
+    double outlierFraction;
+};
+
+static ImageDifference compareImages(gsl::span<const glm::vec4> image, gsl::span<const glm::vec4> reference, float maxPixelError)
+{
+    double squaredError = 0.0;
+    float maxError = 0.0f;
+    size_t numOutliers = 0;
+    for (size_t i = 0; i < image.size(); i++) {
+        const glm::vec4 difference = glm::abs(image[i] - reference[i]);
+        squaredError += double(glm::dot(difference, difference));
+        maxError = std::max(maxError, glm::compMax(difference));
+        if (glm::compMax(difference) > maxPixelError)
+            numOutliers++;
+    }
+    const double numPixels = double(std::max(image.size(), size_t(1)));
+    const double meanSquaredError = squaredError / (4.0 * numPixels);
+    const double psnr = meanSquaredError > 0.0 ? 10.0 * std::log10(1.0 / meanSquaredError) : std::numeric_limits<double>::infinity();
+    return { psnr, maxError, double(numOutliers) / numPixels };
+}
+
+TEST_CASE("Multi-Volume Rendering Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint8_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    std::vector<uint16_t> channelData(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>((i * 7919) % 200);
+        channelData[i] = static_cast<uint16_t>((i * 104729) % 1000);
+    }
+    volume::Volume volume { std::move(data), dim };
+    volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    volume::Volume channelVolume { std::move(channelData), dim };
+    volume::GradientVolume channelGradientVolume { channelVolume };
+    const volume::MacroCellGrid channelMacroCellGrid { channelVolume };
+    volume.interpolationMode = gradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    channelVolume.interpolationMode = channelGradientVolume.interpolationMode = volume::InterpolationMode::Linear;
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(19, 13);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = i < 100 ? glm::vec4(0.0f) : glm::vec4(1.0f, 0.5f, 0.25f, 0.1f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+
+    const auto renderImage = [&](const render::RenderConfig& renderConfig, const volume::Volume& mainVolume, const volume::GradientVolume& mainGradientVolume,
+                            const volume::MacroCellGrid& mainMacroCellGrid, gsl::span<const render::VolumeChannel> channels) {
+        render::Renderer renderer { &mainVolume, &mainGradientVolume, &mainMacroCellGrid, &camera, renderConfig };
+        renderer.setChannels(channels);
+        renderer.render();
+        return std::vector<glm::vec4>(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()));
+    };
+    // The kernels do not give bit identical images for different settings: with FMA contraction a ray grazing a voxel
+    // may pick up a sample more or less. The images are compared like the regression images (see compareImages), with
+    // room for a couple of such pixels in these small images.
+    const auto sameImages = [](const std::vector<glm::vec4>& lhs, const std::vector<glm::vec4>& rhs) {
+        if (lhs.size() != rhs.size())
+            return false;
+        const ImageDifference difference = compareImages(lhs, rhs, 0.1f);
+        return difference.psnr >= 40.0 && difference.outlierFraction <= 0.01;
+    };
+
+    for (const bool volumeShading : { false, true }) {
+        config.volumeShading = volumeShading;
+        const std::vector<glm::vec4> reference = renderImage(config, volume, gradientVolume, macroCellGrid, {});
+
+        // A channel that is fully transparent does not change the image.
+        const render::VolumeChannel channel { &channelVolume, &channelGradientVolume, &channelMacroCellGrid };
+        render::RenderConfig channelConfig = config;
+        channelConfig.channelTransferFunctions[0].tfColorMap.fill(glm::vec4(0.0f));
+        channelConfig.channelTransferFunctions[0].tfColorMapIndexStart = 0.0f;
+        channelConfig.channelTransferFunctions[0].tfColorMapIndexRange = 1000.0f;
+        REQUIRE(sameImages(renderImage(channelConfig, volume, gradientVolume, macroCellGrid, { &channel, 1 }), reference));
+
+        // The same volume twice combines the opacities of both samples: (1 - a)^2 is transparent.
+        const render::VolumeChannel sameChannel { &volume, &gradientVolume, &macroCellGrid };
+        channelConfig.channelTransferFunctions[0] = { config.tfColorMap, config.tfColorMapIndexStart, config.tfColorMapIndexRange };
+        render::RenderConfig combinedConfig = config;
+        for (glm::vec4& entry : combinedConfig.tfColorMap)
+            entry.a = 1.0f - (1.0f - entry.a) * (1.0f - entry.a);
+        REQUIRE(sameImages(renderImage(channelConfig, volume, gradientVolume, macroCellGrid, { &sameChannel, 1 }), renderImage(combinedConfig, volume, gradientVolume, macroCellGrid, {})));
+
+        // Macro cells that are transparent in the main volume are not skipped if the channel is visible in them (here the
+        // main volume is transparent everywhere, so the image is that of the channel).
+        channelConfig.tfColorMap.fill(glm::vec4(0.0f));
+        for (size_t i = 0; i < channelConfig.channelTransferFunctions[0].tfColorMap.size(); i++)
+            channelConfig.channelTransferFunctions[0].tfColorMap[i] = i < 128 ? glm::vec4(0.0f) : glm::vec4(0.2f, 0.4f, 1.0f, 0.05f);
+        channelConfig.channelTransferFunctions[0].tfColorMapIndexRange = 1000.0f;
+        render::RenderConfig channelOnlyConfig = config;
+        channelOnlyConfig.tfColorMap = channelConfig.channelTransferFunctions[0].tfColorMap;
+        channelOnlyConfig.tfColorMapIndexRange = 1000.0f;
+        const std::vector<glm::vec4> channelImage = renderImage(channelConfig, volume, gradientVolume, macroCellGrid, { &channel, 1 });
+        REQUIRE(sameImages(channelImage, renderImage(channelOnlyConfig, channelVolume, channelGradientVolume, channelMacroCellGrid, {})));
+        REQUIRE(std::any_of(std::begin(channelImage), std::end(channelImage), [](const glm::vec4& pixel) { return pixel.a > 0.0f; }));
+
+        // Channels that were set in another render mode are part of the classification once Composite is selected.
+        render::RenderConfig mipConfig = channelConfig;
+        mipConfig.renderMode = render::RenderMode::RenderMIP;
+        render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, mipConfig };
+        renderer.setChannels({ &channel, 1 });
+        renderer.render();
+        renderer.setConfig(channelConfig);
+        renderer.render();
+        REQUIRE(sameImages(std::vector<glm::vec4>(std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer())), channelImage));
+    }
+}
+
+TEST_CASE("Ray Batch Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    const volume::Volume volume { std::vector<uint16_t>(static_cast<size_t>(dim.x * dim.y * dim.z), uint16_t(0)), dim };
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+    const TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, render::RenderConfig {} };
+    const render::Bounds bounds { glm::vec3(0.0f), glm::vec3(dim - 1) };
+
+    // Pixels across the whole screen, including an axis aligned ray (along which the slabs of the x- and y-axis are
+    // infinitely wide) and rays that miss the volume.
+    std::vector<glm::vec2> pixels;
+    for (int y = -4; y <= 4; y++) {
+        for (int x = -4; x <= 4; x++)
+            pixels.emplace_back(float(x) / 4.0f, float(y) / 4.0f);
+    }
+    std::vector<render::Ray> rays(pixels.size());
+    camera.generateRays(pixels, rays);
+    std::vector<uint8_t> hits(rays.size());
+    TestRenderer::test_intersectRaysVolumeBounds(gsl::span<render::Ray>(rays), bounds, gsl::span<uint8_t>(hits));
+
+    bool anyHit = false, anyMiss = false;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        render::Ray ray = camera.generateRay(pixels[i]);
+        REQUIRE(rays[i].origin == ray.origin);
+        REQUIRE(rays[i].direction == ray.direction);
+
+        const bool hit = renderer.test_instersectRayVolumeBounds(ray, bounds);
+        REQUIRE(bool(hits[i]) == hit);
+        if (hit) {
+            REQUIRE(rays[i].tmin == Approx(ray.tmin));
+            REQUIRE(rays[i].tmax == Approx(ray.tmax));
+        }
+        anyHit |= hit;
+        anyMiss |= !hit;
+    }
+    REQUIRE(anyHit);
+    REQUIRE(anyMiss);
+}
+
+TEST_CASE("Progressive Rendering Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    // Not a multiple of the block/packet sizes.
+    config.renderResolution = glm::ivec2(37, 29);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, 0.02f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    config.progressiveFrames = 4;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    renderer.render();
+    const auto frameBuffer = renderer.frameBuffer();
+    const std::vector<glm::vec4> reference { std::begin(frameBuffer), std::end(frameBuffer) };
+
+    // After the first 16 passes every pixel is rendered once with the same samples as render().
+    renderer.resetProgressive();
+    for (int pass = 0; pass < 16; pass++)
+        REQUIRE(renderer.renderProgressivePass());
+    REQUIRE(std::equal(std::begin(reference), std::end(reference), std::begin(renderer.frameBuffer())));
+
+    int passes = 16;
+    while (renderer.renderProgressivePass())
+        passes++;
+    REQUIRE(passes == 16 * config.progressiveFrames);
+    REQUIRE(renderer.progressiveConverged());
+
+    // The accumulated image is an average of jittered samples, so it should stay close to the reference.
+    for (size_t i = 0; i < reference.size(); i++)
+        REQUIRE(renderer.frameBuffer()[i].a == Approx(reference[i].a).margin(0.05f));
+
+    config.renderMode = render::RenderMode::RenderMIP;
+    renderer.setConfig(config);
+    REQUIRE(!renderer.progressiveConverged());
+}
+
+TEST_CASE("Tile Scheduler Tests")
+{
+    // Quadrants of the Z-order curve come one after the other.
+    const std::vector<glm::ivec2> tiles = render::mortonOrderTiles(glm::ivec2(4));
+    REQUIRE(tiles.size() == 16);
+    REQUIRE(tiles[0] == glm::ivec2(0, 0));
+    REQUIRE(tiles[1] == glm::ivec2(1, 0));
+    REQUIRE(tiles[2] == glm::ivec2(0, 1));
+    REQUIRE(tiles[3] == glm::ivec2(1, 1));
+    REQUIRE(tiles[4] == glm::ivec2(2, 0));
+    REQUIRE(tiles[15] == glm::ivec2(3, 3));
+
+    // Every pixel is rendered exactly once, also for grids that are not a multiple of the tile size.
+    const glm::ivec2 numPixels { 37, 21 };
+    for (const auto partitioner : { render::TilePartitioner::Auto, render::TilePartitioner::Simple, render::TilePartitioner::Affinity, render::TilePartitioner::Static }) {
+        for (const int tileSize : { 1, 8, 16, 64 }) {
+            render::TileScheduler scheduler { { glm::ivec2(tileSize), 2, partitioner } };
+            std::vector<std::atomic<int>> counts(size_t(numPixels.x * numPixels.y));
+            for (int frame = 0; frame < 2; frame++) {
+                scheduler.run(numPixels, [&](const glm::ivec2& begin, const glm::ivec2& end) {
+                    for (int y = begin.y; y < end.y; y++) {
+                        for (int x = begin.x; x < end.x; x++)
+                            counts[size_t(x + y * numPixels.x)]++;
+                    }
+                });
+            }
+            REQUIRE(std::all_of(std::begin(counts), std::end(counts), [](const std::atomic<int>& count) { return count == 2; }));
+        }
+    }
+
+    // The image does not depend on the tiles (up to the rounding differences between packets and single rays).
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(37, 29);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, 0.02f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+    renderer.render();
+    const std::vector<glm::vec4> reference { std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer()) };
+
+    renderer.setTileScheduling({ glm::ivec2(5), 3, render::TilePartitioner::Static });
+    renderer.render();
+    for (size_t i = 0; i < reference.size(); i++)
+        REQUIRE(renderer.frameBuffer()[i].a == Approx(reference[i].a).margin(1e-5f));
+
+    // Spreading the voxels over the NUMA nodes copies them.
+    const uint16_t* pVoxels = volume.data<uint16_t>().data();
+    const std::vector<uint16_t> voxels { std::begin(volume.data<uint16_t>()), std::end(volume.data<uint16_t>()) };
+    volume.spreadOverNumaNodes();
+    REQUIRE(volume.data<uint16_t>().data() != pVoxels);
+    REQUIRE(std::equal(std::begin(voxels), std::end(voxels), std::begin(volume.data<uint16_t>()), std::end(volume.data<uint16_t>())));
+}
+
+TEST_CASE("Instrumentation Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const TestCamera camera { glm::vec3(8.0f, 8.0f, -20.0f) };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(37, 29);
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, 0.5f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    config.earlyTerminationOpacity = 0.95f;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+    render::instrumentation::collectFrame();
+    renderer.render();
+    const render::instrumentation::FrameRecord record = render::instrumentation::collectFrame();
+    const auto counter = [&](render::instrumentation::Counter c) { return record.counters[size_t(c)]; };
+    if (!render::instrumentation::enabled()) {
+        // Nothing is counted in builds without instrumentation.
+        REQUIRE(std::all_of(std::begin(record.counters), std::end(record.counters), [](uint64_t value) { return value == 0; }));
+        return;
+    }
+
+    // Every pixel is either traced or culled, and the opaque transfer function terminates the rays early.
+    REQUIRE(counter(render::instrumentation::Counter::RaysTraced) + counter(render::instrumentation::Counter::RaysCulled) == 37 * 29);
+    REQUIRE(counter(render::instrumentation::Counter::RaysTraced) > 0);
+    REQUIRE(counter(render::instrumentation::Counter::Samples) >= counter(render::instrumentation::Counter::RaysTraced));
+    REQUIRE(counter(render::instrumentation::Counter::EarlyTerminations) > 0);
+    REQUIRE(record.stageTimes[size_t(render::instrumentation::Stage::RayMarching)].count() > 0.0);
+    // The counters start over after every collection.
+    REQUIRE(render::instrumentation::collectFrame().counters[size_t(render::instrumentation::Counter::Samples)] == 0);
+
+    // Collected frames and timed stages end up in the trace.
+    const std::filesystem::path traceFile = std::filesystem::temp_directory_path() / "volvis_instrumentation_test.json";
+    render::instrumentation::setTracing(true);
+    {
+        VOLVIS_SCOPED_STAGE(Upload);
+    }
+    render::instrumentation::collectFrame();
+    render::instrumentation::setTracing(false);
+    REQUIRE(render::instrumentation::writeTrace(traceFile));
+    std::ifstream ifs { traceFile };
+    const std::string trace { std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>() };
+    REQUIRE(trace.rfind("{\"traceEvents\":[", 0) == 0);
+    REQUIRE(trace.find("\"name\":\"Upload\",\"ph\":\"X\"") != std::string::npos);
+    REQUIRE(trace.find("\"name\":\"Samples\",\"ph\":\"C\"") != std::string::npos);
+    ifs.close();
+    std::filesystem::remove(traceFile);
+}
+
+TEST_CASE("Render Service Tests")
+{
+    const glm::ivec3 dim { 16, 16, 16 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderMIP;
+    config.renderResolution = glm::ivec2(37, 29);
+    const auto pCamera = std::make_shared<TestCamera>(glm::vec3(8.0f, 8.0f, -20.0f));
+
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, pCamera.get(), config };
+    renderer.render();
+    const auto frameBuffer = renderer.frameBuffer();
+    const std::vector<glm::vec4> reference { std::begin(frameBuffer), std::end(frameBuffer) };
+
+    render::RenderService renderService { &volume, &gradientVolume, &macroCellGrid, config };
+    REQUIRE(renderService.acquireFrame() == nullptr);
+
+    // Submitting many frames in a row cancels the outdated frames; the final frame is always delivered.
+    config.renderMode = render::RenderMode::RenderComposite;
+    for (int i = 0; i < 10; i++)
+        renderService.submit(pCamera, config, volume::InterpolationMode::NearestNeighbour);
+    config.renderMode = render::RenderMode::RenderMIP;
+    renderService.submit(pCamera, config, volume::InterpolationMode::Linear);
+
+    while (!renderService.idle())
+        std::this_thread::yield();
+    const render::RenderService::Frame* pFrame = renderService.acquireFrame();
+    REQUIRE(pFrame != nullptr);
+    REQUIRE(pFrame->resolution == config.renderResolution);
+    REQUIRE(std::equal(std::begin(reference), std::end(reference), std::begin(pFrame->pixels), std::end(pFrame->pixels)));
+    REQUIRE(renderService.acquireFrame() == nullptr);
+}
+
+TEST_CASE("Volume Pyramid Tests")
+{
+    const glm::ivec3 dim { 70, 40, 33 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    const volume::Volume volume { std::move(data), dim, volume::VoxelLayout::Bricked };
+    const volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const volume::VolumePyramid pyramid { volume, gradientVolume, macroCellGrid };
+
+    // 70 -> 35 -> 18 voxels along the largest axis.
+    REQUIRE(pyramid.numLevels() == 3);
+    REQUIRE(pyramid.level(0).pVolume == &volume);
+    const volume::PyramidLevel level1 = pyramid.level(1);
+    REQUIRE(level1.scale == 2.0f);
+    REQUIRE(level1.pVolume->dims() == glm::ivec3(35, 20, 17));
+    REQUIRE(level1.pVolume->layout() == volume::VoxelLayout::Bricked);
+    REQUIRE(pyramid.level(2).pVolume->dims() == glm::ivec3(18, 10, 9));
+    // Each voxel is the (rounded) average of the voxels that it covers; the last slice along z covers a single slice.
+    for (const glm::ivec3& voxel : { glm::ivec3(0), glm::ivec3(3, 4, 5), glm::ivec3(34, 19, 16) }) {
+        const glm::ivec3 begin = 2 * voxel;
+        const glm::ivec3 end = glm::min(begin + 2, dim);
+        float sum = 0.0f, count = 0.0f;
+        for (int z = begin.z; z < end.z; z++) {
+            for (int y = begin.y; y < end.y; y++) {
+                for (int x = begin.x; x < end.x; x++, count++)
+                    sum += volume.getVoxel(x, y, z);
+            }
+        }
+        REQUIRE(level1.pVolume->getVoxel(voxel.x, voxel.y, voxel.z) == std::floor(sum / count + 0.5f));
+    }
+    REQUIRE(volume::VolumePyramid::toLevelCoordinates(glm::vec3(0.5f), 2.0f) == glm::vec3(0.0f));
+    REQUIRE(volume::VolumePyramid::toLevelCoordinates(glm::vec3(5.5f), 4.0f) == glm::vec3(1.0f));
+
+    // A homogeneous volume is equally opaque at every level because the opacity is corrected for the voxel size (a volume
+    // of 32 voxels has no coarser level).
+    const volume::Volume homogeneous { std::vector<uint16_t>(64 * 64 * 64, 100), glm::ivec3(64) };
+    const volume::GradientVolume homogeneousGradient { homogeneous };
+    const volume::MacroCellGrid homogeneousCells { homogeneous };
+    const volume::VolumePyramid homogeneousPyramid { homogeneous, homogeneousGradient, homogeneousCells };
+    render::RenderConfig config {};
+    config.renderMode = render::RenderMode::RenderComposite;
+    config.renderResolution = glm::ivec2(1);
+    config.tfColorMap.fill(glm::vec4(1.0f, 1.0f, 1.0f, 0.1f));
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+
+    const volume::PyramidLevel coarse = homogeneousPyramid.level(1);
+    TestRenderer fineRenderer { &homogeneous, &homogeneousGradient, &homogeneousCells, nullptr, config };
+    TestRenderer coarseRenderer { coarse.pVolume, coarse.pGradientVolume, coarse.pMacroCellGrid, nullptr, config };
+    coarseRenderer.setLevelScale(coarse.scale);
+    // The same ray along the x-axis, in the coordinates of both levels.
+    render::Ray fineRay { glm::vec3(-5.0f, 31.5f, 31.5f), glm::vec3(1.0f, 0.0f, 0.0f), 5.0f, 68.0f };
+    render::Ray coarseRay { volume::VolumePyramid::toLevelCoordinates(fineRay.origin, coarse.scale), fineRay.direction, 2.75f, 33.75f };
+    const glm::vec4 fineColor = fineRenderer.test_traceRayComposite(fineRay, 1.0f);
+    const glm::vec4 coarseColor = coarseRenderer.test_traceRayComposite(coarseRay, 1.0f);
+    REQUIRE(fineColor.a == Approx(1.0f - std::pow(0.9f, 64.0f)));
+    REQUIRE(coarseColor.a == Approx(fineColor.a));
+}
+
+TEST_CASE("Out Of Core Tests")
+{
+    const glm::ivec3 dim { 70, 40, 33 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume inCore { std::move(data), dim, volume::VoxelLayout::Bricked };
+    const volume::GradientVolume inCoreGradient { inCore };
+    const volume::MacroCellGrid inCoreCells { inCore };
+
+    const auto file = std::filesystem::temp_directory_path() / "volvis_brick_test.bvol";
+    volume::writeBrickFile(inCore, inCoreGradient, file, 16);
+    {
+        volume::Volume streamed { file };
+        volume::BrickCache& brickCache = *streamed.brickCache();
+        REQUIRE(streamed.dims() == dim);
+        REQUIRE(streamed.voxelType() == volume::VoxelType::UInt16);
+        REQUIRE(streamed.minimum() == inCore.minimum());
+        REQUIRE(streamed.maximum() == inCore.maximum());
+        REQUIRE(streamed.histogram() == inCore.histogram());
+        // 70 -> 35 -> 18 -> 9 voxels along the largest axis.
+        REQUIRE(brickCache.coarseScale() == 8.0f);
+        REQUIRE(brickCache.coarseVolume().dims() == glm::ivec3(9, 5, 5));
+        REQUIRE(brickCache.brickDims() == glm::ivec3(3, 2, 2));
+
+        // The gradients are computed on the fly, with the magnitude range of the file.
+        const volume::GradientVolume streamedGradient { streamed };
+        REQUIRE(streamedGradient.encoding() == volume::GradientEncoding::OnTheFly);
+        REQUIRE(streamedGradient.maxMagnitude() == inCoreGradient.maxMagnitude());
+
+        // The macro cells are derived from the brick ranges, which are conservative.
+        const volume::MacroCellGrid streamedCells { streamed };
+        REQUIRE(streamedCells.dims() == inCoreCells.dims());
+        for (size_t i = 0; i < inCoreCells.numCells(); i++) {
+            const glm::ivec3 cell { int(i) % inCoreCells.dims().x, (int(i) / inCoreCells.dims().x) % inCoreCells.dims().y, int(i) / (inCoreCells.dims().x * inCoreCells.dims().y) };
+            REQUIRE(streamedCells.getCell(cell).minimum <= inCoreCells.getCell(cell).minimum);
+            REQUIRE(streamedCells.getCell(cell).maximum >= inCoreCells.getCell(cell).maximum);
+        }
+
+        // Nothing is resident yet, so the first sample is taken from the coarse copy.
+        const glm::vec3 coord { 40.3f, 20.7f, 10.1f };
+        const float coarseSample = brickCache.coarseVolume().getSampleInterpolate<volume::InterpolationMode::Linear, uint16_t>(volume::VolumePyramid::toLevelCoordinates(coord, 8.0f));
+        streamed.interpolationMode = volume::InterpolationMode::Linear;
+        REQUIRE(brickCache.residentBytes() == 0);
+        REQUIRE(streamed.getSampleInterpolate(coord) == Approx(coarseSample));
+        REQUIRE(brickCache.takeMissed());
+
+        // Once all bricks are resident the samples match the in-core volume (including the border of the volume).
+        std::vector<size_t> bricks(brickCache.numBricks());
+        for (size_t i = 0; i < bricks.size(); i++)
+            bricks[i] = i;
+        brickCache.prefetch(bricks);
+        brickCache.waitUntilIdle();
+        for (const auto interpolationMode : { volume::InterpolationMode::NearestNeighbour, volume::InterpolationMode::Linear, volume::InterpolationMode::Cubic }) {
+            streamed.interpolationMode = interpolationMode;
+            inCore.interpolationMode = interpolationMode;
+            for (const glm::vec3& position : { coord, glm::vec3(0.0f), glm::vec3(31.5f, 31.9f, 32.2f), glm::vec3(68.9f, 38.2f, 31.7f), glm::vec3(63.0f, 1.5f, 30.0f) })
+                REQUIRE(streamed.getSampleInterpolate(position) == Approx(inCore.getSampleInterpolate(position)));
+        }
+        REQUIRE(streamed.getVoxel(69, 39, 32) == inCore.getVoxel(69, 39, 32));
+        REQUIRE(streamedGradient.getGradient(33, 20, 16).magnitude == Approx(inCoreGradient.getGradient(33, 20, 16).magnitude));
+        REQUIRE_FALSE(brickCache.takeMissed());
+    }
+
+    {
+        // Evict the least recently used bricks once the budget of two bricks is exceeded.
+        const size_t brickBytes = size_t(volume::BrickCache::paddedSize * volume::BrickCache::paddedSize * volume::BrickCache::paddedSize) * sizeof(uint16_t);
+        volume::BrickCache brickCache { file, 2 * brickBytes };
+        for (size_t brick = 0; brick < 4; brick++)
+            REQUIRE(brickCache.brick<uint16_t>(brick) == nullptr);
+        brickCache.waitUntilIdle();
+        // Bricks that samples need are loaded regardless of the budget.
+        REQUIRE(brickCache.residentBytes() == 4 * brickBytes);
+        brickCache.beginFrame();
+        REQUIRE(brickCache.residentBytes() == 2 * brickBytes);
+        REQUIRE(brickCache.brick<uint16_t>(2) != nullptr);
+        REQUIRE(brickCache.brick<uint16_t>(5) == nullptr);
+        brickCache.waitUntilIdle();
+        brickCache.beginFrame();
+        // Brick 3 was not used in the previous frame.
+        REQUIRE(brickCache.residentBytes() == 2 * brickBytes);
+        REQUIRE(brickCache.brick<uint16_t>(2) != nullptr);
+        REQUIRE(brickCache.brick<uint16_t>(5) != nullptr);
+        REQUIRE(brickCache.brick<uint16_t>(3) == nullptr);
+        brickCache.waitUntilIdle();
+    }
+    std::filesystem::remove(file);
+}
+
+TEST_CASE("Compressed Volume Tests")
+{
+    // A smooth volume with noise and a homogeneous region, with dimensions that are not a multiple of the block size.
+    const glm::ivec3 dim { 37, 20, 18 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    std::vector<float> floatData(data.size());
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++) {
+                const size_t i = static_cast<size_t>(x + dim.x * (y + dim.y * z));
+                data[i] = x < 16 ? 0 : static_cast<uint16_t>(static_cast<size_t>(1000 + 20 * x + 3 * y + z) + (i * 7919) % 5);
+                floatData[i] = std::sin(float(x) * 0.3f) * float(y) - 0.5f * float(z);
+            }
+        }
+    }
+    const volume::Volume volume { data, dim };
+    const volume::Volume floatVolume { floatData, dim };
+
+    const auto file = std::filesystem::temp_directory_path() / "volvis_compressed_test.cvol";
+    SECTION("Lossless")
+    {
+        volume::writeCompressedVolume(volume, file);
+        REQUIRE(std::filesystem::file_size(file) < data.size() * sizeof(uint16_t) / 2);
+        const volume::Volume decompressed { file, volume::VoxelLayout::Bricked };
+        REQUIRE(decompressed.dims() == dim);
+        REQUIRE(decompressed.voxelType() == volume::VoxelType::UInt16);
+        REQUIRE(decompressed.histogram() == volume.histogram());
+        for (int z = 0; z < dim.z; z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++)
+                    REQUIRE(decompressed.getVoxel(x, y, z) == volume.getVoxel(x, y, z));
+            }
+        }
+
+        // Float voxels are coded as their bit patterns, so they are reproduced exactly as well.
+        volume::writeCompressedVolume(floatVolume, file);
+        const volume::Volume decompressedFloat { file };
+        REQUIRE(decompressedFloat.voxelType() == volume::VoxelType::Float);
+        REQUIRE(std::equal(std::begin(floatData), std::end(floatData), std::begin(decompressedFloat.data<float>()), std::end(decompressedFloat.data<float>())));
+    }
+    SECTION("Quantized")
+    {
+        volume::writeCompressedVolume(volume, file, volume::VolumeCompression::Quantized, 4);
+        const volume::Volume decompressed { file };
+        REQUIRE(decompressed.voxelType() == volume::VoxelType::UInt16);
+        // The error is at most half a quantization step of the range of a group (less than 1000 here), plus rounding
+        // to an integer.
+        float maxError = 0.0f;
+        for (size_t i = 0; i < data.size(); i++)
+            maxError = std::max(maxError, std::abs(decompressed.data<uint16_t>()[i] - float(data[i])));
+        REQUIRE(maxError <= 0.5f * 1000.0f / 15.0f + 0.5f);
+        // The homogeneous region stays exact.
+        REQUIRE(decompressed.getVoxel(3, 4, 5) == 0.0f);
+    }
+    std::filesystem::remove(file);
+
+    // Invalid files are rejected.
+    const std::vector<std::byte> garbage(100, std::byte { 1 });
+    REQUIRE_THROWS_AS(volume::CompressedVolume(garbage), std::runtime_error);
+}
+
+TEST_CASE("Volume Sequence Tests")
+{
+    const glm::ivec3 dim { 8, 6, 5 };
+    const size_t voxelCount = size_t(dim.x * dim.y * dim.z);
+    const auto expectedVoxel = [](size_t i, size_t timestep) { return float((i * 37 + timestep * 11) % 256); };
+    const auto directory = std::filesystem::temp_directory_path() / "volvis_sequence_test";
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory);
+    const auto writeVolume = [&](const std::filesystem::path& file, const glm::ivec3& volumeDim, size_t timestep) {
+        std::ofstream ofs { file, std::ios::binary };
+        ofs << "# AVS field file\nndim=3\ndim1=" << volumeDim.x << "\ndim2=" << volumeDim.y << "\ndim3=" << volumeDim.z
+            << "\nnspace=3\nveclen=1\ndata=byte\nfield=uniform\n\f\f";
+        for (size_t i = 0; i < size_t(volumeDim.x * volumeDim.y * volumeDim.z); i++)
+            ofs.put(char(expectedVoxel(i, timestep)));
+    };
+    // Four timesteps, followed by one with other dimensions (which is skipped) and a file that is not a volume.
+    constexpr size_t numTimesteps = 4;
+    for (size_t timestep = 0; timestep < numTimesteps; timestep++)
+        writeVolume(directory / ("t" + std::to_string(timestep) + ".fld"), dim, timestep);
+    writeVolume(directory / "t4.fld", dim + 1, numTimesteps);
+    std::ofstream(directory / "readme.txt") << "not a volume";
+
+    const std::vector<std::filesystem::path> files = volume::VolumeSequence::findTimesteps(directory);
+    REQUIRE(files.size() == numTimesteps + 1);
+    for (size_t timestep = 0; timestep < files.size(); timestep++)
+        REQUIRE(files[timestep].filename() == "t" + std::to_string(timestep) + ".fld");
+    REQUIRE_THROWS_AS(volume::VolumeSequence(std::vector<std::filesystem::path> {}), std::runtime_error);
+
+    {
+        // The budget fits two timesteps: the current one and the next one.
+        const size_t timestepBytes = voxelCount * (sizeof(uint8_t) + sizeof(volume::GradientVoxel));
+        volume::VolumeSequence sequence { files, 2 * timestepBytes };
+        REQUIRE(sequence.numTimesteps() == numTimesteps + 1);
+        REQUIRE(sequence.current()->sizeInBytes() == timestepBytes);
+
+        // Playback wraps around and skips the timestep that could not be loaded. A timestep stays valid while it is
+        // held, even after it was evicted.
+        for (size_t step = 0; step < 3 * numTimesteps; step++) {
+            sequence.waitUntilIdle();
+            REQUIRE(sequence.residentTimesteps() <= 2);
+            REQUIRE(sequence.residentBytes() <= 2 * timestepBytes);
+            REQUIRE(sequence.currentIndex() == step % numTimesteps);
+
+            const std::shared_ptr<volume::Timestep> pTimestep = sequence.current();
+            REQUIRE(pTimestep->volume.dims() == dim);
+            REQUIRE(sequence.advance());
+            for (size_t i = 0; i < voxelCount; i++)
+                REQUIRE(pTimestep->volume.data<uint8_t>()[i] == expectedVoxel(i, step % numTimesteps));
+        }
+
+        // Swapping the volume of a renderer gives the same image as a new renderer, and so does swapping the timestep of
+        // the render service.
+        sequence.waitUntilIdle();
+        const std::shared_ptr<volume::Timestep> pTimestep0 = sequence.current();
+        REQUIRE(sequence.advance());
+        sequence.waitUntilIdle();
+        const std::shared_ptr<volume::Timestep> pTimestep1 = sequence.current();
+
+        render::RenderConfig config {};
+        config.renderMode = render::RenderMode::RenderComposite;
+        config.renderResolution = glm::ivec2(17, 11);
+        for (size_t i = 0; i < config.tfColorMap.size(); i++)
+            config.tfColorMap[i] = glm::vec4(1.0f, 0.5f, 0.25f, float(i) / 1024.0f);
+        config.tfColorMapIndexRange = 256.0f;
+        const auto pCamera = std::make_shared<TestCamera>(glm::vec3(4.0f, 3.0f, -10.0f));
+
+        render::Renderer reference { &pTimestep1->volume, &pTimestep1->gradientVolume, &pTimestep1->macroCellGrid, pCamera.get(), config };
+        reference.render();
+        const std::vector<glm::vec4> referenceImage { std::begin(reference.frameBuffer()), std::end(reference.frameBuffer()) };
+
+        render::Renderer renderer { &pTimestep0->volume, &pTimestep0->gradientVolume, &pTimestep0->macroCellGrid, pCamera.get(), config };
+        renderer.render();
+        renderer.setVolume(&pTimestep1->volume, &pTimestep1->gradientVolume, &pTimestep1->macroCellGrid);
+        renderer.render();
+        REQUIRE(std::equal(std::begin(referenceImage), std::end(referenceImage), std::begin(renderer.frameBuffer()), std::end(renderer.frameBuffer())));
+
+        render::RenderService renderService { &pTimestep0->volume, &pTimestep0->gradientVolume, &pTimestep0->macroCellGrid, config };
+        renderService.submit(pCamera, config, volume::InterpolationMode::NearestNeighbour);
+        renderService.setTimestep(pTimestep1);
+        while (!renderService.idle())
+            std::this_thread::yield();
+        const render::RenderService::Frame* pFrame = renderService.acquireFrame();
+        REQUIRE(pFrame != nullptr);
+        REQUIRE(std::equal(std::begin(referenceImage), std::end(referenceImage), std::begin(pFrame->pixels), std::end(pFrame->pixels)));
+    }
+
+    // The statistics caches that loading wrote next to the volumes are not timesteps.
+    REQUIRE(volume::VolumeSequence::findTimesteps(directory).size() == numTimesteps + 1);
+    std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Distributed Rendering Tests")
+{
+    const glm::ivec3 dim { 24, 17, 20 };
+    std::vector<uint16_t> data(static_cast<size_t>(dim.x * dim.y * dim.z));
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = static_cast<uint16_t>((i * 7919) % 200);
+    volume::Volume volume { std::move(data), dim };
+    volume.interpolationMode = volume::InterpolationMode::Linear;
+    volume::GradientVolume gradientVolume { volume };
+    const volume::MacroCellGrid macroCellGrid { volume };
+    const auto pCamera = std::make_shared<TestCamera>(glm::vec3(13.0f, 7.0f, -25.0f));
+
+    render::RenderConfig config {};
+    config.renderResolution = glm::ivec2(37, 29);
+    // Low opacity, such that no ray terminates early.
+    for (size_t i = 0; i < config.tfColorMap.size(); i++)
+        config.tfColorMap[i] = glm::vec4(float(i) / float(config.tfColorMap.size()), 0.5f, 0.25f, 0.01f);
+    config.tfColorMapIndexStart = 0.0f;
+    config.tfColorMapIndexRange = 200.0f;
+    render::Renderer renderer { &volume, &gradientVolume, &macroCellGrid, pCamera.get(), config };
+
+    for (const int numWorkers : { 1, 2, 3, 4, 8 }) {
+        render::DistributedRenderer distributedRenderer { volume, numWorkers, config };
+        REQUIRE(distributedRenderer.numWorkers() == numWorkers);
+
+        // The regions cover the volume.
+        for (int z = 0; z < dim.z; z++) {
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++) {
+                    bool covered = false;
+                    for (int worker = 0; worker < numWorkers; worker++) {
+                        const render::SubvolumeRegion region = distributedRenderer.region(worker);
+                        covered |= glm::all(glm::greaterThanEqual(glm::ivec3(x, y, z), region.lower)) && glm::all(glm::lessThanEqual(glm::ivec3(x, y, z), region.upper));
+                    }
+                    REQUIRE(covered);
+                }
+            }
+        }
+
+        // Compositing the partial images gives the image of the whole volume.
+        distributedRenderer.setCamera(pCamera.get());
+        distributedRenderer.setInterpolationMode(volume::InterpolationMode::Linear);
+        for (const auto renderMode : { render::RenderMode::RenderComposite, render::RenderMode::RenderMIP }) {
+            config.renderMode = renderMode;
+            renderer.setConfig(config);
+            renderer.render();
+            distributedRenderer.setConfig(config);
+            distributedRenderer.render();
+            for (size_t i = 0; i < renderer.frameBuffer().size(); i++)
+                REQUIRE(glm::all(glm::epsilonEqual(distributedRenderer.frameBuffer()[i], renderer.frameBuffer()[i], 1e-3f)));
+        }
+    }
+
+    // The render service hands distributed frames to the user interface like any other frame.
+    config.renderMode = render::RenderMode::RenderMIP;
+    renderer.setConfig(config);
+    renderer.render();
+    config.distributedWorkers = 4;
+    render::RenderService renderService { &volume, &gradientVolume, &macroCellGrid, config };
+    renderService.submit(pCamera, config, volume::InterpolationMode::Linear);
+    while (!renderService.idle())
+        std::this_thread::yield();
+    const render::RenderService::Frame* pFrame = renderService.acquireFrame();
+    REQUIRE(pFrame != nullptr);
+    for (size_t i = 0; i < pFrame->pixels.size(); i++)
+        REQUIRE(glm::all(glm::epsilonEqual(pFrame->pixels[i], renderer.frameBuffer()[i], 1e-3f)));
+}
+
+// Reference images are stored as a one line text header followed by the raw RGBA floats of the pixels.
+static void writeReferenceImage(const std::filesystem::path& file, const glm::ivec2& resolution, gsl::span<const glm::vec4> pixels)
+{
+    std::filesystem::create_directories(file.parent_path());
+    std::ofstream ofs { file, std::ios::binary };
+    ofs << "volvis-reference " << resolution.x << " " << resolution.y << "\n";
+    ofs.write(reinterpret_cast<const char*>(pixels.data()), std::streamsize(pixels.size_bytes()));
+}
+
+// Returns nothing if the file does not exist or is not a reference image of the given resolution.
+static std::optional<std::vector<glm::vec4>> readReferenceImage(const std::filesystem::path& file, const glm::ivec2& resolution)
+{
+    std::ifstream ifs { file, std::ios::binary };
+    std::string header;
+    glm::ivec2 fileResolution;
+    if (!(ifs >> header >> fileResolution.x >> fileResolution.y) || header != "volvis-reference" || fileResolution != resolution || ifs.get() != '\n')
+        return std::nullopt;
+    std::vector<glm::vec4> pixels(size_t(resolution.x) * size_t(resolution.y));
+    if (!ifs.read(reinterpret_cast<char*>(pixels.data()), std::streamsize(pixels.size() * sizeof(glm::vec4))))
+        return std::nullopt;
+    return pixels;
+}
+
+// Image of the current render mode with one ray per pixel (the same rays as render()), traced by calling the ray
+// marching kernels directly. The renderer should have rendered a frame with the current settings, which sets up the
+// per frame state that the kernels read.
+static std::vector<glm::vec4> traceKernelImage(TestRenderer& renderer, const render::RayTraceCamera& camera, const render::RenderConfig& config, const glm::ivec3& dims)
+{
+    const render::Bounds bounds { glm::vec3(0.0f), glm::vec3(dims - 1) };
+    const glm::vec3 planeNormal = -glm::normalize(camera.forward());
+    const glm::vec3 volumeCenter = glm::vec3(dims) / 2.0f;
+    std::vector<glm::vec4> out(size_t(config.renderResolution.x) * size_t(config.renderResolution.y), glm::vec4(0.0f));
+    for (int y = 0; y < config.renderResolution.y; y++) {
+        for (int x = 0; x < config.renderResolution.x; x++) {
+            const glm::vec2 pixelPos = glm::vec2(x, y) / glm::vec2(config.renderResolution);
+            render::Ray ray = camera.generateRay(pixelPos * 2.0f - 1.0f);
+            if (!renderer.test_instersectRayVolumeBounds(ray, bounds))
+                continue;
+
+            glm::vec4& color = out[size_t(config.renderResolution.x * y + x)];
+            switch (config.renderMode) {
+            case render::RenderMode::RenderSlicer:
+                color = renderer.test_traceRaySlice(ray, volumeCenter, planeNormal);
+                break;
+            case render::RenderMode::RenderMIP:
+                color = renderer.test_traceRayMIP(ray, config.sampleStep);
+                break;
+            case render::RenderMode::RenderIso:
+                color = renderer.test_traceRayISO(ray, config.sampleStep);
+                break;
+            case render::RenderMode::RenderComposite:
+                color = renderer.test_traceRayComposite(ray, config.sampleStep);
+                break;
+            case render::RenderMode::RenderTF2D:
+                color = renderer.test_traceRayTF2D(ray, config.sampleStep);
+                break;
+            case render::RenderMode::RenderMIDA:
+                color = renderer.test_traceRayMIDA(ray, config.sampleStep);
+                break;
+            case render::RenderMode::RenderCombined:
+                color = renderer.test_traceRayCombined(ray, config.sampleStep);
+                break;
+            }
+        }
+    }
+    return out;
+}
+
+// Copy of a volume file in the temporary directory, such that caches written next to it stay out of the source tree.
+// The copy is kept (the volume may still map it) and overwritten by the next run.
+static std::filesystem::path temporaryVolumeCopy(const std::filesystem::path& file)
+{
+    const std::filesystem::path out = std::filesystem::temp_directory_path() / ("volvis_" + file.filename().string());
+    std::filesystem::copy_file(file, out, std::filesystem::copy_options::overwrite_existing);
+    return out;
+}
+
+// Golden image regression test: the scans that ship with the viewer are rendered in every render mode and compared
+// against the reference images in integrity_tests/references. The references of the default settings (linear
+// interpolation, float gradients, linear voxel layout) were rendered by the renderer of the original tree, before any
+// of the optimizations, so the test shows that the optimized kernels keep its images. Settings that are meant to give
+// the same images (bricked layout, quantized gradients, adaptive sampling) are compared against those references too;
+// cubic interpolation, which the original renderer did not implement, has references of its own that only guard
+// against later changes. A missing reference fails the test; after an intentional change of the images, run the test
+// with the environment variable VOLVIS_UPDATE_REFERENCES set to record them again from the current kernels (and commit
+// them). Files are found relative to the working directory, so run the tests from the root of the repository.
+TEST_CASE("Image Regression Tests")
+{
+    // Optimizations may reorder floating point operations, but should not visibly change the images. The reference
+    // images may have been recorded with a different compiler (or with/without FMA contraction), which can flip
+    // whether a ray grazing a feature picks it up; a handful of such pixels is tolerated.
+    static constexpr double minPSNR = 40.0;
+    static constexpr float maxPixelError = 0.1f;
+    static constexpr double maxOutlierFraction = 0.002;
+    const std::filesystem::path referenceDirectory { "integrity_tests/references" };
+    const bool updateReferences = std::getenv("VOLVIS_UPDATE_REFERENCES") != nullptr;
+
+    const std::pair<render::RenderMode, const char*> renderModes[] = {
+        { render::RenderMode::RenderSlicer, "slicer" }, { render::RenderMode::RenderMIP, "mip" },
+        { render::RenderMode::RenderIso, "iso" }, { render::RenderMode::RenderComposite, "composite" },
+        { render::RenderMode::RenderTF2D, "tf2d" }, { render::RenderMode::RenderMIDA, "mida" },
+        { render::RenderMode::RenderCombined, "combined" }
+    };
+    struct Variant {
+        std::string name;
+        volume::VoxelLayout layout;
+        volume::GradientEncoding gradientEncoding;
+        volume::InterpolationMode interpolationMode;
+        bool adaptiveSampling;
+        // Compared against references of its own instead of those of the default settings.
+        bool ownReferences;
+    };
+    const Variant variants[] = {
+        { "default", volume::VoxelLayout::Linear, volume::GradientEncoding::Float, volume::InterpolationMode::Linear, false, false },
+        { "bricked", volume::VoxelLayout::Bricked, volume::GradientEncoding::Float, volume::InterpolationMode::Linear, false, false },
+        { "quantized", volume::VoxelLayout::Linear, volume::GradientEncoding::Quantized, volume::InterpolationMode::Linear, false, false },
+        { "adaptive", volume::VoxelLayout::Linear, volume::GradientEncoding::Float, volume::InterpolationMode::Linear, true, false },
+        { "cubic", volume::VoxelLayout::Linear, volume::GradientEncoding::Float, volume::InterpolationMode::Cubic, false, true }
+    };
+    for (const char* fileName : { "resources/carp8.fld", "resources/pig8.fld" }) {
+        INFO("Run the tests from the root of the repository");
+        REQUIRE(std::filesystem::exists(fileName));
+        const std::filesystem::path volumeFile = temporaryVolumeCopy(fileName);
+
+        for (const Variant& variant : variants) {
+            volume::Volume volume { volumeFile, variant.layout };
+            volume.interpolationMode = variant.interpolationMode;
+            volume::GradientVolume gradientVolume { volume, variant.gradientEncoding };
+            gradientVolume.interpolationMode = variant.interpolationMode;
+            const volume::MacroCellGrid macroCellGrid { volume };
+            const glm::ivec3 dims = volume.dims();
+            // In front of the volume, far enough away to see all of it.
+            const TestCamera camera { glm::vec3(float(dims.x) / 2.0f, float(dims.y) / 2.0f, -float(std::max(dims.x, dims.y))) };
+
+            // Shading is enabled so that the images also depend on the gradients.
+            render::RenderConfig config {};
+            config.renderResolution = glm::ivec2(96);
+            config.volumeShading = true;
+            config.adaptiveSampling = variant.adaptiveSampling;
+            for (size_t i = 0; i < config.tfColorMap.size(); i++) {
+                const float value = float(i) / float(config.tfColorMap.size());
+                config.tfColorMap[i] = glm::vec4(value, 0.5f, 1.0f - value, value < 0.2f ? 0.0f : value * 0.05f);
+            }
+            config.tfColorMapIndexStart = volume.minimum();
+            config.tfColorMapIndexRange = volume.maximum() - volume.minimum();
+            config.isoValue = 0.4f * volume.maximum();
+            config.TF2DIntensity = 0.5f * volume.maximum();
+            config.TF2DRadius = 0.2f * volume.maximum();
+            config.TF2DColor = glm::vec4(0.0f, 0.8f, 0.6f, 0.3f);
+            TestRenderer renderer { &volume, &gradientVolume, &macroCellGrid, &camera, config };
+
+            for (const auto& [renderMode, modeName] : renderModes) {
+                const std::string imageName = std::filesystem::path(fileName).stem().string() + "_" + modeName;
+                INFO(imageName << " (" << variant.name << ")");
+                config.renderMode = renderMode;
+                renderer.setConfig(config);
+                renderer.render();
+                const std::vector<glm::vec4> image = traceKernelImage(renderer, camera, config, dims);
+
+                // The fast paths of render() (packets of rays, empty space skipping) give the image of the kernels.
+                const ImageDifference renderDifference = compareImages(renderer.frameBuffer(), image, maxPixelError);
+                REQUIRE(renderDifference.psnr >= minPSNR);
+                REQUIRE(renderDifference.outlierFraction <= maxOutlierFraction);
+
+                const std::filesystem::path referenceFile = referenceDirectory / (imageName + (variant.ownReferences ? "_" + variant.name : "") + ".ref");
+                if (updateReferences) {
+                    // The other variants are compared against the references of the default settings.
+                    if (variant.ownReferences || &variant == &variants[0]) {
+                        writeReferenceImage(referenceFile, config.renderResolution, image);
+                        WARN("Recorded reference image " << referenceFile);
+                    }
+                    continue;
+                }
+                const std::optional<std::vector<glm::vec4>> optReference = readReferenceImage(referenceFile, config.renderResolution);
+                INFO("Reference image " << referenceFile);
+                REQUIRE(optReference);
+                const ImageDifference referenceDifference = compareImages(image, *optReference, maxPixelError);
+                REQUIRE(referenceDifference.psnr >= minPSNR);
+                REQUIRE(referenceDifference.outlierFraction <= maxOutlierFraction);
+            }
+        }
+    }
+}
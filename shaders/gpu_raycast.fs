@@ -0,0 +1,287 @@
+#version 330
+// Ray casting on the GPU (see ui::GPURenderer). Every fragment traces the ray of one pixel with the same rays,
+// classification and compositing as the CPU kernels of render::Renderer, without their acceleration structures
+// (empty space skipping, adaptive sampling) which the GPU does not need to reach interactive rates.
+layout(location = 0) out vec4 o_fragColor;
+
+// Same values as render::RenderMode.
+const int RenderSlicer = 0;
+const int RenderMIP = 1;
+const int RenderIso = 2;
+const int RenderComposite = 3;
+const int RenderTF2D = 4;
+const int RenderMIDA = 5;
+const int RenderCombined = 6;
+
+// Camera (see render::ScreenProjection).
+uniform vec2 u_resolution;
+uniform vec3 u_cameraPosition;
+uniform vec3 u_forward;
+uniform vec3 u_rightEdge;
+uniform vec3 u_topEdge;
+
+// Voxel values are stored normalized for the integer voxel types; u_valueScale converts them back.
+uniform sampler3D u_volume;
+uniform vec3 u_dim;
+uniform float u_valueScale;
+uniform float u_volumeMaximum;
+uniform bool u_linear;
+// Gradient direction (xyz) and magnitude (w).
+uniform sampler3D u_gradients;
+uniform float u_minMagnitude;
+uniform float u_maxMagnitude;
+
+uniform sampler1D u_tfColorMap;
+uniform float u_tfColorMapIndexStart;
+uniform float u_tfColorMapIndexRange;
+uniform float u_TF2DIntensity;
+uniform float u_TF2DRadius;
+uniform vec4 u_TF2DColor;
+
+uniform int u_renderMode;
+uniform float u_sampleStep;
+uniform float u_earlyTerminationOpacity;
+uniform float u_isoValue;
+uniform float u_gamma;
+uniform bool u_volumeShading;
+uniform bool u_smoothstep;
+uniform float u_ka;
+uniform float u_kd;
+uniform float u_ks;
+uniform float u_alpha;
+uniform float u_gl;
+uniform float u_gh;
+
+// Volume::getSampleInterpolate: samples whose interpolation footprint leaves the volume are 0.
+float getSample(vec3 coord)
+{
+    if (u_linear) {
+        if (any(lessThan(coord, vec3(0.0))) || any(greaterThanEqual(coord + 1.0, u_dim)))
+            return 0.0;
+    } else {
+        if (any(lessThan(coord + 0.5, vec3(0.0))) || any(greaterThanEqual(coord + 0.5, u_dim)))
+            return 0.0;
+    }
+    return texture(u_volume, (coord + 0.5) / u_dim).r * u_valueScale;
+}
+
+vec4 getGradient(vec3 coord)
+{
+    return texture(u_gradients, (coord + 0.5) / u_dim);
+}
+
+// Renderer::getTFValue
+vec4 getTFValue(float val)
+{
+    float range01 = (val - u_tfColorMapIndexStart) / u_tfColorMapIndexRange;
+    int size = textureSize(u_tfColorMap, 0);
+    return texelFetch(u_tfColorMap, clamp(int(range01 * float(size)), 0, size - 1), 0);
+}
+
+// Renderer::getTF2DOpacity: a tent over the intensity inside the triangle of the 2D transfer function widget.
+float getTF2DOpacity(float intensity, float gradientMagnitude)
+{
+    float apexIntensity = u_TF2DIntensity;
+    float baseIntensity1 = apexIntensity - u_TF2DRadius;
+    float baseIntensity2 = apexIntensity + u_TF2DRadius;
+    float m1 = (u_minMagnitude - u_maxMagnitude) / (apexIntensity - baseIntensity1);
+    float q1 = u_minMagnitude - m1 * apexIntensity;
+    float m2 = (u_minMagnitude - u_maxMagnitude) / (apexIntensity - baseIntensity2);
+    float q2 = u_minMagnitude - m2 * apexIntensity;
+    if (gradientMagnitude > m1 * intensity + q1 && gradientMagnitude > m2 * intensity + q2 && gradientMagnitude < u_maxMagnitude
+        && intensity > baseIntensity1 && intensity < baseIntensity2) {
+        float projection = intensity < apexIntensity ? (gradientMagnitude - q1) / m1 : (gradientMagnitude - q2) / m2;
+        return 1.0 - abs(intensity - apexIntensity) / abs(projection - apexIntensity);
+    }
+    return 0.0;
+}
+
+// correctOpacity in renderer.cpp.
+float correctOpacity(float opacity, float stepScale)
+{
+    return stepScale == 1.0 ? opacity : 1.0 - pow(1.0 - opacity, stepScale);
+}
+
+// Renderer::computePhongShading
+vec3 computePhongShading(vec3 color, vec4 gradient, vec3 L, vec3 V)
+{
+    vec3 ambient = u_ka * color;
+    vec3 diffuse = vec3(0.0);
+    if (dot(gradient.xyz, gradient.xyz) > 0.0)
+        diffuse = u_kd * color * abs(dot(normalize(gradient.xyz), L));
+    float cosPhi = dot(normalize(reflect(L, gradient.xyz)), V);
+    vec3 specular = vec3(u_ks * pow(abs(cosPhi), u_alpha));
+    return ambient + diffuse + specular;
+}
+
+// The camera is the light source.
+vec3 shade(vec3 color, vec3 samplePos, vec3 rayOrigin)
+{
+    vec4 gradient = getGradient(samplePos);
+    vec3 shaded = computePhongShading(color, gradient, normalize(samplePos - rayOrigin), normalize(u_cameraPosition - samplePos));
+    if (!u_smoothstep || u_renderMode == RenderComposite)
+        return shaded;
+    float weight = smoothstep(u_gl * u_maxMagnitude, u_gh * u_maxMagnitude, gradient.w);
+    return mix(color, shaded, weight);
+}
+
+vec4 traceRaySlice(vec3 origin, vec3 direction)
+{
+    vec3 planeNormal = -normalize(u_forward);
+    float t = dot(u_dim / 2.0 - origin, planeNormal) / dot(direction, planeNormal);
+    float val = getSample(origin + direction * t);
+    return vec4(vec3(max(val / u_volumeMaximum, 0.0)), 1.0);
+}
+
+vec4 traceRayMIP(vec3 origin, vec3 direction, float tmin, float tmax)
+{
+    float maxVal = 0.0;
+    for (float t = tmin; t <= tmax; t += u_sampleStep)
+        maxVal = max(maxVal, getSample(origin + t * direction));
+    return vec4(vec3(maxVal) / u_volumeMaximum, 1.0);
+}
+
+// Renderer::bisectionAccuracy
+float bisectionAccuracy(vec3 origin, vec3 direction, float t0, float t1)
+{
+    float accuracy = 0.01;
+    float a = t0;
+    float b = t1;
+    float c = t0;
+    for (int iteration = 0; iteration < 30; iteration++) {
+        c = (a + b) / 2.0;
+        float fc = getSample(origin + c * direction);
+        if (abs(fc - u_isoValue) < accuracy || abs(b - a) < accuracy)
+            break;
+        if (fc < u_isoValue)
+            a = c;
+        else
+            b = c;
+    }
+    return c;
+}
+
+vec4 traceRayISO(vec3 origin, vec3 direction, float tmin, float tmax)
+{
+    vec3 isoColor = vec3(0.8, 0.8, 0.0);
+    for (float t = tmin; t <= tmax; t += u_sampleStep) {
+        vec3 samplePos = origin + t * direction;
+        if (!u_volumeShading) {
+            if (getSample(samplePos) > u_isoValue)
+                return vec4(isoColor, 1.0);
+            continue;
+        }
+        // The crossing is detected one step ahead, and then refined between the two samples.
+        if (getSample(samplePos) > u_isoValue || getSample(samplePos + u_sampleStep * direction) > u_isoValue) {
+            vec3 precisePos = origin + bisectionAccuracy(origin, direction, t, t + u_sampleStep) * direction;
+            return vec4(computePhongShading(isoColor, getGradient(precisePos), normalize(precisePos - origin), normalize(u_cameraPosition - precisePos)), 1.0);
+        }
+    }
+    return vec4(vec3(0.0), 1.0);
+}
+
+vec4 traceRayComposite(vec3 origin, vec3 direction, float tmin, float tmax)
+{
+    vec4 accumulatedColor = vec4(0.0);
+    float accumulatedOpacity = 0.0;
+    for (float t = tmin; t <= tmax; t += u_sampleStep) {
+        vec3 samplePos = origin + t * direction;
+        vec4 tfValue = getTFValue(getSample(samplePos));
+        float tfOpacity = correctOpacity(tfValue.a, u_sampleStep);
+        vec3 tfColor = tfValue.rgb;
+        if (u_volumeShading && tfOpacity > 0.0)
+            tfColor = shade(tfColor, samplePos, origin);
+
+        accumulatedColor += (1.0 - accumulatedOpacity) * tfOpacity * vec4(tfColor, 1.0);
+        accumulatedOpacity += (1.0 - accumulatedOpacity) * tfOpacity;
+        if (accumulatedOpacity >= u_earlyTerminationOpacity)
+            break;
+    }
+    return accumulatedColor;
+}
+
+vec4 traceRayTF2D(vec3 origin, vec3 direction, float tmin, float tmax)
+{
+    float accumulatedOpacity = 0.0;
+    for (float t = tmin; t <= tmax; t += u_sampleStep) {
+        vec3 samplePos = origin + t * direction;
+        float opacity = getTF2DOpacity(getSample(samplePos), getGradient(samplePos).w);
+        accumulatedOpacity += (1.0 - accumulatedOpacity) * correctOpacity(opacity * u_TF2DColor.a, u_sampleStep);
+        if (accumulatedOpacity >= u_earlyTerminationOpacity) {
+            accumulatedOpacity = min(accumulatedOpacity, 1.0);
+            break;
+        }
+    }
+    return u_TF2DColor * accumulatedOpacity;
+}
+
+// MIDA, and the blend of MIDA with DVR (gamma < 0) or MIP (gamma > 0) for RenderCombined. Unlike the CPU the rays are
+// not terminated early: the accumulated opacity can still decrease when a new maximum follows, and bounding the rest of
+// the ray needs the macro cells.
+vec4 traceRayMIDA(vec3 origin, vec3 direction, float tmin, float tmax)
+{
+    float deltaScale = u_renderMode == RenderCombined && u_gamma <= 0.0 ? 1.0 + u_gamma : 1.0;
+    vec4 accumulatedColor = vec4(0.0);
+    float accumulatedOpacity = 0.0;
+    float maxVal = 0.0;
+    for (float t = tmin; t <= tmax; t += u_sampleStep) {
+        vec3 samplePos = origin + t * direction;
+        float val = getSample(samplePos);
+        vec4 tfValue = getTFValue(val);
+        float tfOpacity = correctOpacity(tfValue.a, u_sampleStep);
+        vec3 color = tfValue.rgb;
+        if (u_volumeShading && tfOpacity > 0.0)
+            color = shade(color, samplePos, origin);
+
+        float delta = val > maxVal ? (val - maxVal) / u_volumeMaximum : 0.0;
+        float beta = 1.0 - delta * deltaScale;
+        accumulatedColor = beta * accumulatedColor + (1.0 - beta * accumulatedOpacity) * tfOpacity * vec4(color, 1.0);
+        accumulatedOpacity = beta * accumulatedOpacity + (1.0 - beta * accumulatedOpacity) * tfOpacity;
+        maxVal = max(val, maxVal);
+    }
+    if (u_renderMode == RenderCombined && u_gamma > 0.0)
+        return mix(accumulatedColor, vec4(vec3(maxVal) / u_volumeMaximum, 1.0), u_gamma);
+    return accumulatedColor;
+}
+
+void main()
+{
+    // The same ray as RayTraceCamera::generateRay for pixel (x, y) of the CPU renderer.
+    vec2 screen = (gl_FragCoord.xy - 0.5) / u_resolution * 2.0 - 1.0;
+    vec3 origin = u_cameraPosition;
+    vec3 direction = normalize(u_forward + screen.x * u_rightEdge + screen.y * u_topEdge);
+
+    // Intersect the ray with the bounds of the volume (see Renderer::intersectRaysVolumeBounds).
+    vec3 invDir = 1.0 / direction;
+    vec3 t0 = -origin * invDir;
+    vec3 t1 = (u_dim - 1.0 - origin) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float tmin = max(max(tNear.x, tNear.y), tNear.z);
+    float tmax = min(min(tFar.x, tFar.y), tFar.z);
+    if (tmin > tmax) {
+        o_fragColor = vec4(0.0);
+        return;
+    }
+
+    switch (u_renderMode) {
+    case RenderSlicer:
+        o_fragColor = traceRaySlice(origin, direction);
+        break;
+    case RenderMIP:
+        o_fragColor = traceRayMIP(origin, direction, tmin, tmax);
+        break;
+    case RenderIso:
+        o_fragColor = traceRayISO(origin, direction, tmin, tmax);
+        break;
+    case RenderComposite:
+        o_fragColor = traceRayComposite(origin, direction, tmin, tmax);
+        break;
+    case RenderTF2D:
+        o_fragColor = traceRayTF2D(origin, direction, tmin, tmax);
+        break;
+    default:
+        o_fragColor = traceRayMIDA(origin, direction, tmin, tmax);
+        break;
+    }
+}
@@ -0,0 +1,8 @@
+#version 330
+
+// A single triangle that covers the whole screen; the vertices are derived from their index, so no buffers are needed.
+void main()
+{
+    const vec2 positions[3] = vec2[3](vec2(-1.0, -1.0), vec2(3.0, -1.0), vec2(-1.0, 3.0));
+    gl_Position = vec4(positions[gl_VertexID], 0.0, 1.0);
+}
@@ -5,24 +5,37 @@
 #include "imgui/imgui_impl_glfw.h"
 #include "imgui/imgui_impl_opengl3.h"
 
+#include "render/instrumentation.h"
+#include "render/render_service.h"
 #include "render/renderer.h"
 #include "ui/full_screen_texture_gl.h"
+#include "ui/gpu_renderer.h"
 #include "ui/menu.h"
 #include "ui/surface_cube.h"
 #include "ui/trackball.h"
 #include "ui/window.h"
 #include "ui/wireframe_cube.h"
+#include "volume/derived_data_cache.h"
 #include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
+#include "volume/statistics_cache.h"
 #include "volume/volume.h"
+#include "volume/volume_pyramid.h"
+#include "volume/volume_sequence.h"
 #include <chrono>
 #include <cmath> // log2
+#include <fmt/format.h>
+#include <glm/common.hpp>
 #include <glm/geometric.hpp>
 #include <glm/gtx/component_wise.hpp>
 #include <glm/vec3.hpp>
 #include <imgui.h>
 #include <iostream>
+#include <memory>
 #include <optional>
 #include <ratio>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 int main(int argc, char** argv)
@@ -49,7 +62,21 @@ int main(int argc, char** argv)
     // class which is responsible for creating the volume + renderer when the user loads a volume.
     std::optional<volume::Volume> optVolume;
     std::optional<volume::GradientVolume> optGradientVolume;
-    std::optional<render::Renderer> optRenderer;
+    std::optional<volume::MacroCellGrid> optMacroCellGrid;
+    std::optional<volume::VolumePyramid> optVolumePyramid;
+    // Volumes that are composited together with the loaded volume (see render::Renderer::setChannels). The render
+    // service points to them, so they are allocated individually.
+    std::vector<std::unique_ptr<volume::Volume>> channelVolumes;
+    std::vector<std::unique_ptr<volume::GradientVolume>> channelGradientVolumes;
+    std::vector<std::unique_ptr<volume::MacroCellGrid>> channelMacroCellGrids;
+    // Loaded instead of the volume above when the user opens a directory of timesteps. The timestep that is rendered is
+    // swapped by the render service, so the menu keeps the widgets of the first timestep.
+    std::unique_ptr<volume::VolumeSequence> pVolumeSequence;
+    // Dimensions of the loaded volume (or of the timesteps of the sequence).
+    glm::ivec3 volumeDims { 0 };
+    std::optional<render::RenderService> optRenderService;
+    // Created when the GPU renderer is first used for the loaded volume (uploading the volume takes a while).
+    std::optional<ui::GPURenderer> optGPURenderer;
     ui::Menu volVisMenu { viewportSize };
 
     // Whether to redraw because the user interacted with the application. When this is the reason for the
@@ -57,38 +84,168 @@ int main(int argc, char** argv)
     // performed at the full (selected) resolution. When the application is static no renders are performed.
     bool redrawUserInteraction = false;
     bool redrawFullResolution = true;
-    auto loadVolume = [&](const std::filesystem::path& filePath) {
-        optVolume.emplace(filePath.string());
-        optVolume->interpolationMode = volVisMenu.interpolationMode();
-        optGradientVolume.emplace(optVolume.value());
-        optRenderer.emplace(&optVolume.value(), &optGradientVolume.value(), &trackballCamera, volVisMenu.renderConfig());
-
-        const float maxDimension = float(glm::compMax(optVolume->dims()));
+    // Whether to redraw because only the Phong constants changed while the iso surface is cached (see
+    // RenderConfig::cacheIsoSurface). Shading the cached surface is fast, so this redraws at the full resolution at once.
+    bool redrawShading = false;
+    // The config of the last frame that was submitted to the render service.
+    render::RenderConfig submittedConfig = volVisMenu.renderConfig();
+    // (Re)start the render service for the loaded volume and its channels.
+    auto startRenderService = [&]() {
+        std::vector<render::VolumeChannel> channels;
+        for (size_t i = 0; i < channelVolumes.size(); i++)
+            channels.push_back({ channelVolumes[i].get(), channelGradientVolumes[i].get(), channelMacroCellGrids[i].get() });
+        // The render service sets the interpolation mode of the volumes when rendering a frame.
+        optRenderService.reset();
+        optRenderService.emplace(&optVolume.value(), &optGradientVolume.value(), &optMacroCellGrid.value(), volVisMenu.renderConfig(),
+            optVolumePyramid ? &optVolumePyramid.value() : nullptr, channels);
+    };
+    // Point the camera at the center of a newly loaded volume.
+    auto resetCamera = [&]() {
+        const float maxDimension = float(glm::compMax(volumeDims));
         trackballCamera.setDistance(maxDimension);
         trackballCamera.setWorldScale(maxDimension);
-        trackballCamera.setLookAt(glm::vec3(optVolume->dims()) / 2.0f);
+        trackballCamera.setLookAt(glm::vec3(volumeDims) / 2.0f);
+    };
+    auto loadVolume = [&](const std::filesystem::path& filePath) {
+        // Stop rendering the previous volume before replacing it.
+        optRenderService.reset();
+        optGPURenderer.reset();
+        optVolumePyramid.reset();
+        pVolumeSequence.reset();
+        channelVolumes.clear();
+        channelGradientVolumes.clear();
+        channelMacroCellGrids.clear();
+        optVolume.emplace(filePath.string(), volume::VoxelLayout::Bricked);
+        // The gradients, macro cells and coarser levels are mapped from the derived data cache if an earlier run wrote it.
+        const auto derivedLevels = volume::readDerivedDataCache(optVolume.value(), volume::GradientEncoding::Float);
+        if (!derivedLevels.empty()) {
+            optGradientVolume.emplace(optVolume.value(), derivedLevels[0]);
+            optMacroCellGrid.emplace(derivedLevels[0]);
+        } else {
+            optGradientVolume.emplace(optVolume.value(), volume::GradientEncoding::Float);
+            optMacroCellGrid.emplace(optVolume.value());
+        }
+        // Later runs load the histograms from the statistics cache instead of computing them again.
+        volume::updateStatisticsCache(optVolume.value(), optGradientVolume.value());
+        // Reducing a streaming volume would read all of it; its coarse copy already keeps it interactive.
+        if (!optVolume->brickCache()) {
+            optVolumePyramid.emplace(optVolume.value(), optGradientVolume.value(), optMacroCellGrid.value(), derivedLevels);
+            if (derivedLevels.size() != size_t(optVolumePyramid->numLevels()))
+                volume::writeDerivedDataCache(optVolumePyramid.value());
+        }
+        startRenderService();
 
+        volumeDims = optVolume->dims();
+        resetCamera();
         volVisMenu.setLoadedVolume(optVolume.value(), optGradientVolume.value());
 
         redrawUserInteraction = true;
     };
+    auto loadSequence = [&](const std::filesystem::path& directory) {
+        // The previous volume stays loaded if the sequence cannot be loaded.
+        std::unique_ptr<volume::VolumeSequence> pNewVolumeSequence;
+        try {
+            pNewVolumeSequence = std::make_unique<volume::VolumeSequence>(
+                volume::VolumeSequence::findTimesteps(directory), volume::VolumeSequence::defaultMemoryBudget, volume::VoxelLayout::Bricked);
+        } catch (const std::runtime_error& error) {
+            std::cerr << "Cannot load " << directory << " as a volume sequence: " << error.what() << std::endl;
+            return;
+        }
+        // Stop rendering the previous volume before replacing it. The timesteps are rendered at full resolution only
+        // (building a pyramid per timestep would take longer than loading it) and on the CPU.
+        optRenderService.reset();
+        optGPURenderer.reset();
+        optVolumePyramid.reset();
+        channelVolumes.clear();
+        channelGradientVolumes.clear();
+        channelMacroCellGrids.clear();
+        optMacroCellGrid.reset();
+        optGradientVolume.reset();
+        optVolume.reset();
+        pVolumeSequence = std::move(pNewVolumeSequence);
+
+        const std::shared_ptr<volume::Timestep> pTimestep = pVolumeSequence->current();
+        optRenderService.emplace(&pTimestep->volume, &pTimestep->gradientVolume, &pTimestep->macroCellGrid, volVisMenu.renderConfig());
+        // From now on the render service holds on to the timestep that it renders.
+        optRenderService->setTimestep(pTimestep);
+
+        volumeDims = pTimestep->volume.dims();
+        resetCamera();
+        volVisMenu.setLoadedVolume(pTimestep->volume, pTimestep->gradientVolume);
+        volVisMenu.setLoadedSequence(pVolumeSequence->numTimesteps());
+
+        redrawUserInteraction = true;
+    };
+
+    auto addChannel = [&](const std::filesystem::path& filePath) {
+        if (pVolumeSequence) {
+            std::cerr << "Volume channels are not supported together with a volume sequence" << std::endl;
+            return;
+        }
+        auto pChannelVolume = std::make_unique<volume::Volume>(filePath.string(), volume::VoxelLayout::Bricked);
+        if (pChannelVolume->dims() != optVolume->dims()) {
+            std::cerr << "Cannot add " << filePath << " as a channel: its dimensions differ from those of the loaded volume" << std::endl;
+            return;
+        }
+        // Stop rendering before the channels change.
+        optRenderService.reset();
+        channelGradientVolumes.push_back(std::make_unique<volume::GradientVolume>(*pChannelVolume, volume::GradientEncoding::Float));
+        channelMacroCellGrids.push_back(std::make_unique<volume::MacroCellGrid>(*pChannelVolume));
+        channelVolumes.push_back(std::move(pChannelVolume));
+        volVisMenu.addChannelVolume(*channelVolumes.back());
+        startRenderService();
+
+        redrawUserInteraction = true;
+    };
 
     // Callbacks.
     volVisMenu.setLoadVolumeCallback(loadVolume);
+    volVisMenu.setAddChannelCallback(addChannel);
+    volVisMenu.setLoadSequenceCallback(loadSequence);
     volVisMenu.setRenderConfigChangedCallback(
         [&](const render::RenderConfig& renderConfig) {
-            if (optRenderer)
-                optRenderer->setConfig(renderConfig);
-            redrawUserInteraction = true;
+            // The new config is submitted to the render service with the next frame.
+            const bool cachedIsoSurface = renderConfig.cacheIsoSurface && renderConfig.renderMode == render::RenderMode::RenderIso;
+            if (cachedIsoSurface && render::renderConfigChanges(submittedConfig, renderConfig).shadingOnly)
+                redrawShading = true;
+            else
+                redrawUserInteraction = true;
         });
     volVisMenu.setInterpolationModeChangedCallback(
-        [&](volume::InterpolationMode interpolationMode) {
-            if (optVolume) {
-                optVolume->interpolationMode = interpolationMode;
-                optGradientVolume->interpolationMode = interpolationMode;
-            }
+        [&](volume::InterpolationMode) {
             redrawUserInteraction = true;
         });
+    // Renders the current view with both renderers and reports how much the images differ.
+    volVisMenu.setCompareRenderersCallback(
+        [&]() -> std::string {
+            const render::RenderConfig renderConfig = volVisMenu.renderConfig();
+            const volume::InterpolationMode interpolationMode = volVisMenu.interpolationMode();
+            if (!optRenderService || pVolumeSequence || !ui::GPURenderer::supports(renderConfig, interpolationMode) || !ui::GPURenderer::canRender(*optVolume) || !channelVolumes.empty())
+                return "The GPU renderer does not support the current volume or settings.";
+            // The render thread changes the interpolation mode of the volumes, so it must not be rendering.
+            if (!optRenderService->idle())
+                return "The CPU renderer is busy, try again when the image has been rendered.";
+
+            if (!optGPURenderer)
+                optGPURenderer.emplace(*optVolume, *optGradientVolume);
+            optVolume->interpolationMode = interpolationMode;
+            optGradientVolume->interpolationMode = interpolationMode;
+            render::Renderer cpuRenderer { &*optVolume, &*optGradientVolume, &*optMacroCellGrid, &trackballCamera, renderConfig };
+            cpuRenderer.render();
+            optGPURenderer->render(trackballCamera, renderConfig, interpolationMode);
+
+            const auto cpuPixels = cpuRenderer.frameBuffer();
+            const std::vector<glm::vec4> gpuPixels = optGPURenderer->frameBuffer();
+            float maxDifference = 0.0f;
+            double sumDifference = 0.0;
+            for (size_t i = 0; i < gpuPixels.size(); i++) {
+                const float difference = glm::compMax(glm::abs(cpuPixels[i] - gpuPixels[i]));
+                maxDifference = std::max(maxDifference, difference);
+                sumDifference += difference;
+            }
+            return fmt::format("Largest difference per pixel: {:.4f}\nMean difference per pixel: {:.6f}",
+                maxDifference, sumDifference / double(std::max<size_t>(gpuPixels.size(), 1)));
+        });
     myWindow.registerWindowResizeCallback(
         [&](const glm::ivec2& newWindowSize) {
             // Maintain aspect ratio!
@@ -109,10 +266,24 @@ int main(int argc, char** argv)
     // The dynamic resolution scale that was used in previous frame (to keep the frame time below the target).
     int prevResolutionScale = 1;
     std::chrono::duration<double> renderTime { 0 };
+    // When the volume sequence last moved on to the next timestep.
+    std::chrono::steady_clock::time_point timestepTime = std::chrono::steady_clock::now();
     while (!myWindow.shouldClose()) {
         myWindow.updateInput();
 
-        if (optRenderer.has_value()) {
+        if (optRenderService.has_value()) {
+            // Play the volume sequence at the chosen speed. A timestep that has not been loaded yet holds playback until
+            // it is, so the render thread never waits for the disk.
+            if (pVolumeSequence) {
+                const auto now = std::chrono::steady_clock::now();
+                const std::chrono::duration<double> timestepDuration { 1.0 / volVisMenu.timestepsPerSecond() };
+                if (volVisMenu.playing() && now - timestepTime >= timestepDuration && pVolumeSequence->advance()) {
+                    timestepTime = now;
+                    optRenderService->setTimestep(pVolumeSequence->current());
+                    redrawUserInteraction = true;
+                }
+                volVisMenu.setSequenceStatus(pVolumeSequence->currentIndex(), pVolumeSequence->residentTimesteps());
+            }
             // If camera changed in any way then we need to redraw.
             static glm::mat4 prevViewMatrix = glm::identity<glm::mat4>();
             const glm::mat4 viewMatrix = trackballCamera.viewMatrix();
@@ -120,53 +291,96 @@ int main(int argc, char** argv)
                 prevViewMatrix = viewMatrix;
                 redrawUserInteraction = true;
             }
-            // If previous frame we rendered at a lower resolution (because something changed) then it will request to draw
-            // the next frame in full resolution. If the user is still holding the mouse button then we can reasonably assume
-            // that (s)he is not finished with the interaction (so we should keep rendering at a lower resolution).
-            if (redrawFullResolution && (myWindow.isMouseButtonPressed(GLFW_MOUSE_BUTTON_LEFT) || myWindow.isMouseButtonPressed(GLFW_MOUSE_BUTTON_RIGHT)))
+            // The image has to be uploaded again when the user picks a different display format.
+            if (fullScreenTextureGL.format() != volVisMenu.displayFormat()) {
+                fullScreenTextureGL.setFormat(volVisMenu.displayFormat());
                 redrawUserInteraction = true;
-
-            // We draw when either the user has interacted (camera matrix changed or render config changed (see callback)) or if
-            //  last frame we rendered at a lower resolution and we want to now render at the full resolution.
-            if (redrawUserInteraction || redrawFullResolution) {
-                if (redrawUserInteraction) {
-                    // Reduce the resolution if the performance drops below the target frame time.
-                    // Estimated performance when rendering at full resolution (resolution returned from menu).
-                    // This way we can dynamically update the resolution while the user is moving the camera since
-                    // some views may be slower to render than others.
-                    const float estimatedFullResFrameTime = float(renderTime.count()) * float(prevResolutionScale * prevResolutionScale);
-                    const float performanceScale = estimatedFullResFrameTime / float(frameTimeTarget);
-                    // Resolution scale changes the number of pixels quadratically (scales both width and height).
-                    const int resolutionScale = std::max(int(std::sqrt(performanceScale)) + 1, 1);
-
-                    // NOTE(Mathijs): calling setBaseRenderResolution will update the render config and call
-                    //  the associated callback. Make sure that you don't read redrawUserInteraction after
-                    //  this call because it will always be true.
-                    volVisMenu.setBaseRenderResolution(baseRenderResolution / resolutionScale);
-                    redrawFullResolution = true;
-                    prevResolutionScale = resolutionScale;
-                } else {
+            }
+            // The GPU renders every frame at the full resolution and synchronously, so none of the resolution scaling below
+            // is needed. Settings that it does not implement (and volume channels and sequences) are rendered on the CPU instead.
+            const bool renderOnGPU = volVisMenu.renderOnGPU() && !pVolumeSequence
+                && ui::GPURenderer::supports(volVisMenu.renderConfig(), volVisMenu.interpolationMode())
+                && ui::GPURenderer::canRender(*optVolume) && channelVolumes.empty();
+            if (renderOnGPU) {
+                if (!optGPURenderer) {
+                    optGPURenderer.emplace(*optVolume, *optGradientVolume);
+                    redrawUserInteraction = true;
+                }
+                if (redrawUserInteraction || redrawShading) {
                     prevResolutionScale = 1;
                     volVisMenu.setBaseRenderResolution(baseRenderResolution);
+                    redrawUserInteraction = false;
+                    redrawShading = false;
                     redrawFullResolution = false;
+                    optGPURenderer->render(trackballCamera, volVisMenu.renderConfig(), volVisMenu.interpolationMode());
+                }
+                renderTime = optGPURenderer->renderTime();
+            } else {
+                // If previous frame we rendered at a lower resolution (because something changed) then it will request to draw
+                // the next frame in full resolution. If the user is still holding the mouse button then we can reasonably assume
+                // that (s)he is not finished with the interaction (so we should keep rendering at a lower resolution).
+                if (redrawFullResolution && optRenderService->idle() && (myWindow.isMouseButtonPressed(GLFW_MOUSE_BUTTON_LEFT) || myWindow.isMouseButtonPressed(GLFW_MOUSE_BUTTON_RIGHT)))
+                    redrawUserInteraction = true;
+
+                // Rendering happens on a background thread. We submit a new frame when either the user has interacted (camera
+                // matrix changed or render config changed (see callback)) or if last frame we rendered at a lower resolution and
+                // we want to now render at the full resolution. The latter waits until the low resolution frame has been shown.
+                if (redrawUserInteraction || redrawShading || (redrawFullResolution && optRenderService->idle())) {
+                    if (volVisMenu.renderConfig().progressive) {
+                        // Progressive rendering: instead of lowering the resolution while the user interacts, the image is
+                        // refined by the render service until it has converged (see render::RenderService::renderLoop).
+                        prevResolutionScale = 1;
+                        volVisMenu.setBaseRenderResolution(baseRenderResolution);
+                        redrawFullResolution = false;
+                    } else if (redrawUserInteraction) {
+                        // Reduce the resolution if the performance drops below the target frame time.
+                        // Estimated performance when rendering at full resolution (resolution returned from menu).
+                        // This way we can dynamically update the resolution while the user is moving the camera since
+                        // some views may be slower to render than others.
+                        const float estimatedFullResFrameTime = float(renderTime.count()) * float(prevResolutionScale * prevResolutionScale);
+                        const float performanceScale = estimatedFullResFrameTime / float(frameTimeTarget);
+                        // Resolution scale changes the number of pixels quadratically (scales both width and height).
+                        const int resolutionScale = std::max(int(std::sqrt(performanceScale)) + 1, 1);
+
+                        // NOTE(Mathijs): calling setBaseRenderResolution will update the render config and call
+                        //  the associated callback if the resolution changed. Make sure that you don't read
+                        //  redrawUserInteraction after this call because it may have been set.
+                        volVisMenu.setBaseRenderResolution(baseRenderResolution / resolutionScale);
+                        redrawFullResolution = true;
+                        prevResolutionScale = resolutionScale;
+                    } else {
+                        prevResolutionScale = 1;
+                        volVisMenu.setBaseRenderResolution(baseRenderResolution);
+                        redrawFullResolution = false;
+                    }
+                    redrawUserInteraction = false;
+                    redrawShading = false;
+
+                    // Frames at a reduced resolution are followed by a full resolution frame, so they may use a coarser level of
+                    // the volume pyramid (if enabled).
+                    render::RenderConfig renderConfig = volVisMenu.renderConfig();
+                    renderConfig.interactive = redrawFullResolution;
+                    submittedConfig = renderConfig;
+
+                    // The render thread gets its own copy of the camera, so the user can keep interacting.
+                    optRenderService->submit(std::make_shared<ui::Trackball>(trackballCamera), renderConfig, volVisMenu.interpolationMode());
                 }
-                redrawUserInteraction = false;
-
-                using clock = std::chrono::high_resolution_clock;
-                const auto start = clock::now();
-                optRenderer->render();
-                const auto end = clock::now();
-                renderTime = end - start;
 
-                fullScreenTextureGL.update(optRenderer->frameBuffer(), volVisMenu.renderConfig().renderResolution);
+                // Upload the newest finished frame (if any) to the GPU.
+                if (const render::RenderService::Frame* pFrame = optRenderService->acquireFrame()) {
+                    renderTime = pFrame->renderTime;
+                    fullScreenTextureGL.update(pFrame->pixels, pFrame->resolution);
+                }
             }
 
             // === Drawing the framebuffer to the screen and adding the wireframe. ===
+            // Measures the time it takes to issue the OpenGL commands (the GPU executes them asynchronously).
+            VOLVIS_SCOPED_STAGE(Draw);
 
             // Make the wireframe slightly larger than the volume to prevent z-fighting
             constexpr float wireframeMargin = 0.05f;
-            const auto wireframeCubeSize = glm::vec3(optVolume->dims()) * (1.0f + wireframeMargin);
-            const auto wireframeCubeOffset = -glm::vec3(optVolume->dims()) * wireframeMargin * 0.5f;
+            const auto wireframeCubeSize = glm::vec3(volumeDims) * (1.0f + wireframeMargin);
+            const auto wireframeCubeOffset = -glm::vec3(volumeDims) * wireframeMargin * 0.5f;
             constexpr glm::vec3 wireframeColor { 1.0f };
 
             // Draw on the left side of the screen next to the menu.
@@ -183,7 +397,7 @@ int main(int argc, char** argv)
             glDepthMask(GL_TRUE);
             glDepthFunc(GL_LEQUAL);
             glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-            surfaceCube.draw(trackballCamera, optVolume->dims());
+            surfaceCube.draw(trackballCamera, volumeDims);
 
             // Enable color writes and depth blending.
             glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
@@ -199,7 +413,10 @@ int main(int argc, char** argv)
             glDepthFunc(GL_ALWAYS);
             //  Assume that the renderer already multiplied the RGB channels by alpha.
             glBlendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-            fullScreenTextureGL.draw();
+            if (renderOnGPU)
+                fullScreenTextureGL.drawTexture(optGPURenderer->texture());
+            else
+                fullScreenTextureGL.draw();
 
             // Finally, draw the part of the wireframe that is in front of the volume.
             glDepthFunc(GL_LEQUAL);
@@ -221,6 +438,7 @@ int main(int argc, char** argv)
         if (myWindow.isKeyPressed(GLFW_KEY_ESCAPE))
             break;
 
+        volVisMenu.addPerformanceFrame(renderTime, render::instrumentation::collectFrame());
         volVisMenu.drawMenu(glm::ivec2(windowSize.x - menuWidth, 0), glm::ivec2(menuWidth, windowSize.y), renderTime);
 
         myWindow.swapBuffers();
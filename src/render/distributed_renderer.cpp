@@ -0,0 +1,271 @@
+#include "distributed_renderer.h"
+#include "renderer.h"
+#include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
+#include <algorithm>
+#include <cstddef>
+#include <glm/common.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <utility>
+
+namespace render {
+
+// Produces the rays of another camera in the voxel coordinates of a subvolume, of which voxel 0 is voxel offset of the
+// whole volume.
+class SubvolumeCamera : public RayTraceCamera {
+public:
+    SubvolumeCamera(const glm::vec3& offset)
+        : m_offset(offset)
+    {
+    }
+
+    void setCamera(const RayTraceCamera* pCamera) { m_pCamera = pCamera; }
+
+    glm::vec3 position() const override { return m_pCamera->position() - m_offset; }
+    glm::vec3 forward() const override { return m_pCamera->forward(); }
+
+    Ray generateRay(const glm::vec2& pixel) const override
+    {
+        Ray ray = m_pCamera->generateRay(pixel);
+        ray.origin -= m_offset;
+        return ray;
+    }
+
+    void generateRays(gsl::span<const glm::vec2> pixels, gsl::span<Ray> rays) const override
+    {
+        m_pCamera->generateRays(pixels, rays);
+        for (Ray& ray : rays)
+            ray.origin -= m_offset;
+    }
+
+private:
+    const RayTraceCamera* m_pCamera { nullptr };
+    glm::vec3 m_offset;
+};
+
+// Copy the voxels [begin, end) of the volume.
+static volume::Volume copySubvolume(const volume::Volume& volume, const glm::ivec3& begin, const glm::ivec3& end)
+{
+    const glm::ivec3 dim = end - begin;
+    return volume::dispatchVoxelType(volume.voxelType(), [&](auto voxel) {
+        using Voxel = decltype(voxel);
+        std::vector<Voxel> data(size_t(dim.x) * size_t(dim.y) * size_t(dim.z));
+        tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& zRange) {
+            for (int z = zRange.begin(); z != zRange.end(); z++) {
+                size_t i = size_t(dim.x) * size_t(dim.y) * size_t(z);
+                for (int y = 0; y < dim.y; y++) {
+                    for (int x = 0; x < dim.x; x++)
+                        data[i++] = static_cast<Voxel>(volume.getVoxel<Voxel>(begin.x + x, begin.y + y, begin.z + z));
+                }
+            }
+        });
+        return volume::Volume(std::move(data), dim, volume.layout());
+    });
+}
+
+// Settings that reuse earlier frames are turned off: the render service reuses the composited image instead.
+static RenderConfig workerConfig(const RenderConfig& config)
+{
+    RenderConfig out = config;
+    out.progressive = false;
+    out.temporalReprojection = false;
+    out.cacheIsoSurface = false;
+    return out;
+}
+
+struct DistributedRenderer::Worker {
+    Worker(const volume::Volume& wholeVolume, const SubvolumeRegion& region_, const RenderConfig& config)
+        : region(region_)
+        , begin(glm::max(region.lower - ghostVoxels, glm::ivec3(0)))
+        , volume(copySubvolume(wholeVolume, begin, glm::min(region.upper + ghostVoxels + 1, wholeVolume.dims())))
+        , gradientVolume(volume, volume::GradientEncoding::Float)
+        , macroCellGrid(volume)
+        , camera(glm::vec3(begin))
+        , renderer(&volume, &gradientVolume, &macroCellGrid, nullptr, workerConfig(config))
+    {
+        const glm::vec3 offset { begin };
+        SampleRegion sampleRegion;
+        sampleRegion.region.lowerUpper = { glm::vec3(region.lower) - offset, glm::vec3(region.upper) - offset };
+        sampleRegion.volumeBounds.lowerUpper = { -offset, glm::vec3(wholeVolume.dims() - 1) - offset };
+        renderer.setSampleRegion(sampleRegion);
+    }
+
+    SubvolumeRegion region;
+    // Voxel of the whole volume that is voxel 0 of the subvolume.
+    glm::ivec3 begin;
+    volume::Volume volume;
+    volume::GradientVolume gradientVolume;
+    volume::MacroCellGrid macroCellGrid;
+    SubvolumeCamera camera;
+    Renderer renderer;
+};
+
+DistributedRenderer::DistributedRenderer(const volume::Volume& volume, int numWorkers, const RenderConfig& initialConfig)
+    : m_volumeMaximum(volume.maximum())
+    , m_config(initialConfig)
+    , m_frameBuffer(size_t(initialConfig.renderResolution.x) * size_t(initialConfig.renderResolution.y), glm::vec4(0.0f))
+{
+    std::vector<SubvolumeRegion> regions;
+    buildTree({ glm::ivec3(0), volume.dims() - 1 }, std::max(numWorkers, 1), regions);
+
+    m_workers.resize(regions.size());
+    tbb::parallel_for(size_t(0), regions.size(), [&](size_t i) {
+        m_workers[i] = std::make_unique<Worker>(volume, regions[i], initialConfig);
+    });
+}
+
+DistributedRenderer::~DistributedRenderer() = default;
+
+// Split the region along its longest axis, such that both halves get a share of the voxels that matches their share of
+// the workers. Returns the index of the node of the region.
+int DistributedRenderer::buildTree(const SubvolumeRegion& region, int numWorkers, std::vector<SubvolumeRegion>& regions)
+{
+    const int nodeIndex = int(m_nodes.size());
+    m_nodes.emplace_back();
+
+    const glm::ivec3 extent = region.upper - region.lower;
+    const int axis = extent.x >= extent.y ? (extent.x >= extent.z ? 0 : 2) : (extent.y >= extent.z ? 1 : 2);
+    if (numWorkers == 1 || extent[axis] < 2) {
+        m_nodes[size_t(nodeIndex)].worker = int(regions.size());
+        regions.push_back(region);
+        return nodeIndex;
+    }
+
+    const int lowerWorkers = numWorkers / 2;
+    const int split = region.lower[axis] + std::clamp(extent[axis] * lowerWorkers / numWorkers, 1, extent[axis] - 1);
+    SubvolumeRegion lowerRegion = region, upperRegion = region;
+    lowerRegion.upper[axis] = split;
+    upperRegion.lower[axis] = split;
+    const int lowerChild = buildTree(lowerRegion, lowerWorkers, regions);
+    const int upperChild = buildTree(upperRegion, numWorkers - lowerWorkers, regions);
+
+    Node& node = m_nodes[size_t(nodeIndex)];
+    node.axis = axis;
+    node.split = split;
+    node.children = { lowerChild, upperChild };
+    return nodeIndex;
+}
+
+// The workers in front to back order: at every split, the half that contains the camera comes first. Every ray from
+// the camera passes through the halves in that order, so this is a visibility order for all pixels at once.
+void DistributedRenderer::visibilityOrder(int nodeIndex, const glm::vec3& cameraPosition, std::vector<size_t>& out) const
+{
+    const Node& node = m_nodes[size_t(nodeIndex)];
+    if (node.worker >= 0) {
+        out.push_back(size_t(node.worker));
+        return;
+    }
+    const size_t nearChild = cameraPosition[node.axis] < float(node.split) ? 0 : 1;
+    visibilityOrder(node.children[nearChild], cameraPosition, out);
+    visibilityOrder(node.children[1 - nearChild], cameraPosition, out);
+}
+
+bool DistributedRenderer::supports(const RenderConfig& config, const volume::Volume& volume)
+{
+    const bool renderMode = config.renderMode == RenderMode::RenderComposite || config.renderMode == RenderMode::RenderMIDA
+        || config.renderMode == RenderMode::RenderMIP;
+    return renderMode && !volume.brickCache();
+}
+
+int DistributedRenderer::numWorkers() const
+{
+    return int(m_workers.size());
+}
+
+SubvolumeRegion DistributedRenderer::region(int worker) const
+{
+    return m_workers[size_t(worker)]->region;
+}
+
+void DistributedRenderer::setConfig(const RenderConfig& config)
+{
+    if (config.renderResolution != m_config.renderResolution)
+        m_frameBuffer.assign(size_t(config.renderResolution.x) * size_t(config.renderResolution.y), glm::vec4(0.0f));
+    m_config = config;
+    for (const auto& pWorker : m_workers)
+        pWorker->renderer.setConfig(workerConfig(config));
+}
+
+void DistributedRenderer::setCamera(const render::RayTraceCamera* pCamera)
+{
+    m_pCamera = pCamera;
+    for (const auto& pWorker : m_workers) {
+        pWorker->camera.setCamera(pCamera);
+        pWorker->renderer.setCamera(&pWorker->camera);
+    }
+}
+
+void DistributedRenderer::setInterpolationMode(volume::InterpolationMode interpolationMode)
+{
+    for (const auto& pWorker : m_workers) {
+        pWorker->volume.interpolationMode = interpolationMode;
+        pWorker->gradientVolume.interpolationMode = interpolationMode;
+    }
+}
+
+void DistributedRenderer::setCancellationFlag(const std::atomic<bool>* pCancelled)
+{
+    m_pCancelled = pCancelled;
+    for (const auto& pWorker : m_workers)
+        pWorker->renderer.setCancellationFlag(pCancelled);
+}
+
+void DistributedRenderer::render()
+{
+    using clock = std::chrono::high_resolution_clock;
+    const auto start = clock::now();
+    tbb::parallel_for(size_t(0), m_workers.size(), [&](size_t i) { m_workers[i]->renderer.render(); });
+    if (m_pCancelled && m_pCancelled->load(std::memory_order_relaxed))
+        return;
+    const auto compositeStart = clock::now();
+
+    m_order.clear();
+    visibilityOrder(0, m_pCamera->position(), m_order);
+    // MIP and MIDA normalize by the maximum of the subvolume: MIP is scaled to the maximum of the whole volume, and a
+    // subvolume of zeros (which would divide by zero) contributes nothing.
+    const bool mip = m_config.renderMode == RenderMode::RenderMIP;
+    const bool normalized = mip || m_config.renderMode == RenderMode::RenderMIDA;
+    m_order.erase(std::remove_if(std::begin(m_order), std::end(m_order), [&](size_t worker) { return normalized && m_workers[worker]->volume.maximum() <= 0.0f; }), std::end(m_order));
+
+    // Direct send: each worker composites one strip of rows.
+    const glm::ivec2 resolution = m_config.renderResolution;
+    const int numStrips = int(m_workers.size());
+    const int stripRows = (resolution.y + numStrips - 1) / numStrips;
+    tbb::parallel_for(0, numStrips, [&](int strip) {
+        const size_t begin = size_t(std::min(strip * stripRows, resolution.y)) * size_t(resolution.x);
+        const size_t end = size_t(std::min((strip + 1) * stripRows, resolution.y)) * size_t(resolution.x);
+        std::fill(std::begin(m_frameBuffer) + std::ptrdiff_t(begin), std::begin(m_frameBuffer) + std::ptrdiff_t(end), glm::vec4(0.0f));
+        for (const size_t worker : m_order) {
+            const gsl::span<const glm::vec4> partialImage = m_workers[worker]->renderer.frameBuffer();
+            if (mip) {
+                const glm::vec4 scale { glm::vec3(m_workers[worker]->volume.maximum() / m_volumeMaximum), 1.0f };
+                for (size_t pixel = begin; pixel < end; pixel++)
+                    m_frameBuffer[pixel] = glm::max(m_frameBuffer[pixel], partialImage[pixel] * scale);
+            } else {
+                for (size_t pixel = begin; pixel < end; pixel++)
+                    m_frameBuffer[pixel] += (1.0f - m_frameBuffer[pixel].a) * partialImage[pixel];
+            }
+        }
+    });
+
+    const auto end = clock::now();
+    m_partialRenderTime = compositeStart - start;
+    m_compositeTime = end - compositeStart;
+}
+
+gsl::span<const glm::vec4> DistributedRenderer::frameBuffer() const
+{
+    return m_frameBuffer;
+}
+
+std::chrono::duration<double> DistributedRenderer::partialRenderTime() const
+{
+    return m_partialRenderTime;
+}
+
+std::chrono::duration<double> DistributedRenderer::compositeTime() const
+{
+    return m_compositeTime;
+}
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include "render/ray_trace_camera.h"
+#include "render/render_config.h"
+#include "volume/volume.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <gsl/span>
+#include <memory>
+#include <vector>
+
+namespace render {
+
+// The voxels [lower, upper] (inclusive) of the whole volume that a worker of the DistributedRenderer renders.
+// Neighbouring regions share the voxels on their common boundary; a sample on it is taken by one of them.
+struct SubvolumeRegion {
+    glm::ivec3 lower;
+    glm::ivec3 upper;
+};
+
+// Sort-last rendering for volumes that are too large for a single machine. The volume is split into subvolumes by
+// recursive bisection (a k-d tree of boxes), which are each rendered by a worker that holds only its own voxels (plus a
+// ghost layer for interpolation and gradients) and runs its own Renderer. The partial images are composited by direct
+// send: the image is split into one strip of rows per worker, and each strip is composited from the partial images of
+// all workers, front to back along the k-d tree with the over operator (Composite and MIDA) or with a maximum (MIP).
+//
+// The workers run in this process, since the project does not depend on a message passing library. A worker only
+// touches its own subvolume, renderer and partial image, and the compositing of a strip only reads the partial images,
+// so each worker maps onto a process that sends its partial image to the processes that composite the strips.
+//
+// MIP images equal those of a single Renderer. Composite images do too, except that early ray termination and the first
+// preintegrated segment work per subvolume. MIDA restarts its running maximum (and normalizes by the maximum) per
+// subvolume, so its image approximates the single Renderer image.
+class DistributedRenderer {
+public:
+    // Layers of voxels copied around each region: cubic interpolation of the gradients reaches two voxels beyond a
+    // sample, and the central differences one more.
+    static constexpr int ghostVoxels = 3;
+
+public:
+    // Copies the subvolumes out of the volume and derives their gradients and macro cells. There are fewer workers than
+    // requested if the volume is too small to split that often. The volume should be supported (see supports).
+    DistributedRenderer(const volume::Volume& volume, int numWorkers, const RenderConfig& initialConfig);
+    ~DistributedRenderer();
+
+    DistributedRenderer(const DistributedRenderer&) = delete;
+    DistributedRenderer& operator=(const DistributedRenderer&) = delete;
+
+    // Composite, MIDA and MIP are supported. Streaming volumes are not, since copying the subvolumes would read all
+    // bricks.
+    static bool supports(const RenderConfig& config, const volume::Volume& volume);
+
+    int numWorkers() const;
+    SubvolumeRegion region(int worker) const;
+
+    void setConfig(const RenderConfig& config);
+    void setCamera(const render::RayTraceCamera* pCamera);
+    void setInterpolationMode(volume::InterpolationMode interpolationMode);
+    void setCancellationFlag(const std::atomic<bool>* pCancelled);
+    void render();
+
+    gsl::span<const glm::vec4> frameBuffer() const;
+    // Time that the last frame spent rendering the partial images and compositing them.
+    std::chrono::duration<double> partialRenderTime() const;
+    std::chrono::duration<double> compositeTime() const;
+
+private:
+    struct Worker;
+    // Node of the k-d tree: either a split of the region at a voxel plane (children[0] below, children[1] above) or a
+    // leaf with the index of its worker.
+    struct Node {
+        int axis { -1 };
+        int split { 0 };
+        std::array<int, 2> children { -1, -1 };
+        int worker { -1 };
+    };
+
+    int buildTree(const SubvolumeRegion& region, int numWorkers, std::vector<SubvolumeRegion>& regions);
+    void visibilityOrder(int node, const glm::vec3& cameraPosition, std::vector<size_t>& out) const;
+
+private:
+    std::vector<Node> m_nodes;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    const float m_volumeMaximum;
+    RenderConfig m_config;
+    const render::RayTraceCamera* m_pCamera { nullptr };
+    const std::atomic<bool>* m_pCancelled { nullptr };
+
+    // Workers front to back as seen from the camera of the current frame.
+    std::vector<size_t> m_order;
+    std::vector<glm::vec4> m_frameBuffer;
+    std::chrono::duration<double> m_partialRenderTime { 0 };
+    std::chrono::duration<double> m_compositeTime { 0 };
+};
+}
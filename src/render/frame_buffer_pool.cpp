@@ -0,0 +1,60 @@
+#include "frame_buffer_pool.h"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace render {
+
+FrameBufferPool::FrameBufferPool()
+{
+    m_entries.reserve(capacity);
+}
+
+void FrameBufferPool::exchange(std::vector<glm::vec4>& buffer, const glm::ivec2& currentResolution, const glm::ivec2& resolution)
+{
+    if (resolution == currentResolution)
+        return;
+
+    // The order of the entries does not matter, so an entry is removed by moving the last entry into its place.
+    const auto remove = [&](std::vector<Entry>::iterator entry) {
+        if (entry != std::prev(std::end(m_entries)))
+            *entry = std::move(m_entries.back());
+        m_entries.pop_back();
+    };
+
+    // Take the requested buffer out first, such that it cannot be evicted by returning the current buffer.
+    std::vector<glm::vec4> pooledPixels;
+    const auto pooled = std::find_if(std::begin(m_entries), std::end(m_entries), [&](const Entry& entry) { return entry.resolution == resolution; });
+    const bool hit = pooled != std::end(m_entries);
+    if (hit) {
+        pooledPixels = std::move(pooled->pixels);
+        remove(pooled);
+    }
+
+    if (!buffer.empty()) {
+        if (m_entries.size() == capacity) {
+            const auto leastRecentlyUsed = std::min_element(std::begin(m_entries), std::end(m_entries),
+                [](const Entry& lhs, const Entry& rhs) { return lhs.lastUse < rhs.lastUse; });
+            remove(leastRecentlyUsed);
+        }
+        m_entries.push_back(Entry { currentResolution, std::move(buffer), ++m_useCounter });
+    }
+
+    if (hit) {
+        buffer = std::move(pooledPixels);
+    } else {
+        m_numMisses++;
+        buffer.assign(size_t(resolution.x) * size_t(resolution.y), glm::vec4(0.0f));
+    }
+}
+
+size_t FrameBufferPool::size() const
+{
+    return m_entries.size();
+}
+
+size_t FrameBufferPool::numMisses() const
+{
+    return m_numMisses;
+}
+}
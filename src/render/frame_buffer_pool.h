@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+namespace render {
+
+// Frame buffers of the resolutions that were rendered recently. Dynamic resolution scaling switches between a reduced
+// resolution while the user interacts and the full resolution afterwards; keeping the buffer of the other resolution
+// alive means that switching back neither allocates nor clears memory.
+class FrameBufferPool {
+public:
+    // Number of buffers that are kept besides the one in use.
+    static constexpr size_t capacity = 3;
+
+public:
+    FrameBufferPool();
+
+    // Replace the buffer (with the pixels of currentResolution) by a buffer with the pixels of resolution, and keep the
+    // current buffer for later (evicting the least recently used buffer if the pool is full). A buffer that is not in
+    // the pool is allocated and cleared to black; a pooled buffer still holds the last image of its resolution, which
+    // the renderer overwrites completely.
+    void exchange(std::vector<glm::vec4>& buffer, const glm::ivec2& currentResolution, const glm::ivec2& resolution);
+
+    // Number of buffers in the pool (not counting the one in use).
+    size_t size() const;
+    // Number of buffers that had to be allocated.
+    size_t numMisses() const;
+
+private:
+    struct Entry {
+        glm::ivec2 resolution;
+        std::vector<glm::vec4> pixels;
+        uint64_t lastUse;
+    };
+    // At most capacity entries (reserved up front such that returning a buffer does not allocate).
+    std::vector<Entry> m_entries;
+    uint64_t m_useCounter { 0 };
+    size_t m_numMisses { 0 };
+};
+}
@@ -0,0 +1,186 @@
+#include "instrumentation.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace render::instrumentation {
+
+using clock = std::chrono::steady_clock;
+
+// Counters of all threads that are alive, plus the totals of the threads that have exited.
+struct Registry {
+    std::mutex mutex;
+    std::vector<ThreadCounters*> threads;
+    std::array<uint64_t, numCounters> exitedCounters {};
+    std::array<uint64_t, numStages> exitedStageTimes {};
+    // Totals at the previous call to collectFrame.
+    std::array<uint64_t, numCounters> previousCounters {};
+    std::array<uint64_t, numStages> previousStageTimes {};
+
+    std::atomic<bool> tracing { false };
+    const clock::time_point traceOrigin { clock::now() };
+    // Trace events, already formatted as JSON objects.
+    std::vector<std::string> traceEvents;
+};
+
+static Registry& registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+static int64_t traceTimestamp(clock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time - registry().traceOrigin).count();
+}
+
+static size_t threadId()
+{
+    return std::hash<std::thread::id>()(std::this_thread::get_id()) % 100000;
+}
+
+const char* counterName(Counter counter)
+{
+    switch (counter) {
+    case Counter::Samples:
+        return "Samples";
+    case Counter::RaysTraced:
+        return "Rays traced";
+    case Counter::RaysCulled:
+        return "Rays culled";
+    case Counter::EarlyTerminations:
+        return "Early terminations";
+    case Counter::SkippedDistance:
+        return "Skipped distance";
+    default:
+        throw std::exception();
+    }
+}
+
+const char* stageName(Stage stage)
+{
+    switch (stage) {
+    case Stage::RayGeneration:
+        return "Ray generation";
+    case Stage::RayMarching:
+        return "Ray marching";
+    case Stage::Upload:
+        return "Upload";
+    case Stage::Draw:
+        return "Draw";
+    default:
+        throw std::exception();
+    }
+}
+
+ThreadCounters::ThreadCounters()
+{
+    Registry& r = registry();
+    std::lock_guard lock { r.mutex };
+    r.threads.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters()
+{
+    Registry& r = registry();
+    std::lock_guard lock { r.mutex };
+    for (size_t i = 0; i < numCounters; i++)
+        r.exitedCounters[i] += counters[i].load(std::memory_order_relaxed);
+    for (size_t i = 0; i < numStages; i++)
+        r.exitedStageTimes[i] += stageTimes[i].load(std::memory_order_relaxed);
+    r.threads.erase(std::remove(std::begin(r.threads), std::end(r.threads), this), std::end(r.threads));
+}
+
+FrameRecord collectFrame()
+{
+    FrameRecord out {};
+    if constexpr (!enabled())
+        return out;
+
+    Registry& r = registry();
+    std::lock_guard lock { r.mutex };
+    std::array<uint64_t, numCounters> counters = r.exitedCounters;
+    std::array<uint64_t, numStages> stageTimes = r.exitedStageTimes;
+    for (const ThreadCounters* pThread : r.threads) {
+        for (size_t i = 0; i < numCounters; i++)
+            counters[i] += pThread->counters[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < numStages; i++)
+            stageTimes[i] += pThread->stageTimes[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < numCounters; i++)
+        out.counters[i] = counters[i] - r.previousCounters[i];
+    for (size_t i = 0; i < numStages; i++)
+        out.stageTimes[i] = std::chrono::nanoseconds(stageTimes[i] - r.previousStageTimes[i]);
+    r.previousCounters = counters;
+    r.previousStageTimes = stageTimes;
+
+    if (r.tracing) {
+        // One counter track per counter and one for the stage times that are summed over the render threads.
+        const int64_t timestamp = traceTimestamp(clock::now());
+        for (size_t i = 0; i < numCounters; i++) {
+            std::ostringstream event;
+            event << "{\"name\":\"" << counterName(Counter(i)) << "\",\"ph\":\"C\",\"ts\":" << timestamp
+                  << ",\"pid\":0,\"tid\":0,\"args\":{\"value\":" << out.counters[i] << "}}";
+            r.traceEvents.push_back(event.str());
+        }
+        std::ostringstream event;
+        event << "{\"name\":\"Render threads (ms)\",\"ph\":\"C\",\"ts\":" << timestamp << ",\"pid\":0,\"tid\":0,\"args\":{"
+              << "\"" << stageName(Stage::RayGeneration) << "\":" << out.stageTimes[size_t(Stage::RayGeneration)].count() * 1000.0 << ","
+              << "\"" << stageName(Stage::RayMarching) << "\":" << out.stageTimes[size_t(Stage::RayMarching)].count() * 1000.0 << "}}";
+        r.traceEvents.push_back(event.str());
+    }
+    return out;
+}
+
+void setTracing(bool tracing)
+{
+    Registry& r = registry();
+    std::lock_guard lock { r.mutex };
+    if (tracing && !r.tracing)
+        r.traceEvents.clear();
+    r.tracing = tracing;
+}
+
+bool tracing()
+{
+    return registry().tracing;
+}
+
+bool writeTrace(const std::filesystem::path& file)
+{
+    Registry& r = registry();
+    std::lock_guard lock { r.mutex };
+    std::ofstream ofs { file };
+    ofs << "{\"traceEvents\":[";
+    for (size_t i = 0; i < r.traceEvents.size(); i++)
+        ofs << (i == 0 ? "\n" : ",\n") << r.traceEvents[i];
+    ofs << "\n]}\n";
+    return bool(ofs);
+}
+
+ScopedStage::ScopedStage(Stage stage)
+    : m_stage(stage)
+    , m_start(clock::now())
+{
+}
+
+ScopedStage::~ScopedStage()
+{
+    const clock::time_point end = clock::now();
+    addStageTime(m_stage, end - m_start);
+
+    Registry& r = registry();
+    if (!r.tracing)
+        return;
+    std::ostringstream event;
+    event << "{\"name\":\"" << stageName(m_stage) << "\",\"ph\":\"X\",\"ts\":" << traceTimestamp(m_start)
+          << ",\"dur\":" << traceTimestamp(end) - traceTimestamp(m_start) << ",\"pid\":0,\"tid\":" << threadId() << "}";
+    std::lock_guard lock { r.mutex };
+    r.traceEvents.push_back(event.str());
+}
+}
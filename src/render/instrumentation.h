@@ -0,0 +1,131 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Per-frame statistics of the renderer: how much work the rays did and where the time went. Collecting them costs time
+// in the hot paths (a clock read per ray), so they are only collected in builds that define VOLVIS_INSTRUMENTATION=1.
+// In other builds the VOLVIS_* macros below expand to nothing and collectFrame returns empty records.
+#ifndef VOLVIS_INSTRUMENTATION
+#define VOLVIS_INSTRUMENTATION 0
+#endif
+
+namespace render::instrumentation {
+
+enum class Counter {
+    // Interpolated samples of the volume taken by the ray marching kernels.
+    Samples,
+    // Rays that intersect the volume bounds, and rays that miss them (which are not marched at all).
+    RaysTraced,
+    RaysCulled,
+    // Rays that stopped before leaving the volume because they became opaque (see RenderConfig::earlyTerminationOpacity).
+    EarlyTerminations,
+    // Distance (in voxels, rounded down per skip) that rays skipped over empty macro cells.
+    SkippedDistance,
+    Count
+};
+
+enum class Stage {
+    // Generating the rays and intersecting them with the volume bounds (summed over all render threads).
+    RayGeneration,
+    // Marching the rays through the volume (summed over all render threads).
+    RayMarching,
+    // Copying a finished frame into the texture (see ui::FullScreenTextureGL::update).
+    Upload,
+    // Drawing the texture and the bounding box with OpenGL.
+    Draw,
+    Count
+};
+
+static constexpr size_t numCounters = size_t(Counter::Count);
+static constexpr size_t numStages = size_t(Stage::Count);
+
+const char* counterName(Counter counter);
+const char* stageName(Stage stage);
+
+// Everything that was counted since the previous call to collectFrame.
+struct FrameRecord {
+    std::array<uint64_t, numCounters> counters {};
+    std::array<std::chrono::duration<double>, numStages> stageTimes {};
+};
+
+// Whether this build collects statistics.
+constexpr bool enabled() { return VOLVIS_INSTRUMENTATION != 0; }
+
+// Sum the counters of all threads since the previous call. The application calls this once per frame.
+FrameRecord collectFrame();
+
+// Tracing: while enabled, every collected frame and every stage that is timed with a ScopedStage is recorded as an event
+// of a Chrome trace (chrome://tracing or https://ui.perfetto.dev), which writeTrace saves as JSON. Returns false if the
+// file could not be written.
+void setTracing(bool tracing);
+bool tracing();
+bool writeTrace(const std::filesystem::path& file);
+
+// Counters of one thread. Only the owning thread writes them, so plain loads and stores suffice (no atomic
+// read-modify-write); collectFrame reads them from another thread.
+struct ThreadCounters {
+    ThreadCounters();
+    ~ThreadCounters();
+
+    std::array<std::atomic<uint64_t>, numCounters> counters {};
+    // Nanoseconds.
+    std::array<std::atomic<uint64_t>, numStages> stageTimes {};
+};
+// Defined in the header so that the hot paths do not call into another translation unit.
+inline thread_local ThreadCounters threadCounters;
+
+inline void count(Counter counter, uint64_t amount = 1)
+{
+    std::atomic<uint64_t>& value = threadCounters.counters[size_t(counter)];
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+inline void addStageTime(Stage stage, std::chrono::steady_clock::duration duration)
+{
+    std::atomic<uint64_t>& value = threadCounters.stageTimes[size_t(stage)];
+    const auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    value.store(value.load(std::memory_order_relaxed) + uint64_t(nanoseconds), std::memory_order_relaxed);
+}
+
+// Adds the time until the end of the scope to the stage, and records it as a trace event while tracing. Meant for
+// coarse stages (once per frame); per ray stages use addStageTime.
+class ScopedStage {
+public:
+    ScopedStage(Stage stage);
+    ~ScopedStage();
+
+private:
+    Stage m_stage;
+    std::chrono::steady_clock::time_point m_start;
+};
+}
+
+#if VOLVIS_INSTRUMENTATION
+#define VOLVIS_COUNT(counter, amount) ::render::instrumentation::count(::render::instrumentation::Counter::counter, uint64_t(amount))
+#define VOLVIS_SCOPED_STAGE(stage) const ::render::instrumentation::ScopedStage scopedStage##stage { ::render::instrumentation::Stage::stage }
+// Reads the clock into a variable that VOLVIS_ADD_STAGE_TIME measures from (and then resets).
+#define VOLVIS_STAGE_START(variable) auto variable = std::chrono::steady_clock::now()
+#define VOLVIS_ADD_STAGE_TIME(stage, variable)                                                                                     \
+    do {                                                                                                                           \
+        const auto variable##End = std::chrono::steady_clock::now();                                                               \
+        ::render::instrumentation::addStageTime(::render::instrumentation::Stage::stage, variable##End - variable);                \
+        variable = variable##End;                                                                                                  \
+    } while (false)
+#else
+#define VOLVIS_COUNT(counter, amount) \
+    do {                              \
+    } while (false)
+#define VOLVIS_SCOPED_STAGE(stage) \
+    do {                           \
+    } while (false)
+#define VOLVIS_STAGE_START(variable) \
+    do {                             \
+    } while (false)
+#define VOLVIS_ADD_STAGE_TIME(stage, variable) \
+    do {                                       \
+    } while (false)
+#endif
@@ -0,0 +1,461 @@
+#include "packet_tracer.h"
+#include "instrumentation.h"
+#include "volume/voxel_layout.h"
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// The packet kernels use AVX2 which is only available on x86-64. The kernels are compiled for AVX2 regardless of the
+// compiler flags (such that the rest of the program still runs on any x86-64 CPU); whether they can be used is
+// checked at runtime. On other architectures the renderer always uses the scalar code path.
+#if defined(__x86_64__) || defined(_M_X64)
+#define PACKET_TRACER_AVX2 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define PACKET_TRACER_AVX2 0
+#endif
+
+namespace render {
+
+#if PACKET_TRACER_AVX2
+
+static bool cpuSupportsAVX2()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    // The OS should save the YMM registers on a context switch (OSXSAVE + XCR0).
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool packetTracingSupported()
+{
+    static const bool supported = cpuSupportsAVX2();
+    return supported;
+}
+
+// Everything below is compiled for AVX2. Do NOT call any (inline) functions from other headers in this region; the
+// compiler might emit an AVX2 version of them which the linker could then also pick for the rest of the program.
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+// Per lane state that is moved between registers and memory when lanes are handled one by one.
+struct alignas(32) PacketLanes {
+    float t[packetSize];
+    float tCellExit[packetSize];
+    float maxVal[packetSize];
+    float remainingMax[packetSize];
+    float tRemainingMaxExit[packetSize];
+    float x[packetSize];
+    float y[packetSize];
+    float z[packetSize];
+};
+
+// Mask with all bits set for the lanes whose bit is set in laneMask.
+static __m256 laneMaskToVector(int laneMask)
+{
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256i selected = _mm256_and_si256(_mm256_set1_epi32(laneMask), bits);
+    return _mm256_castsi256_ps(_mm256_cmpeq_epi32(selected, bits));
+}
+
+// Index into the voxel array of the given voxel coordinates (see volume::VoxelIndexer::index()).
+#if VOLVIS_INSTRUMENTATION
+static int countLanes(int laneMask)
+{
+    int out = 0;
+    for (int lane = 0; lane < packetSize; lane++)
+        out += (laneMask >> lane) & 1;
+    return out;
+}
+#endif
+
+static __m256i voxelIndex(const PacketTraceContext& context, __m256i x, __m256i y, __m256i z)
+{
+    using volume::VoxelIndexer;
+    if (context.bricked) {
+        const __m256i brickMask = _mm256_set1_epi32(VoxelIndexer::brickMask);
+        const __m256i brickX = _mm256_srli_epi32(x, VoxelIndexer::brickBits);
+        const __m256i brickY = _mm256_srli_epi32(y, VoxelIndexer::brickBits);
+        const __m256i brickZ = _mm256_srli_epi32(z, VoxelIndexer::brickBits);
+        const __m256i brick = _mm256_add_epi32(brickX,
+            _mm256_mullo_epi32(_mm256_set1_epi32(context.brickDim[0]),
+                _mm256_add_epi32(brickY, _mm256_mullo_epi32(_mm256_set1_epi32(context.brickDim[1]), brickZ))));
+        const __m256i local = _mm256_or_si256(_mm256_and_si256(x, brickMask),
+            _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(y, brickMask), VoxelIndexer::brickBits),
+                _mm256_slli_epi32(_mm256_and_si256(z, brickMask), 2 * VoxelIndexer::brickBits)));
+        return _mm256_or_si256(_mm256_slli_epi32(brick, 3 * VoxelIndexer::brickBits), local);
+    }
+    return _mm256_add_epi32(x,
+        _mm256_mullo_epi32(_mm256_set1_epi32(context.dim[0]),
+            _mm256_add_epi32(y, _mm256_mullo_epi32(_mm256_set1_epi32(context.dim[1]), z))));
+}
+
+// Load the voxels at the given indices. A hardware gather cannot load 8 or 16-bit values without reading past the
+// element (and thus possibly past the end of the array), so those loads are performed one lane at a time.
+template <typename Voxel>
+static __m256 loadVoxels(const void* pVoxels, __m256i indices)
+{
+    if constexpr (std::is_same_v<Voxel, float>) {
+        return _mm256_i32gather_ps(static_cast<const float*>(pVoxels), indices, sizeof(float));
+    } else {
+        alignas(32) int32_t index[packetSize];
+        alignas(32) int32_t value[packetSize];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(index), indices);
+        for (int lane = 0; lane < packetSize; lane++)
+            value[lane] = static_cast<const Voxel*>(pVoxels)[index[lane]];
+        return _mm256_cvtepi32_ps(_mm256_load_si256(reinterpret_cast<const __m256i*>(value)));
+    }
+}
+
+// Lanes for which 0 <= value and valuePlusFootprint < upper, for each axis (the bounds check of the interpolation).
+static __m256 insideMask(const __m256 value[3], const __m256 valuePlusFootprint[3], const int dim[3])
+{
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int axis = 0; axis < 3; axis++) {
+        const __m256 upper = _mm256_set1_ps(static_cast<float>(dim[axis]));
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(value[axis], _mm256_setzero_ps(), _CMP_GE_OQ));
+        inside = _mm256_and_ps(inside, _mm256_cmp_ps(valuePlusFootprint[axis], upper, _CMP_LT_OQ));
+    }
+    return inside;
+}
+
+// Same as volume::Volume::linearInterpolate (without the range check).
+static __m256 linearInterpolate(__m256 g0, __m256 g1, __m256 factor)
+{
+    return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), factor), g0), _mm256_mul_ps(factor, g1));
+}
+
+// Same as volume::Volume::getSampleNearestNeighbourInterpolation. Lanes that are outside of the volume or that are
+// not active return 0.
+template <typename Voxel>
+static __m256 sampleNearestNeighbour(const PacketTraceContext& context, const __m256 coord[3], __m256 active)
+{
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 rounded[3] = { _mm256_add_ps(coord[0], half), _mm256_add_ps(coord[1], half), _mm256_add_ps(coord[2], half) };
+    const __m256 inside = _mm256_and_ps(active, insideMask(rounded, rounded, context.dim));
+    const __m256i insideInt = _mm256_castps_si256(inside);
+
+    // Lanes outside of the volume read voxel 0 instead.
+    const __m256i x = _mm256_and_si256(_mm256_cvttps_epi32(rounded[0]), insideInt);
+    const __m256i y = _mm256_and_si256(_mm256_cvttps_epi32(rounded[1]), insideInt);
+    const __m256i z = _mm256_and_si256(_mm256_cvttps_epi32(rounded[2]), insideInt);
+    return _mm256_and_ps(loadVoxels<Voxel>(context.pVoxels, voxelIndex(context, x, y, z)), inside);
+}
+
+// Same order of operations as volume::Volume::biLinearInterpolate.
+template <typename Voxel>
+static __m256 biLinearInterpolate(const PacketTraceContext& context, const __m256i x[2], const __m256i y[2], __m256i z, __m256 xFactor, __m256 yFactor)
+{
+    const __m256 g00 = loadVoxels<Voxel>(context.pVoxels, voxelIndex(context, x[0], y[0], z));
+    const __m256 g01 = loadVoxels<Voxel>(context.pVoxels, voxelIndex(context, x[0], y[1], z));
+    const __m256 g10 = loadVoxels<Voxel>(context.pVoxels, voxelIndex(context, x[1], y[0], z));
+    const __m256 g11 = loadVoxels<Voxel>(context.pVoxels, voxelIndex(context, x[1], y[1], z));
+    const __m256 g0 = linearInterpolate(g00, g10, xFactor);
+    const __m256 g1 = linearInterpolate(g01, g11, xFactor);
+    return linearInterpolate(g0, g1, yFactor);
+}
+
+// Same as volume::Volume::getSampleTriLinearInterpolation. Lanes that are outside of the volume or that are
+// not active return 0.
+template <typename Voxel>
+static __m256 sampleTriLinear(const PacketTraceContext& context, const __m256 coord[3], __m256 active)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 coordPlusOne[3] = { _mm256_add_ps(coord[0], one), _mm256_add_ps(coord[1], one), _mm256_add_ps(coord[2], one) };
+    const __m256 inside = _mm256_and_ps(active, insideMask(coord, coordPlusOne, context.dim));
+    const __m256i insideInt = _mm256_castps_si256(inside);
+
+    // Lanes outside of the volume read voxel 0 instead.
+    __m256i lower[3], upper[3];
+    __m256 factor[3];
+    for (int axis = 0; axis < 3; axis++) {
+        const __m256i truncated = _mm256_cvttps_epi32(coord[axis]);
+        factor[axis] = _mm256_sub_ps(coord[axis], _mm256_cvtepi32_ps(truncated));
+        lower[axis] = _mm256_and_si256(truncated, insideInt);
+        upper[axis] = _mm256_and_si256(_mm256_add_epi32(truncated, _mm256_set1_epi32(1)), insideInt);
+    }
+
+    const __m256i x[2] = { lower[0], upper[0] };
+    const __m256i y[2] = { lower[1], upper[1] };
+    const __m256 valueBottom = biLinearInterpolate<Voxel>(context, x, y, lower[2], factor[0], factor[1]);
+    const __m256 valueTop = biLinearInterpolate<Voxel>(context, x, y, upper[2], factor[0], factor[1]);
+    return _mm256_and_ps(linearInterpolate(valueBottom, valueTop, factor[2]), inside);
+}
+
+template <typename Voxel>
+static __m256 sampleVolume(const PacketTraceContext& context, const __m256 coord[3], __m256 active)
+{
+    if (context.nearestNeighbour)
+        return sampleNearestNeighbour<Voxel>(context, coord, active);
+    return sampleTriLinear<Voxel>(context, coord, active);
+}
+
+static __m256 sampleVolume(const PacketTraceContext& context, const __m256 coord[3], __m256 active)
+{
+    switch (context.voxelType) {
+    case PacketVoxelType::UInt8: {
+        return sampleVolume<uint8_t>(context, coord, active);
+    }
+    case PacketVoxelType::UInt16: {
+        return sampleVolume<uint16_t>(context, coord, active);
+    }
+    default: {
+        return sampleVolume<float>(context, coord, active);
+    }
+    }
+}
+
+// Look up the RGBA values of the 1D transfer function (same mapping as Renderer::getTFValue). Values below the
+// range of the transfer function map to the first entry.
+static void lookupTransferFunction(const PacketTraceContext& context, __m256 value, __m256 rgba[4])
+{
+    const __m256 range01 = _mm256_div_ps(_mm256_sub_ps(value, _mm256_set1_ps(context.tfIndexStart)), _mm256_set1_ps(context.tfIndexRange));
+    const __m256 scaled = _mm256_mul_ps(range01, _mm256_set1_ps(static_cast<float>(context.transferFunctionSize)));
+    // Clamp before converting to int to prevent overflow.
+    const __m256 clamped = _mm256_min_ps(scaled, _mm256_set1_ps(static_cast<float>(context.transferFunctionSize - 1)));
+    const __m256i entry = _mm256_max_epi32(_mm256_cvttps_epi32(clamped), _mm256_setzero_si256());
+
+    alignas(32) int32_t entries[packetSize];
+    alignas(32) float channels[4][packetSize];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(entries), entry);
+    for (int lane = 0; lane < packetSize; lane++) {
+        const float* pEntry = context.pTransferFunction + 4 * entries[lane];
+        for (int channel = 0; channel < 4; channel++)
+            channels[channel][lane] = pEntry[channel];
+    }
+    for (int channel = 0; channel < 4; channel++)
+        rgba[channel] = _mm256_load_ps(channels[channel]);
+}
+
+// Marches all rays of the packet at the same time; every lane follows exactly the same steps as the scalar code in
+// Renderer (traceRayMIP/traceRayComposite/traceRayMIDA). Lanes are disabled when their ray has finished.
+void tracePacket(const PacketTraceContext& context, const RayPacket& packet, float* pOutColors, PacketTraceStatistics* pStatistics)
+{
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sampleStep = _mm256_set1_ps(context.sampleStep);
+    const __m256 volumeMaximum = _mm256_set1_ps(context.volumeMaximum);
+    const __m256 earlyTerminationOpacity = _mm256_set1_ps(context.earlyTerminationOpacity);
+
+    PacketLanes lanes;
+    alignas(32) float origin[3][packetSize];
+    alignas(32) float direction[3][packetSize];
+    alignas(32) float tmax[packetSize];
+    int activeLanes = 0;
+    for (int lane = 0; lane < packetSize; lane++) {
+        const Ray& ray = packet.rays[lane];
+        lanes.t[lane] = lanes.tCellExit[lane] = ray.tmin;
+        lanes.maxVal[lane] = 0.0f;
+        tmax[lane] = ray.tmax;
+        origin[0][lane] = ray.origin.x;
+        origin[1][lane] = ray.origin.y;
+        origin[2][lane] = ray.origin.z;
+        direction[0][lane] = ray.direction.x;
+        direction[1][lane] = ray.direction.y;
+        direction[2][lane] = ray.direction.z;
+        if (packet.hit[lane])
+            activeLanes |= 1 << lane;
+    }
+
+    __m256 t = _mm256_load_ps(lanes.t);
+    __m256 tCellExit = t;
+    const __m256 rayTMax = _mm256_load_ps(tmax);
+    __m256 samplePos[3], increment[3];
+    for (int axis = 0; axis < 3; axis++) {
+        const __m256 axisOrigin = _mm256_load_ps(origin[axis]);
+        const __m256 axisDirection = _mm256_load_ps(direction[axis]);
+        samplePos[axis] = _mm256_add_ps(axisOrigin, _mm256_mul_ps(t, axisDirection));
+        increment[axis] = _mm256_mul_ps(sampleStep, axisDirection);
+    }
+
+    // MIP/MIDA: maximum value along the ray. Composite/MIDA: accumulated color and opacity (the accumulated
+    // opacity is always equal to the alpha channel of the accumulated color).
+    __m256 maxVal = _mm256_setzero_ps();
+    __m256 accumulatedColor[4] = { _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps(), _mm256_setzero_ps() };
+    // MIDA: upper bound of the samples on the rest of the ray, valid until tRemainingMaxExit (see Renderer::traceRayMIDA).
+    __m256 remainingMax = _mm256_setzero_ps();
+    __m256 tRemainingMaxExit = _mm256_set1_ps(std::numeric_limits<float>::lowest());
+
+#if VOLVIS_INSTRUMENTATION
+    int samples = 0;
+    int terminatedLanes = 0;
+#endif
+    while (true) {
+        activeLanes &= _mm256_movemask_ps(_mm256_cmp_ps(t, rayTMax, _CMP_LE_OQ));
+        if (activeLanes == 0)
+            break;
+
+        // Lanes that enter a new macro cell check (one by one) for empty space that can be skipped.
+        const int crossingLanes = activeLanes & _mm256_movemask_ps(_mm256_cmp_ps(t, tCellExit, _CMP_GE_OQ));
+        if (crossingLanes) {
+            _mm256_store_ps(lanes.t, t);
+            _mm256_store_ps(lanes.tCellExit, tCellExit);
+            _mm256_store_ps(lanes.maxVal, maxVal);
+            _mm256_store_ps(lanes.x, samplePos[0]);
+            _mm256_store_ps(lanes.y, samplePos[1]);
+            _mm256_store_ps(lanes.z, samplePos[2]);
+            for (int lane = 0; lane < packetSize; lane++) {
+                if (!(crossingLanes & (1 << lane)))
+                    continue;
+
+                const float tBefore = lanes.t[lane];
+                if (!context.skipEmptySpace(context.pUserData, packet.rays[lane], context.sampleStep, lanes.maxVal[lane], lanes.t[lane], lanes.tCellExit[lane])) {
+                    activeLanes &= ~(1 << lane);
+                } else if (lanes.t[lane] != tBefore) {
+                    lanes.x[lane] = origin[0][lane] + lanes.t[lane] * direction[0][lane];
+                    lanes.y[lane] = origin[1][lane] + lanes.t[lane] * direction[1][lane];
+                    lanes.z[lane] = origin[2][lane] + lanes.t[lane] * direction[2][lane];
+                }
+            }
+            if (activeLanes == 0)
+                break;
+            t = _mm256_load_ps(lanes.t);
+            tCellExit = _mm256_load_ps(lanes.tCellExit);
+            samplePos[0] = _mm256_load_ps(lanes.x);
+            samplePos[1] = _mm256_load_ps(lanes.y);
+            samplePos[2] = _mm256_load_ps(lanes.z);
+        }
+
+        const __m256 active = laneMaskToVector(activeLanes);
+        const __m256 val = sampleVolume(context, samplePos, active);
+#if VOLVIS_INSTRUMENTATION
+        samples += countLanes(activeLanes);
+#endif
+
+        switch (context.mode) {
+        case PacketMode::MIP: {
+            maxVal = _mm256_blendv_ps(maxVal, _mm256_max_ps(maxVal, val), active);
+            break;
+        }
+        case PacketMode::Composite: {
+            __m256 tfValue[4];
+            lookupTransferFunction(context, val, tfValue);
+            const __m256 weight = _mm256_mul_ps(_mm256_sub_ps(one, accumulatedColor[3]), tfValue[3]);
+            for (int channel = 0; channel < 3; channel++) {
+                const __m256 accumulated = _mm256_add_ps(accumulatedColor[channel], _mm256_mul_ps(weight, tfValue[channel]));
+                accumulatedColor[channel] = _mm256_blendv_ps(accumulatedColor[channel], accumulated, active);
+            }
+            accumulatedColor[3] = _mm256_blendv_ps(accumulatedColor[3], _mm256_add_ps(accumulatedColor[3], weight), active);
+
+            // Stop tracing rays that became opaque.
+            const int opaqueLanes = activeLanes & _mm256_movemask_ps(_mm256_cmp_ps(accumulatedColor[3], earlyTerminationOpacity, _CMP_GE_OQ));
+#if VOLVIS_INSTRUMENTATION
+            terminatedLanes |= opaqueLanes;
+#endif
+            activeLanes &= ~opaqueLanes;
+            break;
+        }
+        case PacketMode::MIDA: {
+            __m256 tfValue[4];
+            lookupTransferFunction(context, val, tfValue);
+            const __m256 normalizedVal = _mm256_div_ps(val, volumeMaximum);
+            const __m256 normalizedMaxVal = _mm256_div_ps(maxVal, volumeMaximum);
+            const __m256 delta = _mm256_and_ps(_mm256_cmp_ps(val, maxVal, _CMP_GT_OQ), _mm256_sub_ps(normalizedVal, normalizedMaxVal));
+            const __m256 beta = _mm256_sub_ps(one, delta);
+
+            const __m256 betaOpacity = _mm256_mul_ps(beta, accumulatedColor[3]);
+            const __m256 weight = _mm256_mul_ps(_mm256_sub_ps(one, betaOpacity), tfValue[3]);
+            for (int channel = 0; channel < 3; channel++) {
+                const __m256 accumulated = _mm256_add_ps(_mm256_mul_ps(beta, accumulatedColor[channel]), _mm256_mul_ps(weight, tfValue[channel]));
+                accumulatedColor[channel] = _mm256_blendv_ps(accumulatedColor[channel], accumulated, active);
+            }
+            accumulatedColor[3] = _mm256_blendv_ps(accumulatedColor[3], _mm256_add_ps(betaOpacity, weight), active);
+            maxVal = _mm256_blendv_ps(maxVal, _mm256_max_ps(maxVal, val), active);
+
+            // Stop tracing rays that stay opaque no matter which maxima follow (same rule as Renderer::traceRayMIDA).
+            const int opaqueLanes = activeLanes & _mm256_movemask_ps(_mm256_cmp_ps(accumulatedColor[3], earlyTerminationOpacity, _CMP_GE_OQ));
+            if (opaqueLanes) {
+                // Refresh the bound on the rest of the ray for lanes that passed the cell that determined it.
+                const int refreshLanes = opaqueLanes & _mm256_movemask_ps(_mm256_cmp_ps(t, tRemainingMaxExit, _CMP_GE_OQ));
+                if (refreshLanes) {
+                    _mm256_store_ps(lanes.t, t);
+                    _mm256_store_ps(lanes.remainingMax, remainingMax);
+                    _mm256_store_ps(lanes.tRemainingMaxExit, tRemainingMaxExit);
+                    for (int lane = 0; lane < packetSize; lane++) {
+                        if (refreshLanes & (1 << lane))
+                            lanes.remainingMax[lane] = context.maximumAlongRay(context.pUserData, packet.rays[lane], context.sampleStep, lanes.t[lane], lanes.tRemainingMaxExit[lane]);
+                    }
+                    remainingMax = _mm256_load_ps(lanes.remainingMax);
+                    tRemainingMaxExit = _mm256_load_ps(lanes.tRemainingMaxExit);
+                }
+                const __m256 remainingDelta = _mm256_div_ps(_mm256_sub_ps(_mm256_max_ps(remainingMax, maxVal), maxVal), volumeMaximum);
+                const __m256 minBeta = _mm256_sub_ps(one, remainingDelta);
+                const int terminated = opaqueLanes & _mm256_movemask_ps(_mm256_cmp_ps(_mm256_mul_ps(accumulatedColor[3], minBeta), earlyTerminationOpacity, _CMP_GE_OQ));
+#if VOLVIS_INSTRUMENTATION
+                terminatedLanes |= terminated;
+#endif
+                activeLanes &= ~terminated;
+            }
+            break;
+        }
+        }
+
+        // Lanes that are no longer active are never used again so they do not need to be masked.
+        t = _mm256_add_ps(t, sampleStep);
+        for (int axis = 0; axis < 3; axis++)
+            samplePos[axis] = _mm256_add_ps(samplePos[axis], increment[axis]);
+    }
+
+#if VOLVIS_INSTRUMENTATION
+    if (pStatistics) {
+        pStatistics->samples += samples;
+        pStatistics->earlyTerminations += countLanes(terminatedLanes);
+    }
+#else
+    (void)pStatistics;
+#endif
+
+    alignas(32) float channels[4][packetSize];
+    if (context.mode == PacketMode::MIP) {
+        // Normalize the result to a range of [0 to volume maximum].
+        const __m256 normalized = _mm256_div_ps(maxVal, volumeMaximum);
+        for (int channel = 0; channel < 3; channel++)
+            _mm256_store_ps(channels[channel], normalized);
+        _mm256_store_ps(channels[3], one);
+    } else {
+        for (int channel = 0; channel < 4; channel++)
+            _mm256_store_ps(channels[channel], accumulatedColor[channel]);
+    }
+    for (int lane = 0; lane < packetSize; lane++) {
+        for (int channel = 0; channel < 4; channel++)
+            pOutColors[4 * lane + channel] = channels[channel][lane];
+    }
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#else
+
+bool packetTracingSupported()
+{
+    return false;
+}
+
+void tracePacket(const PacketTraceContext&, const RayPacket&, float*, PacketTraceStatistics*)
+{
+    // The renderer only uses packets when packetTracingSupported() returns true.
+    assert(false);
+}
+
+#endif
+}
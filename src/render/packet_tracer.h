@@ -0,0 +1,73 @@
+#pragma once
+#include "render/ray.h"
+#include <cstdint>
+
+namespace render {
+
+// Number of rays that are traced together by the packet kernels (one AVX2 register of floats).
+static constexpr int packetSize = 8;
+
+// Neighbouring rays (pixels) that are marched together.
+struct RayPacket {
+    Ray rays[packetSize];
+    // Whether the ray intersects the volume bounds; rays that miss are ignored.
+    bool hit[packetSize];
+};
+
+enum class PacketMode {
+    MIP,
+    Composite,
+    MIDA
+};
+
+// Same as volume::VoxelType.
+enum class PacketVoxelType {
+    UInt8,
+    UInt16,
+    Float
+};
+
+// Frame-constant data used by the packet kernels. This only contains plain data because the kernels are compiled
+// for a different instruction set than the rest of the program; they should not call (inline) code from other headers.
+struct PacketTraceContext {
+    PacketMode mode;
+    float sampleStep;
+    // See RenderConfig::earlyTerminationOpacity.
+    float earlyTerminationOpacity;
+
+    // Voxel data as stored by volume::Volume (see volume::VoxelIndexer).
+    const void* pVoxels;
+    PacketVoxelType voxelType;
+    int dim[3];
+    int brickDim[3];
+    bool bricked;
+    bool nearestNeighbour; // Nearest neighbour or tri-linear interpolation.
+    float volumeMaximum;
+
+    // 1D transfer function: transferFunctionSize RGBA entries.
+    const float* pTransferFunction;
+    int transferFunctionSize;
+    float tfIndexStart;
+    float tfIndexRange;
+
+    // Empty space skipping for a single ray (see Renderer::skipEmptySpace). It is only called when a ray
+    // crosses into a new macro cell. Returns false if no samples are left on the ray.
+    bool (*skipEmptySpace)(const void* pUserData, const Ray& ray, float sampleStep, float maxVal, float& t, float& tCellExit);
+    // Upper bound of the samples from distance t onwards (see Renderer::maximumAlongRay), used by MIDA to terminate rays.
+    float (*maximumAlongRay)(const void* pUserData, const Ray& ray, float sampleStep, float t, float& tMaximumExit);
+    const void* pUserData;
+};
+
+// Work done by tracePacket, only counted in builds with instrumentation (see instrumentation.h).
+struct PacketTraceStatistics {
+    int samples;
+    int earlyTerminations;
+};
+
+// Whether the CPU that we are running on supports the packet kernels.
+bool packetTracingSupported();
+
+// Trace all rays of the packet and write an RGBA color per ray to pOutColors (packetSize * 4 floats). The statistics are
+// added to pStatistics if it is not null.
+void tracePacket(const PacketTraceContext& context, const RayPacket& packet, float* pOutColors, PacketTraceStatistics* pStatistics = nullptr);
+}
@@ -0,0 +1,42 @@
+#include "preintegration_table.h"
+#include <cmath>
+#include <cstdlib>
+#include <glm/vec3.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace render {
+
+// The entries of the transfer function are constant over their bin, so a segment from entry front to entry back crosses
+// |back - front| bins: half of the first and last bin and all bins in between. Each bin covers its share of the segment
+// and is composited front-to-back with its opacity corrected for that share.
+void PreintegrationTable::build(const std::array<glm::vec4, size>& tfColorMap)
+{
+    m_table.resize(size * size);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size), [&](const tbb::blocked_range<size_t>& frontRange) {
+        for (size_t front = frontRange.begin(); front != frontRange.end(); front++) {
+            for (size_t back = 0; back < size; back++) {
+                if (front == back) {
+                    m_table[front * size + back] = tfColorMap[front];
+                    continue;
+                }
+
+                const int numBins = std::abs(int(back) - int(front));
+                const int direction = back > front ? 1 : -1;
+                glm::vec3 color(0.0f);
+                float opacity = 0.0f;
+                for (int i = 0; i <= numBins; i++) {
+                    const glm::vec4& entry = tfColorMap[size_t(int(front) + i * direction)];
+                    if (entry.a <= 0.0f)
+                        continue;
+                    const float share = (i == 0 || i == numBins ? 0.5f : 1.0f) / float(numBins);
+                    const float entryOpacity = 1.0f - std::pow(1.0f - entry.a, share);
+                    color += (1.0f - opacity) * entryOpacity * glm::vec3(entry);
+                    opacity += (1.0f - opacity) * entryOpacity;
+                }
+                m_table[front * size + back] = opacity > 0.0f ? glm::vec4(color / opacity, opacity) : glm::vec4(0.0f);
+            }
+        }
+    });
+}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <glm/vec4.hpp>
+#include <vector>
+
+namespace render {
+
+// Preintegrated 1D transfer function: the color and opacity of a ray segment of one voxel along which the value
+// changes linearly from the value of a front sample to the value of a back sample (both given as transfer function
+// entries). Compositing whole segments instead of point samples captures thin features of the transfer function that
+// fall between two samples, which allows for larger sample steps at the same image quality.
+class PreintegrationTable {
+public:
+    static constexpr size_t size = 256;
+
+public:
+    // Integrate all segments of the transfer function (in parallel).
+    void build(const std::array<glm::vec4, size>& tfColorMap);
+
+    // Color (not premultiplied by the opacity) and opacity of the segment. A segment of which the front and back are
+    // the same entry has the color and opacity of that entry.
+    glm::vec4 lookup(size_t front, size_t back) const;
+
+private:
+    // size x size entries, indexed by front * size + back.
+    std::vector<glm::vec4> m_table;
+};
+
+inline glm::vec4 PreintegrationTable::lookup(size_t front, size_t back) const
+{
+    return m_table[front * size + back];
+}
+}
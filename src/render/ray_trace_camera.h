@@ -1,7 +1,9 @@
 #pragma once
 #include "ray.h"
+#include <cstddef>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <gsl/span>
 
 namespace render {
 
@@ -13,6 +15,14 @@ public:
     virtual glm::vec3 forward() const = 0;
 
     virtual render::Ray generateRay(const glm::vec2& pixel) const = 0;
+    // The rays through the given pixels (rays[i] goes through pixels[i], both spans have the same size). The renderer
+    // generates the rays of a row of a tile at once; cameras override this to compute the per-frame constants (such as
+    // the basis of the screen plane) once per batch instead of once per ray.
+    virtual void generateRays(gsl::span<const glm::vec2> pixels, gsl::span<render::Ray> rays) const
+    {
+        for (size_t i = 0; i < pixels.size(); i++)
+            rays[i] = generateRay(pixels[i]);
+    }
 };
 
-}
\ No newline at end of file
+}
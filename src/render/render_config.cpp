@@ -0,0 +1,74 @@
+#include "render_config.h"
+#include <cstring>
+
+namespace render {
+
+// Modes that map values to colors with the 1D transfer function.
+static bool usesTransferFunction1D(RenderMode renderMode)
+{
+    return renderMode == RenderMode::RenderComposite || renderMode == RenderMode::RenderMIDA || renderMode == RenderMode::RenderCombined;
+}
+
+// Modes that accumulate opacity along the ray.
+static bool accumulatesOpacity(RenderMode renderMode)
+{
+    return usesTransferFunction1D(renderMode) || renderMode == RenderMode::RenderTF2D;
+}
+
+RenderConfigChanges renderConfigChanges(const RenderConfig& previous, const RenderConfig& config)
+{
+    RenderConfigChanges out {};
+    out.resolution = config.renderResolution != previous.renderResolution;
+    out.transferFunction1D = config.tfColorMap != previous.tfColorMap
+        || config.tfColorMapIndexStart != previous.tfColorMapIndexStart
+        || config.tfColorMapIndexRange != previous.tfColorMapIndexRange
+        || std::memcmp(&config.channelTransferFunctions, &previous.channelTransferFunctions, sizeof(config.channelTransferFunctions)) != 0;
+    out.transferFunction2D = config.TF2DIntensity != previous.TF2DIntensity || config.TF2DRadius != previous.TF2DRadius;
+    out.adaptiveSampling = config.adaptiveSampling != previous.adaptiveSampling
+        || (config.adaptiveSampling && config.adaptiveSamplingQuality != previous.adaptiveSamplingQuality);
+
+    const RenderMode renderMode = config.renderMode;
+    if (out.resolution || renderMode != previous.renderMode || config.progressive != previous.progressive
+        || (config.progressive && config.progressiveFrames != previous.progressiveFrames)
+        || config.distributedWorkers != previous.distributedWorkers) {
+        out.image = true;
+        return out;
+    }
+    // The slicer only depends on the settings above.
+    if (renderMode == RenderMode::RenderSlicer)
+        return out;
+
+    // Level of detail and temporal reprojection only affect interactive frames, which are always followed by a frame
+    // that does not use them.
+    out.image = config.sampleStep != previous.sampleStep;
+    if (renderMode == RenderMode::RenderIso)
+        out.image |= config.isoValue != previous.isoValue || config.analyticIsoSurface != previous.analyticIsoSurface;
+    if (accumulatesOpacity(renderMode)) {
+        out.image |= config.earlyTerminationOpacity != previous.earlyTerminationOpacity
+            || config.preintegrated != previous.preintegrated;
+    }
+    if (usesTransferFunction1D(renderMode))
+        out.image |= out.transferFunction1D || out.adaptiveSampling;
+    if (renderMode == RenderMode::RenderTF2D)
+        out.image |= out.transferFunction2D || config.TF2DColor != previous.TF2DColor;
+    if (renderMode == RenderMode::RenderCombined)
+        out.image |= config.gamma != previous.gamma;
+
+    // Phong shading (the 2D transfer function and MIP are not shaded), and smoothstep on top of it (MIDA and Combined).
+    if (renderMode != RenderMode::RenderMIP && renderMode != RenderMode::RenderTF2D) {
+        out.image |= config.volumeShading != previous.volumeShading;
+        if (config.volumeShading) {
+            if (renderMode == RenderMode::RenderMIDA || renderMode == RenderMode::RenderCombined) {
+                out.image |= config.smoothstep != previous.smoothstep;
+                if (config.smoothstep)
+                    out.image |= config.gl != previous.gl || config.gh != previous.gh;
+            }
+            const bool phongConstants = config.ka != previous.ka || config.kd != previous.kd || config.ks != previous.ks || config.alpha != previous.alpha
+                || config.fastShading != previous.fastShading;
+            out.shadingOnly = phongConstants && !out.image;
+            out.image |= phongConstants;
+        }
+    }
+    return out;
+}
+}
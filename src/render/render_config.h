@@ -1,5 +1,6 @@
 #pragma once
 #include <array>
+#include <cstddef>
 #include <glm/vec2.hpp>
 #include <glm/vec4.hpp>
 #include <cstring> // memcmp  // macOS change TH
@@ -16,13 +17,57 @@ enum class RenderMode {
     RenderCombined,
 };
 
+// Number of volumes that can be composited together with the main volume (see Renderer::setChannels).
+inline constexpr size_t maxVolumeChannels = 3;
+
+// 1D transfer function of a volume channel, with the same meaning as the 1D transfer function in RenderConfig.
+struct ChannelTransferFunction {
+    std::array<glm::vec4, 256> tfColorMap;
+    float tfColorMapIndexStart;
+    float tfColorMapIndexRange;
+};
+
 struct RenderConfig {
     RenderMode renderMode { RenderMode::RenderSlicer };
     glm::ivec2 renderResolution;
 
     bool volumeShading { false };
     bool smoothstep { false };
+    // Shade with a light at the camera and a tabulated specular power (see Renderer::computePhongShadingHeadlight)
+    // instead of evaluating the full Phong model per sample.
+    bool fastShading { false };
+    // Refine the image over multiple frames instead of lowering the resolution during interaction.
+    bool progressive { false };
+    // Number of jittered samples per pixel that progressive rendering accumulates.
+    int progressiveFrames { 8 };
+    // Rays stop once their accumulated opacity reaches this threshold (Composite, TF2D, MIDA and Combined).
+    float earlyTerminationOpacity { 1.0f };
+    // Take larger steps in regions where the transfer function varies little (Composite, MIDA and Combined). The quality
+    // [0, 1] trades accuracy for speed: higher values take smaller steps.
+    bool adaptiveSampling { false };
+    float adaptiveSamplingQuality { 0.5f };
+    // Distance between two samples along a ray in voxels (the base step of adaptive sampling).
+    float sampleStep { 1.0f };
+    // Classify the segments between consecutive samples with preintegrated transfer functions instead of classifying
+    // the samples themselves (Composite, TF2D, MIDA and Combined). This keeps the image stable at larger sample steps.
+    bool preintegrated { false };
+    // Render a coarser level of the volume pyramid while the user interacts (interactive frames). The level is chosen
+    // such that a voxel roughly matches the footprint of a pixel, but it is always coarser than the full resolution.
+    bool levelOfDetail { false };
+    // Render with this many workers that each hold a part of the volume (sort-last, see DistributedRenderer), or with a
+    // single renderer if 0. Only used by the render modes that the distributed renderer supports.
+    int distributedWorkers { 0 };
+    // Reuse the previous frame during interactive frames: its pixels are reprojected to the new camera and only the
+    // pixels that could not be reprojected (plus a rotating subset of the others) are traced. Not used by the slicer.
+    bool temporalReprojection { false };
+    bool interactive { false };
     float isoValue { 95.0f };
+    // Intersect the iso surface of the trilinear interpolant exactly per voxel cell instead of marching along the ray with
+    // sampleStep (only with linear interpolation).
+    bool analyticIsoSurface { false };
+    // Keep the iso surface hits of the last frame per pixel (position and gradient), such that a change of only the Phong
+    // constants shades them again instead of tracing the rays (ISO with volume shading).
+    bool cacheIsoSurface { false };
     float gamma { 0.0f };
     float ka { 0.1f };
     float kd { 0.7f };
@@ -37,6 +82,9 @@ struct RenderConfig {
     // index = (value - start) / range * tfColorMap.size();
     float tfColorMapIndexStart;
     float tfColorMapIndexRange;
+    // Transfer functions of the volume channels (Composite). Multi-volume compositing does not use preintegration or
+    // adaptive sampling, which only describe the transfer function of the main volume.
+    std::array<ChannelTransferFunction, maxVolumeChannels> channelTransferFunctions;
 
     // 2D transfer function.
     float TF2DIntensity;
@@ -54,4 +102,23 @@ inline bool operator!=(const RenderConfig& lhs, const RenderConfig& rhs)
     return !(lhs == rhs);
 }
 
+// Which parts of the render config changed, grouped by what depends on them (see renderConfigChanges).
+struct RenderConfigChanges {
+    // The image looks different, so it has to be rendered again. Only considers the settings that are used by the
+    // render mode: for example editing the iso value while compositing does not change the image.
+    bool image { false };
+    // The size of the framebuffer.
+    bool resolution { false };
+    // The 1D transfer function (including the mapping from values to the color map) and the triangle of the 2D transfer
+    // function, which are used by the macro cell classification and the lookup tables of the renderer.
+    bool transferFunction1D { false };
+    bool transferFunction2D { false };
+    bool adaptiveSampling { false };
+    // The image changed only because of the Phong constants (ka, kd, ks and alpha), so the surfaces did not move.
+    bool shadingOnly { false };
+};
+
+// The interactive flag is not compared: it is set per frame by the application (not by the user).
+RenderConfigChanges renderConfigChanges(const RenderConfig& previous, const RenderConfig& config);
+
 }
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include "render_service.h"
+#include "volume/brick_cache.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <utility>
+
+namespace render {
+
+// Progressive passes are rendered in batches; after each batch the image is handed to the user interface.
+static constexpr std::chrono::duration<double> progressiveBatchTime { 1.0 / 60.0 };
+
+// How often the render thread checks whether the bricks that a frame was missing have been loaded.
+static constexpr std::chrono::milliseconds brickPollInterval { 50 };
+
+// Bricks of a streaming volume that are visible from the camera, front to back. The bricks are found by marching a
+// sparse grid of rays (in steps of half a brick) through the volume.
+static std::vector<size_t> visibleBricks(const volume::BrickCache& brickCache, const RayTraceCamera& camera)
+{
+    static constexpr int raysPerAxis = 32;
+    static constexpr float step = volume::BrickCache::brickSize / 2.0f;
+    const glm::vec3 volumeMax = glm::vec3(brickCache.dims() - 1);
+
+    std::vector<bool> visited(brickCache.numBricks(), false);
+    std::vector<std::pair<float, size_t>> bricks;
+    for (int y = 0; y < raysPerAxis; y++) {
+        for (int x = 0; x < raysPerAxis; x++) {
+            const glm::vec2 pixel = (glm::vec2(x, y) + 0.5f) / float(raysPerAxis) * 2.0f - 1.0f;
+            const Ray ray = camera.generateRay(pixel);
+            const glm::vec3 t0 = -ray.origin / ray.direction;
+            const glm::vec3 t1 = (volumeMax - ray.origin) / ray.direction;
+            const float tEnter = std::max(glm::compMax(glm::min(t0, t1)), 0.0f);
+            const float tExit = glm::compMin(glm::max(t0, t1));
+            for (float t = tEnter; t <= tExit; t += step) {
+                const glm::ivec3 voxel { glm::clamp(ray.origin + t * ray.direction, glm::vec3(0.0f), volumeMax) };
+                const size_t brick = brickCache.brickIndex(voxel / volume::BrickCache::brickSize);
+                if (!visited[brick]) {
+                    visited[brick] = true;
+                    bricks.emplace_back(t, brick);
+                }
+            }
+        }
+    }
+
+    std::sort(std::begin(bricks), std::end(bricks));
+    std::vector<size_t> out;
+    for (const auto& [t, brick] : bricks)
+        out.push_back(brick);
+    return out;
+}
+
+// Produces the rays of another camera in the voxel coordinates of a coarser level of the volume pyramid. The directions
+// stay normalized, so distances along the rays are measured in voxels of the level.
+class LevelCamera : public RayTraceCamera {
+public:
+    LevelCamera(std::shared_ptr<const RayTraceCamera> pCamera, float scale)
+        : m_pCamera(std::move(pCamera))
+        , m_scale(scale)
+    {
+    }
+
+    glm::vec3 position() const override { return volume::VolumePyramid::toLevelCoordinates(m_pCamera->position(), m_scale); }
+    glm::vec3 forward() const override { return m_pCamera->forward(); }
+
+    Ray generateRay(const glm::vec2& pixel) const override
+    {
+        Ray ray = m_pCamera->generateRay(pixel);
+        ray.origin = volume::VolumePyramid::toLevelCoordinates(ray.origin, m_scale);
+        return ray;
+    }
+
+    void generateRays(gsl::span<const glm::vec2> pixels, gsl::span<Ray> rays) const override
+    {
+        m_pCamera->generateRays(pixels, rays);
+        for (Ray& ray : rays)
+            ray.origin = volume::VolumePyramid::toLevelCoordinates(ray.origin, m_scale);
+    }
+
+private:
+    std::shared_ptr<const RayTraceCamera> m_pCamera;
+    float m_scale;
+};
+
+static std::vector<std::unique_ptr<Renderer>> createLevelRenderers(const volume::VolumePyramid* pVolumePyramid, const RenderConfig& initialConfig)
+{
+    std::vector<std::unique_ptr<Renderer>> out;
+    for (int level = 1; pVolumePyramid && level < pVolumePyramid->numLevels(); level++) {
+        const volume::PyramidLevel pyramidLevel = pVolumePyramid->level(level);
+        out.push_back(std::make_unique<Renderer>(pyramidLevel.pVolume, pyramidLevel.pGradientVolume, pyramidLevel.pMacroCellGrid, nullptr, initialConfig));
+        out.back()->setLevelScale(pyramidLevel.scale);
+    }
+    return out;
+}
+
+RenderService::RenderService(
+    volume::Volume* pVolume,
+    volume::GradientVolume* pGradientVolume,
+    const volume::MacroCellGrid* pMacroCellGrid,
+    const RenderConfig& initialConfig,
+    volume::VolumePyramid* pVolumePyramid,
+    gsl::span<const VolumeChannel> channels)
+    : m_pVolume(pVolume)
+    , m_pGradientVolume(pGradientVolume)
+    , m_pVolumePyramid(pVolumePyramid)
+    , m_hasChannels(!channels.empty())
+    , m_renderer(pVolume, pGradientVolume, pMacroCellGrid, nullptr, initialConfig)
+    , m_levelRenderers(createLevelRenderers(pVolumePyramid, initialConfig))
+    , m_pActiveRenderer(&m_renderer)
+    , m_thread([this]() { renderLoop(); })
+{
+    m_renderer.setCancellationFlag(&m_cancelled);
+    if (m_hasChannels)
+        m_renderer.setChannels(channels);
+    for (const auto& pLevelRenderer : m_levelRenderers)
+        pLevelRenderer->setCancellationFlag(&m_cancelled);
+}
+
+RenderService::~RenderService()
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        m_stop = true;
+        m_cancelled = true;
+    }
+    m_wakeUp.notify_one();
+    m_thread.join();
+}
+
+void RenderService::submit(std::shared_ptr<const render::RayTraceCamera> pCamera, const RenderConfig& config, volume::InterpolationMode interpolationMode)
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        m_optPendingSnapshot = Snapshot { std::move(pCamera), config, interpolationMode };
+        // The frame that is in progress (if any) is outdated. This has to happen while holding the lock, otherwise the
+        // render thread might have picked up the new snapshot already and we would cancel that frame instead.
+        m_cancelled = true;
+    }
+    m_wakeUp.notify_one();
+}
+
+void RenderService::setTimestep(std::shared_ptr<volume::Timestep> pTimestep)
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        m_pPendingTimestep = std::move(pTimestep);
+        m_cancelled = true;
+    }
+    m_wakeUp.notify_one();
+}
+
+const RenderService::Frame* RenderService::acquireFrame()
+{
+    std::scoped_lock lock { m_frameMutex };
+    if (!m_newFrame)
+        return nullptr;
+
+    std::swap(m_frontFrame, m_readyFrame);
+    m_newFrame = false;
+    return &m_frames[m_frontFrame];
+}
+
+bool RenderService::idle() const
+{
+    std::scoped_lock lock { m_mutex };
+    return !m_busy && !m_optPendingSnapshot && !m_pPendingTimestep;
+}
+
+// The distributed renderer copies the volume when it is created, so it is not used for the timesteps of a sequence.
+// Channels are not split into subvolumes.
+bool RenderService::usesDistributedRenderer(const RenderConfig& config) const
+{
+    return config.distributedWorkers > 0 && !m_hasChannels && !m_pTimestep && DistributedRenderer::supports(config, *m_pVolume);
+}
+
+// Level of the volume pyramid to render a frame with. Interactive frames (with level of detail enabled) use the level
+// whose voxels best match the footprint of a pixel at the center of the volume, but at least level 1.
+int RenderService::selectLevel(const render::RayTraceCamera& camera, const RenderConfig& config) const
+{
+    if (!config.levelOfDetail || !config.interactive || m_levelRenderers.empty() || m_hasChannels)
+        return 0;
+
+    // Distance between the rays through two neighbouring pixels at the center of the screen.
+    const float pixelSize = 2.0f / float(std::max(config.renderResolution.x, 1));
+    const glm::vec3 direction0 = glm::normalize(camera.generateRay(glm::vec2(0.0f)).direction);
+    const glm::vec3 direction1 = glm::normalize(camera.generateRay(glm::vec2(pixelSize, 0.0f)).direction);
+    const float distance = glm::length(glm::vec3(m_pVolume->dims()) / 2.0f - camera.position());
+    const float footprint = distance * glm::length(direction1 - direction0);
+
+    const int footprintLevel = int(std::log2(std::max(footprint, 1.0f)));
+    return std::clamp(footprintLevel, 1, int(m_levelRenderers.size()));
+}
+
+void RenderService::renderLoop()
+{
+    using clock = std::chrono::high_resolution_clock;
+    while (true) {
+        std::optional<Snapshot> optSnapshot;
+        std::shared_ptr<volume::Timestep> pTimestep;
+        bool bricksLoaded = false;
+        {
+            // Sleep until there is a new snapshot, unless the progressive image has not converged yet.
+            std::unique_lock lock { m_mutex };
+            m_busy = false;
+            const auto hasWork = [&]() { return m_stop || m_optPendingSnapshot || m_pPendingTimestep || (m_progressive && !m_pActiveRenderer->progressiveConverged()); };
+            if (m_bricksMissing) {
+                // The loader thread does not notify us, so poll until the missing bricks are in.
+                m_wakeUp.wait_for(lock, brickPollInterval, hasWork);
+                bricksLoaded = !hasWork() && m_pVolume->brickCache()->idle();
+                if (!hasWork() && !bricksLoaded)
+                    continue;
+            } else {
+                m_wakeUp.wait(lock, hasWork);
+            }
+            if (m_stop)
+                return;
+
+            if (m_optPendingSnapshot) {
+                std::swap(optSnapshot, m_optPendingSnapshot);
+                m_cancelled = false;
+            }
+            if (m_pPendingTimestep) {
+                std::swap(pTimestep, m_pPendingTimestep);
+                m_cancelled = false;
+            }
+            m_busy = true;
+        }
+
+        if (pTimestep) {
+            // The previous timestep is released once the renderer no longer references it.
+            m_pTimestep = pTimestep;
+            m_pVolume = &m_pTimestep->volume;
+            m_pGradientVolume = &m_pTimestep->gradientVolume;
+            m_pVolume->interpolationMode = m_interpolationMode;
+            m_pGradientVolume->interpolationMode = m_interpolationMode;
+            m_renderer.setVolume(m_pVolume, m_pGradientVolume, &m_pTimestep->macroCellGrid);
+            m_pDistributedRenderer.reset();
+            m_distributed = false;
+            // Nothing to render until the first snapshot arrives.
+            if (!m_pCamera && !optSnapshot)
+                continue;
+        }
+        if (optSnapshot) {
+            // Keep the camera alive until the next snapshot replaces it.
+            m_pCamera = std::move(optSnapshot->pCamera);
+            m_interpolationMode = optSnapshot->interpolationMode;
+            m_pVolume->interpolationMode = optSnapshot->interpolationMode;
+            m_pGradientVolume->interpolationMode = optSnapshot->interpolationMode;
+            if (m_pVolumePyramid)
+                m_pVolumePyramid->setInterpolationMode(optSnapshot->interpolationMode);
+
+            const RenderConfig& config = optSnapshot->config;
+            m_distributed = usesDistributedRenderer(config);
+            if (m_distributed) {
+                if (!m_pDistributedRenderer || m_distributedWorkers != config.distributedWorkers) {
+                    m_pDistributedRenderer.reset();
+                    m_pDistributedRenderer = std::make_unique<DistributedRenderer>(*m_pVolume, config.distributedWorkers, config);
+                    m_pDistributedRenderer->setCancellationFlag(&m_cancelled);
+                    m_distributedWorkers = config.distributedWorkers;
+                }
+                m_pDistributedRenderer->setInterpolationMode(optSnapshot->interpolationMode);
+                m_pDistributedRenderer->setCamera(m_pCamera.get());
+                m_pDistributedRenderer->setConfig(config);
+            } else {
+                const int level = selectLevel(*m_pCamera, config);
+                if (level == 0) {
+                    m_pActiveRenderer = &m_renderer;
+                    m_pLevelCamera.reset();
+                    m_pActiveRenderer->setCamera(m_pCamera.get());
+                } else {
+                    m_pActiveRenderer = m_levelRenderers[size_t(level - 1)].get();
+                    m_pLevelCamera = std::make_shared<LevelCamera>(m_pCamera, m_pVolumePyramid->level(level).scale);
+                    m_pActiveRenderer->setCamera(m_pLevelCamera.get());
+                }
+                m_pActiveRenderer->setConfig(config);
+                // The camera may have moved, so progressive rendering always starts over.
+                m_pActiveRenderer->resetProgressive();
+            }
+            m_resolution = config.renderResolution;
+            // The workers of the distributed renderer render every frame in full.
+            m_progressive = config.progressive && !m_distributed;
+
+            if (volume::BrickCache* pBrickCache = m_pVolume->brickCache())
+                pBrickCache->prefetch(visibleBricks(*pBrickCache, *m_pCamera));
+        } else if (bricksLoaded) {
+            m_pActiveRenderer->resetProgressive();
+        }
+
+        volume::BrickCache* pBrickCache = m_pVolume->brickCache();
+        if (pBrickCache)
+            pBrickCache->takeMissed();
+        const auto start = clock::now();
+        if (m_distributed) {
+            m_pDistributedRenderer->render();
+        } else if (m_progressive) {
+            do {
+                m_pActiveRenderer->renderProgressivePass();
+            } while (!m_cancelled && !m_pActiveRenderer->progressiveConverged() && clock::now() - start < progressiveBatchTime);
+        } else {
+            m_pActiveRenderer->render();
+        }
+
+        // A cancelled frame is incomplete; the next snapshot is rendered instead.
+        if (!m_cancelled)
+            publishFrame(m_distributed ? m_pDistributedRenderer->frameBuffer() : m_pActiveRenderer->frameBuffer(), clock::now() - start);
+        if (pBrickCache && pBrickCache->takeMissed())
+            m_bricksMissing = true;
+        else if (bricksLoaded || optSnapshot || pTimestep)
+            m_bricksMissing = false;
+    }
+}
+
+// Copy the rendered image into the back frame and make it the ready frame.
+void RenderService::publishFrame(gsl::span<const glm::vec4> frameBuffer, std::chrono::duration<double> renderTime)
+{
+    Frame& frame = m_frames[m_backFrame];
+    frame.pixels.assign(std::begin(frameBuffer), std::end(frameBuffer));
+    frame.resolution = m_resolution;
+    frame.renderTime = renderTime;
+
+    std::scoped_lock lock { m_frameMutex };
+    std::swap(m_backFrame, m_readyFrame);
+    m_newFrame = true;
+}
+
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include "render/distributed_renderer.h"
+#include "render/ray_trace_camera.h"
+#include "render/render_config.h"
+#include "render/renderer.h"
+#include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
+#include "volume/volume.h"
+#include "volume/volume_pyramid.h"
+#include "volume/volume_sequence.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <glm/vec2.hpp>
+#include <glm/vec4.hpp>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace render {
+
+// Runs the renderer on a background thread so that the user interface stays responsive no matter how long a frame
+// takes to render. The user interface submits snapshots of the camera and the render settings; a frame that is still
+// being rendered when a newer snapshot arrives is cancelled. Finished frames are handed back through a triple buffer.
+class RenderService {
+public:
+    struct Frame {
+        std::vector<glm::vec4> pixels;
+        glm::ivec2 resolution { 0 };
+        std::chrono::duration<double> renderTime { 0 };
+    };
+
+public:
+    // The interpolation mode of the volumes is changed by the render thread (see submit), so the caller should not
+    // modify the volumes while the service exists. Interactive frames render a coarser level of the pyramid (if
+    // given, see RenderConfig::levelOfDetail); level 0 of the pyramid should be the given volume. The volume channels
+    // (see Renderer::setChannels) only exist at the full resolution, so with channels every frame renders level 0.
+    RenderService(
+        volume::Volume* pVolume,
+        volume::GradientVolume* pGradientVolume,
+        const volume::MacroCellGrid* pMacroCellGrid,
+        const RenderConfig& initialConfig,
+        volume::VolumePyramid* pVolumePyramid = nullptr,
+        gsl::span<const VolumeChannel> channels = {});
+    ~RenderService();
+
+    // Render a new frame. The camera is shared with the render thread, so it should not be modified after submitting.
+    void submit(std::shared_ptr<const render::RayTraceCamera> pCamera, const RenderConfig& config, volume::InterpolationMode interpolationMode);
+    // Newest frame that was finished since the previous call, or nullptr if there is none. The frame remains valid until
+    // the next call to acquireFrame.
+    const Frame* acquireFrame();
+    // Render another timestep of a volume sequence from now on (it should have the same dimensions as the volume). The
+    // frame that is in progress is cancelled and the latest snapshot is rendered again with the new timestep, which the
+    // render thread holds on to until it is replaced. Not supported together with a volume pyramid or channels.
+    void setTimestep(std::shared_ptr<volume::Timestep> pTimestep);
+    // Whether the render thread has finished all frames that were submitted.
+    bool idle() const;
+
+private:
+    bool usesDistributedRenderer(const RenderConfig& config) const;
+    int selectLevel(const render::RayTraceCamera& camera, const RenderConfig& config) const;
+    void renderLoop();
+    void publishFrame(gsl::span<const glm::vec4> frameBuffer, std::chrono::duration<double> renderTime);
+
+private:
+    struct Snapshot {
+        std::shared_ptr<const render::RayTraceCamera> pCamera;
+        RenderConfig config;
+        volume::InterpolationMode interpolationMode;
+    };
+
+    volume::Volume* m_pVolume;
+    volume::GradientVolume* m_pGradientVolume;
+    volume::VolumePyramid* m_pVolumePyramid;
+    bool m_hasChannels;
+
+    // Only accessed by the render thread. There is a renderer for each level of the pyramid (m_renderer renders the full
+    // resolution volume), such that each of them keeps its own classification of the macro cells.
+    Renderer m_renderer;
+    std::vector<std::unique_ptr<Renderer>> m_levelRenderers;
+    Renderer* m_pActiveRenderer;
+    // Frames with RenderConfig::distributedWorkers set are rendered by the distributed renderer instead (if it supports
+    // them). Splitting the volume is expensive, so it is kept until the number of workers changes.
+    std::unique_ptr<DistributedRenderer> m_pDistributedRenderer;
+    int m_distributedWorkers { 0 };
+    bool m_distributed { false };
+    std::shared_ptr<const render::RayTraceCamera> m_pCamera;
+    // Camera of the active renderer when it renders a coarser level (see LevelCamera in render_service.cpp).
+    std::shared_ptr<const render::RayTraceCamera> m_pLevelCamera;
+    glm::ivec2 m_resolution { 0 };
+    bool m_progressive { false };
+    volume::InterpolationMode m_interpolationMode { volume::InterpolationMode::NearestNeighbour };
+    // Volume sequences: the timestep that is rendered (m_pVolume and m_pGradientVolume point into it).
+    std::shared_ptr<volume::Timestep> m_pTimestep;
+    // Streaming volumes: the last frame sampled bricks that were not resident yet, so it is rendered again once they
+    // have been loaded.
+    bool m_bricksMissing { false };
+
+    // Communication between the user interface and the render thread (protected by m_mutex).
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeUp;
+    std::optional<Snapshot> m_optPendingSnapshot;
+    std::shared_ptr<volume::Timestep> m_pPendingTimestep;
+    bool m_busy { false };
+    bool m_stop { false };
+    // Set when a newer snapshot is submitted; polled by the renderer to abort the frame that is in progress.
+    std::atomic<bool> m_cancelled { false };
+
+    // Triple buffer: the render thread writes to the back frame and the user interface reads the front frame. The ready
+    // frame is the newest finished frame that the user interface did not acquire yet (if m_newFrame is set).
+    std::mutex m_frameMutex;
+    std::array<Frame, 3> m_frames;
+    size_t m_backFrame { 0 }, m_readyFrame { 1 }, m_frontFrame { 2 };
+    bool m_newFrame { false };
+
+    // Started last, after all other members have been initialized.
+    std::thread m_thread;
+};
+
+}
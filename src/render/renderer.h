@@ -1,9 +1,19 @@
 #pragma once
+#include "render/frame_buffer_pool.h"
+#include "render/packet_tracer.h"
+#include "render/preintegration_table.h"
 #include "render/ray.h"
 #include "render/ray_trace_camera.h"
 #include "render/render_config.h"
+#include "render/screen_projection.h"
+#include "render/specular_table.h"
+#include "render/tile_scheduler.h"
+#include "render/transfer_function_2d_table.h"
 #include "volume/gradient_volume.h"
+#include "volume/macro_cell_grid.h"
 #include "volume/volume.h"
+#include <atomic>
+#include <cstdint>
 #include <cstring> // memcmp
 #include <glm/mat4x4.hpp>
 #include <glm/vec2.hpp>
@@ -11,6 +21,7 @@
 #include <glm/vec4.hpp>
 #include <gsl/span>
 #include <memory>
+#include <optional>
 #include <tuple>
 #include <vector>
 
@@ -24,16 +35,50 @@ union Bounds {
     std::array<glm::vec3, 2> lowerUpper;
 };
 
+// Sort-last rendering (see distributed_renderer.h): the renderer of a subvolume only takes the samples within its region,
+// at the same positions along each ray as a renderer of the whole volume. Both bounds are in voxel coordinates of the
+// subvolume.
+struct SampleRegion {
+    Bounds region;
+    Bounds volumeBounds;
+};
+
+// A volume that is composited together with the main volume of a renderer (see Renderer::setChannels), for example a
+// segmentation mask on top of a CT scan. It should have the same dimensions as the main volume (it is co-registered).
+struct VolumeChannel {
+    const volume::Volume* pVolume;
+    const volume::GradientVolume* pGradientVolume;
+    const volume::MacroCellGrid* pMacroCellGrid;
+};
+
 class Renderer {
 public:
     Renderer(
         const volume::Volume* pVolume,
         const volume::GradientVolume* pGradientVolume,
+        const volume::MacroCellGrid* pMacroCellGrid,
         const render::RayTraceCamera* pCamera,
         const RenderConfig& config);
 
     void setConfig(const RenderConfig& config);
+    void setCamera(const render::RayTraceCamera* pCamera);
+    void setCancellationFlag(const std::atomic<bool>* pCancelled);
+    void setLevelScale(float scale);
+    // Render another volume of the same dimensions (for example the next timestep of a volume sequence). The macro
+    // cells and lookup tables are derived again, and the image starts over.
+    void setVolume(const volume::Volume* pVolume, const volume::GradientVolume* pGradientVolume, const volume::MacroCellGrid* pMacroCellGrid);
+    void setTileScheduling(const TileSchedulerSettings& settings);
+    void setSampleRegion(const SampleRegion& sampleRegion);
+    // Composite the given volumes (at most maxVolumeChannels) together with the main volume, each with its own transfer
+    // function (see RenderConfig::channelTransferFunctions). Only used by the Composite render mode.
+    void setChannels(gsl::span<const VolumeChannel> channels);
     void render();
+
+    // Progressive rendering: render the image over multiple calls to renderProgressivePass (see renderer.cpp).
+    void resetProgressive();
+    bool renderProgressivePass();
+    bool progressiveConverged() const;
+
     gsl::span<const glm::vec4> frameBuffer() const;
 
 protected:
@@ -49,24 +94,176 @@ protected:
     float bisectionAccuracy(const Ray& ray, float t0, float t1, float isoValue) const;
 
     static glm::vec3 computePhongShading(const glm::vec3& color, const volume::GradientVoxel& gradient, const glm::vec3& lightDirection, const glm::vec3& viewDirection, float ka, float kd, float ks, float alpha);
+    static glm::vec3 computePhongShadingHeadlight(const glm::vec3& color, const glm::vec3& gradient, const glm::vec3& lightDirection, float ka, float kd, float ks, const SpecularTable& specularTable);
+
+    // Ray marching kernels that are specialized for the voxel type, interpolation mode and shading settings (see
+    // traceRayFunction).
+    template <typename Voxel, volume::InterpolationMode interpolationMode>
+    glm::vec4 traceRayMIP(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool volumeShading>
+    glm::vec4 traceRayISO(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, bool volumeShading>
+    glm::vec4 traceRayISOAnalytic(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool volumeShading, bool preintegrated>
+    glm::vec4 traceRayComposite(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool volumeShading>
+    glm::vec4 traceRayCompositeChannels(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool preintegrated>
+    glm::vec4 traceRayTF2D(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool volumeShading, bool smoothstep, bool preintegrated>
+    glm::vec4 traceRayMIDA(const Ray& ray, float sampleStep) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool volumeShading, bool smoothstep, bool preintegrated>
+    glm::vec4 traceRayCombined(const Ray& ray, float sampleStep) const;
+
+    // Frame data for the packet kernels, or nothing if the current settings are not supported by the packet kernels.
+    std::optional<PacketTraceContext> packetTraceContext(float sampleStep) const;
+
+    // Intersection of rays with the bounds of the volume, for a single ray and for a batch of rays (see renderPixels).
+    bool instersectRayVolumeBounds(Ray& ray, const Bounds& volumeBounds) const;
+    static void intersectRaysVolumeBounds(gsl::span<Ray> rays, const Bounds& volumeBounds, gsl::span<uint8_t> hits);
+    void clipRaysToSampleRegion(gsl::span<Ray> rays, gsl::span<uint8_t> hits, float sampleStep) const;
 
 private:
+    using TraceRayFunction = glm::vec4 (Renderer::*)(const Ray& ray, float sampleStep) const;
+    TraceRayFunction traceRayFunction(RenderMode renderMode) const;
+    template <typename Voxel>
+    TraceRayFunction traceRayFunction(RenderMode renderMode) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode>
+    TraceRayFunction traceRayFunction(RenderMode renderMode) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode, bool preintegrated>
+    TraceRayFunction traceRayFunction(RenderMode renderMode) const;
+
     void resizeImage(const glm::ivec2& resolution);
-    void resetImage();
 
+    // Temporal reprojection (see RenderConfig::temporalReprojection and renderReprojected).
+    bool canReproject() const;
+    void renderReprojected();
+    void updateReprojectionHistory();
+    glm::vec3 representativePoint(int x, int y) const;
+
+    void classifyMacroCells();
+    void buildTF2DTable();
+    void computeCellGradientMaxima();
+    bool isTransparentCell(const glm::ivec3& cell) const;
+    float adaptiveStep(const glm::vec3& samplePos, float sampleStep) const;
+    float macroCellExit(const Ray& ray, const glm::ivec3& cell) const;
+    template <typename IsEmptyCell>
+    bool skipEmptySpace(const Ray& ray, float sampleStep, IsEmptyCell&& isEmptyCell, float& t, glm::vec3& samplePos, float& tCellExit) const;
+
+    float maximumAlongRay(const Ray& ray, float sampleStep, float t, float& tMaximumExit) const;
+
+    // Iso surface hits, which the shaded ISO kernels and the iso surface buffer have in common.
+    struct IsoSurfaceHit {
+        bool hit { false };
+        glm::vec3 position;
+        glm::vec3 lightDirection;
+        volume::GradientVoxel gradient;
+    };
+    template <typename Voxel, volume::InterpolationMode interpolationMode>
+    std::optional<float> findIsoSurface(const Ray& ray, float sampleStep) const;
+    template <typename Voxel>
+    std::optional<float> findIsoSurfaceAnalytic(const Ray& ray) const;
+    template <typename Voxel>
+    std::optional<float> intersectIsoSurfaceCells(const Ray& ray, const glm::ivec3& macroCell, float tEnter, float tExit, bool firstCell) const;
+    template <typename Voxel, volume::InterpolationMode interpolationMode>
+    IsoSurfaceHit traceIsoSurfaceHit(const Ray& ray, float sampleStep) const;
+    glm::vec4 shadeIsoSurface(const IsoSurfaceHit& hit) const;
+
+    // Iso surface buffer (see RenderConfig::cacheIsoSurface and renderIsoSurfaceBuffer).
+    bool usesIsoSurfaceBuffer() const;
+    void renderIsoSurfaceBuffer();
+    void traceIsoSurfaceBuffer();
+
+    static bool skipEmptySpacePacket(const void* pUserData, const Ray& ray, float sampleStep, float maxVal, float& t, float& tCellExit);
+    static float maximumAlongRayPacket(const void* pUserData, const Ray& ray, float sampleStep, float t, float& tMaximumExit);
+
+    template <typename WritePixel>
+    void renderPixels(const glm::ivec2& offset, int stride, float sampleOffset, gsl::span<const uint8_t> pixelMask, WritePixel&& writePixel);
+    void renderPacket(const PacketTraceContext& context, gsl::span<const Ray> rays, gsl::span<const uint8_t> hits, std::array<glm::vec4, packetSize>& colors) const;
+
+    glm::vec3 shadeSample(const glm::vec3& color, const volume::GradientVoxel& gradient, const Ray& ray, const glm::vec3& position) const;
     glm::vec4 getTFValue(float val) const;
+    glm::vec4 getChannelTFValue(size_t channel, float val) const;
     float getTF2DOpacity(float val, float gradientMagnitude) const;
+    // Preintegrated transfer functions: the classification of the ray segment from a sample with value front to the
+    // next sample with value back (see PreintegrationTable). Only valid if m_config.preintegrated is set.
+    glm::vec4 getPreintegratedTFValue(float front, float back) const;
+    float getPreintegratedTF2DOpacity(float front, float back, float gradientMagnitude) const;
 
-    bool instersectRayVolumeBounds(Ray& ray, const Bounds& volumeBounds) const;
+    size_t pixelIndex(int x, int y) const;
     void fillColor(int x, int y, const glm::vec4& color);
 
 protected:
     const volume::Volume* m_pVolume;
     const volume::GradientVolume* m_pGradientVolume;
+    const volume::MacroCellGrid* m_pMacroCellGrid;
     const render::RayTraceCamera* m_pCamera;
+    // Position of the camera at the start of the frame (see renderPixels).
+    glm::vec3 m_cameraPosition { 0.0f };
     RenderConfig m_config;
+    // Volumes that are composited together with the main volume (see setChannels).
+    std::vector<VolumeChannel> m_channels;
+    // Size of a voxel of the volume relative to a voxel of the full resolution volume (see setLevelScale).
+    float m_levelScale { 1.0f };
+    // Optional flag that is polled while rendering to abort the current frame (see setCancellationFlag).
+    const std::atomic<bool>* m_pCancelled { nullptr };
+    // Distributes the pixels of a frame over the threads (see renderPixels).
+    TileScheduler m_tileScheduler;
+    // Only the samples within this region are taken (see setSampleRegion).
+    std::optional<SampleRegion> m_optSampleRegion;
+
+    // Per macro cell: whether it is fully transparent under the transfer function of the current render mode.
+    std::vector<uint8_t> m_transparentCells;
+    // Adaptive sampling: per macro cell the largest gradient magnitude (computed once) and the step size relative to
+    // the base sample step (depends on the transfer function).
+    std::vector<float> m_cellGradientMaxima;
+    std::vector<float> m_cellStepScales;
+    // Rebuilt whenever the 1D transfer function changes while preintegration is enabled (and the render mode uses it).
+    PreintegrationTable m_preintegrationTable;
+    // Opacity of the 2D transfer function (see getTF2DOpacity), rebuilt whenever its triangle changes.
+    TransferFunction2DTable m_tf2DTable;
+    // Specular power of fast shading (see RenderConfig::fastShading), rebuilt whenever alpha changes.
+    SpecularTable m_specularTable;
+    // Set when the inputs of the classification or of a table changed while the render mode did not use it (see
+    // setConfig).
+    bool m_macroCellsStale { false };
+    bool m_tf2DTableStale { false };
+    bool m_preintegrationTableStale { false };
 
+    // The frame buffer has the pixels of m_frameBufferResolution; the buffers of other resolutions that were rendered
+    // recently are kept in the pool. Every frame writes all pixels (black for rays that miss the volume), so the buffer
+    // is only cleared when it is allocated.
     std::vector<glm::vec4> m_frameBuffer;
+    glm::ivec2 m_frameBufferResolution { 0 };
+    FrameBufferPool m_frameBufferPool;
+
+    // Progressive rendering: number of passes rendered since the last reset, and the sum of all samples per pixel.
+    int m_progressivePass { 0 };
+    std::vector<glm::vec4> m_accumulationBuffer;
+
+    // Temporal reprojection: the previous frame and the point of the volume that each of its pixels shows (NaN if
+    // none), which are only valid if the frame was rendered completely with the current settings. The points of the
+    // frame that is being rendered are collected in m_framePoints.
+    bool m_historyValid { false };
+    volume::InterpolationMode m_historyInterpolationMode { volume::InterpolationMode::NearestNeighbour };
+    std::vector<glm::vec4> m_historyColors;
+    std::vector<glm::vec3> m_historyPoints;
+    std::vector<glm::vec3> m_framePoints;
+    // Per pixel the nearest point of the previous frame that was projected onto it (see renderReprojected), and
+    // whether the pixel is traced.
+    std::vector<std::atomic<uint64_t>> m_reprojectionTargets;
+    std::vector<uint8_t> m_traceMask;
+    // Selects the subset of pixels that is traced again even though they could be reprojected.
+    unsigned m_reprojectionPhase { 0 };
+
+    // Iso surface buffer: per pixel where its ray hits the iso surface (and whether it hits the volume at all), as traced
+    // from the view, camera position and interpolation mode below. Invalidated when the surface changes (see setConfig).
+    bool m_isoSurfaceBufferValid { false };
+    std::optional<ScreenProjection> m_optIsoSurfaceBufferView;
+    glm::vec3 m_isoSurfaceBufferCameraPosition { 0.0f };
+    volume::InterpolationMode m_isoSurfaceBufferInterpolationMode { volume::InterpolationMode::NearestNeighbour };
+    std::vector<IsoSurfaceHit> m_isoSurfaceBuffer;
+    std::vector<uint8_t> m_isoSurfaceRayHits;
 };
 
 }
@@ -0,0 +1,40 @@
+#pragma once
+#include "ray_trace_camera.h"
+#include <glm/geometric.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+
+namespace render {
+
+// Projection of points onto the screen of a pinhole camera. It is derived from the rays that the camera generates, so
+// it works for any camera: the rays through the center of the screen and through the centers of its right and top edges
+// span the image plane. Used by temporal reprojection, and by the GPU renderer to generate the same rays as the camera.
+struct ScreenProjection {
+    ScreenProjection(const RayTraceCamera& camera)
+    {
+        const Ray center = camera.generateRay(glm::vec2(0.0f));
+        const glm::vec3 right = camera.generateRay(glm::vec2(1.0f, 0.0f)).direction;
+        const glm::vec3 top = camera.generateRay(glm::vec2(0.0f, 1.0f)).direction;
+        origin = center.origin;
+        forward = glm::normalize(center.direction);
+        // From the center to the edges of the image plane at a distance of 1 along the forward direction.
+        rightEdge = right / glm::dot(right, forward) - forward;
+        topEdge = top / glm::dot(top, forward) - forward;
+    }
+
+    // Screen coordinates (from -1 to +1, like the pixels passed to RayTraceCamera::generateRay) and the depth along the
+    // forward direction of a point. Returns false if the point lies behind the camera.
+    bool project(const glm::vec3& point, glm::vec2& screen, float& depth) const
+    {
+        const glm::vec3 offset = point - origin;
+        depth = glm::dot(offset, forward);
+        if (depth <= 0.0f)
+            return false;
+        const glm::vec3 planeOffset = offset / depth - forward;
+        screen = glm::vec2(glm::dot(planeOffset, rightEdge) / glm::dot(rightEdge, rightEdge), glm::dot(planeOffset, topEdge) / glm::dot(topEdge, topEdge));
+        return true;
+    }
+
+    glm::vec3 origin, forward, rightEdge, topEdge;
+};
+}
@@ -0,0 +1,17 @@
+#include "specular_table.h"
+#include <cmath>
+
+namespace render {
+
+void SpecularTable::build(float alpha)
+{
+    m_alpha = alpha;
+    for (size_t i = 0; i <= size; i++)
+        m_values[i] = std::pow(float(i) / float(size), alpha);
+}
+
+float SpecularTable::alpha() const
+{
+    return m_alpha;
+}
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace render {
+
+// The specular term of Phong shading, |cos|^alpha, sampled over [0, 1] such that shading a sample interpolates two
+// entries instead of calling std::pow. The exponent only changes when the user edits it, so the table is rebuilt rarely.
+class SpecularTable {
+public:
+    static constexpr size_t size = 1024;
+
+public:
+    void build(float alpha);
+    // The exponent that the table was built for (NaN before the first build).
+    float alpha() const;
+
+    // |cosine|^alpha, linearly interpolated between the entries. NaN gives 0.
+    float lookup(float cosine) const;
+
+private:
+    float m_alpha { std::numeric_limits<float>::quiet_NaN() };
+    // size + 1 entries: entry i holds (i / size)^alpha.
+    std::vector<float> m_values = std::vector<float>(size + 1, 0.0f);
+};
+
+inline float SpecularTable::lookup(float cosine) const
+{
+    const float c = std::abs(cosine);
+    // Also rejects NaN.
+    if (!(c < 1.0f))
+        return c >= 1.0f ? 1.0f : 0.0f;
+    const float x = c * float(size);
+    const size_t i = std::min(size_t(x), size - 1);
+    const float factor = x - float(i);
+    return m_values[i] + factor * (m_values[i + 1] - m_values[i]);
+}
+}
@@ -0,0 +1,64 @@
+#include "tile_scheduler.h"
+#include <algorithm>
+#include <cstdint>
+#include <glm/common.hpp>
+
+// Interleave the bits of x (in the even bits) and y (in the odd bits).
+static uint64_t mortonCode(uint32_t x, uint32_t y)
+{
+    const auto spreadBits = [](uint64_t v) {
+        v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+        v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+        v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        v = (v | (v << 2)) & 0x3333333333333333ull;
+        v = (v | (v << 1)) & 0x5555555555555555ull;
+        return v;
+    };
+    return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+namespace render {
+
+std::vector<glm::ivec2> mortonOrderTiles(const glm::ivec2& numTiles)
+{
+    std::vector<glm::ivec2> out;
+    mortonOrderTiles(numTiles, out);
+    return out;
+}
+
+void mortonOrderTiles(const glm::ivec2& numTiles, std::vector<glm::ivec2>& out)
+{
+    out.clear();
+    out.reserve(size_t(std::max(numTiles.x, 0)) * size_t(std::max(numTiles.y, 0)));
+    for (int y = 0; y < numTiles.y; y++) {
+        for (int x = 0; x < numTiles.x; x++)
+            out.emplace_back(x, y);
+    }
+    // Grids that are not a square power of two leave gaps in the curve, which sorting skips.
+    std::sort(std::begin(out), std::end(out), [](const glm::ivec2& lhs, const glm::ivec2& rhs) {
+        return mortonCode(uint32_t(lhs.x), uint32_t(lhs.y)) < mortonCode(uint32_t(rhs.x), uint32_t(rhs.y));
+    });
+}
+
+TileScheduler::TileScheduler(const TileSchedulerSettings& settings)
+    : m_settings(settings)
+{
+    m_settings.tileSize = glm::max(m_settings.tileSize, glm::ivec2(1));
+    m_settings.grainSize = std::max(m_settings.grainSize, size_t(1));
+}
+
+void TileScheduler::setSettings(const TileSchedulerSettings& settings)
+{
+    m_settings = settings;
+    m_settings.tileSize = glm::max(m_settings.tileSize, glm::ivec2(1));
+    m_settings.grainSize = std::max(m_settings.grainSize, size_t(1));
+    // Recompute the tiles on the next frame.
+    m_numPixels = glm::ivec2(0);
+    m_tiles.clear();
+}
+
+const TileSchedulerSettings& TileScheduler::settings() const
+{
+    return m_settings;
+}
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <glm/vec2.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <vector>
+
+namespace render {
+
+// How TBB splits the tiles over the worker threads (see the TBB documentation of the partitioners).
+enum class TilePartitioner {
+    // Splits ranges further when threads run out of work (work stealing), down to the grain size.
+    Auto,
+    // Always splits ranges down to the grain size.
+    Simple,
+    // Like Auto, but replays the assignment of tiles to threads of the previous frame (which still has the voxels that
+    // those tiles touched in its caches), as long as the number of tiles does not change.
+    Affinity,
+    // Gives every thread an equal contiguous range of tiles without any work stealing.
+    Static,
+};
+
+struct TileSchedulerSettings {
+    // Size of a tile in pixels (of the pixel grid that is being rendered).
+    glm::ivec2 tileSize { 16, 16 };
+    // Minimum number of tiles that a thread renders in one go.
+    size_t grainSize { 1 };
+    TilePartitioner partitioner { TilePartitioner::Auto };
+};
+
+// The order in which the tiles of a grid of numTiles tiles are rendered: the tiles are ordered along a Z-order (Morton)
+// curve, such that consecutive tiles (which are likely rendered by the same thread) are close together on the screen
+// and their rays touch the same parts of the volume. Returns the index (x, y) of every tile.
+std::vector<glm::ivec2> mortonOrderTiles(const glm::ivec2& numTiles);
+// Same, but reuses the memory of out (such that switching between resolutions does not allocate).
+void mortonOrderTiles(const glm::ivec2& numTiles, std::vector<glm::ivec2>& out);
+
+// Renders the screen in parallel in small square tiles. Rays that miss the volume are almost free while rays through
+// dense regions take a full march, so the cost per tile varies a lot; many small tiles (instead of the large blocks that
+// a 2D range over the screen is split into) keep all threads busy until the end of the frame.
+class TileScheduler {
+public:
+    TileScheduler(const TileSchedulerSettings& settings = {});
+
+    void setSettings(const TileSchedulerSettings& settings);
+    const TileSchedulerSettings& settings() const;
+
+    // Call renderTile(begin, end) for every tile of the grid of numPixels pixels, where [begin, end) are the pixels of
+    // the tile. The function is called on multiple threads at the same time.
+    template <typename RenderTile>
+    void run(const glm::ivec2& numPixels, RenderTile&& renderTile);
+
+private:
+    TileSchedulerSettings m_settings;
+    // Tiles in Morton order of the last grid (see mortonOrderTiles).
+    glm::ivec2 m_numPixels { 0 };
+    std::vector<glm::ivec2> m_tiles;
+    tbb::affinity_partitioner m_affinityPartitioner;
+};
+
+template <typename RenderTile>
+void TileScheduler::run(const glm::ivec2& numPixels, RenderTile&& renderTile)
+{
+    if (numPixels != m_numPixels) {
+        m_numPixels = numPixels;
+        mortonOrderTiles((numPixels + m_settings.tileSize - 1) / m_settings.tileSize, m_tiles);
+    }
+
+    const auto renderTiles = [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t i = range.begin(); i != range.end(); i++) {
+            const glm::ivec2 begin = m_tiles[i] * m_settings.tileSize;
+            renderTile(begin, glm::min(begin + m_settings.tileSize, numPixels));
+        }
+    };
+    const tbb::blocked_range<size_t> range { 0, m_tiles.size(), m_settings.grainSize };
+    switch (m_settings.partitioner) {
+    case TilePartitioner::Auto: {
+        tbb::parallel_for(range, renderTiles, tbb::auto_partitioner());
+        break;
+    }
+    case TilePartitioner::Simple: {
+        tbb::parallel_for(range, renderTiles, tbb::simple_partitioner());
+        break;
+    }
+    case TilePartitioner::Affinity: {
+        tbb::parallel_for(range, renderTiles, m_affinityPartitioner);
+        break;
+    }
+    case TilePartitioner::Static: {
+        tbb::parallel_for(range, renderTiles, tbb::static_partitioner());
+        break;
+    }
+    }
+}
+}
@@ -0,0 +1,30 @@
+#include "transfer_function_2d_table.h"
+#include <algorithm>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+namespace render {
+
+void TransferFunction2DTable::build(const glm::vec2& intensityRange, const glm::vec2& magnitudeRange, const std::function<float(float, float)>& opacity)
+{
+    const glm::vec2 start { intensityRange[0], magnitudeRange[0] };
+    const glm::vec2 extent { intensityRange[1] - intensityRange[0], magnitudeRange[1] - magnitudeRange[0] };
+    const glm::vec2 binSize = extent / float(size);
+    m_start = start;
+    // An empty range is never looked up successfully (the scale maps everything to bin 0, which is cleared below).
+    m_scale = glm::vec2(extent.x > 0.0f ? 1.0f / binSize.x : 0.0f, extent.y > 0.0f ? 1.0f / binSize.y : 0.0f);
+
+    m_opacities.resize(size * size);
+    if (extent.x <= 0.0f || extent.y <= 0.0f) {
+        std::fill(std::begin(m_opacities), std::end(m_opacities), 0.0f);
+        return;
+    }
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, size), [&](const tbb::blocked_range<size_t>& rows) {
+        for (size_t y = rows.begin(); y != rows.end(); y++) {
+            const float gradientMagnitude = start.y + (float(y) + 0.5f) * binSize.y;
+            for (size_t x = 0; x < size; x++)
+                m_opacities[y * size + x] = opacity(start.x + (float(x) + 0.5f) * binSize.x, gradientMagnitude);
+        }
+    });
+}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <glm/vec2.hpp>
+#include <vector>
+
+namespace render {
+
+// The opacity of a 2D transfer function over (intensity, gradient magnitude), sampled into a table such that
+// classifying a sample is a single (nearest neighbour) fetch instead of evaluating the widget. The table only covers the
+// region in which the transfer function can be non-zero; it is zero everywhere else.
+class TransferFunction2DTable {
+public:
+    static constexpr size_t size = 256;
+
+public:
+    // Evaluate opacity(intensity, gradientMagnitude) at the centers of size x size bins covering [lower, upper) of both
+    // ranges (in parallel).
+    void build(const glm::vec2& intensityRange, const glm::vec2& magnitudeRange, const std::function<float(float, float)>& opacity);
+
+    float lookup(float intensity, float gradientMagnitude) const;
+
+private:
+    glm::vec2 m_start { 0.0f };
+    // Number of bins per unit of intensity and gradient magnitude.
+    glm::vec2 m_scale { 0.0f };
+    // size x size opacities, intensity-fastest.
+    std::vector<float> m_opacities = std::vector<float>(size * size, 0.0f);
+};
+
+inline float TransferFunction2DTable::lookup(float intensity, float gradientMagnitude) const
+{
+    const float x = (intensity - m_start.x) * m_scale.x;
+    const float y = (gradientMagnitude - m_start.y) * m_scale.y;
+    // Also rejects NaN.
+    if (!(x >= 0.0f && x < float(size) && y >= 0.0f && y < float(size)))
+        return 0.0f;
+    return m_opacities[size_t(y) * size + size_t(x)];
+}
+}
@@ -1,30 +1,93 @@
 #include "ui/full_screen_texture_gl.h"
 #include "opengl.h"
+#include "render/instrumentation.h"
 #include "ui/gl_error.h"
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/vec3.hpp>
+#include <limits>
 
 namespace ui {
 
-FullScreenTextureGL::FullScreenTextureGL()
+static GLenum internalFormat(TextureFormat format)
 {
-    // Generate texture
-    glGenTextures(1, &m_texture);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-    /*glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_RGBA,
-			resolution.x,
-			resolution.y,
-			0,
-			GL_RGBA,
-			GL_FLOAT,
-			nullptr);*/
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    switch (format) {
+    case TextureFormat::RGBA32F:
+        return GL_RGBA32F;
+    case TextureFormat::RGBA16F:
+        return GL_RGBA16F;
+    case TextureFormat::RGBA8:
+        return GL_RGBA8;
+    default:
+        throw std::exception();
+    }
+}
+
+static GLenum pixelType(TextureFormat format)
+{
+    switch (format) {
+    case TextureFormat::RGBA32F:
+        return GL_FLOAT;
+    case TextureFormat::RGBA16F:
+        return GL_HALF_FLOAT;
+    case TextureFormat::RGBA8:
+        return GL_UNSIGNED_BYTE;
+    default:
+        throw std::exception();
+    }
+}
+
+static size_t bytesPerPixel(TextureFormat format)
+{
+    switch (format) {
+    case TextureFormat::RGBA32F:
+        return sizeof(glm::vec4);
+    case TextureFormat::RGBA16F:
+        return sizeof(uint64_t);
+    case TextureFormat::RGBA8:
+        return sizeof(uint32_t);
+    default:
+        throw std::exception();
+    }
+}
 
+static glm::vec4 toRGBA(const glm::vec3& color) { return glm::vec4(color, 1.0f); }
+static glm::vec4 toRGBA(const glm::vec4& color) { return color; }
+
+// Convert the pixels to the texture format while writing them to the (mapped) pixel buffer.
+template <typename Pixel>
+static void convertPixels(gsl::span<const Pixel> pixels, TextureFormat format, void* pOut)
+{
+    switch (format) {
+    case TextureFormat::RGBA32F: {
+        glm::vec4* pOutPixels = static_cast<glm::vec4*>(pOut);
+        for (size_t i = 0; i < pixels.size(); i++)
+            pOutPixels[i] = toRGBA(pixels[i]);
+    } break;
+    case TextureFormat::RGBA16F: {
+        uint64_t* pOutPixels = static_cast<uint64_t*>(pOut);
+        for (size_t i = 0; i < pixels.size(); i++)
+            pOutPixels[i] = glm::packHalf4x16(toRGBA(pixels[i]));
+    } break;
+    case TextureFormat::RGBA8: {
+        // The renderer outputs colors (multiplied by alpha) in the range [0, 1]; packUnorm clamps anything outside.
+        uint32_t* pOutPixels = static_cast<uint32_t*>(pOut);
+        for (size_t i = 0; i < pixels.size(); i++)
+            pOutPixels[i] = glm::packUnorm4x8(toRGBA(pixels[i]));
+    } break;
+    default:
+        throw std::exception();
+    }
+}
+
+FullScreenTextureGL::FullScreenTextureGL(TextureFormat format)
+    : m_format(format)
+    , m_texture(0)
+    , m_persistentMapping(GLEW_ARB_buffer_storage)
+{
     // Create full screen quad
     // For whatever reason, OpenGL doesnt like GL_QUADS (gives me no output), so I'll just use two triangles
     // NOTE: vertical texture coordinates are swapped
@@ -65,36 +128,153 @@ FullScreenTextureGL::FullScreenTextureGL()
     }
 
     const glm::vec3 black { 0.0f };
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 1, 1, 0, GL_RGB, GL_FLOAT, glm::value_ptr(black));
+    update(gsl::span<const glm::vec3>(&black, 1), glm::ivec2(1));
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
 FullScreenTextureGL::~FullScreenTextureGL()
 {
+    deletePixelBuffers();
     glDeleteTextures(1, &m_texture);
     glDeleteVertexArrays(1, &m_vao);
     glDeleteBuffers(1, &m_vbo);
     glDeleteProgram(m_shader);
 }
 
+TextureFormat FullScreenTextureGL::format() const
+{
+    return m_format;
+}
+
+void FullScreenTextureGL::setFormat(TextureFormat format)
+{
+    if (format == m_format)
+        return;
+
+    m_format = format;
+    // Immutable texture storage cannot change format; allocate a new texture at the next update.
+    m_textureResolution = glm::ivec2(0);
+}
+
 void FullScreenTextureGL::update(gsl::span<const glm::vec3> frameBuffer, const glm::ivec2& resolution)
 {
-    glBindTexture(GL_TEXTURE_2D, m_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, resolution.x, resolution.y, 0, GL_RGB, GL_FLOAT, frameBuffer.data());
+    VOLVIS_SCOPED_STAGE(Upload);
+    upload(frameBuffer, resolution);
 }
 
 void FullScreenTextureGL::update(gsl::span<const glm::vec4> frameBuffer, const glm::ivec2& resolution)
 {
+    VOLVIS_SCOPED_STAGE(Upload);
+    upload(frameBuffer, resolution);
+}
+
+// Copy the frame into the next pixel buffer of the ring and copy it into the texture from there. The copy from the
+// pixel buffer into the texture happens asynchronously on the GPU.
+template <typename Pixel>
+void FullScreenTextureGL::upload(gsl::span<const Pixel> frameBuffer, const glm::ivec2& resolution)
+{
+    assert(frameBuffer.size() == size_t(resolution.x) * size_t(resolution.y));
+    if (resolution != m_textureResolution)
+        allocateTexture(resolution);
+    const size_t size = frameBuffer.size() * bytesPerPixel(m_format);
+    if (size > m_pixelBufferSize)
+        allocatePixelBuffers(size);
+
+    const size_t index = m_nextPixelBuffer;
+    m_nextPixelBuffer = (m_nextPixelBuffer + 1) % numPixelBuffers;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffers[index]);
+
+    void* pMapped;
+    if (m_persistentMapping) {
+        // Wait until the GPU has finished the upload that last used this buffer (numPixelBuffers frames ago).
+        if (m_fences[index]) {
+            glClientWaitSync(m_fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, std::numeric_limits<GLuint64>::max());
+            glDeleteSync(m_fences[index]);
+            m_fences[index] = nullptr;
+        }
+        pMapped = m_mappedPixelBuffers[index];
+    } else {
+        // Orphan the buffer so that the driver does not have to wait for the previous upload from this buffer.
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(m_pixelBufferSize), nullptr, GL_STREAM_DRAW);
+        pMapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(size), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    }
+    convertPixels(frameBuffer, m_format, pMapped);
+    if (!m_persistentMapping)
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    // With a pixel buffer bound the data pointer is an offset into the buffer.
     glBindTexture(GL_TEXTURE_2D, m_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, resolution.x, resolution.y, 0, GL_RGBA, GL_FLOAT, frameBuffer.data());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, resolution.x, resolution.y, GL_RGBA, pixelType(m_format), nullptr);
+    if (m_persistentMapping)
+        m_fences[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Allocate the texture storage once per resolution instead of at every update.
+void FullScreenTextureGL::allocateTexture(const glm::ivec2& resolution)
+{
+    // The storage of an immutable texture cannot be resized, so create a new texture.
+    glDeleteTextures(1, &m_texture);
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    if (GLEW_ARB_texture_storage)
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat(m_format), resolution.x, resolution.y);
+    else
+        glTexImage2D(GL_TEXTURE_2D, 0, GLint(internalFormat(m_format)), resolution.x, resolution.y, 0, GL_RGBA, pixelType(m_format), nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    m_textureResolution = resolution;
+}
+
+void FullScreenTextureGL::allocatePixelBuffers(size_t size)
+{
+    deletePixelBuffers();
+
+    glGenBuffers(GLsizei(numPixelBuffers), m_pixelBuffers.data());
+    for (size_t i = 0; i < numPixelBuffers; i++) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffers[i]);
+        if (m_persistentMapping) {
+            // Coherent mapping: writes become visible to the GPU without explicitly flushing them.
+            constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(size), nullptr, flags);
+            m_mappedPixelBuffers[i] = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, GLsizeiptr(size), flags);
+        } else {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, GLsizeiptr(size), nullptr, GL_STREAM_DRAW);
+        }
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_pixelBufferSize = size;
+}
+
+void FullScreenTextureGL::deletePixelBuffers()
+{
+    if (m_pixelBufferSize == 0)
+        return;
+
+    // Deleting a buffer that is still in use by the GPU is fine; OpenGL defers it until the upload has finished.
+    for (GLsync& fence : m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    glDeleteBuffers(GLsizei(numPixelBuffers), m_pixelBuffers.data());
+    m_pixelBuffers = {};
+    m_mappedPixelBuffers = {};
+    m_pixelBufferSize = 0;
 }
 
 void FullScreenTextureGL::draw()
+{
+    drawTexture(m_texture);
+}
+
+// Draw another texture in the same way (for example the frames of ui::GPURenderer, which are rendered on the GPU).
+void FullScreenTextureGL::drawTexture(GLuint texture)
 {
     glUseProgram(m_shader);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
     glUniform1i(glGetUniformLocation(m_shader, "u_texture"), 0);
 
     glBindVertexArray(m_vao);
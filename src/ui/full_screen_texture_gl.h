@@ -1,5 +1,7 @@
 #pragma once
 #include "ui/window.h"
+#include <array>
+#include <cstddef>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
@@ -7,17 +9,52 @@
 
 namespace ui {
 
+// Format in which the framebuffer is stored on the GPU. The lower precision formats need less bandwidth to upload.
+enum class TextureFormat {
+    RGBA32F = 0,
+    RGBA16F,
+    RGBA8
+};
+
 class FullScreenTextureGL {
 public:
-    FullScreenTextureGL();
+    FullScreenTextureGL(TextureFormat format = TextureFormat::RGBA32F);
     ~FullScreenTextureGL();
 
+    TextureFormat format() const;
+    // Takes effect at the next update.
+    void setFormat(TextureFormat format);
+
     void update(gsl::span<const glm::vec3> frameBuffer, const glm::ivec2& resolution);
     void update(gsl::span<const glm::vec4> frameBuffer, const glm::ivec2& resolution);
     void draw();
+    void drawTexture(GLuint texture);
+
+private:
+    template <typename Pixel>
+    void upload(gsl::span<const Pixel> frameBuffer, const glm::ivec2& resolution);
+    void allocateTexture(const glm::ivec2& resolution);
+    void allocatePixelBuffers(size_t size);
+    void deletePixelBuffers();
 
 private:
+    // Uploads go through a ring of pixel buffer objects such that writing the next frame does not have to wait
+    // for the GPU to finish copying the previous frame into the texture.
+    static constexpr size_t numPixelBuffers = 3;
+
+    TextureFormat m_format;
     GLuint m_texture;
+    glm::ivec2 m_textureResolution { 0 };
+
+    // Whether the pixel buffers are mapped once at creation (GL_ARB_buffer_storage) instead of at every upload.
+    bool m_persistentMapping;
+    std::array<GLuint, numPixelBuffers> m_pixelBuffers {};
+    std::array<void*, numPixelBuffers> m_mappedPixelBuffers {};
+    // Signalled when the GPU has finished reading from the corresponding pixel buffer.
+    std::array<GLsync, numPixelBuffers> m_fences {};
+    size_t m_pixelBufferSize { 0 };
+    size_t m_nextPixelBuffer { 0 };
+
     GLuint m_vbo, m_vao;
     GLuint m_shader;
 };
@@ -0,0 +1,286 @@
+#include "gpu_renderer.h"
+#include "render/screen_projection.h"
+#include "ui/gl_error.h"
+#include <array>
+#include <cstdint>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/vector_relational.hpp>
+#include <iostream>
+#include <tuple>
+#include <type_traits>
+
+namespace ui {
+
+// Texture format of the voxels: the integer voxel types are stored normalized, valueScale converts them back.
+struct VoxelFormat {
+    GLenum internalFormat;
+    GLenum type;
+    float valueScale;
+};
+
+template <typename Voxel>
+static VoxelFormat voxelFormat()
+{
+    if constexpr (std::is_same_v<Voxel, uint8_t>)
+        return { GL_R8, GL_UNSIGNED_BYTE, 255.0f };
+    else if constexpr (std::is_same_v<Voxel, uint16_t>)
+        return { GL_R16, GL_UNSIGNED_SHORT, 65535.0f };
+    else
+        return { GL_R32F, GL_FLOAT, 1.0f };
+}
+
+static GLuint createTexture3D(const glm::ivec3& dim, GLenum internalFormat, GLenum format, GLenum type)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_3D, texture);
+    if (GLEW_ARB_texture_storage)
+        glTexStorage3D(GL_TEXTURE_3D, 1, internalFormat, dim.x, dim.y, dim.z);
+    else
+        glTexImage3D(GL_TEXTURE_3D, 0, GLint(internalFormat), dim.x, dim.y, dim.z, 0, format, type, nullptr);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    return texture;
+}
+
+// Upload the voxels in the linear order of the texture. Bricked volumes are converted one slice at a time, such that
+// the copy stays small for large volumes.
+template <typename Voxel>
+static void uploadVoxels(const volume::Volume& volume, GLenum type)
+{
+    const glm::ivec3 dim = volume.dims();
+    if (volume.layout() == volume::VoxelLayout::Linear) {
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dim.x, dim.y, dim.z, GL_RED, type, volume.data<Voxel>().data());
+        return;
+    }
+
+    std::vector<Voxel> slice(size_t(dim.x) * size_t(dim.y));
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            for (int x = 0; x < dim.x; x++)
+                slice[size_t(y * dim.x + x)] = static_cast<Voxel>(volume.getVoxel<Voxel>(x, y, z));
+        }
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z, dim.x, dim.y, 1, GL_RED, type, slice.data());
+    }
+}
+
+GPURenderer::GPURenderer(const volume::Volume& volume, const volume::GradientVolume& gradientVolume)
+    : m_dim(volume.dims())
+    , m_volumeMaximum(volume.maximum())
+    , m_minMagnitude(gradientVolume.minMagnitude())
+    , m_maxMagnitude(gradientVolume.maxMagnitude())
+{
+    // Rows of 8-bit voxels are not 4-byte aligned if the width is odd.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    volume::dispatchVoxelType(volume.voxelType(), [&](auto voxel) {
+        using Voxel = decltype(voxel);
+        const VoxelFormat format = voxelFormat<Voxel>();
+        m_volumeTexture = createTexture3D(m_dim, format.internalFormat, GL_RED, format.type);
+        uploadVoxels<Voxel>(volume, format.type);
+        m_valueScale = format.valueScale;
+    });
+
+    // Half floats halve the memory of the gradients; the shading and the 2D transfer function do not need more.
+    m_gradientTexture = createTexture3D(m_dim, GL_RGBA16F, GL_RGBA, GL_FLOAT);
+    std::vector<glm::vec4> slice(size_t(m_dim.x) * size_t(m_dim.y));
+    for (int z = 0; z < m_dim.z; z++) {
+        for (int y = 0; y < m_dim.y; y++) {
+            for (int x = 0; x < m_dim.x; x++) {
+                const volume::GradientVoxel gradient = gradientVolume.getGradient(x, y, z);
+                slice[size_t(y * m_dim.x + x)] = glm::vec4(gradient.dir, gradient.magnitude);
+            }
+        }
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, z, m_dim.x, m_dim.y, 1, GL_RGBA, GL_FLOAT, slice.data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_3D, 0);
+
+    // The transfer function is uploaded with every frame; it is tiny.
+    const size_t tfSize = std::tuple_size_v<decltype(render::RenderConfig::tfColorMap)>;
+    glGenTextures(1, &m_tfTexture);
+    glBindTexture(GL_TEXTURE_1D, m_tfTexture);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, GLsizei(tfSize), 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    check_gl_error();
+
+    glGenQueries(1, &m_timerQuery);
+    glGenVertexArrays(1, &m_vao);
+
+    // Load shader
+    {
+        GLuint vertexShader = loadShader("gpu_raycast.vs", GL_VERTEX_SHADER);
+        GLuint fragmentShader = loadShader("gpu_raycast.fs", GL_FRAGMENT_SHADER);
+
+        m_shader = glCreateProgram();
+        glAttachShader(m_shader, vertexShader);
+        glAttachShader(m_shader, fragmentShader);
+        glLinkProgram(m_shader);
+
+        glDetachShader(m_shader, vertexShader);
+        glDetachShader(m_shader, fragmentShader);
+    }
+}
+
+GPURenderer::~GPURenderer()
+{
+    glDeleteProgram(m_shader);
+    glDeleteVertexArrays(1, &m_vao);
+    glDeleteQueries(1, &m_timerQuery);
+    glDeleteFramebuffers(1, &m_frameBuffer);
+    glDeleteTextures(1, &m_colorTexture);
+    glDeleteTextures(1, &m_tfTexture);
+    glDeleteTextures(1, &m_gradientTexture);
+    glDeleteTextures(1, &m_volumeTexture);
+}
+
+bool GPURenderer::canRender(const volume::Volume& volume)
+{
+    if (volume.brickCache())
+        return false;
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &maxSize);
+    return glm::all(glm::lessThanEqual(volume.dims(), glm::ivec3(maxSize)));
+}
+
+bool GPURenderer::supports(const render::RenderConfig& config, volume::InterpolationMode interpolationMode)
+{
+    const bool analyticIsoSurface = config.renderMode == render::RenderMode::RenderIso && config.analyticIsoSurface && interpolationMode == volume::InterpolationMode::Linear;
+    return interpolationMode != volume::InterpolationMode::Cubic && !config.adaptiveSampling && !config.preintegrated && !config.progressive && !analyticIsoSurface;
+}
+
+void GPURenderer::render(const render::RayTraceCamera& camera, const render::RenderConfig& config, volume::InterpolationMode interpolationMode)
+{
+    if (config.renderResolution != m_resolution)
+        allocateFrameBuffer(config.renderResolution);
+
+    // The result of the previous frame is ready by now; reading it any earlier would stall until the GPU is done.
+    if (m_timerQueryPending) {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(m_timerQuery, GL_QUERY_RESULT, &nanoseconds);
+        m_renderTime = std::chrono::nanoseconds(nanoseconds);
+    }
+    glBeginQuery(GL_TIME_ELAPSED, m_timerQuery);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_1D, m_tfTexture);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, 0, GLsizei(config.tfColorMap.size()), GL_RGBA, GL_FLOAT, config.tfColorMap.data());
+    // The hardware filtering implements the nearest neighbour and trilinear interpolation of the volume.
+    const GLint filter = interpolationMode == volume::InterpolationMode::NearestNeighbour ? GL_NEAREST : GL_LINEAR;
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, m_gradientTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_3D, m_volumeTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+
+    glUseProgram(m_shader);
+    const auto location = [&](const char* pName) { return glGetUniformLocation(m_shader, pName); };
+    const render::ScreenProjection projection { camera };
+    glUniform2f(location("u_resolution"), float(m_resolution.x), float(m_resolution.y));
+    glUniform3fv(location("u_cameraPosition"), 1, glm::value_ptr(camera.position()));
+    glUniform3fv(location("u_forward"), 1, glm::value_ptr(projection.forward));
+    glUniform3fv(location("u_rightEdge"), 1, glm::value_ptr(projection.rightEdge));
+    glUniform3fv(location("u_topEdge"), 1, glm::value_ptr(projection.topEdge));
+
+    glUniform1i(location("u_volume"), 0);
+    glUniform3f(location("u_dim"), float(m_dim.x), float(m_dim.y), float(m_dim.z));
+    glUniform1f(location("u_valueScale"), m_valueScale);
+    glUniform1f(location("u_volumeMaximum"), m_volumeMaximum);
+    glUniform1i(location("u_linear"), interpolationMode != volume::InterpolationMode::NearestNeighbour);
+    glUniform1i(location("u_gradients"), 1);
+    glUniform1f(location("u_minMagnitude"), m_minMagnitude);
+    glUniform1f(location("u_maxMagnitude"), m_maxMagnitude);
+
+    glUniform1i(location("u_tfColorMap"), 2);
+    glUniform1f(location("u_tfColorMapIndexStart"), config.tfColorMapIndexStart);
+    glUniform1f(location("u_tfColorMapIndexRange"), config.tfColorMapIndexRange);
+    glUniform1f(location("u_TF2DIntensity"), config.TF2DIntensity);
+    glUniform1f(location("u_TF2DRadius"), config.TF2DRadius);
+    glUniform4fv(location("u_TF2DColor"), 1, glm::value_ptr(config.TF2DColor));
+
+    glUniform1i(location("u_renderMode"), int(config.renderMode));
+    glUniform1f(location("u_sampleStep"), config.sampleStep);
+    glUniform1f(location("u_earlyTerminationOpacity"), config.earlyTerminationOpacity);
+    glUniform1f(location("u_isoValue"), config.isoValue);
+    glUniform1f(location("u_gamma"), config.gamma);
+    glUniform1i(location("u_volumeShading"), config.volumeShading);
+    glUniform1i(location("u_smoothstep"), config.smoothstep);
+    glUniform1f(location("u_ka"), config.ka);
+    glUniform1f(location("u_kd"), config.kd);
+    glUniform1f(location("u_ks"), config.ks);
+    glUniform1f(location("u_alpha"), config.alpha);
+    glUniform1f(location("u_gl"), config.gl);
+    glUniform1f(location("u_gh"), config.gh);
+
+    // Every pixel is written, so there is nothing to clear; the caller's viewport is restored afterwards.
+    std::array<GLint, 4> viewport;
+    glGetIntegerv(GL_VIEWPORT, viewport.data());
+    glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
+    glViewport(0, 0, m_resolution.x, m_resolution.y);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
+    glBindVertexArray(m_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+    glEndQuery(GL_TIME_ELAPSED);
+    m_timerQueryPending = true;
+    check_gl_error();
+}
+
+GLuint GPURenderer::texture() const
+{
+    return m_colorTexture;
+}
+
+glm::ivec2 GPURenderer::resolution() const
+{
+    return m_resolution;
+}
+
+std::vector<glm::vec4> GPURenderer::frameBuffer() const
+{
+    std::vector<glm::vec4> out(size_t(m_resolution.x) * size_t(m_resolution.y));
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_frameBuffer);
+    glReadPixels(0, 0, m_resolution.x, m_resolution.y, GL_RGBA, GL_FLOAT, out.data());
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    return out;
+}
+
+std::chrono::duration<double> GPURenderer::renderTime() const
+{
+    return m_renderTime;
+}
+
+// The color texture has the same format as the CPU frame buffer (RGBA 32-bit float), such that both are comparable.
+void GPURenderer::allocateFrameBuffer(const glm::ivec2& resolution)
+{
+    glDeleteFramebuffers(1, &m_frameBuffer);
+    glDeleteTextures(1, &m_colorTexture);
+
+    glGenTextures(1, &m_colorTexture);
+    glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, resolution.x, resolution.y, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &m_frameBuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_frameBuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cerr << "GPU renderer: incomplete frame buffer" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    m_resolution = resolution;
+}
+}
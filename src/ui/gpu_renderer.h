@@ -0,0 +1,64 @@
+#pragma once
+#include "opengl.h"
+#include "render/ray_trace_camera.h"
+#include "render/render_config.h"
+#include "volume/gradient_volume.h"
+#include "volume/volume.h"
+#include <chrono>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+namespace ui {
+
+// Ray casting with OpenGL (shaders/gpu_raycast.fs) as an alternative to render::Renderer. The volume and its gradients
+// are uploaded once as 3D textures and the 1D transfer function as a 1D texture; every frame renders all pixels in a
+// single draw call into a texture of the render resolution, with the same pixel layout as the frame buffer of the CPU
+// renderer (so it can be shown with FullScreenTextureGL::drawTexture and compared with the CPU image).
+class GPURenderer {
+public:
+    // Requires a current OpenGL context; canRender should return true for the volume.
+    GPURenderer(const volume::Volume& volume, const volume::GradientVolume& gradientVolume);
+    GPURenderer(const GPURenderer&) = delete;
+    GPURenderer& operator=(const GPURenderer&) = delete;
+    ~GPURenderer();
+
+    // Whether the volume fits in a 3D texture. Streaming volumes are not kept in memory, so they are never uploaded.
+    static bool canRender(const volume::Volume& volume);
+    // Whether the shaders implement the given settings. Cubic interpolation, adaptive sampling, preintegrated transfer
+    // functions, progressive rendering and the analytic iso surface are only implemented by the CPU renderer.
+    static bool supports(const render::RenderConfig& config, volume::InterpolationMode interpolationMode);
+
+    void render(const render::RayTraceCamera& camera, const render::RenderConfig& config, volume::InterpolationMode interpolationMode);
+
+    // The last rendered frame.
+    GLuint texture() const;
+    glm::ivec2 resolution() const;
+    // Reads the frame back from the GPU (slow; for validation only).
+    std::vector<glm::vec4> frameBuffer() const;
+    // GPU time of the most recent frame of which the timer query has finished (usually the previous frame).
+    std::chrono::duration<double> renderTime() const;
+
+private:
+    void allocateFrameBuffer(const glm::ivec2& resolution);
+
+private:
+    GLuint m_volumeTexture, m_gradientTexture, m_tfTexture;
+    glm::ivec3 m_dim;
+    // Converts normalized texture values back to voxel values.
+    float m_valueScale;
+    float m_volumeMaximum, m_minMagnitude, m_maxMagnitude;
+
+    GLuint m_frameBuffer { 0 }, m_colorTexture { 0 };
+    glm::ivec2 m_resolution { 0 };
+
+    GLuint m_timerQuery;
+    bool m_timerQueryPending { false };
+    std::chrono::duration<double> m_renderTime { 0 };
+
+    // The vertex shader generates the full screen triangle, but OpenGL still requires a vertex array to draw.
+    GLuint m_vao;
+    GLuint m_shader;
+};
+}
@@ -1,5 +1,6 @@
 #include "menu.h"
 #include "render/renderer.h"
+#include <cfloat>
 #include <filesystem>
 #include <fmt/format.h>
 #include <imgui.h>
@@ -12,6 +13,14 @@ Menu::Menu(const glm::ivec2& baseRenderResolution)
     : m_baseRenderResolution(baseRenderResolution)
 {
     m_renderConfig.renderResolution = m_baseRenderResolution;
+
+    // Same order as the values that addPerformanceFrame adds.
+    static constexpr size_t performanceGraphSize = 240;
+    m_performanceGraphs.push_back({ "Render time (ms)", std::vector<float>(performanceGraphSize, 0.0f) });
+    for (size_t i = 0; i < render::instrumentation::numCounters; i++)
+        m_performanceGraphs.push_back({ render::instrumentation::counterName(render::instrumentation::Counter(i)), std::vector<float>(performanceGraphSize, 0.0f) });
+    for (size_t i = 0; i < render::instrumentation::numStages; i++)
+        m_performanceGraphs.push_back({ fmt::format("{} (ms)", render::instrumentation::stageName(render::instrumentation::Stage(i))), std::vector<float>(performanceGraphSize, 0.0f) });
 }
 
 void Menu::setLoadVolumeCallback(LoadVolumeCallback&& callback)
@@ -19,6 +28,16 @@ void Menu::setLoadVolumeCallback(LoadVolumeCallback&& callback)
     m_optLoadVolumeCallback = std::move(callback);
 }
 
+void Menu::setAddChannelCallback(LoadVolumeCallback&& callback)
+{
+    m_optAddChannelCallback = std::move(callback);
+}
+
+void Menu::setLoadSequenceCallback(LoadVolumeCallback&& callback)
+{
+    m_optLoadSequenceCallback = std::move(callback);
+}
+
 void Menu::setRenderConfigChangedCallback(RenderConfigChangedCallback&& callback)
 {
     m_optRenderConfigChangedCallback = std::move(callback);
@@ -29,6 +48,11 @@ void Menu::setInterpolationModeChangedCallback(InterpolationModeChangedCallback&
     m_optInterpolationModeChangedCallback = std::move(callback);
 }
 
+void Menu::setCompareRenderersCallback(CompareRenderersCallback&& callback)
+{
+    m_optCompareRenderersCallback = std::move(callback);
+}
+
 render::RenderConfig Menu::renderConfig() const
 {
     return m_renderConfig;
@@ -39,10 +63,33 @@ volume::InterpolationMode Menu::interpolationMode() const
     return m_interpolationMode;
 }
 
+TextureFormat Menu::displayFormat() const
+{
+    return m_displayFormat;
+}
+
+bool Menu::renderOnGPU() const
+{
+    return m_gpuRenderModes[size_t(m_renderConfig.renderMode)];
+}
+
+bool Menu::playing() const
+{
+    return m_numTimesteps > 0 && m_playing;
+}
+
+float Menu::timestepsPerSecond() const
+{
+    return m_timestepsPerSecond;
+}
+
 void Menu::setBaseRenderResolution(const glm::ivec2& baseRenderResolution)
 {
     m_baseRenderResolution = baseRenderResolution;
-    m_renderConfig.renderResolution = glm::ivec2(glm::vec2(m_baseRenderResolution) * m_resolutionScale);
+    const glm::ivec2 renderResolution = glm::ivec2(glm::vec2(m_baseRenderResolution) * m_resolutionScale);
+    if (renderResolution == m_renderConfig.renderResolution)
+        return;
+    m_renderConfig.renderResolution = renderResolution;
     callRenderConfigChangedCallback();
 }
 
@@ -61,6 +108,44 @@ void Menu::setLoadedVolume(const volume::Volume& volume, const volume::GradientV
         volume.fileName(), dim.x, dim.y, dim.z, volume.minimum(), volume.maximum());
     m_volumeMax = int(volume.maximum());
     m_volumeLoaded = true;
+
+    m_channelTFWidgets.clear();
+    m_channelNames.clear();
+    m_numTimesteps = 0;
+    m_playing = false;
+}
+
+void Menu::setLoadedSequence(size_t numTimesteps)
+{
+    m_numTimesteps = numTimesteps;
+    m_currentTimestep = 0;
+    m_residentTimesteps = 1;
+}
+
+void Menu::setSequenceStatus(size_t currentTimestep, size_t residentTimesteps)
+{
+    m_currentTimestep = currentTimestep;
+    m_residentTimesteps = residentTimesteps;
+}
+
+void Menu::addChannelVolume(const volume::Volume& volume)
+{
+    m_channelTFWidgets.emplace_back(volume);
+    m_channelTFWidgets.back().updateRenderConfig(m_renderConfig.channelTransferFunctions[m_channelTFWidgets.size() - 1]);
+    m_channelNames.emplace_back(volume.fileName());
+}
+
+void Menu::addPerformanceFrame(std::chrono::duration<double> renderTime, const render::instrumentation::FrameRecord& record)
+{
+    std::vector<float> values { float(renderTime.count() * 1000.0) };
+    for (const uint64_t counter : record.counters)
+        values.push_back(float(counter));
+    for (const auto stageTime : record.stageTimes)
+        values.push_back(float(stageTime.count() * 1000.0));
+
+    for (size_t i = 0; i < m_performanceGraphs.size(); i++)
+        m_performanceGraphs[i].values[m_performanceGraphOffset] = values[i];
+    m_performanceGraphOffset = (m_performanceGraphOffset + 1) % m_performanceGraphs[0].values.size();
 }
 
 // This function draws the menu
@@ -79,9 +164,12 @@ void Menu::drawMenu(const glm::ivec2& pos, const glm::ivec2& size, std::chrono::
 
         showRayCastTab(renderTime);
         showTransFuncTab();
+        showChannelTransFuncTabs();
         show2DTransFuncTab();
+        showPerformanceTab();
 
-        if (m_renderConfig != renderConfigBefore)
+        // Settings that the current render mode does not use are passed on with the next change that does matter.
+        if (render::renderConfigChanges(renderConfigBefore, m_renderConfig).image)
             callRenderConfigChangedCallback();
         if (m_interpolationMode != interpolationModeBefore)
             callInterpolationModeChangedCallback();
@@ -98,7 +186,7 @@ void Menu::showLoadVolTab()
 
         if (ImGui::Button("Load volume")) {
             nfdchar_t* pOutPath = nullptr;
-            nfdresult_t result = NFD_OpenDialog("fld", nullptr, &pOutPath);
+            nfdresult_t result = NFD_OpenDialog("fld,bvol,cvol", nullptr, &pOutPath);
 
             if (result == NFD_OKAY) {
                 // Convert from char* to std::filesystem::path
@@ -107,9 +195,34 @@ void Menu::showLoadVolTab()
                     (*m_optLoadVolumeCallback)(path);
             }
         }
+        ImGui::SameLine();
+        if (ImGui::Button("Load volume sequence")) {
+            nfdchar_t* pOutPath = nullptr;
+            if (NFD_PickFolder(nullptr, &pOutPath) == NFD_OKAY && m_optLoadSequenceCallback)
+                (*m_optLoadSequenceCallback)(std::filesystem::path(pOutPath));
+        }
 
-        if (m_volumeLoaded)
+        if (m_volumeLoaded) {
             ImGui::Text("%s", m_volumeInfo.c_str());
+            ImGui::NewLine();
+
+            if (m_numTimesteps > 0) {
+                // Playback moves on to the next timestep once it has been loaded in the background, so it may run
+                // slower than the chosen speed.
+                ImGui::Text("Timestep %zu / %zu (%zu resident)", m_currentTimestep + 1, m_numTimesteps, m_residentTimesteps);
+                ImGui::Checkbox("Play", &m_playing);
+                ImGui::SliderFloat("Timesteps per second", &m_timestepsPerSecond, 1.0f, 60.0f);
+            } else {
+                // Volume channels are composited together with the loaded volume (Compositing render mode).
+                for (size_t i = 0; i < m_channelNames.size(); i++)
+                    ImGui::Text("Channel %zu: %s", i + 1, m_channelNames[i].c_str());
+                if (m_channelNames.size() < render::maxVolumeChannels && ImGui::Button("Add volume channel")) {
+                    nfdchar_t* pOutPath = nullptr;
+                    if (NFD_OpenDialog("fld,bvol,cvol", nullptr, &pOutPath) == NFD_OKAY && m_optAddChannelCallback)
+                        (*m_optAddChannelCallback)(std::filesystem::path(pOutPath));
+                }
+            }
+        }
 
         ImGui::EndTabItem();
     }
@@ -135,6 +248,18 @@ void Menu::showRayCastTab(std::chrono::duration<double> renderTime)
         ImGui::RadioButton("MIDA", pRenderModeInt, int(render::RenderMode::RenderMIDA));
         ImGui::RadioButton("DVR to MIDA to MIP", pRenderModeInt, int(render::RenderMode::RenderCombined));
 
+        // The renderer is chosen per render mode. Switching renderers changes the image, but not the render config.
+        if (ImGui::Checkbox("Render on the GPU", &m_gpuRenderModes[size_t(m_renderConfig.renderMode)]))
+            callRenderConfigChangedCallback();
+        if (renderOnGPU()) {
+            if (!GPURenderer::supports(m_renderConfig, m_interpolationMode))
+                ImGui::TextWrapped("The GPU renderer does not implement tri-cubic interpolation, adaptive sampling, preintegration or progressive rendering; rendering on the CPU.");
+            if (ImGui::Button("Compare with the CPU renderer") && m_optCompareRenderersCallback)
+                m_rendererComparison = (*m_optCompareRenderersCallback)();
+            if (!m_rendererComparison.empty())
+                ImGui::TextWrapped("%s", m_rendererComparison.c_str());
+        }
+
         ImGui::NewLine();
 
         ImGui::Checkbox("Volume Shading", &m_renderConfig.volumeShading);
@@ -145,6 +270,7 @@ void Menu::showRayCastTab(std::chrono::duration<double> renderTime)
         ImGui::DragFloat("kd", &m_renderConfig.kd, 0.01f, 0.0f, 1.0f);
         ImGui::DragFloat("ks", &m_renderConfig.ks, 0.01f, 0.0f, 1.0f);
         ImGui::DragFloat("alpha", &m_renderConfig.alpha, 0.1f, 0.0f, 100.0f);
+        ImGui::Checkbox("Fast shading (headlight)", &m_renderConfig.fastShading);
 
         ImGui::NewLine();
 
@@ -155,10 +281,23 @@ void Menu::showRayCastTab(std::chrono::duration<double> renderTime)
         ImGui::NewLine();
 
         ImGui::DragFloat("Iso Value", &m_renderConfig.isoValue, 0.1f, 0.0f, float(m_volumeMax));
+        ImGui::Checkbox("Analytic iso surface intersection", &m_renderConfig.analyticIsoSurface);
+        ImGui::Checkbox("Cache iso surface for shading changes", &m_renderConfig.cacheIsoSurface);
 
         ImGui::NewLine();
 
         ImGui::DragFloat("Resolution scale", &m_resolutionScale, 0.0025f, 0.25f, 2.0f);
+        ImGui::Checkbox("Progressive rendering", &m_renderConfig.progressive);
+        ImGui::Checkbox("Level of detail while interacting", &m_renderConfig.levelOfDetail);
+        ImGui::Checkbox("Temporal reprojection while interacting", &m_renderConfig.temporalReprojection);
+        ImGui::DragInt("Progressive samples", &m_renderConfig.progressiveFrames, 0.1f, 1, 64);
+        ImGui::DragFloat("Early termination opacity", &m_renderConfig.earlyTerminationOpacity, 0.001f, 0.9f, 1.0f);
+        ImGui::Checkbox("Adaptive sampling", &m_renderConfig.adaptiveSampling);
+        ImGui::SliderFloat("Sampling quality", &m_renderConfig.adaptiveSamplingQuality, 0.0f, 1.0f);
+        ImGui::DragFloat("Sample step", &m_renderConfig.sampleStep, 0.01f, 0.25f, 4.0f);
+        ImGui::Checkbox("Preintegrated transfer function", &m_renderConfig.preintegrated);
+        // Composite, MIDA and MIP are split into subvolumes (0 renders the whole volume at once).
+        ImGui::SliderInt("Distributed workers", &m_renderConfig.distributedWorkers, 0, 16);
 
         ImGui::NewLine();
 
@@ -174,6 +313,15 @@ void Menu::showRayCastTab(std::chrono::duration<double> renderTime)
         ImGui::RadioButton("Linear", pInterpolationModeInt, int(volume::InterpolationMode::Linear));
         ImGui::RadioButton("TriCubic", pInterpolationModeInt, int(volume::InterpolationMode::Cubic));
 
+        ImGui::NewLine();
+
+        // Lower precision formats reduce the time it takes to upload the image to the GPU.
+        int* pDisplayFormatInt = reinterpret_cast<int*>(&m_displayFormat);
+        ImGui::Text("Display format:");
+        ImGui::RadioButton("RGBA 32-bit float", pDisplayFormatInt, int(TextureFormat::RGBA32F));
+        ImGui::RadioButton("RGBA 16-bit float", pDisplayFormatInt, int(TextureFormat::RGBA16F));
+        ImGui::RadioButton("RGBA 8-bit", pDisplayFormatInt, int(TextureFormat::RGBA8));
+
         ImGui::EndTabItem();
     }
 }
@@ -188,6 +336,18 @@ void Menu::showTransFuncTab()
     }
 }
 
+// This renders a 1D Transfer Function Widget per volume channel.
+void Menu::showChannelTransFuncTabs()
+{
+    for (size_t i = 0; i < m_channelTFWidgets.size(); i++) {
+        if (ImGui::BeginTabItem(fmt::format("Channel {} transfer function", i + 1).c_str())) {
+            m_channelTFWidgets[i].draw();
+            m_channelTFWidgets[i].updateRenderConfig(m_renderConfig.channelTransferFunctions[i]);
+            ImGui::EndTabItem();
+        }
+    }
+}
+
 // This renders the 2D Transfer Function Widget.
 void Menu::show2DTransFuncTab()
 {
@@ -198,6 +358,42 @@ void Menu::show2DTransFuncTab()
     }
 }
 
+// This renders the Performance tab: rolling graphs of the statistics of the last frames (see
+//  render/instrumentation.h) and the controls to record a trace.
+void Menu::showPerformanceTab()
+{
+    if (ImGui::BeginTabItem("Performance")) {
+        // Without instrumentation only the render time is known.
+        const size_t numGraphs = render::instrumentation::enabled() ? m_performanceGraphs.size() : 1;
+        for (size_t i = 0; i < numGraphs; i++) {
+            const PerformanceGraph& graph = m_performanceGraphs[i];
+            const size_t newest = (m_performanceGraphOffset + graph.values.size() - 1) % graph.values.size();
+            const std::string overlay = fmt::format("{}: {}", graph.name, graph.values[newest]);
+            ImGui::PlotLines(fmt::format("##{}", graph.name).c_str(), graph.values.data(), int(graph.values.size()), int(m_performanceGraphOffset),
+                overlay.c_str(), 0.0f, FLT_MAX, ImVec2(ImGui::GetContentRegionAvail().x, 40.0f));
+        }
+
+        ImGui::NewLine();
+        if (render::instrumentation::enabled()) {
+            bool tracing = render::instrumentation::tracing();
+            if (ImGui::Checkbox("Record trace", &tracing))
+                render::instrumentation::setTracing(tracing);
+            if (ImGui::Button("Save trace")) {
+                nfdchar_t* pOutPath = nullptr;
+                if (NFD_SaveDialog("json", nullptr, &pOutPath) == NFD_OKAY) {
+                    const std::filesystem::path path = pOutPath;
+                    if (!render::instrumentation::writeTrace(path))
+                        std::cerr << "Failed to write trace to " << path << std::endl;
+                }
+            }
+        } else {
+            ImGui::TextWrapped("Build with VOLVIS_INSTRUMENTATION=1 to collect ray statistics and traces.");
+        }
+
+        ImGui::EndTabItem();
+    }
+}
+
 void Menu::callRenderConfigChangedCallback() const
 {
     if (m_optRenderConfigChangedCallback)
@@ -1,15 +1,20 @@
 #pragma once
+#include "render/instrumentation.h"
 #include "render/render_config.h"
+#include "ui/full_screen_texture_gl.h"
+#include "ui/gpu_renderer.h"
 #include "ui/transfer_func.h"
 #include "ui/transfer_func_2d.h"
 #include "volume/gradient_volume.h"
 #include "volume/volume.h"
 #include <chrono>
+#include <array>
 #include <filesystem>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <string>
+#include <vector>
 
 namespace render {
 class Renderer;
@@ -22,16 +27,38 @@ public:
 
     using LoadVolumeCallback = std::function<void(const std::filesystem::path&)>;
     void setLoadVolumeCallback(LoadVolumeCallback&& callback);
+    // Loads a volume that is composited together with the loaded volume (see render::Renderer::setChannels).
+    void setAddChannelCallback(LoadVolumeCallback&& callback);
+    // Loads the volumes in a directory as the timesteps of a volume sequence (see volume::VolumeSequence).
+    void setLoadSequenceCallback(LoadVolumeCallback&& callback);
     using RenderConfigChangedCallback = std::function<void(const render::RenderConfig&)>;
     void setRenderConfigChangedCallback(RenderConfigChangedCallback&& callback);
     using InterpolationModeChangedCallback = std::function<void(volume::InterpolationMode)>;
     void setInterpolationModeChangedCallback(InterpolationModeChangedCallback&& callback);
+    // Renders the current view with both renderers and returns a description of the difference.
+    using CompareRenderersCallback = std::function<std::string()>;
+    void setCompareRenderersCallback(CompareRenderersCallback&& callback);
 
     render::RenderConfig renderConfig() const;
     volume::InterpolationMode interpolationMode() const;
+    TextureFormat displayFormat() const;
+    // Whether the user selected the GPU renderer for the current render mode (see GPURenderer::supports for the
+    // settings that it can render).
+    bool renderOnGPU() const;
+    // Playback of a volume sequence: whether the user pressed play, and at which speed.
+    bool playing() const;
+    float timestepsPerSecond() const;
 
     void setBaseRenderResolution(const glm::ivec2& baseRenderResolution);
     void setLoadedVolume(const volume::Volume& volume, const volume::GradientVolume& gradientVolume);
+    // Add a transfer function for a volume channel (the channels are removed when a new volume is loaded).
+    void addChannelVolume(const volume::Volume& volume);
+    // Show the playback controls of a volume sequence, of which setLoadedVolume was given the first timestep (the
+    // widgets are not rebuilt for the other timesteps). Loading another volume hides them again.
+    void setLoadedSequence(size_t numTimesteps);
+    void setSequenceStatus(size_t currentTimestep, size_t residentTimesteps);
+    // Add a frame to the graphs of the performance tab. Called once per frame of the user interface.
+    void addPerformanceFrame(std::chrono::duration<double> renderTime, const render::instrumentation::FrameRecord& record);
 
     void drawMenu(const glm::ivec2& pos, const glm::ivec2& size, std::chrono::duration<double> renderTime);
 
@@ -39,7 +66,9 @@ private:
     void showLoadVolTab();
     void showRayCastTab(std::chrono::duration<double> renderTime);
     void showTransFuncTab();
+    void showChannelTransFuncTabs();
     void show2DTransFuncTab();
+    void showPerformanceTab();
 
     void callRenderConfigChangedCallback() const;
     void callInterpolationModeChangedCallback() const;
@@ -51,15 +80,40 @@ private:
 
     std::optional<TransferFunctionWidget> m_tfWidget;
     std::optional<TransferFunction2DWidget> m_tf2DWidget;
+    // Per volume channel its transfer function and file name.
+    std::vector<TransferFunctionWidget> m_channelTFWidgets;
+    std::vector<std::string> m_channelNames;
+
+    // Volume sequence (m_numTimesteps is 0 if a single volume is loaded).
+    size_t m_numTimesteps { 0 };
+    size_t m_currentTimestep { 0 };
+    size_t m_residentTimesteps { 0 };
+    bool m_playing { false };
+    float m_timestepsPerSecond { 10.0f };
 
     glm::ivec2 m_baseRenderResolution;
     float m_resolutionScale { 1.0f };
     render::RenderConfig m_renderConfig {};
     volume::InterpolationMode m_interpolationMode { volume::InterpolationMode::NearestNeighbour };
+    TextureFormat m_displayFormat { TextureFormat::RGBA32F };
+    // Per render mode: whether to render it with the GPURenderer.
+    std::array<bool, size_t(render::RenderMode::RenderCombined) + 1> m_gpuRenderModes {};
+    std::string m_rendererComparison;
+
+    // Rolling graphs of the performance tab: ring buffers of the last values, which all start at the same offset.
+    struct PerformanceGraph {
+        std::string name;
+        std::vector<float> values;
+    };
+    std::vector<PerformanceGraph> m_performanceGraphs;
+    size_t m_performanceGraphOffset { 0 };
 
     std::optional<LoadVolumeCallback> m_optLoadVolumeCallback;
+    std::optional<LoadVolumeCallback> m_optAddChannelCallback;
+    std::optional<LoadVolumeCallback> m_optLoadSequenceCallback;
     std::optional<RenderConfigChangedCallback> m_optRenderConfigChangedCallback;
     std::optional<InterpolationModeChangedCallback> m_optInterpolationModeChangedCallback;
+    std::optional<CompareRenderersCallback> m_optCompareRenderersCallback;
 };
 
 }
@@ -91,21 +91,38 @@ glm::vec3 Trackball::forward() const
     return m_rotation * glm::vec3(0, 0, 1);
 }
 
-// This function generates a ray with its origin at cameraPos, going through pixel pixel on the virtual screen
-render::Ray Trackball::generateRay(const glm::vec2& pixel) const
+Trackball::ScreenBasis Trackball::screenBasis() const
 {
     const float halfScreenPlaceHeight = std::tan(m_fovy / 2.0f);
     const float halfScreenPlaceWidth = m_aspectRatio * halfScreenPlaceHeight;
-    const glm::vec3 cameraSpaceDirection = glm::normalize(glm::vec3(pixel.x * halfScreenPlaceWidth, pixel.y * halfScreenPlaceHeight, 1.0f));
+    return ScreenBasis {
+        m_rotation * glm::vec3(halfScreenPlaceWidth, 0.0f, 0.0f),
+        m_rotation * glm::vec3(0.0f, halfScreenPlaceHeight, 0.0f),
+        m_rotation * glm::vec3(0.0f, 0.0f, 1.0f)
+    };
+}
 
+// This function generates a ray with its origin at cameraPos, going through pixel pixel on the virtual screen
+render::Ray Trackball::generateRay(const glm::vec2& pixel) const
+{
     render::Ray ray;
-    ray.origin = m_cameraPos;
-    ray.direction = m_rotation * cameraSpaceDirection;
-    ray.tmin = std::numeric_limits<float>::lowest();
-    ray.tmax = std::numeric_limits<float>::max();
+    generateRays(gsl::span<const glm::vec2>(&pixel, 1), gsl::span<render::Ray>(&ray, 1));
     return ray;
 }
 
+// Same as generateRay for a batch of pixels, but the screen basis (the tangent and the rotation) is computed only once.
+void Trackball::generateRays(gsl::span<const glm::vec2> pixels, gsl::span<render::Ray> rays) const
+{
+    const ScreenBasis basis = screenBasis();
+    for (size_t i = 0; i < pixels.size(); i++) {
+        render::Ray& ray = rays[i];
+        ray.origin = m_cameraPos;
+        ray.direction = glm::normalize(basis.forward + pixels[i].x * basis.right + pixels[i].y * basis.up);
+        ray.tmin = std::numeric_limits<float>::lowest();
+        ray.tmax = std::numeric_limits<float>::max();
+    }
+}
+
 // This function handles mouse button interaction, where the type of movement depends on
 //  the button pressed
 void Trackball::mouseButtonCallback(int button, int action, int /* mods */)
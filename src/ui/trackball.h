@@ -31,8 +31,16 @@ public:
 
     // Generate ray given pixel in NDC space (-1 to +1)
     render::Ray generateRay(const glm::vec2& pixel) const override;
+    void generateRays(gsl::span<const glm::vec2> pixels, gsl::span<render::Ray> rays) const override;
 
 private:
+    // The screen plane at distance 1 in front of the camera in world space: the ray through pixel p (in NDC space)
+    // has the direction normalize(forward + p.x * right + p.y * up).
+    struct ScreenBasis {
+        glm::vec3 right, up, forward;
+    };
+    ScreenBasis screenBasis() const;
+
     void mouseButtonCallback(int button, int action, int mods);
     void mouseMoveCallback(const glm::vec2& pos);
     void mouseScrollCallback(const glm::vec2& offset);
@@ -35,7 +35,7 @@ TransferFunctionWidget::TransferFunctionWidget(const volume::Volume& volume)
     m_tfPoints.push_back(TFPoint { glm::vec2(0.7f, 0.03f), glm::vec3(0.7f) });
     m_tfPoints.push_back(TFPoint { glm::vec2(1.0f), glm::vec3(1.0f) });
 
-    const auto histogram = volume.histogram();
+    const std::vector<int>& histogram = volume.histogram();
     const auto imgData = createHistogramImage(histogram, histogramOpacity);
 
     glBindTexture(GL_TEXTURE_2D, m_histogramImg);
@@ -54,6 +54,14 @@ void TransferFunctionWidget::updateRenderConfig(render::RenderConfig& renderConf
     renderConfig.tfColorMapIndexRange = m_maxValue;
 }
 
+void TransferFunctionWidget::updateRenderConfig(render::ChannelTransferFunction& transferFunction) const
+{
+    assert(m_colorMap.size() == transferFunction.tfColorMap.size());
+    std::copy(std::begin(m_colorMap), std::end(m_colorMap), std::begin(transferFunction.tfColorMap));
+    transferFunction.tfColorMapIndexStart = 0;
+    transferFunction.tfColorMapIndexRange = m_maxValue;
+}
+
 // Draw the widget and handle interactions.
 void TransferFunctionWidget::draw()
 {
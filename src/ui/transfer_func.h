@@ -14,6 +14,8 @@ public:
 
     void draw();
     void updateRenderConfig(render::RenderConfig& renderConfig) const;
+    // Same for the transfer function of a volume channel.
+    void updateRenderConfig(render::ChannelTransferFunction& transferFunction) const;
 
 private:
     void updateColormap();
@@ -1,6 +1,7 @@
 #include "transfer_func_2d.h"
 #include <algorithm>
 #include <array>
+#include <cmath>
 #include <filesystem>
 #include <glm/common.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -11,8 +12,7 @@
 
 static ImVec2 glmToIm(const glm::vec2& v);
 static glm::vec2 ImToGlm(const ImVec2& v);
-static std::vector<glm::vec4> createHistogramImage(
-    const volume::Volume& volume, const volume::GradientVolume& gradient, const glm::ivec2& res);
+static std::vector<glm::vec4> createHistogramImage(const volume::Histogram2D& histogram);
 
 namespace ui {
 
@@ -28,8 +28,10 @@ TransferFunction2DWidget::TransferFunction2DWidget(const volume::Volume& volume,
     , m_interactingPoint(-1)
     , m_histogramImg(0)
 {
-    const glm::ivec2 res = glm::ivec2(volume.maximum(), gradient.maxMagnitude() + 1);
-    const auto imgData = createHistogramImage(volume, gradient, res);
+    // The 2D histogram is computed together with the gradients (or read from the statistics cache of the volume).
+    const volume::Histogram2D& histogram = gradient.histogram2D();
+    const glm::ivec2 res = glm::max(histogram.dims, glm::ivec2(1));
+    const auto imgData = createHistogramImage(histogram);
 
     glGenTextures(1, &m_histogramImg);
     glBindTexture(GL_TEXTURE_2D, m_histogramImg);
@@ -211,30 +213,24 @@ static glm::vec2 ImToGlm(const ImVec2& v)
     return glm::vec2(v.x, v.y);
 }
 
-// Compute a histogram texture from the volume and gradient data
-static std::vector<glm::vec4> createHistogramImage(
-    const volume::Volume& volume, const volume::GradientVolume& gradient, const glm::ivec2& res)
+// Compute a histogram texture from the 2D histogram: the gradient magnitude increases from the bottom to the top.
+static std::vector<glm::vec4> createHistogramImage(const volume::Histogram2D& histogram)
 {
-    const size_t numPixels = static_cast<size_t>(res.x * res.y);
-    std::vector<int> bins(numPixels, 0);
-    for (int z = 0; z < volume.dims().z; z++) {
-        for (int y = 0; y < volume.dims().y; y++) {
-            for (int x = 0; x < volume.dims().x; x++) {
-                const size_t imgX = static_cast<size_t>(volume.getVoxel(x, y, z));
-                const size_t imgY = static_cast<size_t>(res.y - 1) - static_cast<size_t>(gradient.getGradient(x, y, z).magnitude);
-                const size_t index = imgX + imgY * static_cast<size_t>(res.x);
-                bins[index]++;
-            }
-        }
-    }
+    if (histogram.bins.empty())
+        return std::vector<glm::vec4>(1, glm::vec4(0.0f));
 
-    const int maxCount = *std::max_element(std::begin(bins), std::end(bins));
+    const int maxCount = *std::max_element(std::begin(histogram.bins), std::end(histogram.bins));
     const float factor = 1.0f / std::log(float(maxCount));
 
-    std::vector<glm::vec4> imageData(numPixels, glm::vec4(0.0f));
-    std::transform(std::begin(bins), std::end(bins), std::begin(imageData),
-        [&](int count) {
-            return glm::vec4(1.0f, 1.0f, 1.0f, std::log(float(count)) * factor);
-        });
+    const size_t width = size_t(histogram.dims.x);
+    const size_t height = size_t(histogram.dims.y);
+    std::vector<glm::vec4> imageData(width * height, glm::vec4(0.0f));
+    for (size_t y = 0; y < height; y++) {
+        const auto row = std::begin(histogram.bins) + std::ptrdiff_t(y * width);
+        std::transform(row, row + std::ptrdiff_t(width), std::begin(imageData) + std::ptrdiff_t((height - 1 - y) * width),
+            [&](int count) {
+                return glm::vec4(1.0f, 1.0f, 1.0f, std::log(float(count)) * factor);
+            });
+    }
     return imageData;
 }
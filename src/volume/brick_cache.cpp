@@ -0,0 +1,373 @@
+#include "brick_cache.h"
+#include "gradient_volume.h"
+#include "volume_pyramid.h"
+#include <algorithm>
+#include <fstream>
+#include <glm/common.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <utility>
+
+static constexpr char brickFileMagic[8] = { 'V', 'V', 'B', 'R', 'I', 'C', 'K', '1' };
+
+template <typename T>
+static void writeArray(std::ofstream& ofs, const T* pData, size_t count)
+{
+    ofs.write(reinterpret_cast<const char*>(pData), std::streamsize(count * sizeof(T)));
+}
+
+template <typename T>
+static void readArray(std::ifstream& ifs, T* pData, size_t count)
+{
+    ifs.read(reinterpret_cast<char*>(pData), std::streamsize(count * sizeof(T)));
+}
+
+static size_t numVoxels(const glm::ivec3& dim)
+{
+    return size_t(dim.x) * size_t(dim.y) * size_t(dim.z);
+}
+
+namespace volume {
+
+template <typename Voxel>
+static void writeBricks(const Volume& volume, const GradientVolume& gradientVolume, std::ofstream& ofs, int maxCoarseSize)
+{
+    const glm::ivec3 dim = volume.dims();
+    const glm::ivec3 brickDim = (dim + BrickCache::brickSize - 1) / BrickCache::brickSize;
+
+    // The coarse copy is the first level of the pyramid that is small enough.
+    std::unique_ptr<const Volume> pCoarseVolume;
+    const Volume* pLevel = &volume;
+    int coarseScale = 1;
+    while (glm::compMax(pLevel->dims()) > maxCoarseSize) {
+        pCoarseVolume = std::make_unique<const Volume>(VolumePyramid::reduce(*pLevel));
+        pLevel = pCoarseVolume.get();
+        coarseScale *= 2;
+    }
+    const glm::ivec3 coarseDim = pLevel->dims();
+
+    const std::vector<int>& histogram = volume.histogram();
+    BrickFileHeader header {};
+    std::copy(std::begin(brickFileMagic), std::end(brickFileMagic), header.magic);
+    header.brickSize = BrickCache::brickSize;
+    header.voxelType = int32_t(volume.voxelType());
+    header.coarseScale = coarseScale;
+    for (int axis = 0; axis < 3; axis++) {
+        header.dim[axis] = dim[axis];
+        header.coarseDim[axis] = coarseDim[axis];
+    }
+    header.minimum = volume.minimum();
+    header.maximum = volume.maximum();
+    header.minGradientMagnitude = gradientVolume.minMagnitude();
+    header.maxGradientMagnitude = gradientVolume.maxMagnitude();
+    header.histogramSize = uint32_t(histogram.size());
+    writeArray(ofs, &header, 1);
+    writeArray(ofs, histogram.data(), histogram.size());
+
+    // The value ranges are only known after the bricks have been assembled, so they are written last.
+    std::vector<MacroCell> brickRanges(numVoxels(brickDim));
+    const auto rangesPosition = ofs.tellp();
+    writeArray(ofs, brickRanges.data(), brickRanges.size());
+
+    std::vector<Voxel> coarseVoxels;
+    coarseVoxels.reserve(numVoxels(coarseDim));
+    for (int z = 0; z < coarseDim.z; z++) {
+        for (int y = 0; y < coarseDim.y; y++) {
+            for (int x = 0; x < coarseDim.x; x++)
+                coarseVoxels.push_back(Voxel(pLevel->getVoxel<Voxel>(x, y, z)));
+        }
+    }
+    writeArray(ofs, coarseVoxels.data(), coarseVoxels.size());
+
+    // Assemble the bricks of one slab (along z) in parallel, then append them to the file.
+    constexpr size_t paddedVoxels = size_t(BrickCache::paddedSize) * size_t(BrickCache::paddedSize) * size_t(BrickCache::paddedSize);
+    std::vector<Voxel> slab(size_t(brickDim.x) * size_t(brickDim.y) * paddedVoxels);
+    for (int brickZ = 0; brickZ < brickDim.z; brickZ++) {
+        tbb::parallel_for(tbb::blocked_range<int>(0, brickDim.x * brickDim.y), [&](const tbb::blocked_range<int>& range) {
+            for (int i = range.begin(); i != range.end(); i++) {
+                const glm::ivec3 brick { i % brickDim.x, i / brickDim.x, brickZ };
+                const glm::ivec3 origin = brick * BrickCache::brickSize - BrickCache::apronLower;
+                Voxel* pVoxel = slab.data() + size_t(i) * paddedVoxels;
+                MacroCell brickRange { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() };
+                for (int z = 0; z < BrickCache::paddedSize; z++) {
+                    for (int y = 0; y < BrickCache::paddedSize; y++) {
+                        for (int x = 0; x < BrickCache::paddedSize; x++) {
+                            const glm::ivec3 voxel = glm::clamp(origin + glm::ivec3(x, y, z), glm::ivec3(0), dim - 1);
+                            const float value = volume.getVoxel<Voxel>(voxel.x, voxel.y, voxel.z);
+                            brickRange.minimum = std::min(brickRange.minimum, value);
+                            brickRange.maximum = std::max(brickRange.maximum, value);
+                            *pVoxel++ = Voxel(value);
+                        }
+                    }
+                }
+                brickRanges[size_t(i) + size_t(brickDim.x) * size_t(brickDim.y) * size_t(brickZ)] = brickRange;
+            }
+        });
+        writeArray(ofs, slab.data(), slab.size());
+    }
+
+    ofs.seekp(rangesPosition);
+    writeArray(ofs, brickRanges.data(), brickRanges.size());
+}
+
+void writeBrickFile(const Volume& volume, const GradientVolume& gradientVolume, const std::filesystem::path& file, int maxCoarseSize)
+{
+    std::ofstream ofs { file, std::ios::binary };
+    dispatchVoxelType(volume.voxelType(), [&](auto voxel) { writeBricks<decltype(voxel)>(volume, gradientVolume, ofs, maxCoarseSize); });
+    if (!ofs)
+        std::cerr << "Could not write " << file << std::endl;
+}
+
+BrickCache::BrickCache(const std::filesystem::path& file, size_t memoryBudget)
+    : m_file(file)
+    , m_memoryBudget(memoryBudget)
+{
+    std::ifstream ifs { file, std::ios::binary };
+    readArray(ifs, &m_header, 1);
+    if (!ifs || !std::equal(std::begin(brickFileMagic), std::end(brickFileMagic), m_header.magic))
+        throw std::runtime_error("File " + file.string() + " is not a brick file");
+    if (m_header.brickSize != brickSize || m_header.voxelType < 0 || m_header.voxelType > int32_t(VoxelType::Float))
+        throw std::runtime_error("File " + file.string() + " uses an unsupported brick size or voxel type");
+
+    m_histogram.resize(m_header.histogramSize);
+    readArray(ifs, m_histogram.data(), m_histogram.size());
+    m_brickRanges.resize(numBricks());
+    readArray(ifs, m_brickRanges.data(), m_brickRanges.size());
+
+    const glm::ivec3 coarseDim { m_header.coarseDim[0], m_header.coarseDim[1], m_header.coarseDim[2] };
+    m_brickBytes = dispatchVoxelType(voxelType(), [&](auto voxel) {
+        using Voxel = decltype(voxel);
+        std::vector<Voxel> coarseVoxels(numVoxels(coarseDim));
+        readArray(ifs, coarseVoxels.data(), coarseVoxels.size());
+        m_pCoarseVolume = std::make_unique<const Volume>(std::move(coarseVoxels), coarseDim, VoxelLayout::Bricked);
+        return size_t(paddedSize) * size_t(paddedSize) * size_t(paddedSize) * sizeof(Voxel);
+    });
+    if (!ifs)
+        throw std::runtime_error("File " + file.string() + " is truncated");
+    m_bricksOffset = size_t(ifs.tellg());
+
+    m_pBrickPointers = std::make_unique<std::atomic<const std::byte*>[]>(numBricks());
+    m_pBrickStates = std::make_unique<std::atomic<BrickState>[]>(numBricks());
+    m_pLastUsed = std::make_unique<std::atomic<uint32_t>[]>(numBricks());
+    m_brickData.resize(numBricks());
+    m_thread = std::thread([this]() { loadLoop(); });
+}
+
+BrickCache::~BrickCache()
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        m_stop = true;
+    }
+    m_wakeUp.notify_one();
+    m_thread.join();
+}
+
+glm::ivec3 BrickCache::dims() const
+{
+    return { m_header.dim[0], m_header.dim[1], m_header.dim[2] };
+}
+
+VoxelType BrickCache::voxelType() const
+{
+    return VoxelType(m_header.voxelType);
+}
+
+float BrickCache::minimum() const
+{
+    return m_header.minimum;
+}
+
+float BrickCache::maximum() const
+{
+    return m_header.maximum;
+}
+
+const std::vector<int>& BrickCache::histogram() const
+{
+    return m_histogram;
+}
+
+float BrickCache::minGradientMagnitude() const
+{
+    return m_header.minGradientMagnitude;
+}
+
+float BrickCache::maxGradientMagnitude() const
+{
+    return m_header.maxGradientMagnitude;
+}
+
+glm::ivec3 BrickCache::brickDims() const
+{
+    return (dims() + brickSize - 1) / brickSize;
+}
+
+size_t BrickCache::numBricks() const
+{
+    return numVoxels(brickDims());
+}
+
+size_t BrickCache::brickIndex(const glm::ivec3& brick) const
+{
+    const glm::ivec3 brickDim = brickDims();
+    return size_t(brick.x) + size_t(brickDim.x) * (size_t(brick.y) + size_t(brickDim.y) * size_t(brick.z));
+}
+
+MacroCell BrickCache::brickRange(const glm::ivec3& brick) const
+{
+    return m_brickRanges[brickIndex(brick)];
+}
+
+const Volume& BrickCache::coarseVolume() const
+{
+    return *m_pCoarseVolume;
+}
+
+float BrickCache::coarseScale() const
+{
+    return float(m_header.coarseScale);
+}
+
+size_t BrickCache::residentBytes() const
+{
+    return m_residentBytes.load();
+}
+
+bool BrickCache::takeMissed()
+{
+    return m_missed.exchange(false);
+}
+
+void BrickCache::request(size_t brick) const
+{
+    // A brick that is queued for prefetching may never be loaded (once the budget is reached), so it moves to the
+    // request queue.
+    BrickState state = m_pBrickStates[brick].load();
+    if (state == BrickState::Requested || state == BrickState::Resident)
+        return;
+    if (!m_pBrickStates[brick].compare_exchange_strong(state, BrickState::Requested))
+        return;
+    {
+        std::scoped_lock lock { m_mutex };
+        m_requestQueue.push_back(brick);
+    }
+    m_wakeUp.notify_one();
+}
+
+void BrickCache::prefetch(gsl::span<const size_t> bricks)
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        // Forget the bricks that were prefetched for a previous camera.
+        for (const size_t brick : m_prefetchQueue) {
+            BrickState expected = BrickState::Prefetching;
+            m_pBrickStates[brick].compare_exchange_strong(expected, BrickState::Absent);
+        }
+        m_prefetchQueue.clear();
+
+        for (const size_t brick : bricks) {
+            BrickState expected = BrickState::Absent;
+            if (m_pBrickStates[brick].compare_exchange_strong(expected, BrickState::Prefetching))
+                m_prefetchQueue.push_back(brick);
+        }
+    }
+    m_wakeUp.notify_one();
+}
+
+void BrickCache::beginFrame()
+{
+    m_frame.fetch_add(1, std::memory_order_relaxed);
+    if (m_residentBytes.load() <= m_memoryBudget)
+        return;
+
+    {
+        std::scoped_lock lock { m_mutex };
+        std::vector<std::pair<uint32_t, size_t>> residentBricks;
+        for (size_t brick = 0; brick < numBricks(); brick++) {
+            if (m_pBrickStates[brick].load() == BrickState::Resident)
+                residentBricks.emplace_back(m_pLastUsed[brick].load(std::memory_order_relaxed), brick);
+        }
+        std::sort(std::begin(residentBricks), std::end(residentBricks));
+        for (const auto& [lastUsed, brick] : residentBricks) {
+            if (m_residentBytes.load() <= m_memoryBudget)
+                break;
+            m_pBrickPointers[brick].store(nullptr, std::memory_order_relaxed);
+            m_pBrickStates[brick].store(BrickState::Absent);
+            m_brickData[brick].reset();
+            m_residentBytes -= m_brickBytes;
+        }
+    }
+    // Prefetching continues now that there is space again.
+    m_wakeUp.notify_one();
+}
+
+bool BrickCache::idle() const
+{
+    std::scoped_lock lock { m_mutex };
+    return idleLocked();
+}
+
+void BrickCache::waitUntilIdle() const
+{
+    std::unique_lock lock { m_mutex };
+    m_idle.wait(lock, [&]() { return idleLocked(); });
+}
+
+bool BrickCache::idleLocked() const
+{
+    return !m_loading && m_requestQueue.empty() && (m_prefetchQueue.empty() || m_residentBytes.load() >= m_memoryBudget);
+}
+
+// Runs on the loader thread: read the requested bricks first, then the prefetched bricks while there is space.
+void BrickCache::loadLoop()
+{
+    std::ifstream ifs { m_file, std::ios::binary };
+    while (true) {
+        size_t brick;
+        {
+            std::unique_lock lock { m_mutex };
+            m_loading = false;
+            m_idle.notify_all();
+            m_wakeUp.wait(lock, [&]() { return m_stop || !m_requestQueue.empty() || (!m_prefetchQueue.empty() && m_residentBytes.load() < m_memoryBudget); });
+            if (m_stop)
+                return;
+
+            // Entries whose state changed since they were queued (see request and prefetch) are skipped.
+            BrickState queuedState;
+            if (!m_requestQueue.empty()) {
+                brick = m_requestQueue.front();
+                m_requestQueue.pop_front();
+                queuedState = BrickState::Requested;
+            } else {
+                brick = m_prefetchQueue.front();
+                m_prefetchQueue.pop_front();
+                queuedState = BrickState::Prefetching;
+            }
+            if (m_pBrickStates[brick].load() != queuedState)
+                continue;
+            m_loading = true;
+        }
+
+        // A brick that cannot be read is kept as zeros, otherwise it would be requested again and again.
+        auto pVoxels = std::make_unique<std::byte[]>(m_brickBytes);
+        ifs.seekg(std::streamoff(m_bricksOffset + brick * m_brickBytes));
+        ifs.read(reinterpret_cast<char*>(pVoxels.get()), std::streamsize(m_brickBytes));
+        if (!ifs) {
+            std::cerr << "Could not read brick " << brick << " of " << m_file << std::endl;
+            ifs.clear();
+        }
+
+        std::scoped_lock lock { m_mutex };
+        m_pBrickPointers[brick].store(pVoxels.get(), std::memory_order_release);
+        m_pLastUsed[brick].store(m_frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        m_pBrickStates[brick].store(BrickState::Resident);
+        m_brickData[brick] = std::move(pVoxels);
+        m_residentBytes += m_brickBytes;
+    }
+}
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include "macro_cell_grid.h"
+#include "volume.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <glm/vec3.hpp>
+#include <gsl/span>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace volume {
+
+class GradientVolume;
+
+// Preprocessed on-disk format (.bvol) for volumes that do not fit into memory. The volume is split into bricks of
+// brickSize^3 voxels that are each stored contiguously with an apron (apronLower voxels before and apronUpper voxels
+// after the brick along each axis, clamped to the volume) such that every interpolation kernel can sample a brick
+// without touching its neighbours. The file also stores everything that would otherwise need a pass over all voxels:
+// the statistics, the value range of each brick, the gradient magnitude range and a coarse copy of the volume.
+//
+// Layout: BrickFileHeader, histogram (int32_t per bin), value range per brick (MacroCell), coarse voxels (linear
+// order), bricks (paddedSize^3 voxels each, x-fastest, bricks in linear order).
+struct BrickFileHeader {
+    char magic[8];
+    int32_t dim[3];
+    int32_t brickSize;
+    int32_t voxelType;
+    // The coarse copy is level log2(coarseScale) of the volume pyramid (see VolumePyramid).
+    int32_t coarseScale;
+    int32_t coarseDim[3];
+    float minimum, maximum;
+    float minGradientMagnitude, maxGradientMagnitude;
+    uint32_t histogramSize;
+};
+
+// Convert a volume to the format described above. The coarse copy is reduced until its largest dimension is at most
+// maxCoarseSize voxels.
+void writeBrickFile(const Volume& volume, const GradientVolume& gradientVolume, const std::filesystem::path& file, int maxCoarseSize = 128);
+
+// Keeps the most recently used bricks of a .bvol file in memory, within a memory budget. Bricks are read by a
+// background thread: either when a sample needs a brick that is not resident (see brick()) or ahead of time (see
+// prefetch()). The coarse copy of the volume is always resident and is sampled instead of bricks that are missing.
+class BrickCache {
+public:
+    static constexpr int brickSize = 32;
+    static constexpr int apronLower = 1;
+    static constexpr int apronUpper = 2;
+    static constexpr int paddedSize = apronLower + brickSize + apronUpper;
+    static constexpr size_t defaultMemoryBudget = size_t(1) << 30;
+
+public:
+    // Throws std::runtime_error if the file is not a valid brick file.
+    BrickCache(const std::filesystem::path& file, size_t memoryBudget = defaultMemoryBudget);
+    ~BrickCache();
+
+    BrickCache(const BrickCache&) = delete;
+    BrickCache& operator=(const BrickCache&) = delete;
+
+    glm::ivec3 dims() const;
+    VoxelType voxelType() const;
+    float minimum() const;
+    float maximum() const;
+    const std::vector<int>& histogram() const;
+    float minGradientMagnitude() const;
+    float maxGradientMagnitude() const;
+
+    glm::ivec3 brickDims() const;
+    size_t numBricks() const;
+    size_t brickIndex(const glm::ivec3& brick) const;
+    // Range of the values of the brick, including its apron.
+    MacroCell brickRange(const glm::ivec3& brick) const;
+
+    const Volume& coarseVolume() const;
+    float coarseScale() const;
+
+    // Voxels of the brick (paddedSize^3 voxels, starting at the apron), or nullptr if it is not resident, in which case
+    // it is queued for loading. Can be called from any number of threads, but the bricks may only be read until the
+    // next call to beginFrame. Voxel should match voxelType().
+    template <typename Voxel>
+    const Voxel* brick(size_t brick) const;
+    // Replace the bricks that are queued for prefetching by the given bricks (most important first). Prefetching
+    // stops once the memory budget is reached, whereas bricks that samples ask for are always loaded.
+    void prefetch(gsl::span<const size_t> bricks);
+    // Start a new frame: evict the least recently used bricks until the cache fits into the memory budget. No other
+    // thread may read bricks during this call.
+    void beginFrame();
+    // Whether all bricks that were asked for (and fit into the budget when prefetched) have been loaded.
+    bool idle() const;
+    void waitUntilIdle() const;
+    // Whether a sample needed a brick that was not resident since the previous call (in which case that sample was
+    // taken from the coarse copy). Clears the flag.
+    bool takeMissed();
+    size_t residentBytes() const;
+
+private:
+    enum class BrickState : uint8_t {
+        Absent = 0,
+        Prefetching,
+        Requested,
+        Resident
+    };
+
+    void request(size_t brick) const;
+    void loadLoop();
+    // Requires m_mutex to be locked.
+    bool idleLocked() const;
+
+private:
+    const std::filesystem::path m_file;
+    BrickFileHeader m_header;
+    std::vector<int> m_histogram;
+    std::vector<MacroCell> m_brickRanges;
+    std::unique_ptr<const Volume> m_pCoarseVolume;
+    size_t m_bricksOffset;
+    size_t m_brickBytes;
+    const size_t m_memoryBudget;
+
+    // Per brick: its voxels (nullptr if not resident), state and the frame in which it was last used. The voxels are
+    // owned by m_brickData (protected by m_mutex) and only freed by beginFrame.
+    std::unique_ptr<std::atomic<const std::byte*>[]> m_pBrickPointers;
+    mutable std::unique_ptr<std::atomic<BrickState>[]> m_pBrickStates;
+    mutable std::unique_ptr<std::atomic<uint32_t>[]> m_pLastUsed;
+    std::vector<std::unique_ptr<std::byte[]>> m_brickData;
+    std::atomic<uint32_t> m_frame { 0 };
+    std::atomic<size_t> m_residentBytes { 0 };
+    mutable std::atomic<bool> m_missed { false };
+
+    // Bricks to load: requested by samples (loaded first) and prefetched. The queues may contain outdated entries.
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_wakeUp;
+    mutable std::condition_variable m_idle;
+    mutable std::deque<size_t> m_requestQueue;
+    std::deque<size_t> m_prefetchQueue;
+    bool m_loading { false };
+    bool m_stop { false };
+
+    // Started last, after all other members have been initialized.
+    std::thread m_thread;
+};
+
+template <typename Voxel>
+inline const Voxel* BrickCache::brick(size_t brick) const
+{
+    const std::byte* pVoxels = m_pBrickPointers[brick].load(std::memory_order_acquire);
+    if (!pVoxels) {
+        // Read before writing for the same reason as below.
+        if (!m_missed.load(std::memory_order_relaxed))
+            m_missed.store(true, std::memory_order_relaxed);
+        request(brick);
+        return nullptr;
+    }
+    // Only write when the value changes, such that threads sampling the same brick do not keep invalidating the
+    // cache line of each other.
+    const uint32_t frame = m_frame.load(std::memory_order_relaxed);
+    if (m_pLastUsed[brick].load(std::memory_order_relaxed) != frame)
+        m_pLastUsed[brick].store(frame, std::memory_order_relaxed);
+    return reinterpret_cast<const Voxel*>(pVoxels);
+}
+}
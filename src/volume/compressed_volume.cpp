@@ -0,0 +1,329 @@
+#include "compressed_volume.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <glm/common.hpp>
+#include <glm/vector_relational.hpp>
+#include <iostream>
+#include <stdexcept>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <type_traits>
+
+static constexpr char compressedVolumeMagic[8] = { 'V', 'V', 'C', 'O', 'M', 'P', 'R', '1' };
+
+namespace volume {
+
+// Voxels are coded as unsigned integers of the same size (the bit pattern for float voxels).
+template <typename Voxel>
+using VoxelCode = std::conditional_t<std::is_same_v<Voxel, float>, uint32_t, Voxel>;
+
+template <typename Voxel>
+static VoxelCode<Voxel> toCode(Voxel voxel)
+{
+    VoxelCode<Voxel> code;
+    std::memcpy(&code, &voxel, sizeof(code));
+    return code;
+}
+
+template <typename Voxel>
+static Voxel fromCode(VoxelCode<Voxel> code)
+{
+    Voxel voxel;
+    std::memcpy(&voxel, &code, sizeof(voxel));
+    return voxel;
+}
+
+// Writes values of a given number of bits (least significant bit first).
+class BitWriter {
+public:
+    BitWriter(std::vector<uint8_t>& out)
+        : m_out(out)
+    {
+    }
+    ~BitWriter()
+    {
+        if (m_numBits > 0)
+            m_out.push_back(uint8_t(m_buffer));
+    }
+
+    // At most 56 bits at a time.
+    void write(uint64_t value, int numBits)
+    {
+        m_buffer |= value << m_numBits;
+        m_numBits += numBits;
+        for (; m_numBits >= 8; m_numBits -= 8) {
+            m_out.push_back(uint8_t(m_buffer));
+            m_buffer >>= 8;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& m_out;
+    uint64_t m_buffer { 0 };
+    int m_numBits { 0 };
+};
+
+class BitReader {
+public:
+    BitReader(const uint8_t* pBegin, const uint8_t* pEnd)
+        : m_pNext(pBegin)
+        , m_pEnd(pEnd)
+    {
+    }
+
+    // At most 56 bits at a time. Reading past the end returns zero bits.
+    uint64_t read(int numBits)
+    {
+        for (; m_numBits < numBits; m_numBits += 8)
+            m_buffer |= uint64_t(m_pNext < m_pEnd ? *m_pNext++ : 0) << m_numBits;
+        const uint64_t value = m_buffer & ((uint64_t(1) << numBits) - 1);
+        m_buffer >>= numBits;
+        m_numBits -= numBits;
+        return value;
+    }
+    // Skip the remaining bits of the current byte.
+    void align()
+    {
+        m_buffer = 0;
+        m_numBits = 0;
+    }
+
+private:
+    const uint8_t* m_pNext;
+    const uint8_t* m_pEnd;
+    uint64_t m_buffer { 0 };
+    int m_numBits { 0 };
+};
+
+static int bitWidth(uint64_t value)
+{
+    int width = 0;
+    for (; value != 0; value >>= 1)
+        width++;
+    return width;
+}
+
+static glm::ivec3 blockDims(const glm::ivec3& dim)
+{
+    return (dim + CompressedVolume::blockSize - 1) / CompressedVolume::blockSize;
+}
+
+// The voxels [begin, end) of a block, visited in x-fastest order.
+template <typename F>
+static void forEachBlockVoxel(const glm::ivec3& dim, size_t block, F&& f)
+{
+    const glm::ivec3 blockDim = blockDims(dim);
+    const glm::ivec3 blockCoord { int(block % size_t(blockDim.x)), int(block / size_t(blockDim.x) % size_t(blockDim.y)), int(block / (size_t(blockDim.x) * size_t(blockDim.y))) };
+    const glm::ivec3 begin = blockCoord * CompressedVolume::blockSize;
+    const glm::ivec3 end = glm::min(begin + CompressedVolume::blockSize, dim);
+    for (int z = begin.z; z < end.z; z++) {
+        for (int y = begin.y; y < end.y; y++) {
+            for (int x = begin.x; x < end.x; x++)
+                f(size_t(x) + size_t(dim.x) * (size_t(y) + size_t(dim.y) * size_t(z)), x, y, z);
+        }
+    }
+}
+
+template <typename Voxel>
+static void encodeLosslessGroup(gsl::span<const Voxel> group, VoxelCode<Voxel>& previous, std::vector<uint8_t>& out)
+{
+    std::array<uint64_t, CompressedVolume::groupSize> zigzags;
+    uint64_t maxZigzag = 0;
+    for (size_t i = 0; i < group.size(); i++) {
+        const VoxelCode<Voxel> code = toCode(group[i]);
+        const int64_t difference = int64_t(code) - int64_t(previous);
+        zigzags[i] = (uint64_t(difference) << 1) ^ uint64_t(difference >> 63);
+        maxZigzag = std::max(maxZigzag, zigzags[i]);
+        previous = code;
+    }
+
+    const int width = bitWidth(maxZigzag);
+    out.push_back(uint8_t(width));
+    BitWriter writer { out };
+    for (size_t i = 0; i < group.size(); i++)
+        writer.write(zigzags[i], width);
+}
+
+template <typename Voxel>
+static void decodeLosslessGroup(BitReader& reader, VoxelCode<Voxel>& previous, gsl::span<Voxel> group)
+{
+    const int width = int(reader.read(8));
+    for (Voxel& voxel : group) {
+        const uint64_t zigzag = reader.read(width);
+        const int64_t difference = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1);
+        previous = VoxelCode<Voxel>(int64_t(previous) + difference);
+        voxel = fromCode<Voxel>(previous);
+    }
+    reader.align();
+}
+
+template <typename Voxel>
+static void encodeQuantizedGroup(gsl::span<const Voxel> group, int bits, std::vector<uint8_t>& out)
+{
+    const auto [pMinimum, pMaximum] = std::minmax_element(std::begin(group), std::end(group));
+    const float range[2] { float(*pMinimum), float(*pMaximum) };
+    const auto* pRangeBytes = reinterpret_cast<const uint8_t*>(range);
+    out.insert(std::end(out), pRangeBytes, pRangeBytes + sizeof(range));
+    // Homogeneous groups (for example air) need no indices.
+    if (range[0] == range[1])
+        return;
+
+    const float levels = float((1 << bits) - 1);
+    BitWriter writer { out };
+    for (const Voxel voxel : group)
+        writer.write(uint64_t(std::lround((float(voxel) - range[0]) / (range[1] - range[0]) * levels)), bits);
+}
+
+template <typename Voxel>
+static void decodeQuantizedGroup(BitReader& reader, int bits, gsl::span<Voxel> group)
+{
+    float range[2];
+    for (float& value : range) {
+        const uint32_t code = uint32_t(reader.read(32));
+        std::memcpy(&value, &code, sizeof(value));
+    }
+    const float scale = (range[1] - range[0]) / float((1 << bits) - 1);
+    for (Voxel& voxel : group) {
+        const float value = range[0] == range[1] ? range[0] : range[0] + float(reader.read(bits)) * scale;
+        if constexpr (std::is_integral_v<Voxel>)
+            voxel = Voxel(std::clamp(value + 0.5f, range[0], range[1]));
+        else
+            voxel = value;
+    }
+    reader.align();
+}
+
+template <typename Voxel>
+static std::vector<uint8_t> encodeBlock(const Volume& volume, size_t block, VolumeCompression compression, int quantizationBits)
+{
+    std::vector<Voxel> voxels;
+    voxels.reserve(size_t(CompressedVolume::blockSize * CompressedVolume::blockSize * CompressedVolume::blockSize));
+    forEachBlockVoxel(volume.dims(), block, [&](size_t, int x, int y, int z) { voxels.push_back(Voxel(volume.getVoxel<Voxel>(x, y, z))); });
+
+    std::vector<uint8_t> out;
+    VoxelCode<Voxel> previous = 0;
+    for (size_t first = 0; first < voxels.size(); first += CompressedVolume::groupSize) {
+        const gsl::span<const Voxel> group { voxels.data() + first, std::min(voxels.size() - first, size_t(CompressedVolume::groupSize)) };
+        if (compression == VolumeCompression::Lossless)
+            encodeLosslessGroup(group, previous, out);
+        else
+            encodeQuantizedGroup(group, quantizationBits, out);
+    }
+    return out;
+}
+
+template <typename Voxel>
+static void writeBlocks(const Volume& volume, std::ofstream& ofs, VolumeCompression compression, int quantizationBits)
+{
+    const glm::ivec3 dim = volume.dims();
+    const glm::ivec3 blockDim = blockDims(dim);
+    const size_t numBlocks = size_t(blockDim.x) * size_t(blockDim.y) * size_t(blockDim.z);
+
+    std::vector<std::vector<uint8_t>> blocks(numBlocks);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, numBlocks), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t block = range.begin(); block != range.end(); block++)
+            blocks[block] = encodeBlock<Voxel>(volume, block, compression, quantizationBits);
+    });
+
+    CompressedVolumeHeader header {};
+    std::copy(std::begin(compressedVolumeMagic), std::end(compressedVolumeMagic), header.magic);
+    for (int axis = 0; axis < 3; axis++)
+        header.dim[axis] = dim[axis];
+    header.voxelType = int32_t(volume.voxelType());
+    header.compression = int32_t(compression);
+    header.quantizationBits = quantizationBits;
+    header.blockSize = CompressedVolume::blockSize;
+    header.numBlocks = uint32_t(numBlocks);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<uint64_t> offsets { 0 };
+    for (const auto& block : blocks)
+        offsets.push_back(offsets.back() + block.size());
+    ofs.write(reinterpret_cast<const char*>(offsets.data()), std::streamsize(offsets.size() * sizeof(uint64_t)));
+    for (const auto& block : blocks)
+        ofs.write(reinterpret_cast<const char*>(block.data()), std::streamsize(block.size()));
+}
+
+void writeCompressedVolume(const Volume& volume, const std::filesystem::path& file, VolumeCompression compression, int quantizationBits)
+{
+    std::ofstream ofs { file, std::ios::binary };
+    quantizationBits = std::clamp(quantizationBits, 1, 16);
+    dispatchVoxelType(volume.voxelType(), [&](auto voxel) { writeBlocks<decltype(voxel)>(volume, ofs, compression, quantizationBits); });
+    if (!ofs)
+        std::cerr << "Could not write " << file << std::endl;
+}
+
+CompressedVolume::CompressedVolume(gsl::span<const std::byte> bytes)
+{
+    if (bytes.size() < sizeof(m_header))
+        throw std::runtime_error("Not a compressed volume");
+    std::memcpy(&m_header, bytes.data(), sizeof(m_header));
+    if (!std::equal(std::begin(compressedVolumeMagic), std::end(compressedVolumeMagic), m_header.magic))
+        throw std::runtime_error("Not a compressed volume");
+    if (m_header.voxelType < 0 || m_header.voxelType > int32_t(VoxelType::Float) || m_header.compression < 0 || m_header.compression > int32_t(VolumeCompression::Quantized)
+        || m_header.quantizationBits < 1 || m_header.quantizationBits > 16 || m_header.blockSize != blockSize)
+        throw std::runtime_error("Unsupported compressed volume");
+
+    const glm::ivec3 blockDim = blockDims(dims());
+    const size_t numBlocks = size_t(blockDim.x) * size_t(blockDim.y) * size_t(blockDim.z);
+    const size_t offsetsSize = (numBlocks + 1) * sizeof(uint64_t);
+    if (glm::any(glm::lessThan(dims(), glm::ivec3(0))) || m_header.numBlocks != numBlocks || bytes.size() < sizeof(m_header) + offsetsSize)
+        throw std::runtime_error("Corrupt compressed volume");
+    m_blockOffsets.resize(numBlocks + 1);
+    std::memcpy(m_blockOffsets.data(), bytes.data() + sizeof(m_header), offsetsSize);
+    m_blocks = bytes.subspan(sizeof(m_header) + offsetsSize);
+    if (!std::is_sorted(std::begin(m_blockOffsets), std::end(m_blockOffsets)) || m_blockOffsets.back() > m_blocks.size())
+        throw std::runtime_error("Corrupt compressed volume");
+}
+
+glm::ivec3 CompressedVolume::dims() const
+{
+    return { m_header.dim[0], m_header.dim[1], m_header.dim[2] };
+}
+
+VoxelType CompressedVolume::voxelType() const
+{
+    return VoxelType(m_header.voxelType);
+}
+
+VolumeCompression CompressedVolume::compression() const
+{
+    return VolumeCompression(m_header.compression);
+}
+
+template <typename Voxel>
+std::vector<Voxel> CompressedVolume::decompress() const
+{
+    const glm::ivec3 dim = dims();
+    std::vector<Voxel> out(size_t(dim.x) * size_t(dim.y) * size_t(dim.z));
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, m_blockOffsets.size() - 1), [&](const tbb::blocked_range<size_t>& range) {
+        std::vector<Voxel> voxels(size_t(blockSize * blockSize * blockSize));
+        for (size_t block = range.begin(); block != range.end(); block++) {
+            const auto* pBlock = reinterpret_cast<const uint8_t*>(m_blocks.data());
+            BitReader reader { pBlock + m_blockOffsets[block], pBlock + m_blockOffsets[block + 1] };
+
+            size_t numVoxels = 0;
+            forEachBlockVoxel(dim, block, [&](size_t, int, int, int) { numVoxels++; });
+            VoxelCode<Voxel> previous = 0;
+            for (size_t first = 0; first < numVoxels; first += groupSize) {
+                const gsl::span<Voxel> group { voxels.data() + first, std::min(numVoxels - first, size_t(groupSize)) };
+                if (compression() == VolumeCompression::Lossless)
+                    decodeLosslessGroup(reader, previous, group);
+                else
+                    decodeQuantizedGroup(reader, m_header.quantizationBits, group);
+            }
+
+            size_t i = 0;
+            forEachBlockVoxel(dim, block, [&](size_t index, int, int, int) { out[index] = voxels[i++]; });
+        }
+    });
+    return out;
+}
+
+template std::vector<uint8_t> CompressedVolume::decompress<uint8_t>() const;
+template std::vector<uint16_t> CompressedVolume::decompress<uint16_t>() const;
+template std::vector<float> CompressedVolume::decompress<float>() const;
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include "volume.h"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <glm/vec3.hpp>
+#include <gsl/span>
+#include <vector>
+
+namespace volume {
+
+enum class VolumeCompression {
+    // Reproduces the voxels exactly.
+    Lossless = 0,
+    // Approximates the voxels with quantizationBits bits per voxel (relative to the range of a group), for previews.
+    Quantized
+};
+
+// Compressed volume container (.cvol). The volume is split into blocks of blockSize^3 voxels that are compressed
+// independently, so that they can be decompressed in parallel. The voxels of a block (x-fastest) are coded in groups of
+// groupSize voxels:
+//  - Lossless: the differences between consecutive voxels (zigzag coded), bit packed with the smallest width that fits
+//    all differences of the group (one byte). Float voxels are coded as their bit patterns.
+//  - Quantized: the minimum and maximum of the group (two floats) followed by quantizationBits bits per voxel.
+//
+// Layout: CompressedVolumeHeader, numBlocks + 1 offsets of the blocks (uint64_t, relative to the first block; the last
+// one is the end of the last block), blocks.
+struct CompressedVolumeHeader {
+    char magic[8];
+    int32_t dim[3];
+    int32_t voxelType;
+    int32_t compression;
+    int32_t quantizationBits;
+    int32_t blockSize;
+    uint32_t numBlocks;
+};
+
+// Compress a volume to the format described above. quantizationBits (1 to 16) is only used by Quantized.
+void writeCompressedVolume(const Volume& volume, const std::filesystem::path& file, VolumeCompression compression = VolumeCompression::Lossless, int quantizationBits = 8);
+
+// A compressed volume in memory (for example a memory mapped .cvol file), which should outlive this object.
+class CompressedVolume {
+public:
+    static constexpr int blockSize = 16;
+    static constexpr int groupSize = 64;
+
+public:
+    // Throws std::runtime_error if the bytes are not a valid compressed volume.
+    CompressedVolume(gsl::span<const std::byte> bytes);
+
+    glm::ivec3 dims() const;
+    VoxelType voxelType() const;
+    VolumeCompression compression() const;
+
+    // Decompress all blocks (in parallel) into linear (x-fastest) order. Voxel should match voxelType().
+    template <typename Voxel>
+    std::vector<Voxel> decompress() const;
+
+private:
+    CompressedVolumeHeader m_header;
+    std::vector<uint64_t> m_blockOffsets;
+    gsl::span<const std::byte> m_blocks;
+};
+}
@@ -0,0 +1,246 @@
+#include "derived_data_cache.h"
+#include "mapped_file.h"
+#include "statistics_cache.h"
+#include "volume_pyramid.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <gsl/span>
+#include <optional>
+#include <system_error>
+
+static constexpr char derivedDataCacheMagic[8] = { 'V', 'V', 'D', 'E', 'R', 'I', 'V', 'D' };
+// The sections are aligned such that the voxels and gradients can be used in place (the mapping is page aligned).
+static constexpr uint64_t sectionAlignment = 64;
+
+// Byte range of the file.
+struct Section {
+    uint64_t offset, size;
+};
+
+// Layout: DerivedDataHeader, a DerivedLevelHeader per level, the sections of all levels. The data is stored in the
+// byte order of the machine, like the other caches.
+struct DerivedDataHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t numLevels;
+    // Size and modification time of the volume file.
+    uint64_t sourceSize;
+    int64_t sourceModificationTime;
+    int32_t layout, voxelType, gradientEncoding;
+    int32_t padding;
+};
+
+struct DerivedLevelHeader {
+    int32_t dim[3];
+    float minimum, maximum;
+    uint32_t histogramSize;
+    float minGradientMagnitude, maxGradientMagnitude;
+    int32_t histogram2DDims[2];
+    float intensityBinSize, magnitudeBinSize;
+    Section voxels, gradients, histogram, histogram2D, macroCells;
+};
+
+static_assert(sizeof(int) == sizeof(int32_t) && sizeof(volume::MacroCell) == 2 * sizeof(float));
+
+static size_t storedGradientSize(volume::GradientEncoding encoding)
+{
+    switch (encoding) {
+    case volume::GradientEncoding::Float: {
+        return sizeof(volume::GradientVoxel);
+    }
+    case volume::GradientEncoding::Quantized: {
+        return sizeof(volume::QuantizedGradientVoxel);
+    }
+    default: {
+        return 0;
+    }
+    }
+}
+
+template <typename T>
+static std::vector<T> copyArray(gsl::span<const std::byte> bytes)
+{
+    std::vector<T> out(bytes.size() / sizeof(T));
+    std::memcpy(out.data(), bytes.data(), out.size() * sizeof(T));
+    return out;
+}
+
+namespace volume {
+
+std::filesystem::path derivedDataCachePath(const std::filesystem::path& volumeFile)
+{
+    std::filesystem::path out = volumeFile;
+    out += ".derived";
+    return out;
+}
+
+// Only the headers and the small arrays are read; the voxels and gradients are paged in when they are accessed.
+std::vector<DerivedLevel> readDerivedDataCache(const Volume& volume, GradientEncoding gradientEncoding)
+{
+    if (volume.fileName().empty() || volume.brickCache())
+        return {};
+    const std::filesystem::path volumeFile { std::string(volume.fileName()) };
+    const auto optStamp = fileStamp(volumeFile);
+    const std::filesystem::path cacheFile = derivedDataCachePath(volumeFile);
+    if (!optStamp || !fileStamp(cacheFile))
+        return {};
+
+    const auto pFile = std::make_shared<const MappedFile>(cacheFile);
+    const gsl::span<const std::byte> bytes = pFile->bytes();
+    DerivedDataHeader header {};
+    if (bytes.size() < sizeof(header))
+        return {};
+    std::memcpy(&header, bytes.data(), sizeof(header));
+    if (!std::equal(std::begin(derivedDataCacheMagic), std::end(derivedDataCacheMagic), header.magic) || header.version != derivedDataCacheVersion)
+        return {};
+    if (header.sourceSize != optStamp->first || header.sourceModificationTime != optStamp->second)
+        return {};
+    if (header.layout != int32_t(volume.layout()) || header.voxelType != int32_t(volume.voxelType()) || header.gradientEncoding != int32_t(gradientEncoding))
+        return {};
+    if (header.numLevels == 0 || header.numLevels > uint32_t(VolumePyramid::maxLevels) || bytes.size() < sizeof(header) + header.numLevels * sizeof(DerivedLevelHeader))
+        return {};
+
+    const size_t elementSize = dispatchVoxelType(volume.voxelType(), [](auto voxel) { return sizeof(voxel); });
+    // The bytes of a section if it lies within the file and has the expected size.
+    const auto sectionBytes = [&](const Section& section, size_t expectedSize) -> std::optional<gsl::span<const std::byte>> {
+        if (section.size != expectedSize || section.offset % sectionAlignment != 0 || section.offset > bytes.size() || section.size > bytes.size() - section.offset)
+            return {};
+        return bytes.subspan(size_t(section.offset), size_t(section.size));
+    };
+
+    std::vector<DerivedLevel> out;
+    for (uint32_t levelIndex = 0; levelIndex < header.numLevels; levelIndex++) {
+        DerivedLevelHeader levelHeader {};
+        std::memcpy(&levelHeader, bytes.data() + sizeof(header) + levelIndex * sizeof(levelHeader), sizeof(levelHeader));
+        const glm::ivec3 dim { levelHeader.dim[0], levelHeader.dim[1], levelHeader.dim[2] };
+        const glm::ivec2 histogram2DDims { levelHeader.histogram2DDims[0], levelHeader.histogram2DDims[1] };
+        if (dim.x <= 0 || dim.y <= 0 || dim.z <= 0 || histogram2DDims.x < 0 || histogram2DDims.y < 0)
+            return {};
+        if (levelIndex == 0 && dim != volume.dims())
+            return {};
+
+        const size_t numVoxels = VoxelIndexer(dim, volume.layout()).size();
+        const glm::ivec3 gridDim = (dim + MacroCellGrid::cellSize - 1) / MacroCellGrid::cellSize;
+        const size_t numCells = size_t(gridDim.x) * size_t(gridDim.y) * size_t(gridDim.z);
+        const auto optVoxels = sectionBytes(levelHeader.voxels, levelIndex == 0 ? 0 : numVoxels * elementSize);
+        const auto optGradients = sectionBytes(levelHeader.gradients, numVoxels * storedGradientSize(gradientEncoding));
+        const auto optHistogram = sectionBytes(levelHeader.histogram, size_t(levelHeader.histogramSize) * sizeof(int32_t));
+        const auto optHistogram2D = sectionBytes(levelHeader.histogram2D, size_t(histogram2DDims.x) * size_t(histogram2DDims.y) * sizeof(int32_t));
+        const auto optMacroCells = sectionBytes(levelHeader.macroCells, numCells * sizeof(MacroCell));
+        if (!optVoxels || !optGradients || !optHistogram || !optHistogram2D || !optMacroCells)
+            return {};
+
+        DerivedLevel level {};
+        level.layout = volume.layout();
+        level.voxelType = volume.voxelType();
+        level.gradientEncoding = gradientEncoding;
+        level.dim = dim;
+        level.minimum = levelHeader.minimum;
+        level.maximum = levelHeader.maximum;
+        level.histogram = copyArray<int>(*optHistogram);
+        // Share ownership of the mapping (aliasing constructor).
+        if (!optVoxels->empty())
+            level.pVoxels = std::shared_ptr<const void>(pFile, optVoxels->data());
+        if (!optGradients->empty())
+            level.pGradients = std::shared_ptr<const void>(pFile, optGradients->data());
+        level.minGradientMagnitude = levelHeader.minGradientMagnitude;
+        level.maxGradientMagnitude = levelHeader.maxGradientMagnitude;
+        level.histogram2D.dims = histogram2DDims;
+        level.histogram2D.intensityBinSize = levelHeader.intensityBinSize;
+        level.histogram2D.magnitudeBinSize = levelHeader.magnitudeBinSize;
+        level.histogram2D.bins = copyArray<int>(*optHistogram2D);
+        level.macroCells = copyArray<MacroCell>(*optMacroCells);
+        out.push_back(std::move(level));
+    }
+    return out;
+}
+
+// Like the statistics cache, the cache is written to a temporary file that replaces the old cache when complete.
+void writeDerivedDataCache(const VolumePyramid& pyramid)
+{
+    const PyramidLevel baseLevel = pyramid.level(0);
+    const Volume& baseVolume = *baseLevel.pVolume;
+    if (baseVolume.fileName().empty() || baseVolume.brickCache())
+        return;
+    const std::filesystem::path volumeFile { std::string(baseVolume.fileName()) };
+    const auto optStamp = fileStamp(volumeFile);
+    if (!optStamp)
+        return;
+
+    DerivedDataHeader header {};
+    std::copy(std::begin(derivedDataCacheMagic), std::end(derivedDataCacheMagic), header.magic);
+    header.version = derivedDataCacheVersion;
+    header.numLevels = uint32_t(pyramid.numLevels());
+    header.sourceSize = optStamp->first;
+    header.sourceModificationTime = optStamp->second;
+    header.layout = int32_t(baseVolume.layout());
+    header.voxelType = int32_t(baseVolume.voxelType());
+    header.gradientEncoding = int32_t(baseLevel.pGradientVolume->encoding());
+
+    // Assign the sections to the file in order.
+    std::vector<DerivedLevelHeader> levelHeaders(size_t(pyramid.numLevels()));
+    std::vector<gsl::span<const std::byte>> sections;
+    uint64_t fileSize = sizeof(header) + levelHeaders.size() * sizeof(DerivedLevelHeader);
+    const auto addSection = [&](gsl::span<const std::byte> data) {
+        fileSize = (fileSize + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+        const Section out { fileSize, data.size() };
+        sections.push_back(data);
+        fileSize += data.size();
+        return out;
+    };
+    for (int levelIndex = 0; levelIndex < pyramid.numLevels(); levelIndex++) {
+        const PyramidLevel level = pyramid.level(levelIndex);
+        const Volume& volume = *level.pVolume;
+        const GradientVolume& gradientVolume = *level.pGradientVolume;
+        const Histogram2D& histogram2D = gradientVolume.histogram2D();
+
+        DerivedLevelHeader& levelHeader = levelHeaders[size_t(levelIndex)];
+        levelHeader.dim[0] = volume.dims().x;
+        levelHeader.dim[1] = volume.dims().y;
+        levelHeader.dim[2] = volume.dims().z;
+        levelHeader.minimum = volume.minimum();
+        levelHeader.maximum = volume.maximum();
+        levelHeader.histogramSize = uint32_t(volume.histogram().size());
+        levelHeader.minGradientMagnitude = gradientVolume.minMagnitude();
+        levelHeader.maxGradientMagnitude = gradientVolume.maxMagnitude();
+        levelHeader.histogram2DDims[0] = histogram2D.dims.x;
+        levelHeader.histogram2DDims[1] = histogram2D.dims.y;
+        levelHeader.intensityBinSize = histogram2D.intensityBinSize;
+        levelHeader.magnitudeBinSize = histogram2D.magnitudeBinSize;
+        // The voxels of level 0 are those of the volume file.
+        levelHeader.voxels = addSection(levelIndex == 0 ? gsl::span<const std::byte>() : dispatchVoxelType(volume.voxelType(), [&](auto voxel) { return gsl::as_bytes(volume.data<decltype(voxel)>()); }));
+        levelHeader.gradients = addSection(gradientVolume.storedData());
+        levelHeader.histogram = addSection(gsl::as_bytes(gsl::span<const int>(volume.histogram())));
+        levelHeader.histogram2D = addSection(gsl::as_bytes(gsl::span<const int>(histogram2D.bins)));
+        levelHeader.macroCells = addSection(gsl::as_bytes(level.pMacroCellGrid->cells()));
+    }
+
+    const std::filesystem::path cacheFile = derivedDataCachePath(volumeFile);
+    std::filesystem::path temporaryFile = cacheFile;
+    temporaryFile += ".tmp";
+    {
+        std::ofstream ofs { temporaryFile, std::ios::binary };
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<const char*>(levelHeaders.data()), std::streamsize(levelHeaders.size() * sizeof(DerivedLevelHeader)));
+        uint64_t position = sizeof(header) + levelHeaders.size() * sizeof(DerivedLevelHeader);
+        const char padding[sectionAlignment] = {};
+        for (const gsl::span<const std::byte> section : sections) {
+            const uint64_t offset = (position + sectionAlignment - 1) / sectionAlignment * sectionAlignment;
+            ofs.write(padding, std::streamsize(offset - position));
+            ofs.write(reinterpret_cast<const char*>(section.data()), std::streamsize(section.size()));
+            position = offset + section.size();
+        }
+        if (!ofs) {
+            ofs.close();
+            std::error_code error;
+            std::filesystem::remove(temporaryFile, error);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryFile, cacheFile, error);
+    if (error)
+        std::filesystem::remove(temporaryFile, error);
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include "gradient_volume.h"
+#include "macro_cell_grid.h"
+#include "volume.h"
+#include <cstdint>
+#include <filesystem>
+#include <glm/vec3.hpp>
+#include <memory>
+#include <vector>
+
+namespace volume {
+
+class VolumePyramid;
+
+// The data that is derived from one level of the volume pyramid of a volume file (see volume_pyramid.h).
+struct DerivedLevel {
+    VoxelLayout layout;
+    VoxelType voxelType;
+    GradientEncoding gradientEncoding;
+    glm::ivec3 dim;
+    float minimum, maximum;
+    std::vector<int> histogram;
+    // Voxels in the order of the layout. Empty for level 0, of which the voxels are those of the volume file.
+    std::shared_ptr<const void> pVoxels;
+    // Gradients as stored by GradientVolume (see GradientVolume::storedData). Empty for GradientEncoding::OnTheFly.
+    std::shared_ptr<const void> pGradients;
+    float minGradientMagnitude, maxGradientMagnitude;
+    Histogram2D histogram2D;
+    std::vector<MacroCell> macroCells;
+};
+
+// Computing the gradients, macro cells and coarser levels of a volume takes several passes over all voxels, which
+// dominates the time it takes to load a volume. They are stored in a sidecar file next to the volume file (see
+// derivedDataCachePath) that is memory mapped by later runs, such that the voxels and gradients are used in place
+// (like the voxels of a .fld file). The cache is only used while the volume file keeps the size and modification time
+// that it had when the cache was written, and only by the same version of the cache format with the same layout, voxel
+// type and gradient encoding. The version should be incremented whenever the format or the derived data changes.
+static constexpr uint32_t derivedDataCacheVersion = 1;
+
+// <volume file>.derived
+std::filesystem::path derivedDataCachePath(const std::filesystem::path& volumeFile);
+// Map the cache of the file from which the volume was loaded. The levels share ownership of the mapping. Returns
+// nothing if there is no cache or if it is outdated, invalid or was written for another layout or gradient encoding.
+std::vector<DerivedLevel> readDerivedDataCache(const Volume& volume, GradientEncoding gradientEncoding);
+// Write the cache of the volume file of level 0 of the pyramid. Failures are ignored (for example when the directory
+// of the volume is read-only): the data is then simply computed again the next time.
+void writeDerivedDataCache(const VolumePyramid& pyramid);
+}
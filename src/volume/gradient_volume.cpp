@@ -1,64 +1,260 @@
 #include "gradient_volume.h"
+#include "brick_cache.h"
+#include "derived_data_cache.h"
+#include "statistics_cache.h"
 #include <algorithm>
+#include <cassert>
+#include <cmath>
 #include <exception>
+#include <functional>
+#include <glm/common.hpp>
 #include <glm/geometric.hpp>
 #include <glm/vector_relational.hpp>
 #include <gsl/span>
+#include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <utility>
 
 namespace volume {
 
-// Compute the maximum magnitude from all gradient voxels
-static float computeMaxMagnitude(gsl::span<const GradientVoxel> data)
-{
-    return std::max_element(
-        std::begin(data),
-        std::end(data),
-        [](const GradientVoxel& lhs, const GradientVoxel& rhs) {
-            return lhs.magnitude < rhs.magnitude;
-        })
-        ->magnitude;
-}
+struct GradientField {
+    std::vector<GradientVoxel> data;
+    float minMagnitude, maxMagnitude;
+    Histogram2D histogram2D;
+};
 
-// Compute the minimum magnitude from all gradient voxels
-static float computeMinMagnitude(gsl::span<const GradientVoxel> data)
-{
-    return std::min_element(
-        std::begin(data),
-        std::end(data),
-        [](const GradientVoxel& lhs, const GradientVoxel& rhs) {
-            return lhs.magnitude < rhs.magnitude;
-        })
-        ->magnitude;
-}
+// Resolution of the 2D histogram. The magnitude range is not known until all gradients have been computed, so the
+// rows cover all magnitudes that central differences can produce (at most half of the value range along each axis);
+// the rows above the largest magnitude are dropped afterwards.
+static constexpr int histogramColumns = 256;
+static constexpr int histogramRows = 1024;
 
-// Compute a gradient volume from a volume
-static std::vector<GradientVoxel> computeGradientVolume(const Volume& volume)
+// Compute a gradient volume from a volume with central differences. The gradients are stored in the order defined by
+// the indexer (unless storeGradients is false). The minimum/maximum magnitude (over all gradient voxels) and the 2D
+// histogram (with columns from 0 to the given maximum value) are computed in the same pass.
+template <typename Voxel>
+static GradientField computeGradientVolume(const Volume& volume, const VoxelIndexer& indexer, bool storeGradients, float minimum, float maximum)
 {
     const auto dim = volume.dims();
 
-    std::vector<GradientVoxel> out(static_cast<size_t>(dim.x * dim.y * dim.z));
-    for (int z = 1; z < dim.z - 1; z++) {
-        for (int y = 1; y < dim.y - 1; y++) {
-            for (int x = 1; x < dim.x - 1; x++) {
-                const float gx = (volume.getVoxel(x + 1, y, z) - volume.getVoxel(x - 1, y, z)) / 2.0f;
-                const float gy = (volume.getVoxel(x, y + 1, z) - volume.getVoxel(x, y - 1, z)) / 2.0f;
-                const float gz = (volume.getVoxel(x, y, z + 1) - volume.getVoxel(x, y, z - 1)) / 2.0f;
-
-                const glm::vec3 v { gx, gy, gz };
-                const size_t index = static_cast<size_t>(x + dim.x * (y + dim.y * z));
-                out[index] = GradientVoxel { v, glm::length(v) };
+    GradientField out { std::vector<GradientVoxel>(storeGradients ? indexer.size() : 0), 0.0f, 0.0f, {} };
+    if (indexer.size() == 0)
+        return out;
+
+    Histogram2D& histogram = out.histogram2D;
+    histogram.intensityBinSize = maximum > 0.0f ? maximum / float(histogramColumns) : 1.0f;
+    histogram.magnitudeBinSize = maximum > minimum ? std::sqrt(3.0f) / 2.0f * (maximum - minimum) / float(histogramRows) : 1.0f;
+    const auto histogramBin = [&](float value, float magnitude) {
+        const int x = std::min(int(std::max(value, 0.0f) / histogram.intensityBinSize), histogramColumns - 1);
+        const int y = std::min(int(magnitude / histogram.magnitudeBinSize), histogramRows - 1);
+        return size_t(y) * size_t(histogramColumns) + size_t(x);
+    };
+    tbb::enumerable_thread_specific<std::vector<int>> threadHistograms(size_t(histogramColumns * histogramRows), 0);
+
+    // Voxels on the border of the volume (and padding voxels) keep a zero gradient, so the minimum magnitude is 0.
+    tbb::enumerable_thread_specific<float> threadMaxMagnitudes { 0.0f };
+    tbb::parallel_for(tbb::blocked_range2d<int>(1, std::max(dim.z - 1, 1), 1, std::max(dim.y - 1, 1)), [&](const tbb::blocked_range2d<int>& range) {
+        // The neighbouring rows of the row that is being processed, and the gradients of the row.
+        const size_t rowSize = size_t(std::max(dim.x, 0));
+        std::vector<float> center(rowSize), yMinus(rowSize), yPlus(rowSize), zMinus(rowSize), zPlus(rowSize);
+        std::vector<float> gx(rowSize), gy(rowSize), gz(rowSize), magnitude(rowSize);
+        const auto loadRow = [&](std::vector<float>& row, int y, int z) {
+            for (int x = 0; x < dim.x; x++)
+                row[size_t(x)] = volume.getVoxel<Voxel>(x, y, z);
+        };
+
+        float& maxMagnitude = threadMaxMagnitudes.local();
+        std::vector<int>& bins = threadHistograms.local();
+        for (int z = range.rows().begin(); z != range.rows().end(); z++) {
+            for (int y = range.cols().begin(); y != range.cols().end(); y++) {
+                loadRow(center, y, z);
+                loadRow(yMinus, y - 1, z);
+                loadRow(yPlus, y + 1, z);
+                loadRow(zMinus, y, z - 1);
+                loadRow(zPlus, y, z + 1);
+
+                // Plain arrays such that the compiler can vectorize the differences.
+                for (size_t x = 1; x + 1 < rowSize; x++) {
+                    gx[x] = (center[x + 1] - center[x - 1]) / 2.0f;
+                    gy[x] = (yPlus[x] - yMinus[x]) / 2.0f;
+                    gz[x] = (zPlus[x] - zMinus[x]) / 2.0f;
+                    // Same order of operations as glm::length.
+                    magnitude[x] = std::sqrt(gx[x] * gx[x] + gy[x] * gy[x] + gz[x] * gz[x]);
+                }
+                for (size_t x = 1; x + 1 < rowSize; x++) {
+                    maxMagnitude = std::max(maxMagnitude, magnitude[x]);
+                    bins[histogramBin(center[x], magnitude[x])]++;
+                }
+                if (storeGradients) {
+                    for (int x = 1; x < dim.x - 1; x++) {
+                        const size_t i = size_t(x);
+                        out.data[indexer.index(x, y, z)] = GradientVoxel { glm::vec3(gx[i], gy[i], gz[i]), magnitude[i] };
+                    }
+                }
+            }
+        }
+    });
+
+    for (const float maxMagnitude : threadMaxMagnitudes)
+        out.maxMagnitude = std::max(out.maxMagnitude, maxMagnitude);
+
+    histogram.bins.assign(size_t(histogramColumns * histogramRows), 0);
+    for (const std::vector<int>& bins : threadHistograms)
+        std::transform(std::begin(histogram.bins), std::end(histogram.bins), std::begin(bins), std::begin(histogram.bins), std::plus<int>());
+    // The voxels on the border of the volume (zero gradient) were skipped above.
+    for (int z = 0; z < dim.z; z++) {
+        for (int y = 0; y < dim.y; y++) {
+            if (z == 0 || y == 0 || z >= dim.z - 1 || y >= dim.y - 1) {
+                for (int x = 0; x < dim.x; x++)
+                    histogram.bins[histogramBin(volume.getVoxel<Voxel>(x, y, z), 0.0f)]++;
+            } else {
+                histogram.bins[histogramBin(volume.getVoxel<Voxel>(0, y, z), 0.0f)]++;
+                if (dim.x > 1)
+                    histogram.bins[histogramBin(volume.getVoxel<Voxel>(dim.x - 1, y, z), 0.0f)]++;
             }
         }
     }
+    const int numRows = std::min(int(out.maxMagnitude / histogram.magnitudeBinSize) + 1, histogramRows);
+    histogram.dims = glm::ivec2(histogramColumns, numRows);
+    histogram.bins.resize(size_t(histogramColumns * numRows));
     return out;
 }
 
-GradientVolume::GradientVolume(const Volume& volume)
+static std::vector<QuantizedGradientVoxel> quantizeGradients(gsl::span<const GradientVoxel> gradients, float maxMagnitude)
+{
+    std::vector<QuantizedGradientVoxel> out(gradients.size());
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, gradients.size(), 1 << 16), [&](const tbb::blocked_range<size_t>& range) {
+        for (size_t i = range.begin(); i != range.end(); i++)
+            out[i] = GradientVolume::quantize(gradients[i], maxMagnitude);
+    });
+    return out;
+}
+
+// Gradients computed on the fly are not stored, but the magnitude range is still needed (for example by the 2D
+// transfer function), so it is computed upfront unless the volume file has a statistics cache. Streaming volumes store
+// the range in their brick file; their 2D histogram is approximated by that of the coarse copy, of which the
+// differences span coarseScale voxels.
+static GradientField computeGradientField(const Volume& volume, GradientEncoding encoding)
+{
+    if (const BrickCache* pBrickCache = volume.brickCache()) {
+        const Volume& coarseVolume = pBrickCache->coarseVolume();
+        GradientField field = dispatchVoxelType(coarseVolume.voxelType(), [&](auto voxel) {
+            return computeGradientVolume<decltype(voxel)>(coarseVolume, coarseVolume.indexer(), false, volume.minimum(), volume.maximum());
+        });
+        field.minMagnitude = pBrickCache->minGradientMagnitude();
+        field.maxMagnitude = pBrickCache->maxGradientMagnitude();
+        field.histogram2D.magnitudeBinSize /= pBrickCache->coarseScale();
+        return field;
+    }
+    const VolumeStatistics* pStatistics = volume.statisticsCache();
+    if (encoding == GradientEncoding::OnTheFly && pStatistics && pStatistics->hasGradientStatistics)
+        return { {}, pStatistics->minGradientMagnitude, pStatistics->maxGradientMagnitude, pStatistics->histogram2D };
+    return dispatchVoxelType(volume.voxelType(), [&](auto voxel) {
+        return computeGradientVolume<decltype(voxel)>(volume, volume.indexer(), encoding != GradientEncoding::OnTheFly, volume.minimum(), volume.maximum());
+    });
+}
+
+// The gradients of streaming volumes are always computed on the fly (storing them would defeat streaming).
+GradientVolume::GradientVolume(const Volume& volume, GradientEncoding encoding)
+    : GradientVolume(volume, volume.brickCache() ? GradientEncoding::OnTheFly : encoding, computeGradientField(volume, encoding))
+{
+}
+
+// Store the gradients of the field with the given encoding. The quantized gradients are encoded from the float
+// gradients, which are released when construction completes.
+static std::shared_ptr<const void> encodeGradients(GradientField& field, GradientEncoding encoding)
+{
+    switch (encoding) {
+    case GradientEncoding::Float: {
+        const auto pData = std::make_shared<const std::vector<GradientVoxel>>(std::move(field.data));
+        return std::shared_ptr<const void>(pData, pData->data());
+    }
+    case GradientEncoding::Quantized: {
+        const auto pData = std::make_shared<const std::vector<QuantizedGradientVoxel>>(quantizeGradients(field.data, field.maxMagnitude));
+        return std::shared_ptr<const void>(pData, pData->data());
+    }
+    default: {
+        return nullptr;
+    }
+    }
+}
+
+GradientVolume::GradientVolume(const Volume& volume, GradientEncoding encoding, GradientField field)
+    : m_dim(volume.dims())
+    , m_indexer(volume.dims(), volume.layout())
+    , m_encoding(encoding)
+    , m_pVolume(encoding == GradientEncoding::OnTheFly ? &volume : nullptr)
+    , m_pGradients(encodeGradients(field, encoding))
+    , m_data(encoding == GradientEncoding::Float ? static_cast<const GradientVoxel*>(m_pGradients.get()) : nullptr)
+    , m_quantizedData(encoding == GradientEncoding::Quantized ? static_cast<const QuantizedGradientVoxel*>(m_pGradients.get()) : nullptr)
+    , m_minMagnitude(field.minMagnitude)
+    , m_maxMagnitude(field.maxMagnitude)
+    , m_histogram2D(std::move(field.histogram2D))
+{
+}
+
+GradientVolume::GradientVolume(const Volume& volume, const DerivedLevel& derivedLevel)
     : m_dim(volume.dims())
-    , m_data(computeGradientVolume(volume))
-    , m_minMagnitude(computeMinMagnitude(m_data))
-    , m_maxMagnitude(computeMaxMagnitude(m_data))
+    , m_indexer(volume.dims(), volume.layout())
+    , m_encoding(derivedLevel.gradientEncoding)
+    , m_pVolume(derivedLevel.gradientEncoding == GradientEncoding::OnTheFly ? &volume : nullptr)
+    , m_pGradients(derivedLevel.pGradients)
+    , m_data(m_encoding == GradientEncoding::Float ? static_cast<const GradientVoxel*>(m_pGradients.get()) : nullptr)
+    , m_quantizedData(m_encoding == GradientEncoding::Quantized ? static_cast<const QuantizedGradientVoxel*>(m_pGradients.get()) : nullptr)
+    , m_minMagnitude(derivedLevel.minGradientMagnitude)
+    , m_maxMagnitude(derivedLevel.maxGradientMagnitude)
+    , m_histogram2D(derivedLevel.histogram2D)
+{
+    assert(derivedLevel.dim == volume.dims() && derivedLevel.layout == volume.layout());
+}
+
+// Convert a value in [-1, 1] to an 8 bit signed normalized integer (and back). Unlike an unsigned mapping this
+// represents 0 (and thus axis aligned directions) exactly.
+static uint16_t toSnorm8(float v)
+{
+    return uint16_t(uint8_t(int8_t(std::lround(std::clamp(v, -1.0f, 1.0f) * 127.0f))));
+}
+
+static float fromSnorm8(uint16_t v)
+{
+    return std::max(float(int8_t(uint8_t(v))) / 127.0f, -1.0f);
+}
+
+static glm::vec2 signNotZero(const glm::vec2& v)
 {
+    return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+// Octahedral normal encoding: project the direction onto the octahedron |x| + |y| + |z| = 1 and fold the lower half
+// (z < 0) over the upper half, such that the direction is described by the two coordinates in [-1, 1].
+QuantizedGradientVoxel GradientVolume::quantize(const GradientVoxel& gradient, float maxMagnitude)
+{
+    glm::vec2 octahedral { 0.0f };
+    const float l1Norm = std::abs(gradient.dir.x) + std::abs(gradient.dir.y) + std::abs(gradient.dir.z);
+    if (l1Norm > 0.0f) {
+        octahedral = glm::vec2(gradient.dir) / l1Norm;
+        if (gradient.dir.z < 0.0f)
+            octahedral = (1.0f - glm::abs(glm::vec2(octahedral.y, octahedral.x))) * signNotZero(octahedral);
+    }
+
+    // Only zero gradients are quantized to a zero magnitude, so the shading of tiny gradients stays well defined.
+    uint16_t magnitude = 0;
+    if (gradient.magnitude > 0.0f && maxMagnitude > 0.0f)
+        magnitude = uint16_t(std::clamp(std::lround(gradient.magnitude / maxMagnitude * 65535.0f), 1l, 65535l));
+    return { uint16_t(toSnorm8(octahedral.x) | (toSnorm8(octahedral.y) << 8)), magnitude };
+}
+
+GradientVoxel GradientVolume::dequantize(const QuantizedGradientVoxel& gradient, float maxMagnitude)
+{
+    const glm::vec2 octahedral { fromSnorm8(gradient.direction & 0xFF), fromSnorm8(gradient.direction >> 8) };
+    glm::vec3 direction { octahedral, 1.0f - std::abs(octahedral.x) - std::abs(octahedral.y) };
+    if (direction.z < 0.0f)
+        direction = glm::vec3((1.0f - glm::abs(glm::vec2(octahedral.y, octahedral.x))) * signNotZero(octahedral), direction.z);
+
+    const float magnitude = float(gradient.magnitude) * (maxMagnitude / 65535.0f);
+    return { glm::normalize(direction) * magnitude, magnitude };
 }
 
 float GradientVolume::maxMagnitude() const
@@ -71,11 +267,41 @@ float GradientVolume::minMagnitude() const
     return m_minMagnitude;
 }
 
+const Histogram2D& GradientVolume::histogram2D() const
+{
+    return m_histogram2D;
+}
+
 glm::ivec3 GradientVolume::dims() const
 {
     return m_dim;
 }
 
+VoxelLayout GradientVolume::layout() const
+{
+    return m_indexer.layout();
+}
+
+GradientEncoding GradientVolume::encoding() const
+{
+    return m_encoding;
+}
+
+gsl::span<const std::byte> GradientVolume::storedData() const
+{
+    switch (m_encoding) {
+    case GradientEncoding::Float: {
+        return gsl::as_bytes(gsl::span<const GradientVoxel>(m_data, m_indexer.size()));
+    }
+    case GradientEncoding::Quantized: {
+        return gsl::as_bytes(gsl::span<const QuantizedGradientVoxel>(m_quantizedData, m_indexer.size()));
+    }
+    default: {
+        return {};
+    }
+    };
+}
+
 // This function returns a gradientVoxel at coord based on the current interpolation mode.
 GradientVoxel GradientVolume::getGradientInterpolate(const glm::vec3& coord) const
 {
@@ -110,55 +336,36 @@ GradientVoxel GradientVolume::getGradientNearestNeighbor(const glm::vec3& coord)
     return getGradient(roundToPositiveInt(coord.x), roundToPositiveInt(coord.y), roundToPositiveInt(coord.z));
 }
 
-// ======= TODO : IMPLEMENT ========
-// Returns the trilinearly interpolated gradinet at the given coordinate.
-// Use the linearInterpolate function that you implemented below.
+// Returns the trilinearly interpolated gradient at the given coordinate.
 GradientVoxel GradientVolume::getGradientLinearInterpolate(const glm::vec3& coord) const
 {   
 
     if (glm::any(glm::lessThan(coord, glm::vec3(0))) || glm::any(glm::greaterThanEqual(coord + 1.0f, glm::vec3(m_dim))))
         return { glm::vec3(0.0f), 0.0f };
+    if (m_encoding == GradientEncoding::OnTheFly)
+        return dispatchVoxelType(m_pVolume->voxelType(), [&](auto voxel) { return computeGradientLinearInterpolate<decltype(voxel)>(coord); });
+
+    // The coordinates are non-negative, so truncation is the same as floor. The upper neighbours are always base + 1
+    // (for integer coordinates they get a zero weight), and their indices are assembled from 6 offsets.
+    const glm::ivec3 base { coord };
+    const size_t x0 = m_indexer.xOffset(base.x), x1 = m_indexer.xOffset(base.x + 1);
+    const size_t y0 = m_indexer.yOffset(base.y), y1 = m_indexer.yOffset(base.y + 1);
+    const size_t z0 = m_indexer.zOffset(base.z), z1 = m_indexer.zOffset(base.z + 1);
+    const auto gradient = [&](size_t index) {
+        return m_encoding == GradientEncoding::Float ? m_data[index] : dequantize(m_quantizedData[index], m_maxMagnitude);
+    };
 
-    //get the 8 points around the coord
-    int x0 = static_cast<int>(floor(coord.x));
-    int x1 = static_cast<int>(ceil(coord.x));
-    int y0 = static_cast<int>(floor(coord.y));
-    int y1 = static_cast<int>(ceil(coord.y));
-    int z0 = static_cast<int>(floor(coord.z));
-    int z1 = static_cast<int>(ceil(coord.z));
-
-    //get the 8 gradients
-    GradientVoxel g000 = getGradient(x0, y0, z0);
-    GradientVoxel g001 = getGradient(x0, y0, z1);
-    GradientVoxel g010 = getGradient(x0, y1, z0);
-    GradientVoxel g011 = getGradient(x0, y1, z1);
-    GradientVoxel g100 = getGradient(x1, y0, z0);
-    GradientVoxel g101 = getGradient(x1, y0, z1);
-    GradientVoxel g110 = getGradient(x1, y1, z0);
-    GradientVoxel g111 = getGradient(x1, y1, z1);
-   // Calculate the interpolation factors for each axis
-    float fx = coord.x - static_cast<float>(x0);
-    float fy = coord.y - static_cast<float>(y0);
-    float fz = coord.z - static_cast<float>(z0);
-
-    // Interpolate along x for the bottom and top of the voxel
-    GradientVoxel g00 = linearInterpolate(g000, g100, fx);
-    GradientVoxel g01 = linearInterpolate(g001, g101, fx);
-    GradientVoxel g10 = linearInterpolate(g010, g110, fx);
-    GradientVoxel g11 = linearInterpolate(g011, g111, fx);
-
-    // Interpolate along y
-    GradientVoxel g0 = linearInterpolate(g00, g10, fy);
-    GradientVoxel g1 = linearInterpolate(g01, g11, fy);
-
-    // Interpolate along z
-    GradientVoxel g = linearInterpolate(g0, g1, fz);
-
-    return g;
-}
-
-// ======= TODO : IMPLEMENT ========
-// This function should linearly interpolates the value from g0 to g1 given the factor (t).
+    const glm::vec3 factor = coord - glm::vec3(base);
+    const GradientVoxel g00 = linearInterpolate(gradient(x0 + y0 + z0), gradient(x1 + y0 + z0), factor.x);
+    const GradientVoxel g01 = linearInterpolate(gradient(x0 + y0 + z1), gradient(x1 + y0 + z1), factor.x);
+    const GradientVoxel g10 = linearInterpolate(gradient(x0 + y1 + z0), gradient(x1 + y1 + z0), factor.x);
+    const GradientVoxel g11 = linearInterpolate(gradient(x0 + y1 + z1), gradient(x1 + y1 + z1), factor.x);
+    const GradientVoxel g0 = linearInterpolate(g00, g10, factor.y);
+    const GradientVoxel g1 = linearInterpolate(g01, g11, factor.y);
+    return linearInterpolate(g0, g1, factor.z);
+}
+
+// This function linearly interpolates the value from g0 to g1 given the factor (t).
 // At t=0, linearInterpolate should return g0 and at t=1 it returns g1.
 GradientVoxel GradientVolume::linearInterpolate(const GradientVoxel& g0, const GradientVoxel& g1, float factor)
 {   
@@ -175,7 +382,77 @@ GradientVoxel GradientVolume::linearInterpolate(const GradientVoxel& g0, const G
 // This function returns a gradientVoxel without using interpolation
 GradientVoxel GradientVolume::getGradient(int x, int y, int z) const
 {
-    const size_t i = static_cast<size_t>(x + m_dim.x * (y + m_dim.y * z));
-    return m_data[i];
+    switch (m_encoding) {
+    case GradientEncoding::Float: {
+        return m_data[m_indexer.index(x, y, z)];
+    }
+    case GradientEncoding::Quantized: {
+        return dequantize(m_quantizedData[m_indexer.index(x, y, z)], m_maxMagnitude);
+    }
+    case GradientEncoding::OnTheFly: {
+        return computeGradient(x, y, z);
+    }
+    default: {
+        throw std::exception();
+    }
+    };
+}
+
+// Central differences at a voxel, computed the same way as in computeGradientVolume (including the zero gradient on
+// the border of the volume).
+GradientVoxel GradientVolume::computeGradient(int x, int y, int z) const
+{
+    if (x <= 0 || y <= 0 || z <= 0 || x >= m_dim.x - 1 || y >= m_dim.y - 1 || z >= m_dim.z - 1)
+        return { glm::vec3(0.0f), 0.0f };
+
+    const Volume& volume = *m_pVolume;
+    const float gx = (volume.getVoxel(x + 1, y, z) - volume.getVoxel(x - 1, y, z)) / 2.0f;
+    const float gy = (volume.getVoxel(x, y + 1, z) - volume.getVoxel(x, y - 1, z)) / 2.0f;
+    const float gz = (volume.getVoxel(x, y, z + 1) - volume.getVoxel(x, y, z - 1)) / 2.0f;
+    return { glm::vec3(gx, gy, gz), std::sqrt(gx * gx + gy * gy + gz * gz) };
+}
+
+// Same result as getGradientLinearInterpolate() with stored gradients, but the gradients of the 8 surrounding voxels
+// are computed from the 32 voxels around them, which are read once (instead of 6 reads for each of the 8 gradients).
+template <typename Voxel>
+GradientVoxel GradientVolume::computeGradientLinearInterpolate(const glm::vec3& coord) const
+{
+    const glm::ivec3 base { glm::floor(coord) };
+    // Away from the border of the volume neither the reads nor the gradients need to be checked.
+    const bool interior = glm::all(glm::greaterThanEqual(base, glm::ivec3(1))) && glm::all(glm::lessThan(base + 2, m_dim));
+
+    // The 4x4x4 block from base - 1 to base + 2; its corners and edges are not part of any central difference.
+    float block[4][4][4];
+    for (int z = 0; z < 4; z++) {
+        for (int y = 0; y < 4; y++) {
+            for (int x = 0; x < 4; x++) {
+                if ((x == 0 || x == 3) + (y == 0 || y == 3) + (z == 0 || z == 3) > 1)
+                    continue;
+                const glm::ivec3 voxel = base + glm::ivec3(x - 1, y - 1, z - 1);
+                const bool inside = interior || (glm::all(glm::greaterThanEqual(voxel, glm::ivec3(0))) && glm::all(glm::lessThan(voxel, m_dim)));
+                block[z][y][x] = inside ? m_pVolume->getVoxel<Voxel>(voxel.x, voxel.y, voxel.z) : 0.0f;
+            }
+        }
+    }
+
+    // Gradient of the voxel at base + offset; the block indices are shifted by one.
+    const auto gradient = [&](int x, int y, int z) -> GradientVoxel {
+        const glm::ivec3 voxel = base + glm::ivec3(x, y, z);
+        if (!interior && (glm::any(glm::lessThanEqual(voxel, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(voxel, m_dim - 1))))
+            return { glm::vec3(0.0f), 0.0f };
+        const float gx = (block[z + 1][y + 1][x + 2] - block[z + 1][y + 1][x]) / 2.0f;
+        const float gy = (block[z + 1][y + 2][x + 1] - block[z + 1][y][x + 1]) / 2.0f;
+        const float gz = (block[z + 2][y + 1][x + 1] - block[z][y + 1][x + 1]) / 2.0f;
+        return { glm::vec3(gx, gy, gz), std::sqrt(gx * gx + gy * gy + gz * gz) };
+    };
+
+    const glm::vec3 factor = coord - glm::vec3(base);
+    const GradientVoxel g00 = linearInterpolate(gradient(0, 0, 0), gradient(1, 0, 0), factor.x);
+    const GradientVoxel g01 = linearInterpolate(gradient(0, 0, 1), gradient(1, 0, 1), factor.x);
+    const GradientVoxel g10 = linearInterpolate(gradient(0, 1, 0), gradient(1, 1, 0), factor.x);
+    const GradientVoxel g11 = linearInterpolate(gradient(0, 1, 1), gradient(1, 1, 1), factor.x);
+    const GradientVoxel g0 = linearInterpolate(g00, g10, factor.y);
+    const GradientVoxel g1 = linearInterpolate(g01, g11, factor.y);
+    return linearInterpolate(g0, g1, factor.z);
 }
 }
\ No newline at end of file
@@ -1,7 +1,11 @@
 #pragma once
 #include "volume.h"
+#include <cstdint>
+#include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
+#include <gsl/span>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -11,20 +15,75 @@ struct GradientVoxel {
     float magnitude;
 };
 
+// How the gradients are stored. Float stores a GradientVoxel (16 bytes) per voxel. Quantized stores a
+// QuantizedGradientVoxel (4 bytes) per voxel which is decoded on every access; the direction has an error of at most
+// one degree and the magnitude of 1/65535th of the maximum magnitude. OnTheFly stores nothing and computes the central
+// differences from the volume on every access (the same values as Float, but each sample reads more voxels).
+enum class GradientEncoding {
+    Float = 0,
+    Quantized,
+    OnTheFly
+};
+
+struct QuantizedGradientVoxel {
+    // Octahedral encoding of the normalized direction, 8 bit signed normalized per coordinate.
+    uint16_t direction;
+    // Magnitude relative to the maximum magnitude of the volume.
+    uint16_t magnitude;
+};
+
+// Joint histogram of the voxel values and gradient magnitudes (shown by the 2D transfer function widget). Bin (x, y)
+// counts the voxels with a value in [x, x + 1) * intensityBinSize (negative values are counted in the first column)
+// and a gradient magnitude in [y, y + 1) * magnitudeBinSize.
+struct Histogram2D {
+    glm::ivec2 dims { 0 };
+    float intensityBinSize { 1.0f };
+    float magnitudeBinSize { 1.0f };
+    // dims.x * dims.y counts, x-fastest.
+    std::vector<int> bins;
+};
+
+// Gradients, their magnitude range and the 2D histogram, computed in a single pass (see gradient_volume.cpp).
+struct GradientField;
+struct DerivedLevel;
+
 class GradientVolume {
 public:
     // DO NOT REMOVE
     InterpolationMode interpolationMode { InterpolationMode::NearestNeighbour };
 
 public:
-    GradientVolume(const Volume& volume);
+    // With GradientEncoding::OnTheFly the volume is referenced, so it should outlive the gradient volume.
+    GradientVolume(const Volume& volume, GradientEncoding encoding = GradientEncoding::Float);
+    // Gradients mapped from the derived data cache of the volume file (see derived_data_cache.h), with the encoding that
+    // they were stored with.
+    GradientVolume(const Volume& volume, const DerivedLevel& derivedLevel);
 
+    GradientVoxel getGradientInterpolate(const glm::vec3& coord) const;
+    // Same as above but with the interpolation mode chosen at compile time (instead of checking it for every sample).
+    template <InterpolationMode mode>
     GradientVoxel getGradientInterpolate(const glm::vec3& coord) const;
     GradientVoxel getGradient(int x, int y, int z) const;
 
     float minMagnitude() const;
     float maxMagnitude() const;
+    const Histogram2D& histogram2D() const;
     glm::ivec3 dims() const;
+    VoxelLayout layout() const;
+    GradientEncoding encoding() const;
+    // The stored gradients: a GradientVoxel or QuantizedGradientVoxel (see encoding()) per voxel in the order of the
+    // layout. Empty for GradientEncoding::OnTheFly.
+    gsl::span<const std::byte> storedData() const;
+
+    static QuantizedGradientVoxel quantize(const GradientVoxel& gradient, float maxMagnitude);
+    static GradientVoxel dequantize(const QuantizedGradientVoxel& gradient, float maxMagnitude);
+
+private:
+    GradientVolume(const Volume& volume, GradientEncoding encoding, GradientField field);
+
+    GradientVoxel computeGradient(int x, int y, int z) const;
+    template <typename Voxel>
+    GradientVoxel computeGradientLinearInterpolate(const glm::vec3& coord) const;
 
 protected:
     GradientVoxel getGradientNearestNeighbor(const glm::vec3& coord) const;
@@ -33,7 +92,26 @@ protected:
 
 protected:
     const glm::ivec3 m_dim;
-    const std::vector<GradientVoxel> m_data;
+    const VoxelIndexer m_indexer;
+    const GradientEncoding m_encoding;
+    // Only used by GradientEncoding::OnTheFly.
+    const Volume* m_pVolume;
+    // Either owned by the gradient volume or pointing into the memory mapped derived data cache. The gradients are never
+    // modified, so copies of the gradient volume can share them. Only the pointer that matches the encoding is set.
+    const std::shared_ptr<const void> m_pGradients;
+    const GradientVoxel* const m_data;
+    const QuantizedGradientVoxel* const m_quantizedData;
     const float m_minMagnitude, m_maxMagnitude;
+    const Histogram2D m_histogram2D;
 };
+
+template <InterpolationMode mode>
+inline GradientVoxel GradientVolume::getGradientInterpolate(const glm::vec3& coord) const
+{
+    // No cubic for the gradient, linear is good enough.
+    if constexpr (mode == InterpolationMode::NearestNeighbour)
+        return getGradientNearestNeighbor(coord);
+    else
+        return getGradientLinearInterpolate(coord);
+}
 }
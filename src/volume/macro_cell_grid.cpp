@@ -0,0 +1,123 @@
+#include "macro_cell_grid.h"
+#include "brick_cache.h"
+#include "derived_data_cache.h"
+#include <algorithm>
+#include <glm/common.hpp>
+#include <limits>
+#include <tbb/blocked_range2d.h>
+#include <tbb/parallel_for.h>
+
+namespace volume {
+
+// Compute the minimum/maximum of each macro cell.
+// A cell contains all sample positions whose integer part lies in [cell * cellSize, (cell + 1) * cellSize). The
+// interpolation kernels also read the neighbouring voxels of a sample (up to two voxels away for tri-cubic), so the
+// range of each cell is extended by that footprint to guarantee that any interpolated value lies within [min, max].
+template <typename Voxel>
+static std::vector<MacroCell> computeMacroCells(const Volume& volume, const glm::ivec3& gridDim)
+{
+    static constexpr int footprintLower = 1;
+    static constexpr int footprintUpper = 2;
+    const glm::ivec3 dim = volume.dims();
+
+    std::vector<MacroCell> out(static_cast<size_t>(gridDim.x * gridDim.y * gridDim.z));
+    tbb::parallel_for(tbb::blocked_range2d<int>(0, gridDim.z, 0, gridDim.y), [&](const tbb::blocked_range2d<int>& range) {
+        for (int cz = range.rows().begin(); cz != range.rows().end(); cz++) {
+            for (int cy = range.cols().begin(); cy != range.cols().end(); cy++) {
+                for (int cx = 0; cx < gridDim.x; cx++) {
+                    const glm::ivec3 cell { cx, cy, cz };
+                    const glm::ivec3 begin = glm::max(cell * MacroCellGrid::cellSize - footprintLower, glm::ivec3(0));
+                    const glm::ivec3 end = glm::min((cell + 1) * MacroCellGrid::cellSize + footprintUpper, dim);
+
+                    MacroCell macroCell { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest() };
+                    for (int z = begin.z; z < end.z; z++) {
+                        for (int y = begin.y; y < end.y; y++) {
+                            for (int x = begin.x; x < end.x; x++) {
+                                const float value = volume.getVoxel<Voxel>(x, y, z);
+                                macroCell.minimum = std::min(macroCell.minimum, value);
+                                macroCell.maximum = std::max(macroCell.maximum, value);
+                            }
+                        }
+                    }
+
+                    const size_t index = static_cast<size_t>(cx + gridDim.x * (cy + gridDim.y * cz));
+                    out[index] = macroCell;
+                }
+            }
+        }
+    });
+    return out;
+}
+
+// The macro cells of a streaming volume are derived from the value ranges of the bricks (stored in the brick file), such
+// that the grid can be built without reading the voxels. A brick is a whole number of cells and its range includes the
+// apron, which covers the footprint of the cells on its border.
+static std::vector<MacroCell> brickMacroCells(const BrickCache& brickCache, const glm::ivec3& gridDim)
+{
+    static_assert(BrickCache::brickSize % MacroCellGrid::cellSize == 0 && BrickCache::apronLower >= 1 && BrickCache::apronUpper >= 2);
+    std::vector<MacroCell> out;
+    out.reserve(static_cast<size_t>(gridDim.x * gridDim.y * gridDim.z));
+    for (int cz = 0; cz < gridDim.z; cz++) {
+        for (int cy = 0; cy < gridDim.y; cy++) {
+            for (int cx = 0; cx < gridDim.x; cx++)
+                out.push_back(brickCache.brickRange(glm::ivec3(cx, cy, cz) * MacroCellGrid::cellSize / BrickCache::brickSize));
+        }
+    }
+    return out;
+}
+
+static glm::ivec3 computeGridDims(const glm::ivec3& volumeDims)
+{
+    return (volumeDims + MacroCellGrid::cellSize - 1) / MacroCellGrid::cellSize;
+}
+
+MacroCellGrid::MacroCellGrid(const Volume& volume)
+    : m_dim(computeGridDims(volume.dims()))
+    , m_data(volume.brickCache() ? brickMacroCells(*volume.brickCache(), m_dim) : dispatchVoxelType(volume.voxelType(), [&](auto voxel) { return computeMacroCells<decltype(voxel)>(volume, m_dim); }))
+{
+}
+
+MacroCellGrid::MacroCellGrid(const DerivedLevel& derivedLevel)
+    : m_dim(computeGridDims(derivedLevel.dim))
+    , m_data(derivedLevel.macroCells)
+{
+}
+
+glm::ivec3 MacroCellGrid::dims() const
+{
+    return m_dim;
+}
+
+size_t MacroCellGrid::numCells() const
+{
+    return m_data.size();
+}
+
+gsl::span<const MacroCell> MacroCellGrid::cells() const
+{
+    return m_data;
+}
+
+// Returns the cell that contains the given (continuous) voxel coordinate. Coordinates outside of the volume
+// are clamped to the closest cell.
+glm::ivec3 MacroCellGrid::cellOf(const glm::vec3& coord) const
+{
+    const glm::ivec3 cell = glm::ivec3(glm::max(coord, glm::vec3(0.0f))) / cellSize;
+    return glm::min(cell, m_dim - 1);
+}
+
+size_t MacroCellGrid::cellIndex(const glm::ivec3& cell) const
+{
+    return static_cast<size_t>(cell.x + m_dim.x * (cell.y + m_dim.y * cell.z));
+}
+
+MacroCell MacroCellGrid::getCell(const glm::ivec3& cell) const
+{
+    return m_data[cellIndex(cell)];
+}
+
+MacroCell MacroCellGrid::getCell(int x, int y, int z) const
+{
+    return getCell(glm::ivec3(x, y, z));
+}
+}
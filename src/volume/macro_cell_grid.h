@@ -0,0 +1,41 @@
+#pragma once
+#include "volume.h"
+#include <glm/vec3.hpp>
+#include <gsl/span>
+#include <vector>
+
+namespace volume {
+struct DerivedLevel;
+
+struct MacroCell {
+    float minimum;
+    float maximum;
+};
+
+// Coarse grid of bricks that store the minimum/maximum voxel value of the region they cover. This is used by
+// the renderer to skip over parts of the volume that cannot contribute to the image (empty space skipping).
+class MacroCellGrid {
+public:
+    // Width of a macro cell in voxels (along each axis).
+    static constexpr int cellSize = 8;
+
+public:
+    MacroCellGrid(const Volume& volume);
+    // The macro cells stored in the derived data cache of the volume file (see derived_data_cache.h).
+    MacroCellGrid(const DerivedLevel& derivedLevel);
+
+    MacroCell getCell(int x, int y, int z) const;
+    MacroCell getCell(const glm::ivec3& cell) const;
+    glm::ivec3 cellOf(const glm::vec3& coord) const;
+    size_t cellIndex(const glm::ivec3& cell) const;
+    size_t numCells() const;
+    // All cells, indexed by cellIndex.
+    gsl::span<const MacroCell> cells() const;
+
+    glm::ivec3 dims() const;
+
+protected:
+    const glm::ivec3 m_dim;
+    const std::vector<MacroCell> m_data;
+};
+}
@@ -0,0 +1,101 @@
+#include "mapped_file.h"
+#include <iostream>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace volume {
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& file)
+{
+    m_fileHandle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (m_fileHandle == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_fileHandle, &size)) {
+        std::cerr << "Could not open " << file << std::endl;
+        return;
+    }
+    // Mapping an empty file is an error.
+    if (size.QuadPart == 0)
+        return;
+
+    m_mappingHandle = CreateFileMappingW(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mappingHandle)
+        m_pData = static_cast<const std::byte*>(MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0));
+    if (!m_pData) {
+        std::cerr << "Could not map " << file << std::endl;
+        return;
+    }
+    m_size = size_t(size.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+    if (m_mappingHandle)
+        CloseHandle(m_mappingHandle);
+    if (m_fileHandle != INVALID_HANDLE_VALUE && m_fileHandle)
+        CloseHandle(m_fileHandle);
+}
+
+void MappedFile::adviseSequential() const
+{
+    // Windows detects sequential access by itself.
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& file)
+{
+    const int fd = open(file.c_str(), O_RDONLY);
+    struct stat fileInfo;
+    if (fd == -1 || fstat(fd, &fileInfo) == -1) {
+        std::cerr << "Could not open " << file << std::endl;
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+
+    // Mapping an empty file is an error.
+    if (fileInfo.st_size > 0) {
+        void* pData = mmap(nullptr, size_t(fileInfo.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (pData != MAP_FAILED) {
+            m_pData = static_cast<const std::byte*>(pData);
+            m_size = size_t(fileInfo.st_size);
+        } else {
+            std::cerr << "Could not map " << file << std::endl;
+        }
+    }
+    // The mapping stays valid after closing the file.
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_pData)
+        munmap(const_cast<std::byte*>(m_pData), m_size);
+}
+
+void MappedFile::adviseSequential() const
+{
+    if (m_pData)
+        madvise(const_cast<std::byte*>(m_pData), m_size, MADV_SEQUENTIAL);
+}
+
+#endif
+
+gsl::span<const std::byte> MappedFile::bytes() const
+{
+    return { m_pData, m_size };
+}
+
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <gsl/span>
+
+namespace volume {
+
+// Read-only memory mapping of a file. The contents are paged in by the operating system when they are accessed, so
+// opening a file is cheap and the data does not count towards the private memory of the process.
+class MappedFile {
+public:
+    // The mapping is empty if the file could not be opened.
+    MappedFile(const std::filesystem::path& file);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    gsl::span<const std::byte> bytes() const;
+    // Tell the operating system that the file will be read from front to back (only a hint).
+    void adviseSequential() const;
+
+private:
+    const std::byte* m_pData { nullptr };
+    size_t m_size { 0 };
+#ifdef _WIN32
+    void* m_fileHandle { nullptr };
+    void* m_mappingHandle { nullptr };
+#endif
+};
+
+}
@@ -0,0 +1,151 @@
+#include "statistics_cache.h"
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <system_error>
+#include <utility>
+
+static constexpr char statisticsCacheMagic[8] = { 'V', 'V', 'S', 'T', 'A', 'T', 'S', '1' };
+
+// Layout: StatisticsCacheHeader, histogram (int32_t per bin), 2D histogram (int32_t per bin).
+struct StatisticsCacheHeader {
+    char magic[8];
+    // Size and modification time of the volume file.
+    uint64_t sourceSize;
+    int64_t sourceModificationTime;
+    float minimum, maximum;
+    uint32_t histogramSize;
+    int32_t hasGradientStatistics;
+    float minGradientMagnitude, maxGradientMagnitude;
+    int32_t histogram2DDims[2];
+    float intensityBinSize, magnitudeBinSize;
+};
+
+template <typename T>
+static void writeArray(std::ofstream& ofs, const T* pData, size_t count)
+{
+    ofs.write(reinterpret_cast<const char*>(pData), std::streamsize(count * sizeof(T)));
+}
+
+template <typename T>
+static void readArray(std::ifstream& ifs, T* pData, size_t count)
+{
+    ifs.read(reinterpret_cast<char*>(pData), std::streamsize(count * sizeof(T)));
+}
+
+namespace volume {
+
+std::optional<std::pair<uint64_t, int64_t>> fileStamp(const std::filesystem::path& file)
+{
+    std::error_code error;
+    const auto size = std::filesystem::file_size(file, error);
+    if (error)
+        return {};
+    const auto modificationTime = std::filesystem::last_write_time(file, error);
+    if (error)
+        return {};
+    return std::pair<uint64_t, int64_t> { size, modificationTime.time_since_epoch().count() };
+}
+
+std::filesystem::path statisticsCachePath(const std::filesystem::path& volumeFile)
+{
+    std::filesystem::path out = volumeFile;
+    out += ".stats";
+    return out;
+}
+
+std::optional<VolumeStatistics> readStatisticsCache(const std::filesystem::path& volumeFile)
+{
+    const auto optStamp = fileStamp(volumeFile);
+    const std::filesystem::path cacheFile = statisticsCachePath(volumeFile);
+    const auto optCacheStamp = fileStamp(cacheFile);
+    if (!optStamp || !optCacheStamp)
+        return {};
+
+    std::ifstream ifs { cacheFile, std::ios::binary };
+    StatisticsCacheHeader header {};
+    readArray(ifs, &header, 1);
+    if (!ifs || !std::equal(std::begin(statisticsCacheMagic), std::end(statisticsCacheMagic), header.magic))
+        return {};
+    if (header.sourceSize != optStamp->first || header.sourceModificationTime != optStamp->second)
+        return {};
+    // Check the sizes against the size of the cache before allocating anything.
+    const glm::ivec2 histogram2DDims { header.histogram2DDims[0], header.histogram2DDims[1] };
+    if (histogram2DDims.x < 0 || histogram2DDims.y < 0)
+        return {};
+    const size_t histogram2DSize = size_t(histogram2DDims.x) * size_t(histogram2DDims.y);
+    if (optCacheStamp->first != sizeof(header) + (size_t(header.histogramSize) + histogram2DSize) * sizeof(int32_t))
+        return {};
+
+    VolumeStatistics out {};
+    out.minimum = header.minimum;
+    out.maximum = header.maximum;
+    out.histogram.resize(header.histogramSize);
+    readArray(ifs, out.histogram.data(), out.histogram.size());
+    out.hasGradientStatistics = header.hasGradientStatistics != 0;
+    out.minGradientMagnitude = header.minGradientMagnitude;
+    out.maxGradientMagnitude = header.maxGradientMagnitude;
+    out.histogram2D.dims = histogram2DDims;
+    out.histogram2D.intensityBinSize = header.intensityBinSize;
+    out.histogram2D.magnitudeBinSize = header.magnitudeBinSize;
+    out.histogram2D.bins.resize(histogram2DSize);
+    readArray(ifs, out.histogram2D.bins.data(), out.histogram2D.bins.size());
+    if (!ifs)
+        return {};
+    return out;
+}
+
+// The cache is written to a temporary file that replaces the old cache when complete, such that a concurrent reader
+// never sees a partial cache.
+void writeStatisticsCache(const std::filesystem::path& volumeFile, const VolumeStatistics& statistics)
+{
+    const auto optStamp = fileStamp(volumeFile);
+    if (!optStamp)
+        return;
+
+    StatisticsCacheHeader header {};
+    std::copy(std::begin(statisticsCacheMagic), std::end(statisticsCacheMagic), header.magic);
+    header.sourceSize = optStamp->first;
+    header.sourceModificationTime = optStamp->second;
+    header.minimum = statistics.minimum;
+    header.maximum = statistics.maximum;
+    header.histogramSize = uint32_t(statistics.histogram.size());
+    header.hasGradientStatistics = statistics.hasGradientStatistics ? 1 : 0;
+    header.minGradientMagnitude = statistics.minGradientMagnitude;
+    header.maxGradientMagnitude = statistics.maxGradientMagnitude;
+    header.histogram2DDims[0] = statistics.histogram2D.dims.x;
+    header.histogram2DDims[1] = statistics.histogram2D.dims.y;
+    header.intensityBinSize = statistics.histogram2D.intensityBinSize;
+    header.magnitudeBinSize = statistics.histogram2D.magnitudeBinSize;
+
+    const std::filesystem::path cacheFile = statisticsCachePath(volumeFile);
+    std::filesystem::path temporaryFile = cacheFile;
+    temporaryFile += ".tmp";
+    {
+        std::ofstream ofs { temporaryFile, std::ios::binary };
+        writeArray(ofs, &header, 1);
+        writeArray(ofs, statistics.histogram.data(), statistics.histogram.size());
+        writeArray(ofs, statistics.histogram2D.bins.data(), statistics.histogram2D.bins.size());
+        if (!ofs) {
+            ofs.close();
+            std::error_code error;
+            std::filesystem::remove(temporaryFile, error);
+            return;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporaryFile, cacheFile, error);
+    if (error)
+        std::filesystem::remove(temporaryFile, error);
+}
+
+void updateStatisticsCache(const Volume& volume, const GradientVolume& gradientVolume)
+{
+    const VolumeStatistics* pStatistics = volume.statisticsCache();
+    if (volume.fileName().empty() || volume.brickCache() || volume.histogram().empty() || (pStatistics && pStatistics->hasGradientStatistics))
+        return;
+    const VolumeStatistics statistics { volume.minimum(), volume.maximum(), volume.histogram(), true,
+        gradientVolume.minMagnitude(), gradientVolume.maxMagnitude(), gradientVolume.histogram2D() };
+    writeStatisticsCache(std::string(volume.fileName()), statistics);
+}
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "gradient_volume.h"
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace volume {
+
+// Statistics of a volume file that otherwise require passes over all voxels (or even computing all gradients). They
+// are stored in a sidecar file next to the volume file (see statisticsCachePath), which is only used while the volume
+// file keeps the size and modification time that it had when the statistics were computed.
+struct VolumeStatistics {
+    float minimum, maximum;
+    std::vector<int> histogram;
+    // The gradient statistics are only valid if hasGradientStatistics is set.
+    bool hasGradientStatistics;
+    float minGradientMagnitude, maxGradientMagnitude;
+    Histogram2D histogram2D;
+};
+
+// Size and modification time of the file, or nothing if the file does not exist. The caches next to a volume file are
+// only valid while the stamp of the volume file matches the one that they were written for.
+std::optional<std::pair<uint64_t, int64_t>> fileStamp(const std::filesystem::path& file);
+
+// <volume file>.stats
+std::filesystem::path statisticsCachePath(const std::filesystem::path& volumeFile);
+// Returns nothing if there is no cache or if it is outdated or invalid.
+std::optional<VolumeStatistics> readStatisticsCache(const std::filesystem::path& volumeFile);
+// Failures are ignored (for example when the directory of the volume is read-only): the statistics are then simply
+// computed again the next time.
+void writeStatisticsCache(const std::filesystem::path& volumeFile, const VolumeStatistics& statistics);
+// Writes the statistics of the volume and of its gradients to the cache of the volume file, unless that cache already
+// has them. Volumes that were not loaded from a file and streaming volumes (which store their statistics in the brick
+// file) are skipped. Nothing is written implicitly; the viewer calls this after loading a volume.
+void updateStatisticsCache(const Volume& volume, const GradientVolume& gradientVolume);
+}
@@ -1,51 +1,114 @@
 #include "volume.h"
+#include "brick_cache.h"
+#include "compressed_volume.h"
+#include "derived_data_cache.h"
+#include "mapped_file.h"
+#include "statistics_cache.h"
+#include "volume_pyramid.h"
 #include <algorithm>
 #include <array>
 #include <cassert>
 #include <cctype> // isspace
 #include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <filesystem>
-#include <fstream>
 #include <glm/glm.hpp>
 #include <gsl/span>
 #include <iostream>
 #include <string>
+#include <limits>
+#include <stdexcept>
+#include <string_view>
+#include <tbb/blocked_range.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+#include <type_traits>
 
 struct Header {
     glm::ivec3 dim;
     size_t elementSize;
+    // Offset of the first voxel from the start of the file.
+    size_t dataOffset;
 };
-static Header readHeader(std::ifstream& ifs);
-static float computeMinimum(gsl::span<const uint16_t> data);
-static float computeMaximum(gsl::span<const uint16_t> data);
-static std::vector<int> computeHistogram(gsl::span<const uint16_t> data);
+// Little endian 16-bit value that may be stored at an odd address.
+struct UnalignedUint16 {
+    uint8_t low, high;
+    operator uint16_t() const { return uint16_t(low | (high << 8)); }
+};
+static_assert(sizeof(UnalignedUint16) == 2 && alignof(UnalignedUint16) == 1);
+
+static Header readHeader(std::string_view text);
+struct Statistics {
+    float minimum, maximum;
+    std::vector<int> histogram;
+};
+template <typename T>
+static Statistics computeStatistics(gsl::span<const T> data);
+template <typename Voxel, typename T>
+static std::vector<Voxel> toLayout(gsl::span<const T> linearData, const volume::VoxelIndexer& indexer, const glm::ivec3& dim);
 
 namespace volume {
 
-Volume::Volume(const std::filesystem::path& file)
+Volume::Volume(const std::filesystem::path& file, VoxelLayout layout)
     : m_fileName(file.string())
+    , m_layout(layout)
+    , m_indexer(glm::ivec3(0), layout)
 {
     using clock = std::chrono::high_resolution_clock;
     auto start = clock::now();
     loadFile(file);
     auto end = clock::now();
     std::cout << "Time to load: " << std::chrono::duration<double, std::milli>(end - start).count() << "ms" << std::endl;
+}
 
-    if (m_data.size() > 0) {
-        m_minimum = computeMinimum(m_data);
-        m_maximum = computeMaximum(m_data);
-        m_histogram = computeHistogram(m_data);
-    }
+Volume::Volume(std::vector<uint8_t> data, const glm::ivec3& dim, VoxelLayout layout)
+    : m_fileName()
+    , m_elementSize(sizeof(uint8_t))
+    , m_dim(dim)
+    , m_layout(layout)
+    , m_indexer(dim, layout)
+{
+    const auto pData = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+    setVoxels(gsl::span<const uint8_t>(*pData), pData);
 }
 
-Volume::Volume(std::vector<uint16_t> data, const glm::ivec3& dim)
+Volume::Volume(std::vector<uint16_t> data, const glm::ivec3& dim, VoxelLayout layout)
     : m_fileName()
-    , m_elementSize(2)
+    , m_elementSize(sizeof(uint16_t))
     , m_dim(dim)
-    , m_data(std::move(data))
-    , m_minimum(computeMinimum(m_data))
-    , m_maximum(computeMaximum(m_data))
-    , m_histogram(computeHistogram(m_data))
+    , m_layout(layout)
+    , m_indexer(dim, layout)
+{
+    const auto pData = std::make_shared<const std::vector<uint16_t>>(std::move(data));
+    setVoxels(gsl::span<const uint16_t>(*pData), pData);
+}
+
+// Used for volumes that are derived from other volumes.
+Volume::Volume(std::vector<float> data, const glm::ivec3& dim, VoxelLayout layout)
+    : m_fileName()
+    , m_elementSize(sizeof(float))
+    , m_dim(dim)
+    , m_layout(layout)
+    , m_indexer(dim, layout)
+{
+    const auto pData = std::make_shared<const std::vector<float>>(std::move(data));
+    setVoxels(gsl::span<const float>(*pData), pData);
+}
+
+Volume::Volume(const DerivedLevel& derivedLevel)
+    : m_fileName()
+    , m_elementSize(dispatchVoxelType(derivedLevel.voxelType, [](auto voxel) { return sizeof(voxel); }))
+    , m_dim(derivedLevel.dim)
+    , m_layout(derivedLevel.layout)
+    , m_indexer(derivedLevel.dim, derivedLevel.layout)
+    , m_voxelType(derivedLevel.voxelType)
+    , m_pVoxels(derivedLevel.pVoxels)
+    , m_voxelCount(m_indexer.size())
+    , m_minimum(derivedLevel.minimum)
+    , m_maximum(derivedLevel.maximum)
+    , m_histogram(derivedLevel.histogram)
 {
 }
 
@@ -59,7 +122,7 @@ float Volume::maximum() const
     return m_maximum;
 }
 
-std::vector<int> Volume::histogram() const
+const std::vector<int>& Volume::histogram() const
 {
     return m_histogram;
 }
@@ -69,15 +132,65 @@ glm::ivec3 Volume::dims() const
     return m_dim;
 }
 
+VoxelLayout Volume::layout() const
+{
+    return m_layout;
+}
+
+const VoxelIndexer& Volume::indexer() const
+{
+    return m_indexer;
+}
+
+VoxelType Volume::voxelType() const
+{
+    return m_voxelType;
+}
+
 std::string_view Volume::fileName() const
 {
     return m_fileName;
 }
 
+BrickCache* Volume::brickCache() const
+{
+    return m_pBrickCache.get();
+}
+
+const VolumeStatistics* Volume::statisticsCache() const
+{
+    return m_pStatisticsCache.get();
+}
+
+// Copy the voxels into memory of which each worker thread first writes an equal, contiguous part. Operating systems
+// place a page on the NUMA node of the thread that first writes it, so the voxels end up spread over all nodes instead
+// of on the node of the thread that loaded the volume. Rays sample the volume in an order that is unrelated to the
+// threads, so accesses do not become local; they are balanced over the memory controllers of all sockets instead of
+// saturating one. Volumes that are mapped from a file are copied into memory as well. Does nothing for streaming
+// volumes.
+void Volume::spreadOverNumaNodes()
+{
+    if (!m_pVoxels)
+        return;
+
+    dispatchVoxelType(m_voxelType, [&](auto voxel) {
+        using Voxel = decltype(voxel);
+        const Voxel* pSource = static_cast<const Voxel*>(m_pVoxels.get());
+        // Default initialized, so the pages are not touched before they are copied into.
+        std::shared_ptr<Voxel[]> pVoxels { new Voxel[m_voxelCount] };
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0, m_voxelCount), [&](const tbb::blocked_range<size_t>& range) {
+                std::copy(pSource + range.begin(), pSource + range.end(), pVoxels.get() + range.begin());
+            },
+            tbb::static_partitioner());
+        const Voxel* pData = pVoxels.get();
+        m_pVoxels = std::shared_ptr<const void>(std::move(pVoxels), pData);
+    });
+}
+
 float Volume::getVoxel(int x, int y, int z) const
 {
-    const size_t i = size_t(x + m_dim.x * (y + m_dim.y * z));
-    return static_cast<float>(m_data[i]);
+    return dispatchVoxelType(m_voxelType, [&](auto voxel) { return getVoxel<decltype(voxel)>(x, y, z); });
 }
 
 // This function returns a value based on the current interpolation mode
@@ -102,6 +215,12 @@ float Volume::getSampleInterpolate(const glm::vec3& coord) const
 // This function returns the nearest neighbour value at the continuous 3D position given by coord.
 // Notice that in this framework we assume that the distance between neighbouring voxels is 1 in all directions
 float Volume::getSampleNearestNeighbourInterpolation(const glm::vec3& coord) const
+{
+    return dispatchVoxelType(m_voxelType, [&](auto voxel) { return getSampleNearestNeighbourInterpolation<decltype(voxel)>(coord); });
+}
+
+template <typename Voxel>
+float Volume::getSampleNearestNeighbourInterpolation(const glm::vec3& coord) const
 {
     // check if the coordinate is within volume boundaries, since we only look at direct neighbours we only need to check within 0.5
     if (glm::any(glm::lessThan(coord + 0.5f, glm::vec3(0))) || glm::any(glm::greaterThanEqual(coord + 0.5f, glm::vec3(m_dim))))
@@ -113,49 +232,64 @@ float Volume::getSampleNearestNeighbourInterpolation(const glm::vec3& coord) con
         return static_cast<int>(f + 0.5f);
     };
 
-    return getVoxel(roundToPositiveInt(coord.x), roundToPositiveInt(coord.y), roundToPositiveInt(coord.z));
+    if (m_pBrickCache)
+        return getSampleStreaming<InterpolationMode::NearestNeighbour, Voxel>(coord);
+    return getVoxel<Voxel>(roundToPositiveInt(coord.x), roundToPositiveInt(coord.y), roundToPositiveInt(coord.z));
 }
 
-// ======= TODO : IMPLEMENT the functions below for tri-linear interpolation ========
-// ======= Consider using the linearInterpolate and biLinearInterpolate functions ===
 // This function returns the trilinear interpolated value at the continuous 3D position given by coord.
 float Volume::getSampleTriLinearInterpolation(const glm::vec3& coord) const
 {
-   
-    if (glm::any(glm::lessThan(coord, glm::vec3(0))) || glm::any(glm::greaterThanEqual(coord + 1.0f, glm::vec3(m_dim))))
-        return 0.0f;
-
-    // Extract the integer parts of the coordinates and the fractional remainder for interpolation
-    int z0 = static_cast<int>(coord.z);
-
-    float zFactor = coord.z - static_cast<float>(z0);
-
-    // Perform bilinear interpolation on the bottom and top slices
-    float valueBottom = biLinearInterpolate(glm::vec2(coord.x, coord.y), z0);
-    float valueTop = biLinearInterpolate(glm::vec2(coord.x, coord.y), z0 + 1);
+    return dispatchVoxelType(m_voxelType, [&](auto voxel) { return getSampleTriLinearInterpolation<decltype(voxel)>(coord); });
+}
 
-    // Perform linear interpolation between the slices
-    return linearInterpolate(valueBottom, valueTop, zFactor);
+// Trilinear interpolation of the 8 voxels at pVoxels[xOffsets[i] + yOffsets[j] + zOffsets[k]].
+template <typename Voxel>
+static float trilinearKernel(const Voxel* pVoxels, const size_t (&xOffsets)[2], const size_t (&yOffsets)[2], const size_t (&zOffsets)[2], const glm::vec3& factor)
+{
+    const auto lerp = [](float g0, float g1, float t) { return g0 + t * (g1 - g0); };
+    const auto row = [&](size_t yz) { return lerp(float(pVoxels[xOffsets[0] + yz]), float(pVoxels[xOffsets[1] + yz]), factor.x); };
+    const float bottom = lerp(row(yOffsets[0] + zOffsets[0]), row(yOffsets[1] + zOffsets[0]), factor.y);
+    const float top = lerp(row(yOffsets[0] + zOffsets[1]), row(yOffsets[1] + zOffsets[1]), factor.y);
+    return lerp(bottom, top, factor.z);
 }
 
+// All 8 neighbours lie inside the volume once the sample passes the bounds check, so they are read without any
+// further checks. Their indices are assembled from 6 offsets (see VoxelIndexer::xOffset).
+template <typename Voxel>
+float Volume::getSampleTriLinearInterpolation(const glm::vec3& coord) const
+{
+    if (glm::any(glm::lessThan(coord, glm::vec3(0))) || glm::any(glm::greaterThanEqual(coord + 1.0f, glm::vec3(m_dim))))
+        return 0.0f;
+    if (m_pBrickCache)
+        return getSampleStreaming<InterpolationMode::Linear, Voxel>(coord);
+
+    // The coordinates are non-negative, so truncation is the same as floor.
+    const glm::ivec3 base { coord };
+    const size_t xOffsets[2] { m_indexer.xOffset(base.x), m_indexer.xOffset(base.x + 1) };
+    const size_t yOffsets[2] { m_indexer.yOffset(base.y), m_indexer.yOffset(base.y + 1) };
+    const size_t zOffsets[2] { m_indexer.zOffset(base.z), m_indexer.zOffset(base.z + 1) };
+    return trilinearKernel(static_cast<const Voxel*>(m_pVoxels.get()), xOffsets, yOffsets, zOffsets, coord - glm::vec3(base));
+}
 
 // This function linearly interpolates the value at X using incoming values g0 and g1 given a factor (equal to the positon of x in 1D)
 //
 // g0--X--------g1
 //   factor
 float Volume::linearInterpolate(float g0, float g1, float factor)
-{   
-    if (factor < 0.0f || factor > 1.0f)
-    {
-        std::cout << factor << std::endl;
-        return 0.0f;
-    }
+{
     // linear interpolation is a weighted average of the two values
     return (1.0f - factor) * g0 + factor * g1;
 }
 
 // This function bi-linearly interpolates the value at the given continuous 2D XY coordinate for a fixed integer z coordinate.
 float Volume::biLinearInterpolate(const glm::vec2& xyCoord, int z) const
+{
+    return dispatchVoxelType(m_voxelType, [&](auto voxel) { return biLinearInterpolate<decltype(voxel)>(xyCoord, z); });
+}
+
+template <typename Voxel>
+float Volume::biLinearInterpolate(const glm::vec2& xyCoord, int z) const
 {    
     // get the 4 neighbouring voxels
     const auto x0 = static_cast<int>(xyCoord.x);
@@ -164,10 +298,10 @@ float Volume::biLinearInterpolate(const glm::vec2& xyCoord, int z) const
     const auto y1 = y0 + 1;
 
     // get the values at the 4 neighbouring voxels
-    const auto g00 = getVoxel(x0, y0, z);
-    const auto g01 = getVoxel(x0, y1, z);
-    const auto g10 = getVoxel(x1, y0, z);
-    const auto g11 = getVoxel(x1, y1, z);
+    const auto g00 = getVoxel<Voxel>(x0, y0, z);
+    const auto g01 = getVoxel<Voxel>(x0, y1, z);
+    const auto g10 = getVoxel<Voxel>(x1, y0, z);
+    const auto g11 = getVoxel<Voxel>(x1, y1, z);
 
     // interpolate the values in x direction
     const auto xFactor = xyCoord.x - static_cast<float>(x0);
@@ -181,74 +315,344 @@ float Volume::biLinearInterpolate(const glm::vec2& xyCoord, int z) const
 }
 
 
-// ======= OPTIONAL : This functions can be used to implement cubic interpolation ========
+// Cubic interpolation uses the uniform cubic B-spline. Its weights are non-negative and sum to one, so (unlike
+// Catmull-Rom) an interpolated value never leaves the range of its 4x4x4 neighbourhood, which keeps the value ranges
+// of the macro cells valid. The B-spline smooths the data slightly (it approximates rather than interpolates).
+//
 // This function represents the h(x) function, which returns the weight of the cubic interpolation kernel for a given position x
 float Volume::weight(float x)
 {
+    x = std::abs(x);
+    if (x < 1.0f)
+        return (4.0f - 6.0f * x * x + 3.0f * x * x * x) / 6.0f;
+    if (x < 2.0f)
+        return (2.0f - x) * (2.0f - x) * (2.0f - x) / 6.0f;
     return 0.0f;
 }
 
-// ======= OPTIONAL : This functions can be used to implement cubic interpolation ========
+// The weights h(factor + 1), h(factor), h(1 - factor) and h(2 - factor) of the 4 samples around a position, computed
+// together (the polynomials share terms).
+static glm::vec4 cubicWeights(float factor)
+{
+    const float factor2 = factor * factor;
+    const float factor3 = factor2 * factor;
+    const float inverse = 1.0f - factor;
+    return glm::vec4(
+               inverse * inverse * inverse,
+               3.0f * factor3 - 6.0f * factor2 + 4.0f,
+               -3.0f * factor3 + 3.0f * factor2 + 3.0f * factor + 1.0f,
+               factor3)
+        / 6.0f;
+}
+
 // This functions returns the results of a cubic interpolation using 4 values and a factor
 float Volume::cubicInterpolate(float g0, float g1, float g2, float g3, float factor)
 {
-    return 0.0f;
+    const glm::vec4 weights = cubicWeights(factor);
+    return weights.x * g0 + weights.y * g1 + weights.z * g2 + weights.w * g3;
+}
+
+// The 4 voxel coordinates (along one axis) that contribute to a cubic sample at coord; coordinates outside of the
+// volume are clamped to the border.
+static glm::ivec4 cubicNeighbours(float coord, int dim)
+{
+    const int i = static_cast<int>(coord);
+    return glm::clamp(glm::ivec4(i - 1, i, i + 1, i + 2), glm::ivec4(0), glm::ivec4(dim - 1));
 }
 
-// ======= OPTIONAL : This functions can be used to implement cubic interpolation ========
 // This function returns the value of a bicubic interpolation
 float Volume::biCubicInterpolate(const glm::vec2& xyCoord, int z) const
 {
-    return 0.0f;
+    return dispatchVoxelType(m_voxelType, [&](auto voxel) { return biCubicInterpolate<decltype(voxel)>(xyCoord, z); });
+}
+
+template <typename Voxel>
+float Volume::biCubicInterpolate(const glm::vec2& xyCoord, int z) const
+{
+    if (glm::any(glm::lessThan(xyCoord, glm::vec2(0))) || glm::any(glm::greaterThanEqual(xyCoord + 1.0f, glm::vec2(m_dim))))
+        return 0.0f;
+
+    const glm::ivec4 xs = cubicNeighbours(xyCoord.x, m_dim.x);
+    const glm::ivec4 ys = cubicNeighbours(xyCoord.y, m_dim.y);
+    const float xFactor = xyCoord.x - static_cast<float>(static_cast<int>(xyCoord.x));
+    const float yFactor = xyCoord.y - static_cast<float>(static_cast<int>(xyCoord.y));
+    float rows[4];
+    for (int j = 0; j < 4; j++)
+        rows[j] = cubicInterpolate(getVoxel<Voxel>(xs[0], ys[j], z), getVoxel<Voxel>(xs[1], ys[j], z), getVoxel<Voxel>(xs[2], ys[j], z), getVoxel<Voxel>(xs[3], ys[j], z), xFactor);
+    return cubicInterpolate(rows[0], rows[1], rows[2], rows[3], yFactor);
 }
 
-// ======= OPTIONAL : This functions can be used to implement cubic interpolation ========
 // This function computes the tricubic interpolation at coord
 float Volume::getSampleTriCubicInterpolation(const glm::vec3& coord) const
 {
-    return 0.0f;
+    return dispatchVoxelType(m_voxelType, [&](auto voxel) { return getSampleTriCubicInterpolation<decltype(voxel)>(coord); });
+}
+
+// The kernel is separable, so the 64 voxels at pVoxels[xOffsets[i] + yOffsets[j] + zOffsets[k]] are reduced along x
+// (16 rows), then y (4 columns) and finally z. The 12 weights are computed once per sample instead of once per tap.
+template <typename Voxel>
+static float tricubicKernel(const Voxel* pVoxels, const size_t (&xOffsets)[4], const size_t (&yOffsets)[4], const size_t (&zOffsets)[4], const glm::vec3& factor)
+{
+    const glm::vec4 xWeights = cubicWeights(factor.x);
+    const glm::vec4 yWeights = cubicWeights(factor.y);
+    const glm::vec4 zWeights = cubicWeights(factor.z);
+    float result = 0.0f;
+    for (int k = 0; k < 4; k++) {
+        float plane = 0.0f;
+        for (int j = 0; j < 4; j++) {
+            const Voxel* pRow = pVoxels + yOffsets[j] + zOffsets[k];
+            float row = 0.0f;
+            for (int i = 0; i < 4; i++)
+                row += xWeights[i] * static_cast<float>(pRow[xOffsets[i]]);
+            plane += yWeights[j] * row;
+        }
+        result += zWeights[k] * plane;
+    }
+    return result;
+}
+
+// The voxel indices are assembled from 12 offsets (see VoxelIndexer::xOffset) instead of being computed for each of
+// the 64 taps.
+template <typename Voxel>
+float Volume::getSampleTriCubicInterpolation(const glm::vec3& coord) const
+{
+    // Same domain as trilinear interpolation.
+    if (glm::any(glm::lessThan(coord, glm::vec3(0))) || glm::any(glm::greaterThanEqual(coord + 1.0f, glm::vec3(m_dim))))
+        return 0.0f;
+    if (m_pBrickCache)
+        return getSampleStreaming<InterpolationMode::Cubic, Voxel>(coord);
+
+    const glm::ivec3 base { coord };
+    const glm::ivec4 xs = cubicNeighbours(coord.x, m_dim.x);
+    const glm::ivec4 ys = cubicNeighbours(coord.y, m_dim.y);
+    const glm::ivec4 zs = cubicNeighbours(coord.z, m_dim.z);
+
+    size_t xOffsets[4], yOffsets[4], zOffsets[4];
+    for (int i = 0; i < 4; i++) {
+        xOffsets[i] = m_indexer.xOffset(xs[i]);
+        yOffsets[i] = m_indexer.yOffset(ys[i]);
+        zOffsets[i] = m_indexer.zOffset(zs[i]);
+    }
+    return tricubicKernel(static_cast<const Voxel*>(m_pVoxels.get()), xOffsets, yOffsets, zOffsets, coord - glm::vec3(base));
+}
+
+// A brick contains all neighbours that the kernels read (its apron is clamped to the volume in the same way as
+// cubicNeighbours), so every sample reads a single brick. Samples in bricks that are not resident (yet) are taken from
+// the coarse copy of the volume instead; the renderer keeps running while the bricks are being loaded.
+template <InterpolationMode mode, typename Voxel>
+float Volume::getSampleStreaming(const glm::vec3& coord) const
+{
+    const glm::ivec3 base = mode == InterpolationMode::NearestNeighbour ? glm::ivec3(coord + 0.5f) : glm::ivec3(coord);
+    const glm::ivec3 brick = base / BrickCache::brickSize;
+    const Voxel* pBrick = m_pBrickCache->brick<Voxel>(m_pBrickCache->brickIndex(brick));
+    if (!pBrick) {
+        const Volume& coarseVolume = m_pBrickCache->coarseVolume();
+        const glm::vec3 coarseCoord = VolumePyramid::toLevelCoordinates(coord, m_pBrickCache->coarseScale());
+        // The coarse voxels cover the border of the volume only partially, so the coordinates are clamped to the domain of the kernel.
+        const glm::vec3 coarseMax = glm::max(glm::vec3(coarseVolume.dims() - 1) - 0.001f, glm::vec3(0.0f));
+        return coarseVolume.getSampleInterpolate<mode, Voxel>(glm::clamp(coarseCoord, glm::vec3(0.0f), coarseMax));
+    }
+
+    // Voxels of a brick are stored in linear order.
+    constexpr size_t yStride = BrickCache::paddedSize;
+    constexpr size_t zStride = yStride * yStride;
+    const glm::ivec3 local = base - brick * BrickCache::brickSize + BrickCache::apronLower;
+    const Voxel* pVoxel = pBrick + size_t(local.x) + yStride * size_t(local.y) + zStride * size_t(local.z);
+    const glm::vec3 factor = coord - glm::vec3(base);
+    if constexpr (mode == InterpolationMode::NearestNeighbour) {
+        return static_cast<float>(*pVoxel);
+    } else if constexpr (mode == InterpolationMode::Linear) {
+        static constexpr size_t xOffsets[2] { 0, 1 };
+        static constexpr size_t yOffsets[2] { 0, yStride };
+        static constexpr size_t zOffsets[2] { 0, zStride };
+        return trilinearKernel(pVoxel, xOffsets, yOffsets, zOffsets, factor);
+    } else {
+        static constexpr size_t xOffsets[4] { 0, 1, 2, 3 };
+        static constexpr size_t yOffsets[4] { 0, yStride, 2 * yStride, 3 * yStride };
+        static constexpr size_t zOffsets[4] { 0, zStride, 2 * zStride, 3 * zStride };
+        return tricubicKernel(pVoxel - 1 - yStride - zStride, xOffsets, yOffsets, zOffsets, factor);
+    }
+}
+
+template <typename Voxel>
+float Volume::getStreamingVoxel(int x, int y, int z) const
+{
+    const glm::ivec3 voxel { x, y, z };
+    const glm::ivec3 brick = voxel / BrickCache::brickSize;
+    const Voxel* pBrick = m_pBrickCache->brick<Voxel>(m_pBrickCache->brickIndex(brick));
+    if (!pBrick) {
+        const Volume& coarseVolume = m_pBrickCache->coarseVolume();
+        const glm::ivec3 coarseVoxel = glm::min(voxel / int(m_pBrickCache->coarseScale()), coarseVolume.dims() - 1);
+        return coarseVolume.getVoxel<Voxel>(coarseVoxel.x, coarseVoxel.y, coarseVoxel.z);
+    }
+    const glm::ivec3 local = voxel - brick * BrickCache::brickSize + BrickCache::apronLower;
+    return static_cast<float>(pBrick[size_t(local.x) + size_t(BrickCache::paddedSize) * (size_t(local.y) + size_t(BrickCache::paddedSize) * size_t(local.z))]);
+}
+
+template <InterpolationMode mode, typename Voxel>
+void Volume::getSamplesInterpolate(const glm::vec3& start, const glm::vec3& increment, gsl::span<float> samples) const
+{
+    for (size_t i = 0; i < samples.size(); i++) {
+        const glm::vec3 coord = start + float(i) * increment;
+        if constexpr (mode == InterpolationMode::NearestNeighbour)
+            samples[i] = getSampleNearestNeighbourInterpolation<Voxel>(coord);
+        else if constexpr (mode == InterpolationMode::Linear)
+            samples[i] = getSampleTriLinearInterpolation<Voxel>(coord);
+        else
+            samples[i] = getSampleTriCubicInterpolation<Voxel>(coord);
+    }
 }
 
+// The sample functions are called by the (templated) ray marching kernels of the renderer.
+#define INSTANTIATE_SAMPLE_FUNCTIONS(Voxel)                                                                                                  \
+    template float Volume::getSampleNearestNeighbourInterpolation<Voxel>(const glm::vec3&) const;                                               \
+    template float Volume::getSampleTriLinearInterpolation<Voxel>(const glm::vec3&) const;                                                      \
+    template float Volume::getSampleTriCubicInterpolation<Voxel>(const glm::vec3&) const;                                                       \
+    template void Volume::getSamplesInterpolate<InterpolationMode::NearestNeighbour, Voxel>(const glm::vec3&, const glm::vec3&, gsl::span<float>) const; \
+    template void Volume::getSamplesInterpolate<InterpolationMode::Linear, Voxel>(const glm::vec3&, const glm::vec3&, gsl::span<float>) const;           \
+    template void Volume::getSamplesInterpolate<InterpolationMode::Cubic, Voxel>(const glm::vec3&, const glm::vec3&, gsl::span<float>) const; \
+    template float Volume::getStreamingVoxel<Voxel>(int, int, int) const;
+INSTANTIATE_SAMPLE_FUNCTIONS(uint8_t)
+INSTANTIATE_SAMPLE_FUNCTIONS(uint16_t)
+INSTANTIATE_SAMPLE_FUNCTIONS(float)
+#undef INSTANTIATE_SAMPLE_FUNCTIONS
+
 // Load an fld volume data file
-// First read and parse the header, then the volume data can be directly converted from bytes to uint16_ts
+// The file is memory mapped and the header is parsed in place. The voxels keep their precision (8 or 16 bits) and are
+// used directly from the mapping when the volume has a linear layout; otherwise they are reordered straight from the
+// mapping, so there is never more than one copy of the volume in memory.
 void Volume::loadFile(const std::filesystem::path& file)
 {
     assert(std::filesystem::exists(file));
-    std::ifstream ifs(file, std::ios::binary);
-    assert(ifs.is_open());
+    if (file.extension() == ".bvol") {
+        openBrickFile(file);
+        return;
+    }
+    // Skip the statistics pass if the statistics of the file were cached by an earlier run.
+    if (auto optStatistics = readStatisticsCache(file))
+        m_pStatisticsCache = std::make_shared<const VolumeStatistics>(std::move(*optStatistics));
+    if (file.extension() == ".cvol") {
+        loadCompressedFile(file);
+        return;
+    }
+
+    const auto pFile = std::make_shared<const MappedFile>(file);
+    const auto bytes = pFile->bytes();
 
-    const auto header = readHeader(ifs);
+    const auto header = readHeader(std::string_view(reinterpret_cast<const char*>(bytes.data()), bytes.size()));
     m_dim = header.dim;
     m_elementSize = header.elementSize;
+    m_indexer = VoxelIndexer(m_dim, m_layout);
 
-    const size_t voxelCount = static_cast<size_t>(header.dim.x * header.dim.y * header.dim.z);
+    const size_t voxelCount = static_cast<size_t>(header.dim.x) * static_cast<size_t>(header.dim.y) * static_cast<size_t>(header.dim.z);
     const size_t byteCount = voxelCount * header.elementSize;
-    std::vector<char> buffer(byteCount);
-    // Data section is separated from header by two /f characters.
-    ifs.seekg(2, std::ios::cur);
-    ifs.read(buffer.data(), std::streamsize(byteCount));
+    if (header.dataOffset + byteCount > bytes.size()) {
+        std::cerr << "File " << file << " is smaller than its header says" << std::endl;
+        return;
+    }
+    const std::byte* pVoxelBytes = bytes.data() + header.dataOffset;
 
-    m_data.resize(voxelCount);
     if (header.elementSize == 1) { // Bytes.
-        for (size_t i = 0; i < byteCount; i++) {
-            m_data[i] = static_cast<uint16_t>(buffer[i] & 0xFF);
+        if (m_layout != VoxelLayout::Linear)
+            pFile->adviseSequential();
+        setVoxels(gsl::span<const uint8_t>(reinterpret_cast<const uint8_t*>(pVoxelBytes), voxelCount), pFile);
+    } else if (header.elementSize == 2) { // uint16_ts (little endian, like all platforms that we support).
+        if (reinterpret_cast<uintptr_t>(pVoxelBytes) % alignof(uint16_t) == 0) {
+            if (m_layout != VoxelLayout::Linear)
+                pFile->adviseSequential();
+            setVoxels(gsl::span<const uint16_t>(reinterpret_cast<const uint16_t*>(pVoxelBytes), voxelCount), pFile);
+        } else {
+            // The header has an odd length, so the voxels are read byte by byte.
+            setVoxels(gsl::span<const UnalignedUint16>(reinterpret_cast<const UnalignedUint16*>(pVoxelBytes), voxelCount), pFile);
         }
-    } else if (header.elementSize == 2) { // uint16_ts.
-        for (size_t i = 0; i < byteCount; i += 2) {
-            m_data[i / 2] = static_cast<uint16_t>((buffer[i] & 0xFF) + (buffer[i + 1] & 0xFF) * 256);
+    }
+}
+
+// Open a preprocessed brick file (see brick_cache.h). The statistics are stored in the file, so no voxels are read.
+void Volume::openBrickFile(const std::filesystem::path& file)
+{
+    try {
+        m_pBrickCache = std::make_shared<BrickCache>(file);
+    } catch (const std::runtime_error& error) {
+        std::cerr << error.what() << std::endl;
+        return;
+    }
+    m_dim = m_pBrickCache->dims();
+    m_voxelType = m_pBrickCache->voxelType();
+    m_elementSize = dispatchVoxelType(m_voxelType, [](auto voxel) { return sizeof(voxel); });
+    m_indexer = VoxelIndexer(m_dim, m_layout);
+    m_minimum = m_pBrickCache->minimum();
+    m_maximum = m_pBrickCache->maximum();
+    m_histogram = m_pBrickCache->histogram();
+}
+
+// Load a compressed volume (see compressed_volume.h). The blocks are decompressed in parallel straight from the mapping.
+void Volume::loadCompressedFile(const std::filesystem::path& file)
+{
+    const MappedFile mappedFile { file };
+    try {
+        const CompressedVolume compressedVolume { mappedFile.bytes() };
+        m_dim = compressedVolume.dims();
+        m_indexer = VoxelIndexer(m_dim, m_layout);
+        dispatchVoxelType(compressedVolume.voxelType(), [&](auto voxel) {
+            using Voxel = decltype(voxel);
+            m_elementSize = sizeof(Voxel);
+            const auto pData = std::make_shared<const std::vector<Voxel>>(compressedVolume.decompress<Voxel>());
+            setVoxels(gsl::span<const Voxel>(*pData), pData);
+        });
+    } catch (const std::runtime_error& error) {
+        std::cerr << "File " << file << ": " << error.what() << std::endl;
+    }
+}
+
+template <typename T>
+void Volume::setVoxels(gsl::span<const T> linearData, std::shared_ptr<const void> pOwner)
+{
+    if (linearData.empty())
+        return;
+
+    // Compute the statistics before rearranging the data such that they do not include any padding voxels.
+    if (m_pStatisticsCache) {
+        m_minimum = m_pStatisticsCache->minimum;
+        m_maximum = m_pStatisticsCache->maximum;
+        m_histogram = m_pStatisticsCache->histogram;
+    } else {
+        Statistics statistics = computeStatistics(linearData);
+        m_minimum = statistics.minimum;
+        m_maximum = statistics.maximum;
+        m_histogram = std::move(statistics.histogram);
+    }
+
+    // Unaligned 16-bit values are stored as regular 16-bit voxels.
+    using Voxel = std::conditional_t<std::is_same_v<T, UnalignedUint16>, uint16_t, T>;
+    m_voxelType = voxelTypeOf<Voxel>();
+    if constexpr (std::is_same_v<T, Voxel>) {
+        if (m_layout == VoxelLayout::Linear) {
+            // Share ownership with pOwner (aliasing constructor).
+            m_pVoxels = std::shared_ptr<const void>(std::move(pOwner), linearData.data());
+            m_voxelCount = linearData.size();
+            return;
         }
     }
+
+    auto pLayoutData = std::make_shared<const std::vector<Voxel>>(toLayout<Voxel>(linearData, m_indexer, m_dim));
+    const Voxel* pVoxels = pLayoutData->data();
+    m_voxelCount = pLayoutData->size();
+    m_pVoxels = std::shared_ptr<const void>(std::move(pLayoutData), pVoxels);
 }
 }
 
-static Header readHeader(std::ifstream& ifs)
+// Parse the header at the start of the file.
+static Header readHeader(std::string_view text)
 {
     Header out {};
 
     // Read input until the data section starts.
-    std::string line;
-    while (ifs.peek() != '\f' && !ifs.eof()) {
-        std::getline(ifs, line);
+    size_t position = 0;
+    while (position < text.size() && text[position] != '\f') {
+        const size_t lineEnd = std::min(text.find('\n', position), text.size());
+        std::string line { text.substr(position, lineEnd - position) };
+        position = std::min(lineEnd + 1, text.size());
         // Remove comments.
         line = line.substr(0, line.find('#'));
         // Remove any spaces from the string.
@@ -292,23 +696,74 @@ static Header readHeader(std::ifstream& ifs)
             std::cerr << "Invalid AVS keyword " << key << " in file" << std::endl;
         }
     }
+    // Data section is separated from header by two \f characters.
+    out.dataOffset = position + 2;
     return out;
 }
 
-static float computeMinimum(gsl::span<const uint16_t> data)
+// Rearrange voxels stored in the linear (x-fastest) order into the order of the given layout.
+template <typename Voxel, typename T>
+static std::vector<Voxel> toLayout(gsl::span<const T> linearData, const volume::VoxelIndexer& indexer, const glm::ivec3& dim)
 {
-    return float(*std::min_element(std::begin(data), std::end(data)));
+    if (indexer.layout() == volume::VoxelLayout::Linear)
+        return std::vector<Voxel>(std::begin(linearData), std::end(linearData));
+
+    std::vector<Voxel> out(indexer.size(), Voxel(0));
+    tbb::parallel_for(tbb::blocked_range<int>(0, dim.z), [&](const tbb::blocked_range<int>& zRange) {
+        for (int z = zRange.begin(); z != zRange.end(); z++) {
+            size_t i = size_t(dim.x) * size_t(dim.y) * size_t(z);
+            for (int y = 0; y < dim.y; y++) {
+                for (int x = 0; x < dim.x; x++) {
+                    out[indexer.index(x, y, z)] = linearData[i++];
+                }
+            }
+        }
+    });
+    return out;
 }
 
-static float computeMaximum(gsl::span<const uint16_t> data)
+// Compute the minimum, maximum and histogram in a single (parallel) pass over the voxels. The histogram has one bin per
+// integer value from 0 to the maximum (negative values of float volumes are counted in the first bin).
+template <typename T>
+static Statistics computeStatistics(gsl::span<const T> data)
 {
-    return float(*std::max_element(std::begin(data), std::end(data)));
-}
+    const auto bin = [](float value) { return size_t(std::max(value, 0.0f)); };
+    // Integer voxels (8 or 16 bits) fit into a histogram of fixed size; the histogram of float voxels grows as needed.
+    constexpr bool integerVoxels = !std::is_same_v<T, float>;
+    constexpr size_t integerBins = size_t(1) << (8 * sizeof(T));
+    const auto emptyThreadStatistics = []() {
+        return Statistics { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), std::vector<int>(integerVoxels ? integerBins : 0, 0) };
+    };
 
-static std::vector<int> computeHistogram(gsl::span<const uint16_t> data)
-{
-    std::vector<int> histogram(size_t(*std::max_element(std::begin(data), std::end(data)) + 1), 0);
-    for (const auto v : data)
-        histogram[v]++;
-    return histogram;
+    tbb::enumerable_thread_specific<Statistics> threadStatistics { emptyThreadStatistics };
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, data.size(), 1 << 16), [&](const tbb::blocked_range<size_t>& range) {
+        Statistics& local = threadStatistics.local();
+        float minimum = local.minimum, maximum = local.maximum;
+        for (size_t i = range.begin(); i != range.end(); i++) {
+            const float value = float(data[i]);
+            minimum = std::min(minimum, value);
+            maximum = std::max(maximum, value);
+            const size_t valueBin = bin(value);
+            if constexpr (!integerVoxels) {
+                if (valueBin >= local.histogram.size())
+                    local.histogram.resize(valueBin + 1, 0);
+            }
+            local.histogram[valueBin]++;
+        }
+        local.minimum = minimum;
+        local.maximum = maximum;
+    });
+
+    Statistics out { std::numeric_limits<float>::max(), std::numeric_limits<float>::lowest(), {} };
+    for (const Statistics& local : threadStatistics) {
+        out.minimum = std::min(out.minimum, local.minimum);
+        out.maximum = std::max(out.maximum, local.maximum);
+    }
+    out.histogram.resize(bin(out.maximum) + 1, 0);
+    for (const Statistics& local : threadStatistics) {
+        const size_t numBins = std::min(local.histogram.size(), out.histogram.size());
+        for (size_t i = 0; i < numBins; i++)
+            out.histogram[i] += local.histogram[i];
+    }
+    return out;
 }
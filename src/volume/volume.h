@@ -1,8 +1,15 @@
 #pragma once
+#include "voxel_layout.h"
+#include <cassert>
+#include <cstdint>
+#include <exception>
 #include <filesystem>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <gsl/span>
+#include <memory>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 namespace volume {
@@ -13,47 +20,191 @@ enum class InterpolationMode {
     Cubic
 };
 
+// Type in which the voxels are stored. Volumes keep the precision of their source (8 or 16 bit integers for .fld
+// files), so 8-bit volumes need half the memory (bandwidth) of 16-bit volumes.
+enum class VoxelType {
+    UInt8 = 0,
+    UInt16,
+    Float
+};
+
+template <typename Voxel>
+constexpr VoxelType voxelTypeOf();
+
+// Call f with a value of the C++ type that corresponds to voxelType. Only the type of the argument is meaningful; it
+// selects the template specialization, for example: dispatchVoxelType(type, [](auto voxel) { using Voxel = decltype(voxel); ... }).
+template <typename F>
+decltype(auto) dispatchVoxelType(VoxelType voxelType, F&& f);
+
+class BrickCache;
+struct DerivedLevel;
+struct VolumeStatistics;
+
 class Volume {
 public:
     // DO NOT REMOVE
     InterpolationMode interpolationMode { InterpolationMode::NearestNeighbour };
 
 public:
-    Volume(const std::filesystem::path& file);
-    Volume(std::vector<uint16_t> data, const glm::ivec3& dim);
+    Volume(const std::filesystem::path& file, VoxelLayout layout = VoxelLayout::Linear);
+    Volume(std::vector<uint8_t> data, const glm::ivec3& dim, VoxelLayout layout = VoxelLayout::Linear);
+    Volume(std::vector<uint16_t> data, const glm::ivec3& dim, VoxelLayout layout = VoxelLayout::Linear);
+    Volume(std::vector<float> data, const glm::ivec3& dim, VoxelLayout layout = VoxelLayout::Linear);
+    // A coarser level of the volume pyramid of a volume file, mapped from its derived data cache (see
+    // derived_data_cache.h). The voxels are used in place.
+    Volume(const DerivedLevel& derivedLevel);
 
     float minimum() const;
     float maximum() const;
-    std::vector<int> histogram() const;
+    // One bin per integer value from 0 to the maximum (see computeStatistics in volume.cpp).
+    const std::vector<int>& histogram() const;
     glm::ivec3 dims() const;
+    VoxelLayout layout() const;
+    const VoxelIndexer& indexer() const;
+    VoxelType voxelType() const;
+    // Raw voxel data, stored in the order defined by indexer(). Voxel should match voxelType(). Empty for streaming
+    // volumes.
+    template <typename Voxel>
+    gsl::span<const Voxel> data() const;
     std::string_view fileName() const;
+    // Volumes loaded from a .bvol file are streamed from disk (see brick_cache.h): the voxels are read through the
+    // cache instead of being kept in memory. Returns nullptr for volumes that are fully in memory.
+    BrickCache* brickCache() const;
+    // The statistics cache of the volume file (see statistics_cache.h) if it was valid when the volume was loaded,
+    // otherwise nullptr.
+    const VolumeStatistics* statisticsCache() const;
+    // Move the voxels to memory that is spread over all NUMA nodes by first touch (see volume.cpp). Only worth it on
+    // machines with multiple sockets, where a volume that lives on one node limits the bandwidth of all threads.
+    void spreadOverNumaNodes();
 
     float getSampleInterpolate(const glm::vec3& coord) const;
+    // Same as above but with the interpolation mode and voxel type chosen at compile time (instead of checking them
+    // for every sample). Voxel should match voxelType().
+    template <InterpolationMode mode, typename Voxel>
+    float getSampleInterpolate(const glm::vec3& coord) const;
+    // Sample samples.size() equidistant positions along a ray: samples[i] is the sample at start + i * increment. The
+    // loop over the positions is compiled together with the interpolation kernel (getSampleInterpolate is called
+    // through an out-of-line function for every sample).
+    template <InterpolationMode mode, typename Voxel>
+    void getSamplesInterpolate(const glm::vec3& start, const glm::vec3& increment, gsl::span<float> samples) const;
+    float getVoxel(int x, int y, int z) const;
+    template <typename Voxel>
     float getVoxel(int x, int y, int z) const;
 
 protected:
+    // The functions without a template argument dispatch on the voxel type of the volume.
+    float getSampleNearestNeighbourInterpolation(const glm::vec3& coord) const;
+    template <typename Voxel>
     float getSampleNearestNeighbourInterpolation(const glm::vec3& coord) const;
 
+    float getSampleTriLinearInterpolation(const glm::vec3& coord) const;
+    template <typename Voxel>
     float getSampleTriLinearInterpolation(const glm::vec3& coord) const;
     float biLinearInterpolate(const glm::vec2& xyCoord, int z) const;
+    template <typename Voxel>
+    float biLinearInterpolate(const glm::vec2& xyCoord, int z) const;
     static float linearInterpolate(float g0, float g1, float factor);
 
     float getSampleTriCubicInterpolation(const glm::vec3& coord) const;
+    template <typename Voxel>
+    float getSampleTriCubicInterpolation(const glm::vec3& coord) const;
+    float biCubicInterpolate(const glm::vec2& xyCoord, int z) const;
+    template <typename Voxel>
     float biCubicInterpolate(const glm::vec2& xyCoord, int z) const;
     static float cubicInterpolate(float g0, float g1, float g2, float g3, float factor);
     static float weight(float x);
 
 private:
     void loadFile(const std::filesystem::path& file);
+    void openBrickFile(const std::filesystem::path& file);
+    void loadCompressedFile(const std::filesystem::path& file);
+    // Sample/voxel of a streaming volume. The coordinates must pass the bounds check of the interpolation mode.
+    template <InterpolationMode mode, typename Voxel>
+    float getSampleStreaming(const glm::vec3& coord) const;
+    template <typename Voxel>
+    float getStreamingVoxel(int x, int y, int z) const;
+    // Compute the statistics of the voxels (stored in linear order) and store them in the order of the layout. The
+    // voxels are used in place if possible, in which case pOwner is kept alive for as long as the volume exists.
+    template <typename T>
+    void setVoxels(gsl::span<const T> linearData, std::shared_ptr<const void> pOwner);
 
 protected:
     const std::string m_fileName;
     size_t m_elementSize;
     glm::ivec3 m_dim;
+    VoxelLayout m_layout;
+    VoxelIndexer m_indexer;
 
-    std::vector<uint16_t> m_data;
+    // Either owned by the volume or pointing into a memory mapped file (see setVoxels). The voxels are never
+    // modified after loading, so copies of the volume can share them.
+    VoxelType m_voxelType { VoxelType::UInt16 };
+    std::shared_ptr<const void> m_pVoxels;
+    size_t m_voxelCount { 0 };
 
     float m_minimum, m_maximum;
     std::vector<int> m_histogram;
+
+    // Only set for streaming volumes, in which case m_pVoxels is empty.
+    std::shared_ptr<BrickCache> m_pBrickCache;
+    // Only set for volumes loaded from a file with a valid statistics cache.
+    std::shared_ptr<const VolumeStatistics> m_pStatisticsCache;
 };
+
+template <typename Voxel>
+constexpr VoxelType voxelTypeOf()
+{
+    if constexpr (std::is_same_v<Voxel, uint8_t>)
+        return VoxelType::UInt8;
+    else if constexpr (std::is_same_v<Voxel, uint16_t>)
+        return VoxelType::UInt16;
+    else {
+        static_assert(std::is_same_v<Voxel, float>, "Unsupported voxel type");
+        return VoxelType::Float;
+    }
+}
+
+template <typename F>
+inline decltype(auto) dispatchVoxelType(VoxelType voxelType, F&& f)
+{
+    switch (voxelType) {
+    case VoxelType::UInt8: {
+        return f(uint8_t {});
+    }
+    case VoxelType::UInt16: {
+        return f(uint16_t {});
+    }
+    case VoxelType::Float: {
+        return f(float {});
+    }
+    default: {
+        throw std::exception();
+    }
+    }
+}
+
+template <typename Voxel>
+inline gsl::span<const Voxel> Volume::data() const
+{
+    assert(voxelTypeOf<Voxel>() == m_voxelType);
+    return { static_cast<const Voxel*>(m_pVoxels.get()), m_voxelCount };
+}
+
+template <typename Voxel>
+inline float Volume::getVoxel(int x, int y, int z) const
+{
+    if (m_pBrickCache)
+        return getStreamingVoxel<Voxel>(x, y, z);
+    return static_cast<float>(static_cast<const Voxel*>(m_pVoxels.get())[m_indexer.index(x, y, z)]);
+}
+
+template <InterpolationMode mode, typename Voxel>
+inline float Volume::getSampleInterpolate(const glm::vec3& coord) const
+{
+    if constexpr (mode == InterpolationMode::NearestNeighbour)
+        return getSampleNearestNeighbourInterpolation<Voxel>(coord);
+    else if constexpr (mode == InterpolationMode::Linear)
+        return getSampleTriLinearInterpolation<Voxel>(coord);
+    else
+        return getSampleTriCubicInterpolation<Voxel>(coord);
+}
 }
@@ -0,0 +1,109 @@
+#include "volume_pyramid.h"
+#include "derived_data_cache.h"
+#include <algorithm>
+#include <glm/common.hpp>
+#include <glm/gtx/component_wise.hpp>
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <type_traits>
+#include <utility>
+
+namespace volume {
+
+// Halve the resolution of the volume: each voxel is the average of (up to, on the border) 2x2x2 voxels.
+template <typename Voxel>
+static Volume reduceVolume(const Volume& volume)
+{
+    const glm::ivec3 dim = volume.dims();
+    const glm::ivec3 reducedDim = (dim + 1) / 2;
+
+    std::vector<Voxel> data(size_t(reducedDim.x) * size_t(reducedDim.y) * size_t(reducedDim.z));
+    tbb::parallel_for(tbb::blocked_range<int>(0, reducedDim.z), [&](const tbb::blocked_range<int>& zRange) {
+        for (int z = zRange.begin(); z != zRange.end(); z++) {
+            size_t i = size_t(reducedDim.x) * size_t(reducedDim.y) * size_t(z);
+            for (int y = 0; y < reducedDim.y; y++) {
+                for (int x = 0; x < reducedDim.x; x++) {
+                    const glm::ivec3 begin = 2 * glm::ivec3(x, y, z);
+                    const glm::ivec3 end = glm::min(begin + 2, dim);
+                    float sum = 0.0f;
+                    for (int fineZ = begin.z; fineZ < end.z; fineZ++) {
+                        for (int fineY = begin.y; fineY < end.y; fineY++) {
+                            for (int fineX = begin.x; fineX < end.x; fineX++)
+                                sum += volume.getVoxel<Voxel>(fineX, fineY, fineZ);
+                        }
+                    }
+                    const float average = sum / float(glm::compMul(end - begin));
+                    if constexpr (std::is_integral_v<Voxel>)
+                        data[i++] = Voxel(average + 0.5f);
+                    else
+                        data[i++] = average;
+                }
+            }
+        }
+    });
+    return Volume(std::move(data), reducedDim, volume.layout());
+}
+
+VolumePyramid::OwnedLevel::OwnedLevel(Volume&& volume_, GradientEncoding gradientEncoding)
+    : volume(std::move(volume_))
+    , gradientVolume(volume, gradientEncoding)
+    , macroCellGrid(volume)
+{
+}
+
+VolumePyramid::OwnedLevel::OwnedLevel(const DerivedLevel& derivedLevel)
+    : volume(derivedLevel)
+    , gradientVolume(volume, derivedLevel)
+    , macroCellGrid(derivedLevel)
+{
+}
+
+VolumePyramid::VolumePyramid(const Volume& volume, const GradientVolume& gradientVolume, const MacroCellGrid& macroCellGrid, gsl::span<const DerivedLevel> derivedLevels)
+    : m_baseLevel { &volume, &gradientVolume, &macroCellGrid, 1.0f }
+{
+    const Volume* pFinerVolume = &volume;
+    while (int(m_levels.size()) + 1 < maxLevels && glm::compMax(pFinerVolume->dims()) > minimumSize) {
+        // A cached level is only used if it is the level that reducing the finer level would produce.
+        const size_t levelIndex = m_levels.size() + 1;
+        const bool cached = levelIndex < derivedLevels.size() && derivedLevels[levelIndex].dim == (pFinerVolume->dims() + 1) / 2
+            && derivedLevels[levelIndex].layout == volume.layout() && derivedLevels[levelIndex].gradientEncoding == gradientVolume.encoding();
+        if (cached)
+            m_levels.push_back(std::make_unique<OwnedLevel>(derivedLevels[levelIndex]));
+        else
+            m_levels.push_back(std::make_unique<OwnedLevel>(reduce(*pFinerVolume), gradientVolume.encoding()));
+        pFinerVolume = &m_levels.back()->volume;
+    }
+}
+
+int VolumePyramid::numLevels() const
+{
+    return int(m_levels.size()) + 1;
+}
+
+PyramidLevel VolumePyramid::level(int level) const
+{
+    if (level == 0)
+        return m_baseLevel;
+    const OwnedLevel& ownedLevel = *m_levels[size_t(level - 1)];
+    return { &ownedLevel.volume, &ownedLevel.gradientVolume, &ownedLevel.macroCellGrid, float(1 << level) };
+}
+
+void VolumePyramid::setInterpolationMode(InterpolationMode interpolationMode)
+{
+    for (const auto& pLevel : m_levels) {
+        pLevel->volume.interpolationMode = interpolationMode;
+        pLevel->gradientVolume.interpolationMode = interpolationMode;
+    }
+}
+
+Volume VolumePyramid::reduce(const Volume& volume)
+{
+    return dispatchVoxelType(volume.voxelType(), [&](auto voxel) { return reduceVolume<decltype(voxel)>(volume); });
+}
+
+// Convert a full resolution voxel coordinate to a voxel coordinate of the level with the given scale.
+glm::vec3 VolumePyramid::toLevelCoordinates(const glm::vec3& coord, float scale)
+{
+    return (coord - 0.5f * (scale - 1.0f)) / scale;
+}
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include "gradient_volume.h"
+#include "macro_cell_grid.h"
+#include "volume.h"
+#include <glm/vec3.hpp>
+#include <gsl/span>
+#include <memory>
+#include <vector>
+
+namespace volume {
+
+struct DerivedLevel;
+
+// A volume at one level of the pyramid, with the derived data that the renderer needs.
+struct PyramidLevel {
+    const Volume* pVolume;
+    const GradientVolume* pGradientVolume;
+    const MacroCellGrid* pMacroCellGrid;
+    // Each voxel covers scale x scale x scale voxels of the full resolution volume.
+    float scale;
+};
+
+// Mip pyramid of a volume: every level halves the resolution of the previous one (each voxel is the average of 2x2x2
+// voxels). Level 0 is the full resolution volume that the pyramid was built from, which is referenced rather than
+// copied, so it should outlive the pyramid. The voxel at coordinate p of a level covers the full resolution voxels
+// around p * scale + (scale - 1) / 2 (see toLevelCoordinates).
+class VolumePyramid {
+public:
+    // The coarsest level is the first one whose largest dimension does not exceed this size.
+    static constexpr int minimumSize = 32;
+    static constexpr int maxLevels = 5;
+
+public:
+    // The coarser levels are reduced in parallel and use the same layout and gradient encoding as level 0. Levels that
+    // are in the derived data cache of the volume file (see derived_data_cache.h) are mapped instead.
+    VolumePyramid(const Volume& volume, const GradientVolume& gradientVolume, const MacroCellGrid& macroCellGrid, gsl::span<const DerivedLevel> derivedLevels = {});
+
+    int numLevels() const;
+    PyramidLevel level(int level) const;
+    // Sets the interpolation mode of the coarser levels (level 0 is not owned by the pyramid).
+    void setInterpolationMode(InterpolationMode interpolationMode);
+
+    static glm::vec3 toLevelCoordinates(const glm::vec3& coord, float scale);
+    // Halve the resolution of a volume (the next level of its pyramid).
+    static Volume reduce(const Volume& volume);
+
+private:
+    struct OwnedLevel {
+        OwnedLevel(Volume&& volume, GradientEncoding gradientEncoding);
+        OwnedLevel(const DerivedLevel& derivedLevel);
+
+        Volume volume;
+        GradientVolume gradientVolume;
+        MacroCellGrid macroCellGrid;
+    };
+
+    PyramidLevel m_baseLevel;
+    // Levels 1 and up. The gradient volumes may reference their volume, so the levels are never moved.
+    std::vector<std::unique_ptr<OwnedLevel>> m_levels;
+};
+}
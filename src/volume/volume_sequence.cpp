@@ -0,0 +1,198 @@
+#include "volume_sequence.h"
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+namespace volume {
+
+Timestep::Timestep(Volume&& volume_, GradientEncoding gradientEncoding)
+    : volume(std::move(volume_))
+    , gradientVolume(volume, gradientEncoding)
+    , macroCellGrid(volume)
+{
+}
+
+size_t Timestep::sizeInBytes() const
+{
+    const size_t voxelBytes = dispatchVoxelType(volume.voxelType(), [&](auto voxel) { return volume.data<decltype(voxel)>().size_bytes(); });
+    return voxelBytes + gradientVolume.storedData().size();
+}
+
+// Load a timestep, or return nullptr if the file could not be read or does not have the expected dimensions. The
+// volume is checked before the gradients are computed, since a volume that failed to load has no valid dimensions.
+static std::shared_ptr<Timestep> loadTimestep(const std::filesystem::path& file, VoxelLayout layout, GradientEncoding gradientEncoding, std::optional<glm::ivec3> optDim)
+{
+    Volume volume { file, layout };
+    const bool loaded = volume.brickCache() || dispatchVoxelType(volume.voxelType(), [&](auto voxel) { return !volume.data<decltype(voxel)>().empty(); });
+    if (!loaded) {
+        std::cerr << "Could not load timestep " << file << std::endl;
+        return nullptr;
+    }
+    if (optDim && volume.dims() != *optDim) {
+        std::cerr << "Timestep " << file << " does not have the same dimensions as the first timestep" << std::endl;
+        return nullptr;
+    }
+    return std::make_shared<Timestep>(std::move(volume), gradientEncoding);
+}
+
+std::vector<std::filesystem::path> VolumeSequence::findTimesteps(const std::filesystem::path& directory)
+{
+    // Other files in the directory (such as the statistics caches next to the volumes) are ignored.
+    std::vector<std::filesystem::path> out;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        const auto extension = entry.path().extension();
+        if (entry.is_regular_file() && (extension == ".fld" || extension == ".bvol" || extension == ".cvol"))
+            out.push_back(entry.path());
+    }
+    if (error)
+        std::cerr << "Could not read directory " << directory << ": " << error.message() << std::endl;
+    std::sort(std::begin(out), std::end(out));
+    return out;
+}
+
+VolumeSequence::VolumeSequence(std::vector<std::filesystem::path> files, size_t memoryBudget, VoxelLayout layout, GradientEncoding gradientEncoding)
+    : m_files(std::move(files))
+    , m_layout(layout)
+    , m_gradientEncoding(gradientEncoding)
+    , m_timesteps(m_files.size())
+    , m_failed(m_files.size(), false)
+{
+    if (m_files.empty())
+        throw std::runtime_error("The volume sequence has no timesteps");
+    m_timesteps[0] = loadTimestep(m_files[0], m_layout, m_gradientEncoding, std::nullopt);
+    if (!m_timesteps[0])
+        throw std::runtime_error("Could not load the first timestep " + m_files[0].string());
+    m_dim = m_timesteps[0]->volume.dims();
+
+    // All timesteps have the same dimensions, so they use (about) the same memory as the first one.
+    m_timestepBytes = std::max(m_timesteps[0]->sizeInBytes(), size_t(1));
+    const size_t fitting = std::max(memoryBudget / m_timestepBytes, size_t(2));
+    m_prefetchDepth = std::min(fitting, m_files.size()) - 1;
+
+    m_thread = std::thread([this]() { loadLoop(); });
+}
+
+VolumeSequence::~VolumeSequence()
+{
+    {
+        std::scoped_lock lock { m_mutex };
+        m_stop = true;
+    }
+    m_wakeUp.notify_one();
+    m_thread.join();
+}
+
+size_t VolumeSequence::numTimesteps() const
+{
+    return m_files.size();
+}
+
+size_t VolumeSequence::currentIndex() const
+{
+    std::scoped_lock lock { m_mutex };
+    return m_current;
+}
+
+std::shared_ptr<Timestep> VolumeSequence::current() const
+{
+    std::scoped_lock lock { m_mutex };
+    return m_timesteps[m_current];
+}
+
+bool VolumeSequence::advance()
+{
+    // The evicted timesteps are freed after releasing the lock (unless the caller still holds them).
+    std::vector<std::shared_ptr<Timestep>> evicted;
+    {
+        std::scoped_lock lock { m_mutex };
+        const std::vector<size_t> window = windowLocked();
+        if (window.size() < 2 || !m_timesteps[window[1]])
+            return false;
+        m_current = window[1];
+
+        const std::vector<size_t> newWindow = windowLocked();
+        for (size_t i = 0; i < m_timesteps.size(); i++) {
+            if (m_timesteps[i] && std::find(std::begin(newWindow), std::end(newWindow), i) == std::end(newWindow))
+                evicted.push_back(std::move(m_timesteps[i]));
+        }
+    }
+    m_wakeUp.notify_one();
+    return true;
+}
+
+size_t VolumeSequence::residentTimesteps() const
+{
+    std::scoped_lock lock { m_mutex };
+    return size_t(std::count_if(std::begin(m_timesteps), std::end(m_timesteps), [](const auto& pTimestep) { return pTimestep != nullptr; }));
+}
+
+size_t VolumeSequence::residentBytes() const
+{
+    return residentTimesteps() * m_timestepBytes;
+}
+
+bool VolumeSequence::idle() const
+{
+    std::scoped_lock lock { m_mutex };
+    return !m_loading && nextToLoadLocked() == m_files.size();
+}
+
+void VolumeSequence::waitUntilIdle() const
+{
+    std::unique_lock lock { m_mutex };
+    m_idle.wait(lock, [&]() { return !m_loading && nextToLoadLocked() == m_files.size(); });
+}
+
+std::vector<size_t> VolumeSequence::windowLocked() const
+{
+    std::vector<size_t> out { m_current };
+    for (size_t i = 1; i < m_files.size() && out.size() <= m_prefetchDepth; i++) {
+        const size_t timestep = (m_current + i) % m_files.size();
+        if (!m_failed[timestep])
+            out.push_back(timestep);
+    }
+    return out;
+}
+
+size_t VolumeSequence::nextToLoadLocked() const
+{
+    for (size_t timestep : windowLocked()) {
+        if (!m_timesteps[timestep])
+            return timestep;
+    }
+    return m_files.size();
+}
+
+// Runs on the loader thread: load the timesteps of the window in playback order.
+void VolumeSequence::loadLoop()
+{
+    while (true) {
+        size_t timestep;
+        {
+            std::unique_lock lock { m_mutex };
+            m_loading = false;
+            m_idle.notify_all();
+            m_wakeUp.wait(lock, [&]() { return m_stop || nextToLoadLocked() != m_files.size(); });
+            if (m_stop)
+                return;
+            timestep = nextToLoadLocked();
+            m_loading = true;
+        }
+
+        // Playback may have moved on while loading, in which case the timestep is dropped (after releasing the lock).
+        std::shared_ptr<Timestep> pTimestep = loadTimestep(m_files[timestep], m_layout, m_gradientEncoding, m_dim);
+        std::scoped_lock lock { m_mutex };
+        if (!pTimestep) {
+            m_failed[timestep] = true;
+            continue;
+        }
+        const std::vector<size_t> window = windowLocked();
+        if (std::find(std::begin(window), std::end(window), timestep) != std::end(window))
+            m_timesteps[timestep] = std::move(pTimestep);
+    }
+}
+}
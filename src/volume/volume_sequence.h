@@ -0,0 +1,104 @@
+#pragma once
+#include "gradient_volume.h"
+#include "macro_cell_grid.h"
+#include "volume.h"
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <glm/vec3.hpp>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace volume {
+
+// One timestep of a volume sequence, with the derived data that the renderer needs. The gradient volume references the
+// volume, so timesteps are never moved (they are shared through std::shared_ptr).
+struct Timestep {
+    // Computes the gradients and macro cells of the volume.
+    Timestep(Volume&& volume, GradientEncoding gradientEncoding);
+    Timestep(const Timestep&) = delete;
+    Timestep& operator=(const Timestep&) = delete;
+
+    // Memory used by the voxels and the stored gradients.
+    size_t sizeInBytes() const;
+
+    Volume volume;
+    GradientVolume gradientVolume;
+    MacroCellGrid macroCellGrid;
+};
+
+// Time series of volumes (one file per timestep, all with the same dimensions) that is played back one timestep after
+// the other. Only the current timestep and the next few are resident: a background thread loads the timesteps that
+// follow the current one (including their gradients and macro cells) while the current one is rendered, and frees the
+// timesteps that playback has moved past. advance() only moves to the next timestep once it is completely loaded, so
+// the renderer never waits for the disk.
+class VolumeSequence {
+public:
+    static constexpr size_t defaultMemoryBudget = size_t(2) << 30;
+
+public:
+    // The files that make up a sequence in a directory: the volumes (.fld, .bvol and .cvol) sorted by file name.
+    static std::vector<std::filesystem::path> findTimesteps(const std::filesystem::path& directory);
+
+    // Loads the first timestep before returning. As many timesteps are kept resident as fit into the memory budget,
+    // but always at least the current and the next one (double buffering). Throws std::runtime_error if there are no
+    // files or the first one cannot be loaded.
+    VolumeSequence(
+        std::vector<std::filesystem::path> files,
+        size_t memoryBudget = defaultMemoryBudget,
+        VoxelLayout layout = VoxelLayout::Linear,
+        GradientEncoding gradientEncoding = GradientEncoding::Float);
+    ~VolumeSequence();
+
+    VolumeSequence(const VolumeSequence&) = delete;
+    VolumeSequence& operator=(const VolumeSequence&) = delete;
+
+    size_t numTimesteps() const;
+    size_t currentIndex() const;
+    // The timestep to render. It stays alive for as long as the caller holds on to it, even if the sequence moves on.
+    std::shared_ptr<Timestep> current() const;
+    // Move to the next timestep (wrapping around after the last one) if it has been loaded. Returns whether the current
+    // timestep changed.
+    bool advance();
+
+    // Number of timesteps that are loaded and their memory (timesteps that the caller still holds after they were
+    // evicted are not counted).
+    size_t residentTimesteps() const;
+    size_t residentBytes() const;
+    // Whether all timesteps that fit into the memory budget ahead of the current one have been loaded.
+    bool idle() const;
+    void waitUntilIdle() const;
+
+private:
+    void loadLoop();
+    // Timesteps that should be resident: the current one followed by the next m_prefetchDepth timesteps that did not
+    // fail to load. Requires m_mutex to be locked.
+    std::vector<size_t> windowLocked() const;
+    // The first timestep of the window that is neither loaded nor failed, or numTimesteps() if there is none. Requires
+    // m_mutex to be locked.
+    size_t nextToLoadLocked() const;
+
+private:
+    const std::vector<std::filesystem::path> m_files;
+    const VoxelLayout m_layout;
+    const GradientEncoding m_gradientEncoding;
+    glm::ivec3 m_dim;
+    size_t m_timestepBytes;
+    size_t m_prefetchDepth;
+
+    // Per timestep: the loaded data (nullptr if not resident) and whether it could not be loaded (it is then skipped).
+    mutable std::mutex m_mutex;
+    mutable std::condition_variable m_wakeUp;
+    mutable std::condition_variable m_idle;
+    std::vector<std::shared_ptr<Timestep>> m_timesteps;
+    std::vector<bool> m_failed;
+    size_t m_current { 0 };
+    bool m_loading { false };
+    bool m_stop { false };
+
+    // Started last, after all other members have been initialized.
+    std::thread m_thread;
+};
+}
@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <glm/vec3.hpp>
+
+namespace volume {
+
+// Order in which the voxels of a volume are stored in memory.
+enum class VoxelLayout {
+    // x-fastest, then y, then z (x + dim.x * (y + dim.y * z)).
+    Linear = 0,
+    // The volume is split into 8x8x8 bricks that are each stored contiguously (x-fastest within a brick). Neighbouring
+    // voxels along y/z are then (mostly) in the same few cache lines, so the cost of sampling is much less dependent
+    // on the direction of the ray. The volume is padded to a multiple of the brick size.
+    Bricked
+};
+
+// Maps 3D voxel coordinates to an index into the voxel array according to the chosen layout.
+class VoxelIndexer {
+public:
+    static constexpr int brickBits = 3;
+    static constexpr int brickSize = 1 << brickBits;
+    static constexpr int brickMask = brickSize - 1;
+
+public:
+    VoxelIndexer(const glm::ivec3& dim, VoxelLayout layout)
+        : m_layout(layout)
+        , m_dim(dim)
+        , m_brickDim((dim + brickMask) / brickSize)
+    {
+    }
+
+    VoxelLayout layout() const { return m_layout; }
+    glm::ivec3 dims() const { return m_dim; }
+    glm::ivec3 brickDims() const { return m_brickDim; }
+
+    // Number of elements that the voxel array should contain (including padding).
+    size_t size() const
+    {
+        if (m_layout == VoxelLayout::Bricked)
+            return (size_t(m_brickDim.x) * size_t(m_brickDim.y) * size_t(m_brickDim.z)) << (3 * brickBits);
+        return size_t(m_dim.x) * size_t(m_dim.y) * size_t(m_dim.z);
+    }
+
+    size_t index(int x, int y, int z) const
+    {
+        if (m_layout == VoxelLayout::Bricked) {
+            const size_t brick = size_t((x >> brickBits) + m_brickDim.x * ((y >> brickBits) + m_brickDim.y * (z >> brickBits)));
+            const size_t local = size_t((x & brickMask) | ((y & brickMask) << brickBits) | ((z & brickMask) << (2 * brickBits)));
+            return (brick << (3 * brickBits)) | local;
+        }
+        return size_t(x) + size_t(m_dim.x) * (size_t(y) + size_t(m_dim.y) * size_t(z));
+    }
+
+    // In both layouts the index is a sum of independent offsets per axis: index(x, y, z) == xOffset(x) + yOffset(y) +
+    // zOffset(z). Kernels that read a neighbourhood of voxels can compute the offsets once per axis.
+    size_t xOffset(int x) const
+    {
+        if (m_layout == VoxelLayout::Bricked)
+            return (size_t(x >> brickBits) << (3 * brickBits)) | size_t(x & brickMask);
+        return size_t(x);
+    }
+    size_t yOffset(int y) const
+    {
+        if (m_layout == VoxelLayout::Bricked)
+            return (size_t(m_brickDim.x * (y >> brickBits)) << (3 * brickBits)) | size_t((y & brickMask) << brickBits);
+        return size_t(m_dim.x) * size_t(y);
+    }
+    size_t zOffset(int z) const
+    {
+        if (m_layout == VoxelLayout::Bricked)
+            return (size_t(m_brickDim.x) * size_t(m_brickDim.y) * size_t(z >> brickBits) << (3 * brickBits)) | size_t((z & brickMask) << (2 * brickBits));
+        return size_t(m_dim.x) * size_t(m_dim.y) * size_t(z);
+    }
+
+private:
+    VoxelLayout m_layout;
+    glm::ivec3 m_dim;
+    glm::ivec3 m_brickDim;
+};
+
+}